@@ -12,11 +12,21 @@
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
 #include <json.h>
 #include <mosquitto.h>
 
 
 #include "pzPowerI2C_registers.h"
+#include "capture_log.h"
+#include "gpio_event.h"
+#include "sample_time.h"
+#include "latency.h"
+#include "metrics_http.h"
+#include "shm_latest.h"
  
 extern char *optarg;
 extern int optind, opterr, optopt;
@@ -34,6 +44,47 @@ int outputDebug=0;
 
 static struct mosquitto *mosq;
 
+/* raw capture and replay */
+static capture_log captureLog;
+static capture_log replayLog;
+
+/* --read-loop paced by a GPIO line */
+static gpio_line dataReadyLine;
+
+/* monotonic acquisition time of the last read. Zero when replaying */
+static sample_time sampleMonotonic;
+static sample_time_map clockMap;
+
+/* per-stage latency. Nothing unless built with make LATENCY=1 */
+LATENCY_HIST(histRead,"i2c_read");
+LATENCY_HIST(histDecode,"decode");
+LATENCY_HIST(histJsonString,"json_string");
+LATENCY_HIST(histPublish,"publish");
+#ifdef LATENCY_STATS
+static double latencyInterval = 60.0;
+#endif
+
+/* --metrics-listen. Registers of the last read and counters for scrapes */
+static metrics_http metrics;
+static uint16_t lastRegisters[CAPACITY_REGISTERS];
+static uint64_t lastReadTime;
+static unsigned long reads;
+static unsigned long busErrors;
+static unsigned long publishFailures;
+
+/* --shm latest value segment */
+static shm_latest shmLatest;
+
+/* --serve query server and its clients */
+#define QUERY_CLIENTS 16
+#define QUERY_LINE_MAX 128
+#define QUERY_TIMEOUT 5		/* seconds a client waits for an answer */
+static int serverFd=-1;		/* connection to server with --server */
+static double maxAge=1.0;	/* seconds a cached read may be served for */
+static volatile sig_atomic_t serveStop;
+int query_read(uint16_t *rxBuffer, uint64_t *sampleTime, sample_time *t);
+int query_write(uint8_t address, uint16_t value);
+
 /* actions to take */
 typedef struct {
 	/* MQTT */
@@ -114,12 +165,37 @@ typedef struct {
 
 	int setStartupPowerOnDelay;
 	int setStartupPowerOnDelay_value;
+
+	/* 20000 series */
+	int capture;
+	char capture_filename[256];
+
+	int replay;
+	char replay_filename[256];
+
+	int dataReady;
+	char dataReady_line[80];
+
+	int metricsListen;
+	char metricsListen_address[128];
+
+	int shm;
+
+	int serve;
+	char serve_path[108];
+
+	int server;
+	char server_path[108];
+
+	int batch;
+	char batch_filename[256];
 } struct_action;
 
 /* global structures */
 struct_action action={0};
 
-void write_word(int i2cHandle, uint8_t address, uint16_t value) {
+/* write register. Returns 0 on success */
+int write_word_raw(int i2cHandle, uint8_t address, uint16_t value) {
 	uint8_t txBuffer[3];	/* transmit buffer (extra byte is address byte) */
 	int opResult = 0;	/* for error checking of operations */
 
@@ -137,6 +213,23 @@ void write_word(int i2cHandle, uint8_t address, uint16_t value) {
 	if ( -1 == opResult ) {
 		fprintf(stderr,"# Error writing value %d to address %d. %s\n",value,address,strerror(errno));
 
+		return -1;
+	}
+
+	return 0;
+}
+
+/* write register on the bus, or through the --server. Returns 0 or -1 on failure */
+int write_word_try(int i2cHandle, uint8_t address, uint16_t value) {
+	if ( serverFd >= 0 ) 
+		return ( 0 == query_write(address,value) ) ? 0 : -1;
+
+	return write_word_raw(i2cHandle,address,value);
+}
+
+/* write register on the bus, or through the --server. Exits on failure */
+void write_word(int i2cHandle, uint8_t address, uint16_t value) {
+	if ( 0 != write_word_try(i2cHandle,address,value) ) {
 		exit(1);
 	}
 }
@@ -169,11 +262,13 @@ int voltageToAdc(double voltage) {
 	return round( voltage / (40.0 / 1024.0) );
 }
 
-json_object *json_object_new_dateTime(void) {
+json_object *json_object_new_dateTime(uint64_t sampleTime) {
 	struct tm *now;
 	struct timeval time;
 	char timestamp[32];
-        gettimeofday(&time, NULL);
+
+	time.tv_sec = sampleTime / 1000000;
+	time.tv_usec = sampleTime % 1000000;
 	now = localtime(&time.tv_sec);
 	if ( 0 == now ) {
 		fprintf(stderr,"# error calling localtime() %s",strerror(errno));
@@ -188,7 +283,21 @@ json_object *json_object_new_dateTime(void) {
 
 }
 
-void decodeRegisters(uint16_t *rxBuffer) {
+/* monotonic times of read and mapping of monotonic to UTC, which is t + realtime_ns - monotonic_ns */
+json_object *json_object_new_sampleTime(const sample_time *t, const sample_time_map *m) {
+	json_object *jobj_time = json_object_new_object();
+
+	json_object_object_add(jobj_time,"sample",json_object_new_int64(t->sample_ns));
+	json_object_object_add(jobj_time,"read_start",json_object_new_int64(t->start_ns));
+	json_object_object_add(jobj_time,"read_end",json_object_new_int64(t->end_ns));
+	json_object_object_add(jobj_time,"monotonic_ns",json_object_new_int64(m->monotonic_ns));
+	json_object_object_add(jobj_time,"realtime_ns",json_object_new_int64((int64_t) m->monotonic_ns + m->offset_ns));
+	json_object_object_add(jobj_time,"uncertainty_ns",json_object_new_int64(m->uncertainty_ns));
+
+	return jobj_time;
+}
+
+void decodeRegisters(uint16_t *rxBuffer, uint64_t sampleTime) {
 	int i;
  
 	/*
@@ -202,7 +311,12 @@ void decodeRegisters(uint16_t *rxBuffer) {
 
 
 	/* data */
-	json_object_object_add(jobj,"dateTime",json_object_new_dateTime());
+	json_object_object_add(jobj,"dateTime",json_object_new_dateTime(sampleTime));
+	if ( 0 != sampleMonotonic.sample_ns ) {
+		/* reads are seconds apart, so map every one */
+		sample_time_map_update(&clockMap);
+		json_object_object_add(jobj,"monotonic_ns",json_object_new_sampleTime(&sampleMonotonic,&clockMap));
+	}
 
 	/* input voltage */
 	json_object_object_add(jobj_data, "voltage_in_now",json_object_new_double(
@@ -296,8 +410,8 @@ void decodeRegisters(uint16_t *rxBuffer) {
 
 }
 
-void read_pzpoweri2c(int i2cHandle) {
-	uint16_t rxBuffer[CAPACITY_REGISTERS]; 	/* receive buffer */
+/* read all registers as sent on the bus (high byte first) into rxBuffer. Returns 0, or -1 if not acknowledged or short */
+int read_pzpoweri2c_raw(int i2cHandle, uint16_t *rxBuffer) {
 	uint8_t txBuffer[1];			/* transmit buffer */
 	int opResult = 0;			/* for error checking of operations */
 	uint8_t address;
@@ -310,7 +424,7 @@ void read_pzpoweri2c(int i2cHandle) {
 	if ( 0 != outputDebug ) { 
 		fprintf(stderr,"# read_pzpoweri2c() starting\n");
 		fprintf(stderr,"# CAPACITY_REGISTERS=%d\n",CAPACITY_REGISTERS);
-		fprintf(stderr,"# sizeof(rxBuffer)=%d\n",sizeof(rxBuffer));
+		fprintf(stderr,"# sizeof(rxBuffer)=%d\n",CAPACITY_REGISTERS*2);
 		fprintf(stderr,"# txBuffer[0]=0x%02x (this is the starting address)\n",txBuffer[0]);
 		fprintf(stderr,"# write(i2cHandle,txBuffer[0],1) starting\n");
 	}
@@ -324,14 +438,18 @@ void read_pzpoweri2c(int i2cHandle) {
 
 
 	if (opResult != 1) {
-		fprintf(stderr,"# No ACK! Exiting...\n");
-		exit(2);
+		fprintf(stderr,"# No ACK!\n");
+		return -1;
 	}
 
 	/* clear rxbuffer */
-	memset(rxBuffer, 0, sizeof(rxBuffer));
+	memset(rxBuffer, 0, CAPACITY_REGISTERS*2);
 	/* read registers into rxBuffer */
 	opResult = read(i2cHandle, rxBuffer, nRegisters*2);
+	reads++;
+	if ( opResult != nRegisters*2 ) {
+		busErrors++;
+	}
 
 	if ( 0 != outputDebug ) { 
 		fprintf(stderr,"# read opResult=%d (bytes read)\n",opResult);
@@ -361,17 +479,769 @@ void read_pzpoweri2c(int i2cHandle) {
 		}
 	}
 
+	/* registers past a short read are zeros from the memset, not readings */
+	if ( opResult != nRegisters*2 ) {
+		fprintf(stderr,"# Short read! %d of %d bytes\n",opResult,nRegisters*2);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* decoded registers to the --shm segment */
+void shm_latest_write_pzpower(const uint16_t *rxBuffer, uint64_t sampleTime) {
+	shm_pzpower_record r;
+
+	memset(&r,0,sizeof(r));
+	r.timestamp_usec=sampleTime;
+	r.monotonic_ns=sampleMonotonic.sample_ns;
+	r.voltage_in_now=adcToVoltage(rxBuffer[PZP_I2C_REG_VOLTAGE_INPUT_NOW]);
+	r.voltage_in_average=adcToVoltage(rxBuffer[PZP_I2C_REG_VOLTAGE_INPUT_AVG]);
+	r.temperature_pcb_now=ntcThermistor(rxBuffer[PZP_I2C_REG_TEMPERATURE_BOARD_NOW], 3977, 10000, 10000, 1024);
+	r.temperature_pcb_average=ntcThermistor(rxBuffer[PZP_I2C_REG_TEMPERATURE_BOARD_AVG], 3977, 10000, 10000, 1024);
+	r.magnetic_switch_state=rxBuffer[PZP_I2C_REG_SWITCH_MAGNET_NOW];
+	r.magnetic_switch_latch=rxBuffer[PZP_I2C_REG_SWITCH_MAGNET_LATCH];
+	r.sequence_number=rxBuffer[PZP_I2C_REG_SEQUENCE_NUMBER];
+	r.uptime_minutes=rxBuffer[PZP_I2C_REG_TIME_UPTIME_MINUTES];
+	r.read_watchdog_seconds=rxBuffer[PZP_I2C_REG_TIME_WATCHDOG_READ_SECONDS];
+	r.write_watchdog_seconds=rxBuffer[PZP_I2C_REG_TIME_WATCHDOG_WRITE_SECONDS];
+	r.command_off_seconds=rxBuffer[PZP_I2C_REG_COMMAND_OFF];
+	r.power_off_flags=rxBuffer[PZP_I2C_REG_POWER_OFF_FLAGS];
+
+	shm_latest_write(&shmLatest,&r);
+}
+
+/* convert registers as sent on the bus and decode into JSON objects */
+void decode_pzpoweri2c(const uint16_t *rawBuffer, uint64_t sampleTime) {
+	uint16_t rxBuffer[CAPACITY_REGISTERS];
+	int i;
 
 	/* results */
-	for ( i=0 ; i<nRegisters ; i++ ) {
+	for ( i=0 ; i<CAPACITY_REGISTERS ; i++ ) {
 		/* pzPowerI2C PIC sends high byte and then low byte */
-		rxBuffer[i]=ntohs(rxBuffer[i]);
+		rxBuffer[i]=ntohs(rawBuffer[i]);
+	}
+
+	memcpy(lastRegisters,rxBuffer,sizeof(lastRegisters));
+	lastReadTime=sampleTime;
+
+	if ( action.shm ) {
+		shm_latest_write_pzpower(rxBuffer,sampleTime);
 	}
 
 	/* decode data and put into JSON objects */
-	decodeRegisters(rxBuffer);
+	decodeRegisters(rxBuffer,sampleTime);
+}
+
+/* read and decode. edge_ns is the monotonic time of the data-ready edge, 0 if none */
+void read_pzpoweri2c(int i2cHandle, uint64_t edge_ns) {
+	uint16_t rxBuffer[CAPACITY_REGISTERS]; 	/* receive buffer */
+	uint64_t sampleTime;
+
+	LATENCY_VAR(t);
+
+	LATENCY_START(t);
+	if ( serverFd >= 0 ) {
+		/* registers and times of the server's read */
+		if ( 0 != query_read(rxBuffer,&sampleTime,&sampleMonotonic) ) 
+			exit(2);
+	} else {
+		sampleTime = ( 0 != edge_ns ) ? gpio_timestamp_usec(edge_ns) : capture_now_usec();
+		sample_time_start(&sampleMonotonic);
+		if ( 0 != read_pzpoweri2c_raw(i2cHandle,rxBuffer) ) {
+			fprintf(stderr,"# Exiting...\n");
+			exit(2);
+		}
+		sample_time_end(&sampleMonotonic,edge_ns,0.0);
+	}
+	LATENCY_STOP(histRead,t);
+
+	if ( action.capture ) {
+		capture_log_append(&captureLog,CAPTURE_DEVICE_PZPOWERI2C,sampleTime,rxBuffer,sizeof(rxBuffer));
+	}
+
+	LATENCY_START(t);
+	decode_pzpoweri2c(rxBuffer,sampleTime);
+	LATENCY_STOP(histDecode,t);
 }
 
+/*
+--serve query server. One thread answers every client from a poll() loop. Requests are
+lines:
+
+READ [milliseconds]	registers no older than milliseconds (default --max-age)
+WRITE register value	write a register. Cached registers are dropped
+STATS			request and bus counters
+
+and answers are one line starting with OK or ERR. READ answers with
+OK timestamp_usec start_ns end_ns sample_ns hex, where hex is the 128 register bytes
+as sent on the bus. All READs that arrive together share one bus read, and a READ that
+the cache is new enough for doesn't touch the bus at all.
+*/
+typedef struct {
+	int fd;				/* -1 if slot is free */
+	char line[QUERY_LINE_MAX];
+	size_t lineLength;
+	int readPending;		/* READ waiting for the bus read of this round */
+	uint64_t readMaxAge_ns;
+} query_client;
+
+static void serve_signal(int sig) {
+	serveStop=1;
+}
+
+static void query_send(query_client *c, const char *reply) {
+	/* replies are short, so they fit in the socket buffer of a client that is reading them */
+	if ( send(c->fd,reply,strlen(reply),MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) strlen(reply) ) {
+		close(c->fd);
+		c->fd=-1;
+	}
+}
+
+void serve_pzpoweri2c(int i2cHandle) {
+	query_client clients[QUERY_CLIENTS];
+	struct pollfd pfd[QUERY_CLIENTS+1];
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	uint16_t cache[CAPACITY_REGISTERS];
+	sample_time cacheTime;
+	uint64_t cacheTimestamp=0;
+	int haveCache=0;
+	int listenFd, fd;
+	unsigned long requests=0, busReads=0, busWrites=0;
+	char reply[CAPACITY_REGISTERS*4+128];
+	int i, j, n, rc;
+
+	for ( i=0 ; i<QUERY_CLIENTS ; i++ ) 
+		clients[i].fd=-1;
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ( -1 == listenFd ) {
+		fprintf(stderr,"# Error creating socket. %s\n",strerror(errno));
+		exit(1);
+	}
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	strncpy(addr.sun_path,action.serve_path,sizeof(addr.sun_path)-1);
+	/* socket left by a server that didn't exit cleanly */
+	unlink(action.serve_path);
+
+	if ( -1 == bind(listenFd,(struct sockaddr *) &addr,sizeof(addr)) || -1 == listen(listenFd,QUERY_CLIENTS) ) {
+		fprintf(stderr,"# Error listening on %s. %s\n",action.serve_path,strerror(errno));
+		exit(1);
+	}
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler=serve_signal;
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
+
+	fprintf(stderr,"# serving queries on %s. Reads up to %0.3f seconds old are answered from cache\n",action.serve_path,maxAge);
+
+	while ( ! serveStop ) {
+		pfd[0].fd=listenFd;
+		pfd[0].events=POLLIN;
+		for ( i=0 ; i<QUERY_CLIENTS ; i++ ) {
+			pfd[i+1].fd=clients[i].fd;
+			pfd[i+1].events=POLLIN;
+			pfd[i+1].revents=0;
+		}
+
+		rc = poll(pfd,QUERY_CLIENTS+1,1000);
+		if ( rc < 0 ) {
+			if ( EINTR == errno )
+				continue;
+			fprintf(stderr,"# Error waiting for queries. %s\n",strerror(errno));
+			break;
+		}
+
+		if ( pfd[0].revents & POLLIN ) {
+			while ( -1 != (fd = accept(listenFd,NULL,NULL)) ) {
+				for ( i=0 ; i<QUERY_CLIENTS && clients[i].fd >= 0 ; i++ )
+					;
+				if ( QUERY_CLIENTS == i ) {
+					/* full. Client sees the connection close and reports it */
+					close(fd);
+					continue;
+				}
+				memset(&clients[i],0,sizeof(query_client));
+				clients[i].fd=fd;
+			}
+		}
+
+		/* gather requests. WRITEs are done right away, READs wait for the end of the round */
+		for ( i=0 ; i<QUERY_CLIENTS ; i++ ) {
+			query_client *c = &clients[i];
+			char buf[QUERY_LINE_MAX];
+			char *eol;
+
+			if ( c->fd < 0 || 0 == (pfd[i+1].revents & (POLLIN | POLLHUP | POLLERR)) ) 
+				continue;
+
+			n = recv(c->fd,buf,sizeof(buf),MSG_DONTWAIT);
+			if ( n <= 0 ) {
+				close(c->fd);
+				c->fd=-1;
+				continue;
+			}
+
+			for ( j=0 ; j<n && c->fd >= 0 ; j++ ) {
+				if ( c->lineLength >= sizeof(c->line)-1 ) {
+					query_send(c,"ERR line too long\n");
+					if ( c->fd >= 0 ) {
+						close(c->fd);
+						c->fd=-1;
+					}
+					break;
+				}
+				c->line[c->lineLength++]=buf[j];
+				if ( '\n' != buf[j] )
+					continue;
+
+				c->line[c->lineLength]='\0';
+				c->lineLength=0;
+				if ( NULL != (eol=strpbrk(c->line,"\r\n")) )
+					*eol='\0';
+				requests++;
+
+				if ( 0 == strncmp(c->line,"READ",4) ) {
+					double ms = maxAge * 1000.0;
+
+					sscanf(c->line+4,"%lf",&ms);
+					c->readPending=1;
+					c->readMaxAge_ns=(uint64_t) (ms * 1000000.0);
+				} else if ( 0 == strncmp(c->line,"WRITE",5) ) {
+					unsigned int address, value;
+
+					if ( 2 != sscanf(c->line+5,"%u %u",&address,&value) || address >= CAPACITY_REGISTERS || value > 65535 ) {
+						query_send(c,"ERR WRITE register value\n");
+					} else if ( 0 != write_word_raw(i2cHandle,address,value) ) {
+						query_send(c,"ERR write failed\n");
+					} else {
+						busWrites++;
+						haveCache=0;
+						query_send(c,"OK\n");
+					}
+				} else if ( 0 == strncmp(c->line,"STATS",5) ) {
+					snprintf(reply,sizeof(reply),"OK requests=%lu reads=%lu writes=%lu\n",requests,busReads,busWrites);
+					query_send(c,reply);
+				} else {
+					query_send(c,"ERR unknown request\n");
+				}
+			}
+		}
+
+		/* one bus read for every READ of this round that the cache is too old for */
+		for ( i=0, n=0 ; i<QUERY_CLIENTS ; i++ ) {
+			if ( clients[i].fd >= 0 && clients[i].readPending && ( ! haveCache || sample_time_now_ns() - cacheTime.sample_ns > clients[i].readMaxAge_ns ) ) 
+				n++;
+		}
+		if ( n ) {
+			cacheTimestamp=capture_now_usec();
+			sample_time_start(&cacheTime);
+			haveCache = ( 0 == read_pzpoweri2c_raw(i2cHandle,cache) );
+			sample_time_end(&cacheTime,0,0.0);
+			busReads++;
+		}
+
+		if ( haveCache ) {
+			char *p;
+
+			p = reply + sprintf(reply,"OK %llu %llu %llu %llu ",(unsigned long long) cacheTimestamp,
+				(unsigned long long) cacheTime.start_ns,(unsigned long long) cacheTime.end_ns,(unsigned long long) cacheTime.sample_ns);
+			for ( j=0 ; j<CAPACITY_REGISTERS*2 ; j++ ) 
+				p += sprintf(p,"%02x",((uint8_t *) cache)[j]);
+			strcpy(p,"\n");
+		} else {
+			strcpy(reply,"ERR no ACK\n");
+		}
+
+		for ( i=0 ; i<QUERY_CLIENTS ; i++ ) {
+			if ( clients[i].fd >= 0 && clients[i].readPending ) {
+				clients[i].readPending=0;
+				query_send(&clients[i],reply);
+			}
+		}
+	}
+
+	for ( i=0 ; i<QUERY_CLIENTS ; i++ ) {
+		if ( clients[i].fd >= 0 )
+			close(clients[i].fd);
+	}
+	close(listenFd);
+	unlink(action.serve_path);
+
+	fprintf(stderr,"# served %lu requests with %lu bus reads and %lu writes\n",requests,busReads,busWrites);
+}
+
+/* connect to --server. Returns 0 on success */
+int query_connect(const char *path) {
+	struct sockaddr_un addr;
+
+	serverFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if ( -1 == serverFd ) {
+		fprintf(stderr,"# Error creating socket. %s\n",strerror(errno));
+		return -1;
+	}
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	strncpy(addr.sun_path,path,sizeof(addr.sun_path)-1);
+
+	if ( -1 == connect(serverFd,(struct sockaddr *) &addr,sizeof(addr)) ) {
+		fprintf(stderr,"# Error connecting to pzPowerI2C server %s. %s\n",path,strerror(errno));
+		close(serverFd);
+		serverFd=-1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* send request and wait for the answer line. Returns 0 on success */
+static int query_request(const char *request, char *answer, size_t length) {
+	struct pollfd pfd;
+	size_t n=0;
+	ssize_t rc;
+
+	if ( send(serverFd,request,strlen(request),MSG_NOSIGNAL) != (ssize_t) strlen(request) ) {
+		fprintf(stderr,"# Error sending to pzPowerI2C server. %s\n",strerror(errno));
+		return -1;
+	}
+
+	while ( n < length-1 ) {
+		pfd.fd=serverFd;
+		pfd.events=POLLIN;
+		if ( 1 != poll(&pfd,1,QUERY_TIMEOUT*1000) ) {
+			fprintf(stderr,"# No answer from pzPowerI2C server\n");
+			return -1;
+		}
+		rc = recv(serverFd,answer+n,1,0);
+		if ( rc <= 0 ) {
+			fprintf(stderr,"# pzPowerI2C server closed connection\n");
+			return -1;
+		}
+		if ( '\n' == answer[n] ) 
+			break;
+		n++;
+	}
+	answer[n]='\0';
+
+	if ( 0 != strncmp(answer,"OK",2) ) {
+		fprintf(stderr,"# pzPowerI2C server: %s\n",answer);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* registers, UTC and monotonic times of a read by the server. Returns 0 on success */
+int query_read(uint16_t *rxBuffer, uint64_t *sampleTime, sample_time *t) {
+	char request[32];
+	char answer[CAPACITY_REGISTERS*4+128];
+	unsigned long long timestamp, start, end, sample;
+	char *p;
+	int i, offset;
+	unsigned int byte;
+
+	snprintf(request,sizeof(request),"READ %0.0f\n",maxAge*1000.0);
+	if ( 0 != query_request(request,answer,sizeof(answer)) ) 
+		return -1;
+
+	if ( 4 != sscanf(answer,"OK %llu %llu %llu %llu %n",&timestamp,&start,&end,&sample,&offset) || strlen(answer+offset) != CAPACITY_REGISTERS*4 ) {
+		fprintf(stderr,"# unexpected answer from pzPowerI2C server\n");
+		return -1;
+	}
+
+	for ( i=0, p=answer+offset ; i<CAPACITY_REGISTERS*2 ; i++, p+=2 ) {
+		sscanf(p,"%2x",&byte);
+		((uint8_t *) rxBuffer)[i]=byte;
+	}
+
+	*sampleTime=timestamp;
+	t->start_ns=start;
+	t->end_ns=end;
+	t->sample_ns=sample;
+
+	return 0;
+}
+
+int query_write(uint8_t address, uint16_t value) {
+	char request[64];
+	char answer[128];
+
+	fprintf(stderr,"# write_word %d to register %d through server\n",value,address);
+	snprintf(request,sizeof(request),"WRITE %u %u\n",address,value);
+
+	return query_request(request,answer,sizeof(answer));
+}
+
+/*
+--batch commands. Names, ranges and registers are the same as the command line switches.
+Commands without an argument write fixedValue
+*/
+#define BATCH_READ        'r'
+#define BATCH_READ_SWITCH 'w'
+#define BATCH_INTEGER     'i'
+#define BATCH_VOLTS       'v'
+#define BATCH_PARAM       'p'
+#define BATCH_SERIAL      's'
+
+typedef struct {
+	const char *name;
+	char argument;		/* BATCH_* or 0 for none */
+	double minValue;
+	double maxValue;
+	uint8_t address;	/* register written */
+	uint16_t fixedValue;
+	int verify;		/* register reads back as written */
+} batch_command;
+
+static const batch_command batchCommands[] = {
+	{ "read",                             BATCH_READ,        0,     0, 0, 0, 0 },
+	{ "read-switch",                      BATCH_READ_SWITCH, 0,     0, 0, 0, 0 },
+	{ "reset-switch-latch",               0,                 0,     0, PZP_I2C_REG_SWITCH_MAGNET_LATCH, 0, 0 },
+	{ "reset-write-watchdog",             0,                 0,     0, PZP_I2C_REG_TIME_WATCHDOG_WRITE_SECONDS, 0, 0 },
+	{ "set-command-off",                  BATCH_INTEGER,     0, 65534, PZP_I2C_REG_COMMAND_OFF, 0, 0 },
+	{ "set-command-off-hold-time",        BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_COMMAND_OFF_HOLD_TIME, 0, 1 },
+	{ "disable-read-watchdog",            0,                 0,     0, PZP_I2C_REG_CONFIG_READ_WATCHDOG_OFF_THRESHOLD, 65535, 1 },
+	{ "set-read-watchdog-off-threshold",  BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_READ_WATCHDOG_OFF_THRESHOLD, 0, 1 },
+	{ "set-read-watchdog-off-hold-time",  BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_READ_WATCHDOG_OFF_HOLD_TIME, 0, 1 },
+	{ "disable-write-watchdog",           0,                 0,     0, PZP_I2C_REG_CONFIG_WRITE_WATCHDOG_OFF_THRESHOLD, 65535, 1 },
+	{ "set-write-watchdog-off-threshold", BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_WRITE_WATCHDOG_OFF_THRESHOLD, 0, 1 },
+	{ "set-write-watchdog-off-hold-time", BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_WRITE_WATCHDOG_OFF_HOLD_TIME, 0, 1 },
+	{ "disable-lvd",                      0,                 0,     0, PZP_I2C_REG_CONFIG_LVD_DISCONNECT_DELAY, 65535, 1 },
+	{ "set-lvd-off-threshold",            BATCH_VOLTS,       8,    40, PZP_I2C_REG_CONFIG_LVD_DISCONNECT_VOLTAGE, 0, 1 },
+	{ "set-lvd-off-delay",                BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_LVD_DISCONNECT_DELAY, 0, 1 },
+	{ "set-lvd-on-threshold",             BATCH_VOLTS,       8,    40, PZP_I2C_REG_CONFIG_LVD_RECONNECT_VOLTAGE, 0, 1 },
+	{ "disable-hvd",                      0,                 0,     0, PZP_I2C_REG_CONFIG_HVD_DISCONNECT_DELAY, 65535, 1 },
+	{ "set-hvd-off-threshold",            BATCH_VOLTS,       8,    40, PZP_I2C_REG_CONFIG_HVD_DISCONNECT_VOLTAGE, 0, 1 },
+	{ "set-hvd-off-delay",                BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_HVD_DISCONNECT_DELAY, 0, 1 },
+	{ "set-hvd-on-threshold",             BATCH_VOLTS,       8,    40, PZP_I2C_REG_CONFIG_HVD_RECONNECT_VOLTAGE, 0, 1 },
+	{ "param",                            BATCH_PARAM,       0, 65535, PZP_I2C_REG_CONFIG_PARAM_WRITE, 0, 0 },
+	{ "set-serial",                       BATCH_SERIAL,      0, 65535, PZP_I2C_REG_CONFIG_SERIAL_PREFIX, 0, 1 },
+	{ "set-adc-ticks",                    BATCH_INTEGER,     1, 65534, PZP_I2C_REG_CONFIG_TICKS_ADC, 0, 1 },
+	{ "set-startup-power-on-delay",       BATCH_INTEGER,     1, 65535, PZP_I2C_REG_CONFIG_STARTUP_POWER_ON_DELAY, 0, 1 },
+	{ NULL,                               0,                 0,     0, 0, 0, 0 }
+};
+
+/* print one result line and release it */
+static void batch_result(json_object *result) {
+	printf("%s\n",json_object_to_json_string_ext(result,JSON_C_TO_STRING_PLAIN));
+	fflush(stdout);
+	json_object_put(result);
+}
+
+/* add decoded registers of last read to result */
+static void batch_add_read(json_object *result) {
+	json_object_object_add(result,"pzPowerI2C",json_object_get(jobj));
+}
+
+/* 
+run commands from --batch file, or stdin for -, against the open bus. Registers from the initial
+read are used until something is written. After the last command, registers are read once more 
+if anything was written, and every register that reads back is checked. Returns exit value
+*/
+int batch_pzpoweri2c(int i2cHandle) {
+	FILE *in;
+	char line[256];
+	uint16_t written[CAPACITY_REGISTERS];
+	int verify[CAPACITY_REGISTERS];
+	int dirty=0;			/* registers written since last read */
+	int nLine=0, nCommands=0, nReads=1, nWrites=0, nMismatches=0;
+	int exitValue=0;
+	json_object *result, *mismatches, *m;
+	int i;
+
+	memset(verify,0,sizeof(verify));
+
+	if ( 0 == strcmp(action.batch_filename,"-") ) {
+		in=stdin;
+	} else if ( NULL == (in=fopen(action.batch_filename,"r")) ) {
+		fprintf(stderr,"# Error opening batch file %s. %s\n",action.batch_filename,strerror(errno));
+		return 1;
+	}
+
+	while ( 0 == exitValue && NULL != fgets(line,sizeof(line),in) ) {
+		const batch_command *c;
+		char *name, *argument, *end;
+		char error[128];
+		double value=0.0;
+		uint16_t registerValue=0;
+		int serialNumber=0;
+		char serialPrefix=0;
+
+		nLine++;
+
+		/* name and optional argument. Leading -- is allowed so switches can be pasted */
+		line[strcspn(line,"\r\n#")]='\0';
+		name=line+strspn(line," \t");
+		if ( '\0' == name[0] )
+			continue;
+		if ( 0 == strncmp(name,"--",2) )
+			name+=2;
+		argument=name+strcspn(name," \t=");
+		if ( '\0' != argument[0] ) {
+			*argument++='\0';
+			argument+=strspn(argument," \t=");
+		}
+		for ( end=argument+strlen(argument) ; end > argument && (' ' == end[-1] || '\t' == end[-1]) ; end-- )
+			;
+		*end='\0';
+
+		nCommands++;
+		result=json_object_new_object();
+		json_object_object_add(result,"line",json_object_new_int(nLine));
+		json_object_object_add(result,"command",json_object_new_string(name));
+		if ( '\0' != argument[0] ) 
+			json_object_object_add(result,"argument",json_object_new_string(argument));
+
+		for ( c=batchCommands ; NULL != c->name && 0 != strcmp(c->name,name) ; c++ )
+			;
+
+		/* check argument */
+		error[0]='\0';
+		if ( NULL == c->name ) {
+			snprintf(error,sizeof(error),"unknown command");
+		} else if ( 0 == c->argument || BATCH_READ == c->argument || BATCH_READ_SWITCH == c->argument ) {
+			if ( '\0' != argument[0] )
+				snprintf(error,sizeof(error),"takes no argument");
+			registerValue=c->fixedValue;
+		} else if ( '\0' == argument[0] ) {
+			snprintf(error,sizeof(error),"needs an argument");
+		} else if ( BATCH_SERIAL == c->argument ) {
+			if ( 2 != sscanf(argument,"%c%d",&serialPrefix,&serialNumber) || serialPrefix < 'A' || serialPrefix > 'Z' || serialNumber < 0 || serialNumber > 65535 ) 
+				snprintf(error,sizeof(error),"invalid serial number");
+		} else if ( BATCH_PARAM == c->argument && 0 == strcmp(argument,"save") ) {
+			registerValue=1;
+		} else if ( BATCH_PARAM == c->argument && 0 == strcmp(argument,"defaults") ) {
+			registerValue=2;
+		} else if ( BATCH_PARAM == c->argument && 0 == strcmp(argument,"reset_cpu") ) {
+			registerValue=65535;
+		} else {
+			value=strtod(argument,&end);
+			if ( end == argument || '\0' != *end ) {
+				snprintf(error,sizeof(error),"argument is not a number");
+			} else if ( value < c->minValue || value > c->maxValue ) {
+				snprintf(error,sizeof(error),"value of %g is outside of range of %g to %g",value,c->minValue,c->maxValue);
+			} else {
+				registerValue = ( BATCH_VOLTS == c->argument ) ? voltageToAdc(value) : (uint16_t) value;
+			}
+		}
+
+		if ( '\0' != error[0] ) {
+			json_object_object_add(result,"ok",json_object_new_boolean(0));
+			json_object_object_add(result,"error",json_object_new_string(error));
+			batch_result(result);
+			exitValue=1;
+			break;
+		}
+
+		/* reads only go to the bus if something was written since the last one */
+		if ( BATCH_READ == c->argument || BATCH_READ_SWITCH == c->argument ) {
+			if ( dirty ) {
+				json_object_put(jobj);
+				read_pzpoweri2c(i2cHandle,0);
+				nReads++;
+				dirty=0;
+			}
+			json_object_object_add(result,"ok",json_object_new_boolean(1));
+			if ( BATCH_READ_SWITCH == c->argument ) {
+				int state = ( 0 != lastRegisters[PZP_I2C_REG_SWITCH_MAGNET_NOW] );
+				int latch = ( 0 != lastRegisters[PZP_I2C_REG_SWITCH_MAGNET_LATCH] );
+
+				json_object_object_add(result,"exit_value",json_object_new_int(
+					( ! state && ! latch ) ? 128 : ( ! state && latch ) ? 129 : ( state && latch ) ? 130 : 127));
+			} else {
+				batch_add_read(result);
+			}
+			batch_result(result);
+			continue;
+		}
+
+		/* write. A write that isn't acknowledged stops the batch like a bad command */
+		if ( BATCH_SERIAL == c->argument ) {
+			if ( 0 != write_word_try(i2cHandle,PZP_I2C_REG_CONFIG_SERIAL_PREFIX,serialPrefix) ) {
+				snprintf(error,sizeof(error),"write failed");
+			} else {
+				/* prefix is on the device even if the number isn't */
+				nWrites++;
+				dirty=1;
+
+				if ( 0 != write_word_try(i2cHandle,PZP_I2C_REG_CONFIG_SERIAL_NUMBER,serialNumber) ) {
+					snprintf(error,sizeof(error),"write failed");
+				} else {
+					written[PZP_I2C_REG_CONFIG_SERIAL_PREFIX]=serialPrefix;
+					written[PZP_I2C_REG_CONFIG_SERIAL_NUMBER]=serialNumber;
+					verify[PZP_I2C_REG_CONFIG_SERIAL_PREFIX]=verify[PZP_I2C_REG_CONFIG_SERIAL_NUMBER]=1;
+					nWrites++;
+				}
+			}
+		} else if ( 0 != write_word_try(i2cHandle,c->address,registerValue) ) {
+			snprintf(error,sizeof(error),"write failed");
+		} else {
+			nWrites++;
+			if ( c->verify ) {
+				written[c->address]=registerValue;
+				verify[c->address]=1;
+			}
+		}
+
+		if ( '\0' != error[0] ) {
+			json_object_object_add(result,"ok",json_object_new_boolean(0));
+			json_object_object_add(result,"register",json_object_new_int(c->address));
+			json_object_object_add(result,"error",json_object_new_string(error));
+			batch_result(result);
+			exitValue=1;
+			break;
+		}
+
+		if ( BATCH_PARAM == c->argument ) {
+			/* allow parameters to be written to EEPROM. Defaults and reset replace what we wrote */
+			usleep(100000);
+			if ( 1 != registerValue ) 
+				memset(verify,0,sizeof(verify));
+		}
+		dirty=1;
+
+		json_object_object_add(result,"ok",json_object_new_boolean(1));
+		json_object_object_add(result,"register",json_object_new_int(c->address));
+		json_object_object_add(result,"value",json_object_new_int( BATCH_SERIAL == c->argument ? serialNumber : registerValue ));
+		batch_result(result);
+	}
+
+	if ( stdin != in ) 
+		fclose(in);
+
+	/* final verify */
+	if ( dirty ) {
+		json_object_put(jobj);
+		read_pzpoweri2c(i2cHandle,0);
+		nReads++;
+	}
+
+	result=json_object_new_object();
+	mismatches=json_object_new_array();
+	for ( i=0 ; i<CAPACITY_REGISTERS ; i++ ) {
+		if ( verify[i] && written[i] != lastRegisters[i] ) {
+			m=json_object_new_object();
+			json_object_object_add(m,"register",json_object_new_int(i));
+			json_object_object_add(m,"written",json_object_new_int(written[i]));
+			json_object_object_add(m,"read",json_object_new_int(lastRegisters[i]));
+			json_object_array_add(mismatches,m);
+			nMismatches++;
+		}
+	}
+	json_object_object_add(result,"verify",json_object_new_boolean(0 == nMismatches));
+	json_object_object_add(result,"commands",json_object_new_int(nCommands));
+	json_object_object_add(result,"writes",json_object_new_int(nWrites));
+	json_object_object_add(result,"reads",json_object_new_int(nReads));
+	json_object_object_add(result,"mismatches",mismatches);
+	batch_add_read(result);
+
+	if ( 0 == exitValue && 0 != nMismatches ) 
+		exitValue=3;
+	batch_result(result);
+
+	fprintf(stderr,"# batch ran %d commands with %d writes and %d register reads\n",nCommands,nWrites,nReads);
+
+	return exitValue;
+}
+
+/* render registers of last read and counters for --metrics-listen scrapes */
+void metrics_render(void) {
+	const uint16_t *r = lastRegisters;
+
+	metrics_begin(&metrics);
+
+	metrics_family(&metrics,"pz_voltage_in_volts","gauge","Input voltage");
+	metrics_value(&metrics,"pz_voltage_in_volts","kind=\"now\"",adcToVoltage(r[PZP_I2C_REG_VOLTAGE_INPUT_NOW]));
+	metrics_value(&metrics,"pz_voltage_in_volts","kind=\"average\"",adcToVoltage(r[PZP_I2C_REG_VOLTAGE_INPUT_AVG]));
+	metrics_family(&metrics,"pz_temperature_pcb_celsius","gauge","Circuit board temperature");
+	metrics_value(&metrics,"pz_temperature_pcb_celsius","kind=\"now\"",ntcThermistor(r[PZP_I2C_REG_TEMPERATURE_BOARD_NOW], 3977, 10000, 10000, 1024));
+	metrics_value(&metrics,"pz_temperature_pcb_celsius","kind=\"average\"",ntcThermistor(r[PZP_I2C_REG_TEMPERATURE_BOARD_AVG], 3977, 10000, 10000, 1024));
+	metrics_family(&metrics,"pz_magnetic_switch_state","gauge","Magnetic switch closed now");
+	metrics_value(&metrics,"pz_magnetic_switch_state",NULL,0 != r[PZP_I2C_REG_SWITCH_MAGNET_NOW]);
+	metrics_family(&metrics,"pz_magnetic_switch_latch","gauge","Magnetic switch closed since latch was reset");
+	metrics_value(&metrics,"pz_magnetic_switch_latch",NULL,0 != r[PZP_I2C_REG_SWITCH_MAGNET_LATCH]);
+	metrics_family(&metrics,"pz_uptime_minutes","gauge","Minutes since pzPower started");
+	metrics_value(&metrics,"pz_uptime_minutes",NULL,r[PZP_I2C_REG_TIME_UPTIME_MINUTES]);
+	metrics_family(&metrics,"pz_sequence_number","gauge","pzPower sequence number");
+	metrics_value(&metrics,"pz_sequence_number",NULL,r[PZP_I2C_REG_SEQUENCE_NUMBER]);
+	metrics_family(&metrics,"pz_watchdog_seconds","gauge","Seconds since watchdog was last reset");
+	metrics_value(&metrics,"pz_watchdog_seconds","watchdog=\"read\"",r[PZP_I2C_REG_TIME_WATCHDOG_READ_SECONDS]);
+	metrics_value(&metrics,"pz_watchdog_seconds","watchdog=\"write\"",r[PZP_I2C_REG_TIME_WATCHDOG_WRITE_SECONDS]);
+	metrics_family(&metrics,"pz_command_off_seconds","gauge","Seconds until commanded power off, 0 if none");
+	metrics_value(&metrics,"pz_command_off_seconds",NULL,r[PZP_I2C_REG_COMMAND_OFF]);
+	metrics_family(&metrics,"pz_power_off_flags","gauge","Power off flags register");
+	metrics_value(&metrics,"pz_power_off_flags",NULL,r[PZP_I2C_REG_POWER_OFF_FLAGS]);
+
+	metrics_family(&metrics,"pz_reads_total","counter","Register reads");
+	metrics_value(&metrics,"pz_reads_total",NULL,reads);
+	metrics_family(&metrics,"pz_bus_errors_total","counter","Register reads that came back short");
+	metrics_value(&metrics,"pz_bus_errors_total",NULL,busErrors);
+	metrics_family(&metrics,"pz_publish_failures_total","counter","MQTT publishes not accepted");
+	metrics_value(&metrics,"pz_publish_failures_total",NULL,publishFailures);
+	metrics_family(&metrics,"pz_last_read_timestamp_seconds","gauge","Time of last read");
+	metrics_value(&metrics,"pz_last_read_timestamp_seconds",NULL,lastReadTime / 1e6);
+
+#ifdef LATENCY_STATS
+	{
+		static latency_hist * const hists[] = { &histRead, &histDecode, &histJsonString, &histPublish };
+		static const double quantiles[] = { 0.5, 0.9, 0.99 };
+		char labels[64];
+		int i, j;
+
+		metrics_family(&metrics,"pz_stage_latency_seconds","gauge","Stage latency quantiles since the last --latency-interval");
+		for ( i=0 ; i<(int) (sizeof(hists)/sizeof(hists[0])) ; i++ ) {
+			for ( j=0 ; j<(int) (sizeof(quantiles)/sizeof(quantiles[0])) ; j++ ) {
+				snprintf(labels,sizeof(labels),"stage=\"%s\",quantile=\"%g\"",hists[i]->name,quantiles[j]);
+				metrics_value(&metrics,"pz_stage_latency_seconds",labels,latency_quantile(hists[i],quantiles[j]) / 1e9);
+			}
+		}
+	}
+#endif
+
+	metrics_end(&metrics);
+}
+
+#ifdef LATENCY_STATS
+/* every latencyInterval seconds or when forced, send histograms to <topic>/latency or stderr */
+void latency_export(int force) {
+	static latency_hist * const hists[] = { &histRead, &histDecode, &histJsonString, &histPublish };
+	static char buf[16384];
+	static uint64_t next;
+	char topic[sizeof(action.mqtt_topic)+16];
+	uint64_t now = latency_now_ns();
+	int i, len, rc;
+
+	if ( 0 == next ) 
+		next = now + (uint64_t) (latencyInterval * 1e9);
+	if ( ! force && now < next ) 
+		return;
+	next = now + (uint64_t) (latencyInterval * 1e9);
+
+	len = latency_json(buf,sizeof(buf),hists,sizeof(hists)/sizeof(hists[0]));
+	if ( len < 0 ) {
+		fputs("# latency metrics document too large\n",stderr);
+	} else if ( action.mqtt ) {
+		snprintf(topic,sizeof(topic),"%s/latency",action.mqtt_topic);
+		rc = mosquitto_publish(mosq,NULL,topic,len,buf,0,0);
+		if ( MOSQ_ERR_SUCCESS != rc ) {
+			publishFailures++;
+			fprintf(stderr,"# mosquitto error %d publishing latency\n",rc);
+		}
+	} else {
+		fprintf(stderr,"# %s\n",buf);
+	}
+
+	for ( i=0 ; i<(int) (sizeof(hists)/sizeof(hists[0])) ; i++ ) {
+		latency_reset(hists[i]);
+	}
+}
+#endif
+
 
 void printUsage(void) {
 	fprintf(stderr,"Usage:\n\n");
@@ -383,6 +1253,18 @@ void printUsage(void) {
 	fprintf(stderr,"--mqtt-host      hostname       MQTT broker\n");
 	fprintf(stderr,"--mqtt-port      port number    MQTT broker\n");
 	fprintf(stderr,"--mqtt-topic     port number    MQTT topic\n");
+	fprintf(stderr,"--capture        filename       append raw registers of every read to capture log\n");
+	fprintf(stderr,"--replay         filename       decode and output every read in capture log. No I2C access\n");
+	fprintf(stderr,"--data-ready     chip:line      with --read-loop, read when GPIO line rises\n");
+#ifdef LATENCY_STATS
+	fprintf(stderr,"--latency-interval seconds      send stage latency histograms this often (default 60)\n");
+#endif
+	fprintf(stderr,"--metrics-listen address        with --read-loop, serve Prometheus metrics on port, address:port, or unix:/path\n");
+	fprintf(stderr,"--shm                           put latest read in shared memory %s for shmLatest\n",SHM_LATEST_NAME_PZPOWER);
+	fprintf(stderr,"--serve          socket path    stay running and answer --server queries on Unix socket\n");
+	fprintf(stderr,"--server         socket path    get registers from --serve instead of the I2C bus\n");
+	fprintf(stderr,"--max-age        seconds        oldest cached registers --serve may answer with (default 1)\n");
+	fprintf(stderr,"--batch          filename       run commands from file, - for stdin, with one read before and one after\n");
 	fprintf(stderr,"--debug          none           some additional debugging information\n");
 	fprintf(stderr,"--help                          this message\n");
 }
@@ -484,6 +1366,9 @@ int m_pub(const char *message ) {
 
 	/* check return status of mosquitto_publish */ 
 	/* this really just checks if mosquitto library accepted the message. Not that it was actually send on the network */
+	if ( MOSQ_ERR_SUCCESS != rc ) {
+		publishFailures++;
+	}
 	if ( MOSQ_ERR_SUCCESS == rc ) {
 		/* successful send */
 	} else if ( MOSQ_ERR_INVAL == rc ) {
@@ -504,6 +1389,47 @@ int m_pub(const char *message ) {
 	return	rc;
 }
 
+/* decode every pzPowerI2C record of capture log and send to stdout and optionally MQTT */
+void replay_pzpoweri2c(void) {
+	capture_record rec;
+	unsigned long nRecords=0;
+	char *s;
+	LATENCY_VAR(t);
+
+	if ( 0 != capture_log_open(&replayLog,action.replay_filename) ) {
+		exit(1);
+	}
+
+	while ( capture_log_next(&replayLog,&rec) ) {
+		if ( CAPTURE_DEVICE_PZPOWERI2C != rec.device || CAPACITY_REGISTERS*2 != rec.length ) 
+			continue;
+
+		LATENCY_START(t);
+		decode_pzpoweri2c((const uint16_t *) rec.data,rec.timestamp_usec);
+		LATENCY_STOP(histDecode,t);
+
+		jobj_enclosing = json_object_new_object();
+		json_object_object_add(jobj_enclosing, "pzPowerI2C", jobj);
+
+		LATENCY_START(t);
+		s = (char *) json_object_to_json_string_ext(jobj_enclosing, JSON_C_TO_STRING_PRETTY);
+		LATENCY_STOP(histJsonString,t);
+		printf("%s\n", s);
+
+		if ( action.mqtt ) {
+			LATENCY_START(t);
+			m_pub(s);
+			LATENCY_STOP(histPublish,t);
+		}
+
+		json_object_put(jobj_enclosing);
+		nRecords++;
+	}
+
+	fprintf(stderr,"# replayed %lu records\n",nRecords);
+	capture_log_close(&replayLog);
+}
+
 int main(int argc, char **argv) {
 	/* optarg */
 	int c;
@@ -513,6 +1439,8 @@ int main(int argc, char **argv) {
 	int exitValue=0;
 	int rc;
 	char *s;
+	uint64_t edgeTime=0;	/* monotonic time of data-ready edge. 0 reads at now */
+	LATENCY_VAR(tStage);
 
 	/* I2C stuff */
 	char i2cDevice[64];	/* I2C device name */
@@ -578,6 +1506,20 @@ int main(int argc, char **argv) {
 		        {"set-adc-ticks",                    required_argument, 0, 10020 },
 		        {"set-startup-power-on-delay",       required_argument, 0, 10030 },
 
+			/* 20000 series. Raw register capture and replay */
+			{"capture",                          required_argument, 0, 20000 },
+			{"replay",                           required_argument, 0, 20010 },
+			{"data-ready",                       required_argument, 0, 20020 },
+#ifdef LATENCY_STATS
+			{"latency-interval",                 required_argument, 0, 20030 },
+#endif
+			{"metrics-listen",                   required_argument, 0, 20040 },
+			{"shm",                              no_argument,       0, 20050 },
+			{"serve",                            required_argument, 0, 20060 },
+			{"server",                           required_argument, 0, 20070 },
+			{"max-age",                          required_argument, 0, 20080 },
+			{"batch",                            required_argument, 0, 20090 },
+
 			/* normal program */
 			{"mqtt",                             no_argument,       0, 'm' },
 			{"mqtt-host",                        required_argument, 0, 'H' },
@@ -702,6 +1644,47 @@ int main(int argc, char **argv) {
 				action.setStartupPowerOnDelay_value = rangeCheckInt("set-startup-power-on-delay",atoi(optarg),1,65535);
 				break;
 
+			/* 20000 series */
+			case 20000:
+				flagProccess(&action.capture,"capture"); 
+				strncpy(action.capture_filename,optarg,sizeof(action.capture_filename)-1);
+				break;
+			case 20010:
+				flagProccess(&action.replay,"replay"); 
+				strncpy(action.replay_filename,optarg,sizeof(action.replay_filename)-1);
+				break;
+			case 20020:
+				flagProccess(&action.dataReady,"data-ready"); 
+				strncpy(action.dataReady_line,optarg,sizeof(action.dataReady_line)-1);
+				break;
+#ifdef LATENCY_STATS
+			case 20030:
+				latencyInterval = atof(optarg);
+				break;
+#endif
+			case 20040:
+				flagProccess(&action.metricsListen,"metrics-listen"); 
+				strncpy(action.metricsListen_address,optarg,sizeof(action.metricsListen_address)-1);
+				break;
+			case 20050:
+				flagProccess(&action.shm,"shm"); 
+				break;
+			case 20060:
+				flagProccess(&action.serve,"serve"); 
+				strncpy(action.serve_path,optarg,sizeof(action.serve_path)-1);
+				break;
+			case 20070:
+				flagProccess(&action.server,"server"); 
+				strncpy(action.server_path,optarg,sizeof(action.server_path)-1);
+				break;
+			case 20080:
+				maxAge = atof(optarg);
+				break;
+			case 20090:
+				flagProccess(&action.batch,"batch"); 
+				strncpy(action.batch_filename,optarg,sizeof(action.batch_filename)-1);
+				break;
+
 			/* getopt / standard program */
 			case '?':
 				/* getopt error of missing argument or unknown option */
@@ -750,20 +1733,107 @@ int main(int argc, char **argv) {
 	}
 
 
-	/* Open I2C bus */
-	int i2cHandle = open(i2cDevice, O_RDWR);
+	if ( action.shm && 0 != shm_latest_create(&shmLatest,SHM_LATEST_NAME_PZPOWER,SHM_LATEST_PZPOWER,sizeof(shm_pzpower_record)) ) {
+		exit(1);
+	}
 
-	if ( -1 == i2cHandle ) {
-		fprintf(stderr,"# Error opening I2C device.\n# %s\n# Exiting...\n",strerror(errno));
+	/* replay does not touch the I2C bus */
+	if ( action.replay ) {
+		if ( action.mqtt && 0 == _mosquitto_startup() ) {
+			return	1;
+		}
+
+		replay_pzpoweri2c();
+
+#ifdef LATENCY_STATS
+		latency_export(1);
+#endif
+
+		if ( action.mqtt ) {
+			_mosquitto_shutdown();
+		}
+
+		fprintf(stderr,"# Done...\n");
+		exit(0);
+	}
+
+	if ( action.capture && 0 != capture_log_create(&captureLog,action.capture_filename) ) {
 		exit(1);
 	}
-	/* not using 10 bit addresses */
-	opResult = ioctl(i2cHandle, I2C_TENBIT, 0);
-	/* address of device we will be working with */
-	opResult = ioctl(i2cHandle, I2C_SLAVE, i2cAddress);
+
+	/* --server does every read and write through the query server */
+	int i2cHandle = -1;
+
+	if ( action.server ) {
+		if ( action.serve || action.dataReady ) {
+			fputs("# --server can't be used with --serve or --data-ready. Aborting...\n",stderr);
+			exit(1);
+		}
+		if ( 0 != query_connect(action.server_path) ) {
+			exit(1);
+		}
+	} else {
+		/* Open I2C bus */
+		i2cHandle = open(i2cDevice, O_RDWR);
+
+		if ( -1 == i2cHandle ) {
+			fprintf(stderr,"# Error opening I2C device.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+		/* not using 10 bit addresses */
+		opResult = ioctl(i2cHandle, I2C_TENBIT, 0);
+		/* address of device we will be working with */
+		opResult = ioctl(i2cHandle, I2C_SLAVE, i2cAddress);
+	}
+
+	/* resident query server. Nothing else is done */
+	if ( action.serve ) {
+		serve_pzpoweri2c(i2cHandle);
+		close(i2cHandle);
+		fprintf(stderr,"# Done...\n");
+		exit(0);
+	}
+
+	if ( action.dataReady ) {
+		if ( ! action.readLoop ) {
+			fputs("# --data-ready needs --read-loop. Aborting...\n",stderr);
+			exit(1);
+		}
+		if ( 0 != gpio_line_parse(action.dataReady_line,&dataReadyLine) || 0 != gpio_line_open(&dataReadyLine,GPIO_EVENT_RISING,"pzPowerI2C") ) {
+			exit(1);
+		}
+	}
+
+	if ( action.metricsListen ) {
+		if ( ! action.readLoop ) {
+			fputs("# --metrics-listen needs --read-loop. Aborting...\n",stderr);
+			exit(1);
+		}
+		if ( 0 != metrics_http_open(&metrics,action.metricsListen_address) ) {
+			exit(1);
+		}
+	}
 
 	/* do initial read and decode of pzPower. We may read and decode again at the end */
-	read_pzpoweri2c(i2cHandle);
+	read_pzpoweri2c(i2cHandle,0);
+
+	/* batch session. Commands come from the file instead of the command line */
+	if ( action.batch ) {
+		exitValue = batch_pzpoweri2c(i2cHandle);
+		json_object_put(jobj);
+
+		if ( action.capture ) {
+			capture_log_close(&captureLog);
+		}
+		if ( action.server ) {
+			close(serverFd);
+		} else {
+			close(i2cHandle);
+		}
+
+		fprintf(stderr,"# Done...\n");
+		exit(exitValue);
+	}
 
 
 
@@ -947,15 +2017,16 @@ int main(int argc, char **argv) {
 	
 	do {
 		if ( action.reRead ) {
-			/* release JSON objects */
-			json_object_put(jobj_enclosing);
-			json_object_put(jobj);
-			json_object_put(jobj_configuration); 
-			json_object_put(jobj_power_off_flags); 
-			json_object_put(jobj_data); 
+			/* release JSON objects. After the first pass jobj is owned by jobj_enclosing */
+			if ( NULL != jobj_enclosing ) {
+				json_object_put(jobj_enclosing);
+				jobj_enclosing=NULL;
+			} else {
+				json_object_put(jobj);
+			}
 
 			/* re read and create new JSON objects */
-			read_pzpoweri2c(i2cHandle);
+			read_pzpoweri2c(i2cHandle,edgeTime);
 		}
 
 		/* print JSON output */
@@ -964,32 +2035,87 @@ int main(int argc, char **argv) {
 		json_object_object_add(jobj_enclosing, "pzPowerI2C", jobj);
 
 		/* convert JSON object to string */
+		LATENCY_START(tStage);
 		s = (char *) json_object_to_json_string_ext(jobj_enclosing, JSON_C_TO_STRING_PRETTY);
+		LATENCY_STOP(histJsonString,tStage);
 
 		/* print to stdout */
 		printf("%s\n", s);
 
 		/* send to MQTT */
 		if ( action.mqtt ) {
+			LATENCY_START(tStage);
 			rc =  m_pub(s);
+			LATENCY_STOP(histPublish,tStage);
 		}
+		if ( action.metricsListen ) {
+			metrics_render();
+			metrics_http_poll(&metrics,0);
+		}
+#ifdef LATENCY_STATS
+		latency_export(0);
+#endif
 		
 
-		if ( action.readLoop ) {
+		if ( action.readLoop && action.dataReady ) {
+			uint64_t edge;
+			int waited;
+
+			action.reRead=1;
+			/* wait for edge. --read-loop seconds is the longest wait */
+			edgeTime=0;
+			if ( action.metricsListen ) {
+				/* wait in slices so scrapes are answered */
+				for ( waited=0, rc=0 ; 0 == rc && ( 0 == action.readLoop_value || waited < action.readLoop_value*1000 ) ; waited+=100 ) {
+					metrics_http_poll(&metrics,0);
+					rc = gpio_line_wait(&dataReadyLine,100,&edge,NULL);
+				}
+			} else {
+				rc = gpio_line_wait(&dataReadyLine,action.readLoop_value ? action.readLoop_value*1000 : -1,&edge,NULL);
+			}
+			if ( rc < 0 ) {
+				exit(1);
+			} else if ( 1 == rc ) {
+				edgeTime=edge;
+			} else if ( outputDebug ) {
+				fprintf(stderr,"# no edge on %s line %u in %d seconds\n",dataReadyLine.chip,dataReadyLine.offset,action.readLoop_value);
+			}
+		} else if ( action.readLoop ) {
 			action.reRead=1;
 			/* wait interval */
 			fprintf(stderr,"# sleeping %d seconds before next read\n",action.readLoop_value);
-			sleep(action.readLoop_value);
+			if ( action.metricsListen ) {
+				metrics_http_sleep(&metrics,action.readLoop_value*1000);
+			} else {
+				sleep(action.readLoop_value);
+			}
 		} else {
 			action.reRead=0;
 		}
 	} while ( action.reRead );
 
 	/* release JSON objects */
-	json_object_put(jobj);
-	json_object_put(jobj_configuration); 
-	json_object_put(jobj_power_off_flags); 
-	json_object_put(jobj_data); 
+	json_object_put(jobj_enclosing);
+
+#ifdef LATENCY_STATS
+	latency_export(1);
+#endif
+
+	if ( action.capture ) {
+		capture_log_close(&captureLog);
+	}
+
+	if ( action.dataReady ) {
+		gpio_line_close(&dataReadyLine);
+	}
+
+	if ( action.metricsListen ) {
+		metrics_http_close(&metrics);
+	}
+
+	if ( action.shm ) {
+		shm_latest_close(&shmLatest);
+	}
 
 	/* shut down MQTT */
 	if ( action.mqtt ) {
@@ -997,8 +2123,10 @@ int main(int argc, char **argv) {
 	}
 
 
-	/* close I2C */
-	if ( -1 == close(i2cHandle) ) {
+	/* close I2C, or connection to --server */
+	if ( action.server ) {
+		close(serverFd);
+	} else if ( -1 == close(i2cHandle) ) {
 		fprintf(stderr,"# Error closing I2C device.\n# %s\n# Exiting...\n",strerror(errno));
 		exit(1);
 	}
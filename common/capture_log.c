@@ -0,0 +1,376 @@
+/*
+Compact binary capture log of raw sensor register blocks. See capture_log.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "capture_log.h"
+#include "sample_time.h"
+
+#define CAPTURE_ALIGN(n) (((n)+7) & ~((size_t) 7))
+
+uint64_t capture_now_usec(void) {
+	struct timeval time;
+
+	gettimeofday(&time, NULL);
+	return ((uint64_t)time.tv_sec * 1000000) + time.tv_usec;
+}
+
+/* monotonic microseconds for index entries, on the clock samples are timed with */
+static uint64_t _capture_monotonic_usec(void) {
+	return sample_time_now_ns() / 1000;
+}
+
+static void _index_filename(char *s, size_t len, const char *filename) {
+	snprintf(s,len,"%s.idx",filename);
+}
+
+/* map (or re-map) mapBytes of the log file */
+static int _capture_map(capture_log *log, size_t mapBytes) {
+	int prot = PROT_READ | (log->writing ? PROT_WRITE : 0);
+
+	if ( NULL != log->map ) {
+		munmap(log->map,log->mapBytes);
+		log->map=NULL;
+	}
+
+	if ( log->writing && -1 == ftruncate(log->fd,mapBytes) ) {
+		fprintf(stderr,"# capture log error growing file. %s\n",strerror(errno));
+		return -1;
+	}
+
+	log->map = mmap(NULL, mapBytes, prot, MAP_SHARED, log->fd, 0);
+	if ( MAP_FAILED == log->map ) {
+		log->map=NULL;
+		fprintf(stderr,"# capture log error mapping file. %s\n",strerror(errno));
+		return -1;
+	}
+	log->mapBytes=mapBytes;
+
+	return 0;
+}
+
+/* check record header at offset. Returns bytes occupied by record or 0 if no valid record */
+static size_t _capture_record_at(capture_log *log, size_t offset, size_t limit) {
+	capture_record_header *h;
+	size_t bytes;
+
+	if ( offset + sizeof(capture_record_header) > limit )
+		return 0;
+
+	h = (capture_record_header *) (log->map + offset);
+	if ( 0 == h->device )
+		return 0;
+
+	bytes = CAPTURE_ALIGN(sizeof(capture_record_header) + h->length);
+	if ( offset + bytes > limit )
+		return 0;
+
+	return bytes;
+}
+
+/* find end of valid data, starting from a known good offset */
+static void _capture_find_end(capture_log *log, size_t offset, size_t limit) {
+	size_t bytes;
+
+	while ( 0 != (bytes=_capture_record_at(log,offset,limit)) ) {
+		log->sequence = ((capture_record_header *) (log->map + offset))->sequence + 1;
+		offset += bytes;
+	}
+
+	log->used=offset;
+}
+
+static int _capture_check_header(capture_log *log, size_t fileBytes) {
+	capture_file_header *fh = (capture_file_header *) log->map;
+
+	if ( fileBytes < sizeof(capture_file_header) || 0 != memcmp(fh->magic,CAPTURE_MAGIC,sizeof(fh->magic)) ) {
+		fprintf(stderr,"# capture log has invalid header\n");
+		return -1;
+	}
+	if ( CAPTURE_VERSION != fh->version ) {
+		fprintf(stderr,"# capture log version %u not supported\n",fh->version);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* load sidecar index if present. Entries past the end of valid data are dropped */
+static void _capture_load_index(capture_log *log, const char *filename) {
+	char indexFilename[1024];
+	FILE *fp;
+	long bytes;
+
+	_index_filename(indexFilename,sizeof(indexFilename),filename);
+
+	fp=fopen(indexFilename,"r");
+	if ( NULL == fp )
+		return;
+
+	fseek(fp,0,SEEK_END);
+	bytes=ftell(fp);
+	rewind(fp);
+
+	log->indexEntries = bytes / sizeof(capture_index_entry);
+	log->index = malloc(log->indexEntries * sizeof(capture_index_entry) + 1);
+	if ( NULL == log->index || fread(log->index,sizeof(capture_index_entry),log->indexEntries,fp) != log->indexEntries ) {
+		free(log->index);
+		log->index=NULL;
+		log->indexEntries=0;
+	}
+	fclose(fp);
+
+	while ( log->indexEntries > 0 && log->index[log->indexEntries-1].offset >= log->used ) {
+		log->indexEntries--;
+	}
+}
+
+int capture_log_create(capture_log *log, const char *filename) {
+	char indexFilename[1024];
+	struct stat st;
+	size_t start;
+
+	memset(log,0,sizeof(capture_log));
+	log->writing=1;
+
+	log->fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if ( -1 == log->fd ) {
+		fprintf(stderr,"# Error opening capture log %s. %s\n",filename,strerror(errno));
+		return -1;
+	}
+	fstat(log->fd,&st);
+
+	if ( 0 != _capture_map(log, CAPTURE_ALIGN(st.st_size) + CAPTURE_GROW_BYTES) ) {
+		close(log->fd);
+		return -1;
+	}
+
+	if ( 0 == st.st_size ) {
+		/* new log */
+		capture_file_header *fh = (capture_file_header *) log->map;
+
+		memcpy(fh->magic,CAPTURE_MAGIC,sizeof(fh->magic));
+		fh->version=CAPTURE_VERSION;
+		fh->header_bytes=sizeof(capture_file_header);
+		fh->created_usec=capture_now_usec();
+		log->used=sizeof(capture_file_header);
+	} else {
+		/* append to existing log. Start from last index entry instead of scanning everything */
+		if ( 0 != _capture_check_header(log,st.st_size) ) {
+			capture_log_close(log);
+			return -1;
+		}
+
+		log->used=st.st_size;
+		_capture_load_index(log,filename);
+		start = log->indexEntries ? log->index[log->indexEntries-1].offset : sizeof(capture_file_header);
+		_capture_find_end(log,start,st.st_size);
+
+		/* elapsed time carries on from the last entry, so entries never go back */
+		if ( log->indexEntries ) 
+			log->elapsedStart_usec=log->index[log->indexEntries-1].elapsed_usec;
+	}
+	log->monotonicStart_usec=_capture_monotonic_usec();
+
+	/* a new log starts a new index. Entries left from an old log of the same name would point into nothing */
+	_index_filename(indexFilename,sizeof(indexFilename),filename);
+	log->indexFp = fopen(indexFilename, ( 0 == st.st_size ) ? "w" : "a");
+	if ( NULL == log->indexFp ) {
+		fprintf(stderr,"# Error opening capture index %s. %s\n",indexFilename,strerror(errno));
+		capture_log_close(log);
+		return -1;
+	}
+
+	/* drop a partly written entry and entries past the end of the log, so appended entries line up */
+	if ( 0 != st.st_size && 0 != ftruncate(fileno(log->indexFp),log->indexEntries * sizeof(capture_index_entry)) ) {
+		fprintf(stderr,"# Error truncating capture index %s. %s\n",indexFilename,strerror(errno));
+		capture_log_close(log);
+		return -1;
+	}
+	free(log->index);
+	log->index=NULL;
+	log->indexEntries=0;
+
+	return 0;
+}
+
+int capture_log_open(capture_log *log, const char *filename) {
+	struct stat st;
+
+	memset(log,0,sizeof(capture_log));
+
+	log->fd = open(filename, O_RDONLY);
+	if ( -1 == log->fd ) {
+		fprintf(stderr,"# Error opening capture log %s. %s\n",filename,strerror(errno));
+		return -1;
+	}
+	fstat(log->fd,&st);
+
+	if ( 0 == st.st_size || 0 != _capture_map(log,st.st_size) || 0 != _capture_check_header(log,st.st_size) ) {
+		capture_log_close(log);
+		return -1;
+	}
+
+	/* log may have been left at its mapped size by a capture that was killed */
+	_capture_find_end(log,sizeof(capture_file_header),st.st_size);
+	_capture_load_index(log,filename);
+	madvise(log->map,log->mapBytes,MADV_SEQUENTIAL);
+
+	capture_log_rewind(log);
+
+	return 0;
+}
+
+int capture_log_append(capture_log *log, uint16_t device, uint64_t timestamp_usec, const void *data, uint16_t length) {
+	capture_record_header *h;
+	size_t bytes = CAPTURE_ALIGN(sizeof(capture_record_header) + length);
+
+	if ( log->used + bytes > log->mapBytes ) {
+		if ( 0 != _capture_map(log, log->mapBytes + CAPTURE_GROW_BYTES) )
+			return -1;
+	}
+
+	/* an index that can't be written stops, so it never has a gap. Seeking past its end scans */
+	if ( NULL != log->indexFp && 0 == (log->sequence % CAPTURE_INDEX_INTERVAL) ) {
+		capture_index_entry e;
+
+		e.elapsed_usec=log->elapsedStart_usec + (_capture_monotonic_usec() - log->monotonicStart_usec);
+		e.offset=log->used;
+		if ( 1 != fwrite(&e,sizeof(e),1,log->indexFp) || 0 != fflush(log->indexFp) ) {
+			fprintf(stderr,"# Error writing capture index. %s. No more entries will be written\n",strerror(errno));
+			fclose(log->indexFp);
+			log->indexFp=NULL;
+		}
+	}
+
+	memcpy(log->map + log->used + sizeof(capture_record_header), data, length);
+
+	/* header written last so a reader never sees a partially written record */
+	h = (capture_record_header *) (log->map + log->used);
+	h->timestamp_usec=timestamp_usec;
+	h->length=length;
+	h->sequence=log->sequence;
+	h->device=device;
+
+	log->used += bytes;
+	log->sequence++;
+
+	return 0;
+}
+
+int capture_log_next(capture_log *log, capture_record *rec) {
+	capture_record_header *h;
+	size_t bytes;
+
+	bytes=_capture_record_at(log,log->position,log->used);
+	if ( 0 == bytes )
+		return 0;
+
+	h = (capture_record_header *) (log->map + log->position);
+	rec->timestamp_usec=h->timestamp_usec;
+	rec->device=h->device;
+	rec->length=h->length;
+	rec->sequence=h->sequence;
+	rec->data=log->map + log->position + sizeof(capture_record_header);
+
+	log->position += bytes;
+
+	return 1;
+}
+
+void capture_log_rewind(capture_log *log) {
+	log->position=sizeof(capture_file_header);
+}
+
+/* 
+the index finds the last entry at or before elapsed_usec. Record timestamps are wall clock, so they 
+are only compared with each other up to the next entry, and a step of the wall clock can't send the 
+seek further than that
+*/
+void capture_log_seek(capture_log *log, uint64_t elapsed_usec) {
+	size_t lo, hi, mid;
+	size_t previous, end = log->used;
+	uint64_t elapsed = 0, target;
+	capture_record rec;
+
+	capture_log_rewind(log);
+
+	/* binary search for last index entry at or before elapsed_usec */
+	if ( log->indexEntries > 0 && log->index[0].elapsed_usec <= elapsed_usec ) {
+		lo=0;
+		hi=log->indexEntries;
+		while ( hi - lo > 1 ) {
+			mid = lo + (hi-lo)/2;
+			if ( log->index[mid].elapsed_usec <= elapsed_usec ) {
+				lo=mid;
+			} else {
+				hi=mid;
+			}
+		}
+		log->position=log->index[lo].offset;
+		elapsed=log->index[lo].elapsed_usec;
+		if ( lo+1 < log->indexEntries ) 
+			end=log->index[lo+1].offset;
+	}
+
+	/* timestamp the rest of elapsed_usec after the record we are at */
+	previous=log->position;
+	if ( 0 == capture_log_next(log,&rec) )
+		return;
+	log->position=previous;
+	target=rec.timestamp_usec + (elapsed_usec - elapsed);
+
+	/* scan forward to first record at or after it */
+	while ( log->position < end ) {
+		previous=log->position;
+		if ( 0 == capture_log_next(log,&rec) )
+			break;
+		if ( rec.timestamp_usec >= target ) {
+			log->position=previous;
+			break;
+		}
+	}
+}
+
+int capture_log_close(capture_log *log) {
+	int rc=0;
+
+	if ( NULL != log->map ) {
+		if ( log->writing ) {
+			msync(log->map,log->used,MS_SYNC);
+		}
+		munmap(log->map,log->mapBytes);
+		log->map=NULL;
+	}
+
+	/* drop the unused tail of the last mapping */
+	if ( log->writing && log->fd >= 0 && -1 == ftruncate(log->fd,log->used) ) {
+		fprintf(stderr,"# capture log error truncating file. %s\n",strerror(errno));
+		rc=-1;
+	}
+
+	if ( log->fd >= 0 && -1 == close(log->fd) ) {
+		rc=-1;
+	}
+	log->fd=-1;
+
+	if ( NULL != log->indexFp ) {
+		fclose(log->indexFp);
+		log->indexFp=NULL;
+	}
+
+	free(log->index);
+	log->index=NULL;
+	log->indexEntries=0;
+
+	return rc;
+}
@@ -0,0 +1,103 @@
+#ifndef APRSi2C_COMMON_CAPTURE_LOG_H
+#define APRSi2C_COMMON_CAPTURE_LOG_H
+/*
+Compact binary capture log of raw sensor register blocks.
+
+The log is a memory-mapped file: a file header followed by records, each a fixed
+record header plus the raw bytes read from the device (padded to 8 bytes). Replaying
+the log through the same decode functions reproduces the original output.
+
+A sidecar index file (<log>.idx) holds the elapsed recording time and offset of every
+CAPTURE_INDEX_INTERVAL-th record so that replay can seek without scanning. Elapsed time
+is on CLOCK_MONOTONIC, so it never goes back when the wall clock is set.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_MAGIC          "APRSCAP1"
+#define CAPTURE_VERSION        1
+#define CAPTURE_INDEX_INTERVAL 64
+#define CAPTURE_GROW_BYTES     (1024*1024)
+
+/* device identifiers stored with each record */
+#define CAPTURE_DEVICE_BMP280_CALIBRATION 0x0101
+#define CAPTURE_DEVICE_BMP280             0x0102
+#define CAPTURE_DEVICE_LSM9DS1            0x0201
+#define CAPTURE_DEVICE_LSM9DS1_SETUP      0x0202
+#define CAPTURE_DEVICE_PZPOWERI2C         0x0301
+
+/* 
+upper 4 bits of device are the instance number when a process samples more than one
+device of the same type. First instance is 0, so single device logs are unchanged 
+*/
+#define CAPTURE_DEVICE_TYPE(device)            ((device) & 0x0fff)
+#define CAPTURE_DEVICE_INSTANCE(device)        (((device) >> 12) & 0x0f)
+#define CAPTURE_DEVICE_MAKE(device,instance)   ((uint16_t) (((device) & 0x0fff) | ((instance) << 12)))
+#define CAPTURE_INSTANCE_MAX                   16
+
+/* on disk file header, 32 bytes */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_bytes;
+	uint64_t created_usec;
+	uint64_t reserved;
+} capture_file_header;
+
+/* on disk record header, 16 bytes. device of 0 marks end of data */
+typedef struct {
+	uint64_t timestamp_usec;
+	uint16_t device;
+	uint16_t length;
+	uint32_t sequence;
+} capture_record_header;
+
+/* on disk index entry */
+typedef struct {
+	uint64_t elapsed_usec;	/* monotonic time since the log was created, not counting time between captures */
+	uint64_t offset;
+} capture_index_entry;
+
+/* record as returned to the caller. data points into the mapped log */
+typedef struct {
+	uint64_t timestamp_usec;
+	uint16_t device;
+	uint16_t length;
+	uint32_t sequence;
+	const uint8_t *data;
+} capture_record;
+
+typedef struct {
+	int fd;
+	int writing;
+	uint8_t *map;
+	size_t mapBytes;	/* bytes currently mapped */
+	size_t used;		/* end of valid data */
+	size_t position;	/* read position */
+	uint32_t sequence;	/* sequence number of next record to append */
+
+	FILE *indexFp;			/* index being written. NULL if it couldn't be */
+	uint64_t elapsedStart_usec;	/* elapsed time when this capture started */
+	uint64_t monotonicStart_usec;	/* monotonic time when this capture started */
+	capture_index_entry *index;	/* index loaded for reading */
+	size_t indexEntries;
+} capture_log;
+
+uint64_t capture_now_usec(void);
+
+/* open for appending, creating the log if needed. Returns 0 on success */
+int capture_log_create(capture_log *log, const char *filename);
+/* open for replay. Returns 0 on success */
+int capture_log_open(capture_log *log, const char *filename);
+
+int capture_log_append(capture_log *log, uint16_t device, uint64_t timestamp_usec, const void *data, uint16_t length);
+
+/* returns 1 and fills rec if a record is available, 0 at end of log */
+int capture_log_next(capture_log *log, capture_record *rec);
+/* position at first record elapsed_usec of recording after the start of the log */
+void capture_log_seek(capture_log *log, uint64_t elapsed_usec);
+void capture_log_rewind(capture_log *log);
+
+int capture_log_close(capture_log *log);
+#endif
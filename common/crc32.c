@@ -0,0 +1,37 @@
+/*
+Table driven CRC-32. See crc32.h
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crc32.h"
+
+static uint32_t table[256];
+static int tableReady=0;
+
+/* reflected polynomial 0x04C11DB7 */
+static void make_table(void) {
+	uint32_t c;
+	int i, j;
+
+	for ( i=0 ; i<256 ; i++ ) {
+		c = i;
+		for ( j=0 ; j<8 ; j++ )
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		table[i] = c;
+	}
+	tableReady=1;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t n) {
+	const uint8_t *p = buf;
+
+	if ( ! tableReady )
+		make_table();
+
+	crc = ~crc;
+	while ( n-- )
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
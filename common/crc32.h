@@ -0,0 +1,13 @@
+#ifndef APRSi2C_COMMON_CRC32_H
+#define APRSi2C_COMMON_CRC32_H
+/*
+CRC-32 (IEEE 802.3, as zlib and PNG use). Start with 0 and feed blocks in order:
+
+	crc = crc32_update(0, buf, n);
+	crc = crc32_update(crc, more, m);
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t n);
+#endif
@@ -0,0 +1,175 @@
+/*
+GPIO line edge events through the gpiochip character device. See gpio_event.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "gpio_event.h"
+
+/* plain non-negative decimal number, no sign, spaces or trailing characters. -1 if it isn't */
+static long _parse_number(const char *s) {
+	char *end;
+	long value;
+
+	if ( *s < '0' || *s > '9' ) 
+		return -1;
+
+	errno=0;
+	value=strtol(s,&end,10);
+	if ( 0 != errno || '\0' != *end || value > (long) INT32_MAX ) 
+		return -1;
+
+	return value;
+}
+
+int gpio_line_parse(const char *spec, gpio_line *line) {
+	char chip[64];
+	const char *colon;
+	size_t len;
+	long number;
+	int n;
+
+	memset(line,0,sizeof(gpio_line));
+	line->fd=-1;
+
+	colon=strrchr(spec,':');
+	if ( NULL == colon || colon == spec || '\0' == colon[1] ) {
+		fprintf(stderr,"# GPIO line '%s' must be chip:line\n",spec);
+		return -1;
+	}
+
+	len = colon - spec;
+	if ( len >= sizeof(chip) ) {
+		fprintf(stderr,"# GPIO chip in '%s' is too long\n",spec);
+		return -1;
+	}
+	memcpy(chip,spec,len);
+	chip[len]='\0';
+
+	if ( '/' == chip[0] ) {
+		n = snprintf(line->chip,sizeof(line->chip),"%s",chip);
+	} else if ( 0 == strncmp(chip,"gpiochip",8) ) {
+		n = snprintf(line->chip,sizeof(line->chip),"/dev/%s",chip);
+	} else if ( (number=_parse_number(chip)) >= 0 ) {
+		n = snprintf(line->chip,sizeof(line->chip),"/dev/gpiochip%ld",number);
+	} else {
+		fprintf(stderr,"# GPIO chip in '%s' must be a number, gpiochipN or a path\n",spec);
+		return -1;
+	}
+	if ( n < 0 || n >= (int) sizeof(line->chip) ) {
+		fprintf(stderr,"# GPIO chip in '%s' is too long\n",spec);
+		return -1;
+	}
+
+	number = _parse_number(colon+1);
+	if ( number < 0 ) {
+		fprintf(stderr,"# GPIO line in '%s' must be a number\n",spec);
+		return -1;
+	}
+	line->offset = (unsigned int) number;
+
+	return 0;
+}
+
+int gpio_line_open(gpio_line *line, int edges, const char *consumer) {
+	struct gpio_v2_line_request req;
+	int chipFd;
+
+	chipFd = open(line->chip, O_RDONLY | O_CLOEXEC);
+	if ( -1 == chipFd ) {
+		fprintf(stderr,"# Error opening GPIO chip %s. %s\n",line->chip,strerror(errno));
+		return -1;
+	}
+
+	memset(&req,0,sizeof(req));
+	req.offsets[0]=line->offset;
+	req.num_lines=1;
+	snprintf(req.consumer,sizeof(req.consumer),"%s",consumer);
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if ( edges & GPIO_EVENT_RISING )
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+	if ( edges & GPIO_EVENT_FALLING )
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+	if ( -1 == ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req) ) {
+		fprintf(stderr,"# Error requesting GPIO line %s:%u. %s\n",line->chip,line->offset,strerror(errno));
+		close(chipFd);
+		return -1;
+	}
+	close(chipFd);
+
+	line->fd=req.fd;
+
+	return 0;
+}
+
+void gpio_line_close(gpio_line *line) {
+	if ( line->fd >= 0 ) {
+		close(line->fd);
+	}
+	line->fd=-1;
+}
+
+int gpio_line_value(gpio_line *line) {
+	struct gpio_v2_line_values values;
+
+	memset(&values,0,sizeof(values));
+	values.mask=1;
+	if ( -1 == ioctl(line->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) )
+		return -1;
+
+	return (int) (values.bits & 1);
+}
+
+int gpio_line_wait(gpio_line *line, int timeout_ms, uint64_t *timestamp_ns, int *rising) {
+	struct gpio_v2_line_event event;
+	struct pollfd pfd;
+	int rc;
+
+	pfd.fd=line->fd;
+	pfd.events=POLLIN;
+	pfd.revents=0;
+
+	rc = poll(&pfd,1,timeout_ms);
+	if ( rc < 0 ) {
+		if ( EINTR == errno )
+			return 0;
+		fprintf(stderr,"# Error waiting for GPIO line %s:%u. %s\n",line->chip,line->offset,strerror(errno));
+		return -1;
+	}
+	if ( 0 == rc )
+		return 0;
+
+	if ( sizeof(event) != read(line->fd,&event,sizeof(event)) ) {
+		fprintf(stderr,"# Error reading GPIO line %s:%u event. %s\n",line->chip,line->offset,strerror(errno));
+		return -1;
+	}
+
+	if ( NULL != timestamp_ns )
+		*timestamp_ns=event.timestamp_ns;
+	if ( NULL != rising )
+		*rising = ( GPIO_V2_LINE_EVENT_RISING_EDGE == event.id );
+
+	return 1;
+}
+
+uint64_t gpio_timestamp_usec(uint64_t timestamp_ns) {
+	struct timespec realtime, monotonic;
+	int64_t offset_ns;
+
+	/* offset between the clocks right now. Event was recent so a wall clock step in between is unlikely */
+	clock_gettime(CLOCK_MONOTONIC,&monotonic);
+	clock_gettime(CLOCK_REALTIME,&realtime);
+	offset_ns = ((int64_t) realtime.tv_sec - monotonic.tv_sec) * 1000000000LL + (realtime.tv_nsec - monotonic.tv_nsec);
+
+	return (uint64_t) ((int64_t) timestamp_ns + offset_ns) / 1000;
+}
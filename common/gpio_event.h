@@ -0,0 +1,37 @@
+#ifndef APRSi2C_COMMON_GPIO_EVENT_H
+#define APRSi2C_COMMON_GPIO_EVENT_H
+/*
+Wait for edges on a GPIO line through the Linux gpiochip character device (GPIO v2 uAPI).
+Used for sensor interrupt and data-ready lines instead of polling the sensor.
+*/
+#include <stdint.h>
+
+#define GPIO_EVENT_RISING  1
+#define GPIO_EVENT_FALLING 2
+#define GPIO_EVENT_BOTH    (GPIO_EVENT_RISING | GPIO_EVENT_FALLING)
+
+typedef struct {
+	char chip[64];		/* /dev/gpiochipN */
+	unsigned int offset;	/* line on chip */
+	int fd;			/* line request */
+} gpio_line;
+
+/* parse chip:line, where chip is gpiochipN, /dev/gpiochipN, or N. Returns 0 on success */
+int gpio_line_parse(const char *spec, gpio_line *line);
+
+/* request line as input with edge detection. Returns 0 on success */
+int gpio_line_open(gpio_line *line, int edges, const char *consumer);
+void gpio_line_close(gpio_line *line);
+
+/* current value of line. Returns 0 or 1, -1 on error */
+int gpio_line_value(gpio_line *line);
+
+/*
+wait up to timeout_ms (-1 forever) for an edge. Returns 1 and sets timestamp_ns (kernel
+CLOCK_MONOTONIC) and rising, 0 on timeout, -1 on error
+*/
+int gpio_line_wait(gpio_line *line, int timeout_ms, uint64_t *timestamp_ns, int *rising);
+
+/* event timestamp as microseconds since the epoch, the same time base as capture_now_usec() */
+uint64_t gpio_timestamp_usec(uint64_t timestamp_ns);
+#endif
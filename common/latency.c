@@ -0,0 +1,131 @@
+/*
+Per-stage log-linear latency histograms. See latency.h
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "latency.h"
+
+uint64_t latency_now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW,&t);
+	return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+int latency_bucket(uint64_t ns) {
+	int log2;
+
+	if ( ns < LATENCY_SUB ) 
+		return (int) ns;
+
+	log2 = 63 - __builtin_clzll(ns);
+	if ( log2 > LATENCY_MAX_LOG2 ) 
+		return LATENCY_BUCKETS - 1;
+
+	/* top LATENCY_SUB_BITS bits below the leading one pick the linear bucket */
+	return (log2 - LATENCY_SUB_BITS + 1) * LATENCY_SUB + (int) ((ns >> (log2 - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+}
+
+uint64_t latency_bucket_lower(int bucket) {
+	int log2;
+
+	if ( bucket < LATENCY_SUB ) 
+		return (uint64_t) bucket;
+
+	log2 = bucket / LATENCY_SUB + LATENCY_SUB_BITS - 1;
+	return ((uint64_t) (LATENCY_SUB + bucket % LATENCY_SUB)) << (log2 - LATENCY_SUB_BITS);
+}
+
+void latency_record(latency_hist *h, uint64_t ns) {
+	uint64_t old;
+
+	__atomic_fetch_add(&h->count,1,__ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_ns,ns,__ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->bucket[latency_bucket(ns)],1,__ATOMIC_RELAXED);
+
+	old = __atomic_load_n(&h->min_ns,__ATOMIC_RELAXED);
+	while ( ns < old && ! __atomic_compare_exchange_n(&h->min_ns,&old,ns,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED) )
+		;
+	old = __atomic_load_n(&h->max_ns,__ATOMIC_RELAXED);
+	while ( ns > old && ! __atomic_compare_exchange_n(&h->max_ns,&old,ns,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED) )
+		;
+}
+
+uint64_t latency_quantile(const latency_hist *h, double fraction) {
+	uint64_t want, seen = 0, ns = h->max_ns;
+	int i;
+
+	if ( 0 == h->count ) 
+		return 0;
+
+	want = (uint64_t) (fraction * h->count);
+	for ( i=0 ; i<LATENCY_BUCKETS ; i++ ) {
+		seen += h->bucket[i];
+		if ( seen > want ) {
+			ns = latency_bucket_lower(i);
+			break;
+		}
+	}
+
+	/* bucket bound may be outside of what was recorded */
+	if ( ns < h->min_ns ) 
+		ns = h->min_ns;
+	if ( ns > h->max_ns ) 
+		ns = h->max_ns;
+	return ns;
+}
+
+void latency_reset(latency_hist *h) {
+	const char *name = h->name;
+
+	memset(h,0,sizeof(latency_hist));
+	h->name=name;
+	h->min_ns=UINT64_MAX;
+}
+
+int latency_json(char *buf, size_t len, latency_hist * const *hists, int n) {
+	const latency_hist *h;
+	size_t used = 0;
+	int i, b, first, rc;
+
+/* append to buf or give up */
+#define LATENCY_APPEND(...) \
+	do { \
+		rc = snprintf(buf + used, len - used, __VA_ARGS__); \
+		if ( rc < 0 || (size_t) rc >= len - used ) \
+			return -1; \
+		used += rc; \
+	} while ( 0 )
+
+	LATENCY_APPEND("{\"latency_ns\":{");
+	for ( i=0 ; i<n ; i++ ) {
+		h=hists[i];
+
+		LATENCY_APPEND("%s\"%s\":{\"count\":%llu",i ? "," : "",h->name,(unsigned long long) h->count);
+		if ( h->count ) {
+			LATENCY_APPEND(",\"min\":%llu,\"max\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu",
+				(unsigned long long) h->min_ns,
+				(unsigned long long) h->max_ns,
+				(unsigned long long) (h->sum_ns / h->count),
+				(unsigned long long) latency_quantile(h,0.50),
+				(unsigned long long) latency_quantile(h,0.90),
+				(unsigned long long) latency_quantile(h,0.99));
+		}
+
+		LATENCY_APPEND(",\"buckets\":[");
+		for ( b=0, first=1 ; b<LATENCY_BUCKETS ; b++ ) {
+			if ( 0 == h->bucket[b] ) 
+				continue;
+			LATENCY_APPEND("%s[%llu,%u]",first ? "" : ",",(unsigned long long) latency_bucket_lower(b),h->bucket[b]);
+			first=0;
+		}
+		LATENCY_APPEND("]}");
+	}
+	LATENCY_APPEND("}}");
+
+#undef LATENCY_APPEND
+	return (int) used;
+}
@@ -0,0 +1,62 @@
+#ifndef APRSi2C_COMMON_LATENCY_H
+#define APRSi2C_COMMON_LATENCY_H
+/*
+Per-stage latency histograms. Built with -DLATENCY_STATS (make LATENCY=1), otherwise every
+macro here compiles to nothing.
+
+Stages are timed with CLOCK_MONOTONIC_RAW into fixed log-linear histograms: 8 linear buckets 
+for each power of two of nanoseconds, so any duration is within 12.5% of its bucket. Recording 
+is lock free and allocates nothing, so it is safe from bus worker threads.
+
+	LATENCY_HIST(histRead,"i2c_read");		at file scope
+	LATENCY_VAR(t);					in a function
+	LATENCY_START(t);
+	... stage ...
+	LATENCY_STOP(histRead,t);
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB      (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_LOG2 40	/* about 18 minutes. Longer goes in the last bucket */
+#define LATENCY_BUCKETS  ((LATENCY_MAX_LOG2 - LATENCY_SUB_BITS + 2) * LATENCY_SUB)
+
+typedef struct {
+	const char *name;
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint32_t bucket[LATENCY_BUCKETS];
+} latency_hist;
+
+#ifdef LATENCY_STATS
+#define LATENCY_HIST(var,label) static latency_hist var = { .name = label, .min_ns = UINT64_MAX }
+#define LATENCY_VAR(t)          uint64_t t
+#define LATENCY_START(t)        ((t) = latency_now_ns())
+#define LATENCY_STOP(hist,t)    latency_record(&(hist),latency_now_ns() - (t))
+#else
+#define LATENCY_HIST(var,label)
+#define LATENCY_VAR(t)
+#define LATENCY_START(t)        do { } while ( 0 )
+#define LATENCY_STOP(hist,t)    do { } while ( 0 )
+#endif
+
+/* CLOCK_MONOTONIC_RAW in nanoseconds */
+uint64_t latency_now_ns(void);
+void latency_record(latency_hist *h, uint64_t ns);
+/* bucket of a duration and the smallest duration in a bucket */
+int latency_bucket(uint64_t ns);
+uint64_t latency_bucket_lower(int bucket);
+/* duration below which fraction (0 to 1) of the recorded durations fall. Bucket resolution, within min and max */
+uint64_t latency_quantile(const latency_hist *h, double fraction);
+
+/* 
+metrics document of histograms as JSON into buf. Only non-empty buckets are listed, as 
+[lower_ns, count]. Returns length, or -1 if buf is too small 
+*/
+int latency_json(char *buf, size_t len, latency_hist * const *hists, int n);
+/* zero counts of histogram. Used after exporting for interval statistics */
+void latency_reset(latency_hist *h);
+#endif
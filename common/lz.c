@@ -0,0 +1,150 @@
+/*
+LZ77 in the LZ4 block format. See lz.h
+*/
+#include <string.h>
+#include "lz.h"
+
+static uint32_t read32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int hash(uint32_t v) {
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* length beyond a nibble of 15, as bytes of 255 and the rest */
+static int put_length(uint8_t *dst, int op, int dstBytes, int len) {
+	for ( ; len >= 255 ; len -= 255 ) {
+		if ( op >= dstBytes )
+			return -1;
+		dst[op++] = 255;
+	}
+	if ( op >= dstBytes )
+		return -1;
+	dst[op++] = len;
+
+	return op;
+}
+
+/* literals, then a match of matchLen at offset unless matchLen is 0. Returns new op or -1 */
+static int put_sequence(uint8_t *dst, int op, int dstBytes, const uint8_t *literals, int litLen, int offset, int matchLen) {
+	int m = ( matchLen > 0 ) ? matchLen - LZ_MIN_MATCH : 0;
+
+	if ( op >= dstBytes )
+		return -1;
+	dst[op++] = ((litLen < 15 ? litLen : 15) << 4) | (m < 15 ? m : 15);
+
+	if ( litLen >= 15 && -1 == (op = put_length(dst,op,dstBytes,litLen-15)) )
+		return -1;
+	if ( op + litLen > dstBytes )
+		return -1;
+	memcpy(dst+op,literals,litLen);
+	op += litLen;
+
+	if ( 0 == matchLen )
+		return op;
+
+	if ( op + 2 > dstBytes )
+		return -1;
+	dst[op++] = offset & 0xff;
+	dst[op++] = offset >> 8;
+
+	if ( m >= 15 && -1 == (op = put_length(dst,op,dstBytes,m-15)) )
+		return -1;
+
+	return op;
+}
+
+int lz_compress(const uint8_t *src, int n, uint8_t *dst, int dstBytes) {
+	int table[1 << LZ_HASH_BITS];
+	int ip=0, anchor=0, op=0;
+	int h, ref, len;
+
+	memset(table,0xff,sizeof(table));
+
+	while ( ip < n - LZ_MATCH_LIMIT ) {
+		h = hash(read32(src+ip));
+		ref = table[h];
+		table[h] = ip;
+
+		if ( ref < 0 || ip - ref > LZ_MAX_OFFSET || read32(src+ref) != read32(src+ip) ) {
+			ip++;
+			continue;
+		}
+
+		for ( len=LZ_MIN_MATCH ; ip+len < n - LZ_LAST_LITERALS && src[ref+len] == src[ip+len] ; len++ )
+			;
+
+		op = put_sequence(dst, op, dstBytes, src+anchor, ip-anchor, ip-ref, len);
+		if ( op < 0 )
+			return -1;
+
+		ip += len;
+		anchor = ip;
+	}
+
+	/* rest as literals */
+	return put_sequence(dst, op, dstBytes, src+anchor, n-anchor, 0, 0);
+}
+
+/* length beyond a nibble of 15. Returns -1 if src runs out */
+static int get_length(const uint8_t *src, int n, int *ip) {
+	int len=0, b;
+
+	do {
+		if ( *ip >= n )
+			return -1;
+		b = src[(*ip)++];
+		len += b;
+	} while ( 255 == b );
+
+	return len;
+}
+
+int lz_decompress(const uint8_t *src, int n, uint8_t *dst, int dstBytes) {
+	int ip=0, op=0;
+	int token, litLen, matchLen, offset, more;
+
+	while ( ip < n ) {
+		token = src[ip++];
+
+		litLen = token >> 4;
+		if ( 15 == litLen ) {
+			if ( -1 == (more = get_length(src,n,&ip)) )
+				return -1;
+			litLen += more;
+		}
+		if ( ip + litLen > n || op + litLen > dstBytes )
+			return -1;
+		memcpy(dst+op,src+ip,litLen);
+		ip += litLen;
+		op += litLen;
+
+		/* last sequence has no match */
+		if ( ip == n )
+			break;
+
+		if ( ip + 2 > n )
+			return -1;
+		offset = src[ip] | (src[ip+1] << 8);
+		ip += 2;
+		if ( 0 == offset || offset > op )
+			return -1;
+
+		matchLen = token & 15;
+		if ( 15 == matchLen ) {
+			if ( -1 == (more = get_length(src,n,&ip)) )
+				return -1;
+			matchLen += more;
+		}
+		matchLen += LZ_MIN_MATCH;
+		if ( op + matchLen > dstBytes )
+			return -1;
+
+		/* byte at a time, the match can overlap what it is copying */
+		for ( ; matchLen > 0 ; matchLen--, op++ )
+			dst[op] = dst[op-offset];
+	}
+
+	return op;
+}
@@ -0,0 +1,29 @@
+#ifndef APRSi2C_COMMON_LZ_H
+#define APRSi2C_COMMON_LZ_H
+/*
+LZ77 compression in the LZ4 block format, small enough to carry around and quick to decompress
+on a Pi Zero. Each sequence is a token (literal length in the high nibble, match length - 4 in
+the low), more length bytes for nibbles of 15, the literals, then a 16 bit little endian
+offset back into the output and more match length bytes. The last sequence is literals only.
+
+Compression uses a hash table of the last position of each 4 byte prefix, one probe per byte.
+That is what LZ4's fast mode does. The end of block rules are kept, so the output is LZ4 block
+data.
+*/
+#include <stdint.h>
+
+#define LZ_MIN_MATCH     4
+#define LZ_HASH_BITS     12
+#define LZ_MAX_OFFSET    65535
+#define LZ_LAST_LITERALS 5	/* block ends with at least this many literals */
+#define LZ_MATCH_LIMIT   12	/* no match starts this close to the end */
+
+/* most bytes compressing n bytes can take */
+#define LZ_BOUND(n) ((n) + (n)/255 + 16)
+
+/* returns compressed length, or -1 if it is more than dstBytes */
+int lz_compress(const uint8_t *src, int n, uint8_t *dst, int dstBytes);
+
+/* returns decompressed length, or -1 if src is bad or would decompress to more than dstBytes */
+int lz_decompress(const uint8_t *src, int n, uint8_t *dst, int dstBytes);
+#endif
@@ -0,0 +1,297 @@
+/*
+Non-blocking HTTP responder for Prometheus text exposition. See metrics_http.h
+*/
+
+#define _GNU_SOURCE	/* accept4() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics_http.h"
+
+static void _client_close(metrics_client *c) {
+	if ( c->fd >= 0 ) 
+		close(c->fd);
+	c->fd=-1;
+	c->requestLength=0;
+	c->responseLength=0;
+	c->sent=0;
+}
+
+int metrics_http_open(metrics_http *m, const char *address) {
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	char host[64];
+	const char *colon;
+	int i, one = 1;
+
+	memset(m,0,sizeof(metrics_http));
+	m->listenFd=-1;
+	for ( i=0 ; i<METRICS_CLIENTS ; i++ ) {
+		m->client[i].fd=-1;
+	}
+	snprintf(m->address,sizeof(m->address),"%s",address);
+
+	if ( 0 == strncmp(address,"unix:",5) ) {
+		m->unixSocket=1;
+		memset(&sun,0,sizeof(sun));
+		sun.sun_family=AF_UNIX;
+		snprintf(sun.sun_path,sizeof(sun.sun_path),"%s",address+5);
+
+		m->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if ( m->listenFd < 0 ) {
+			fprintf(stderr,"# Error creating metrics socket. %s\n",strerror(errno));
+			return -1;
+		}
+		/* left behind by a previous run */
+		unlink(sun.sun_path);
+		if ( 0 != bind(m->listenFd,(struct sockaddr *) &sun,sizeof(sun)) ) {
+			fprintf(stderr,"# Error binding metrics socket %s. %s\n",sun.sun_path,strerror(errno));
+			metrics_http_close(m);
+			return -1;
+		}
+	} else {
+		memset(&sin,0,sizeof(sin));
+		sin.sin_family=AF_INET;
+		sin.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+
+		colon=strrchr(address,':');
+		if ( NULL != colon ) {
+			snprintf(host,sizeof(host),"%.*s",(int) (colon-address),address);
+			if ( 1 != inet_pton(AF_INET,host,&sin.sin_addr) ) {
+				fprintf(stderr,"# metrics address %s is not an IPv4 address\n",host);
+				return -1;
+			}
+			sin.sin_port=htons(atoi(colon+1));
+		} else {
+			sin.sin_port=htons(atoi(address));
+		}
+
+		m->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if ( m->listenFd < 0 ) {
+			fprintf(stderr,"# Error creating metrics socket. %s\n",strerror(errno));
+			return -1;
+		}
+		setsockopt(m->listenFd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+		if ( 0 != bind(m->listenFd,(struct sockaddr *) &sin,sizeof(sin)) ) {
+			fprintf(stderr,"# Error binding metrics socket %s. %s\n",address,strerror(errno));
+			metrics_http_close(m);
+			return -1;
+		}
+	}
+
+	if ( 0 != listen(m->listenFd,METRICS_CLIENTS) ) {
+		fprintf(stderr,"# Error listening on metrics socket %s. %s\n",address,strerror(errno));
+		metrics_http_close(m);
+		return -1;
+	}
+
+	return 0;
+}
+
+void metrics_http_close(metrics_http *m) {
+	int i;
+
+	for ( i=0 ; i<METRICS_CLIENTS ; i++ ) {
+		_client_close(&m->client[i]);
+	}
+
+	if ( m->listenFd >= 0 ) {
+		close(m->listenFd);
+		if ( m->unixSocket ) 
+			unlink(m->address+5);
+	}
+	m->listenFd=-1;
+}
+
+/* request is complete. Copy the current rendering into the client's response */
+static void _client_respond(metrics_http *m, metrics_client *c) {
+	const char *status = "200 OK";
+	size_t bodyLength = m->bodyLength;
+	int n;
+
+	if ( 0 != strncmp(c->request,"GET /metrics ",13) && 0 != strncmp(c->request,"GET / ",6) ) {
+		status = "404 Not Found";
+		bodyLength = 0;
+	}
+
+	n = snprintf(c->response,sizeof(c->response),
+		"HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		status,bodyLength);
+	memcpy(c->response+n,m->body,bodyLength);
+	c->responseLength = n + bodyLength;
+	c->sent=0;
+
+	if ( bodyLength ) 
+		m->scrapes++;
+}
+
+static void _client_service(metrics_http *m, metrics_client *c, short revents) {
+	ssize_t n;
+
+	if ( revents & (POLLERR | POLLHUP | POLLNVAL) && 0 == c->responseLength ) {
+		_client_close(c);
+		return;
+	}
+
+	if ( 0 == c->responseLength && (revents & POLLIN) ) {
+		n = recv(c->fd,c->request+c->requestLength,sizeof(c->request)-1-c->requestLength,MSG_DONTWAIT);
+		if ( 0 == n || (n < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) ) {
+			_client_close(c);
+			return;
+		}
+		if ( n > 0 ) {
+			c->requestLength += n;
+			c->request[c->requestLength]='\0';
+		}
+
+		if ( NULL != strstr(c->request,"\r\n\r\n") || NULL != strstr(c->request,"\n\n") || c->requestLength == sizeof(c->request)-1 ) 
+			_client_respond(m,c);
+	}
+
+	if ( c->responseLength ) {
+		n = send(c->fd,c->response+c->sent,c->responseLength-c->sent,MSG_DONTWAIT | MSG_NOSIGNAL);
+		if ( n < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno ) {
+			_client_close(c);
+			return;
+		}
+		if ( n > 0 ) 
+			c->sent += n;
+		if ( c->sent == c->responseLength ) 
+			_client_close(c);
+	}
+}
+
+void metrics_http_poll(metrics_http *m, int timeout_ms) {
+	struct pollfd pfd[METRICS_CLIENTS+1];
+	metrics_client *map[METRICS_CLIENTS+1];
+	time_t now = time(NULL);
+	int i, n = 0, fd;
+
+	if ( m->listenFd < 0 ) 
+		return;
+
+	pfd[n].fd=m->listenFd;
+	pfd[n].events=POLLIN;
+	map[n++]=NULL;
+
+	for ( i=0 ; i<METRICS_CLIENTS ; i++ ) {
+		if ( m->client[i].fd < 0 ) 
+			continue;
+		if ( now - m->client[i].opened > METRICS_CLIENT_TIMEOUT ) {
+			_client_close(&m->client[i]);
+			continue;
+		}
+		pfd[n].fd=m->client[i].fd;
+		pfd[n].events = m->client[i].responseLength ? POLLOUT : POLLIN;
+		map[n++]=&m->client[i];
+	}
+
+	if ( poll(pfd,n,timeout_ms) <= 0 ) 
+		return;
+
+	for ( i=1 ; i<n ; i++ ) {
+		if ( pfd[i].revents ) 
+			_client_service(m,map[i],pfd[i].revents);
+	}
+
+	if ( pfd[0].revents & POLLIN ) {
+		while ( (fd = accept4(m->listenFd,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 ) {
+			for ( i=0 ; i<METRICS_CLIENTS && m->client[i].fd >= 0 ; i++ )
+				;
+			if ( METRICS_CLIENTS == i ) {
+				/* busy. Scraper will retry */
+				close(fd);
+				continue;
+			}
+			m->client[i].fd=fd;
+			m->client[i].opened=now;
+			m->client[i].requestLength=0;
+			m->client[i].responseLength=0;
+		}
+	}
+}
+
+void metrics_http_sleep(metrics_http *m, int milliseconds) {
+	struct timespec t;
+	int64_t end, left;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	end = (int64_t) t.tv_sec * 1000 + t.tv_nsec / 1000000 + milliseconds;
+
+	for ( ;; ) {
+		clock_gettime(CLOCK_MONOTONIC,&t);
+		left = end - ((int64_t) t.tv_sec * 1000 + t.tv_nsec / 1000000);
+		if ( left <= 0 ) 
+			break;
+		if ( m->listenFd < 0 ) {
+			usleep(left * 1000);
+			break;
+		}
+		metrics_http_poll(m,(int) (left > 1000 ? 1000 : left));
+	}
+}
+
+static void _append(metrics_http *m, const char *format, ...) {
+	va_list ap;
+	int n;
+
+	if ( m->stagingOverflow ) 
+		return;
+
+	va_start(ap,format);
+	n = vsnprintf(m->staging+m->stagingLength,sizeof(m->staging)-m->stagingLength,format,ap);
+	va_end(ap);
+
+	if ( n < 0 || (size_t) n >= sizeof(m->staging)-m->stagingLength ) {
+		m->stagingOverflow=1;
+		return;
+	}
+	m->stagingLength += n;
+}
+
+void metrics_begin(metrics_http *m) {
+	m->stagingLength=0;
+	m->stagingOverflow=0;
+}
+
+void metrics_family(metrics_http *m, const char *name, const char *type, const char *help) {
+	_append(m,"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+}
+
+void metrics_value(metrics_http *m, const char *name, const char *labels, double value) {
+	char v[32];
+
+	if ( isnan(value) ) 
+		strcpy(v,"NaN");
+	else if ( isinf(value) ) 
+		strcpy(v,value > 0 ? "+Inf" : "-Inf");
+	else 
+		snprintf(v,sizeof(v),"%.10g",value);
+
+	if ( NULL != labels && labels[0] ) 
+		_append(m,"%s{%s} %s\n",name,labels,v);
+	else 
+		_append(m,"%s %s\n",name,v);
+}
+
+void metrics_end(metrics_http *m) {
+	if ( m->stagingOverflow ) {
+		fprintf(stderr,"# metrics larger than %d bytes. Keeping previous\n",METRICS_BODY_MAX);
+		return;
+	}
+
+	memcpy(m->body,m->staging,m->stagingLength);
+	m->bodyLength=m->stagingLength;
+}
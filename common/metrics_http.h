@@ -0,0 +1,65 @@
+#ifndef APRSi2C_COMMON_METRICS_HTTP_H
+#define APRSi2C_COMMON_METRICS_HTTP_H
+/*
+Prometheus text exposition served over HTTP from the sampling loop's own thread.
+
+The program renders its metrics into a staging buffer once per cycle with metrics_begin(),
+metrics_family(), metrics_value() and metrics_end(). metrics_end() copies a complete
+rendering to the buffer scrapes are answered from. metrics_http_poll() accepts, reads and 
+writes without blocking, so it is called every cycle and a slow or stuck scraper never holds 
+up sampling. Nothing is allocated after metrics_http_open().
+
+Listen address is a port (bound to 127.0.0.1), address:port, or unix:/path for a Unix socket.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define METRICS_BODY_MAX     32768
+#define METRICS_REQUEST_MAX  1024
+#define METRICS_CLIENTS      4
+#define METRICS_CLIENT_TIMEOUT 10	/* seconds a scrape may take before it is dropped */
+
+typedef struct {
+	int fd;				/* -1 if slot is free */
+	time_t opened;
+	char request[METRICS_REQUEST_MAX];
+	size_t requestLength;
+	char response[METRICS_BODY_MAX + 256];
+	size_t responseLength;		/* 0 until request is complete */
+	size_t sent;
+} metrics_client;
+
+typedef struct {
+	int listenFd;
+	char address[128];
+	int unixSocket;
+
+	/* rendering in progress */
+	char staging[METRICS_BODY_MAX];
+	size_t stagingLength;
+	int stagingOverflow;
+
+	/* last complete rendering. Scrapes copy from here */
+	char body[METRICS_BODY_MAX];
+	size_t bodyLength;
+
+	metrics_client client[METRICS_CLIENTS];
+	unsigned long scrapes;
+} metrics_http;
+
+/* listen on address. Returns 0 on success */
+int metrics_http_open(metrics_http *m, const char *address);
+void metrics_http_close(metrics_http *m);
+/* service connections. Waits at most timeout_ms for one to be ready, 0 doesn't wait */
+void metrics_http_poll(metrics_http *m, int timeout_ms);
+/* service connections for milliseconds. Replaces sleep() in a sampling loop */
+void metrics_http_sleep(metrics_http *m, int milliseconds);
+
+/* render */
+void metrics_begin(metrics_http *m);
+void metrics_family(metrics_http *m, const char *name, const char *type, const char *help);
+/* one sample. labels without braces, ie sensor="LSM9DS1",axis="x", or NULL */
+void metrics_value(metrics_http *m, const char *name, const char *labels, double value);
+void metrics_end(metrics_http *m);
+#endif
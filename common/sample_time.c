@@ -0,0 +1,82 @@
+/*
+CLOCK_MONOTONIC acquisition timestamps and monotonic to UTC mapping. See sample_time.h
+*/
+
+#include <stdint.h>
+#include <time.h>
+#include "sample_time.h"
+
+/* realtime reads bracketed by monotonic reads to keep the narrowest of */
+#define SAMPLE_TIME_MAP_TRIES 5
+
+static uint64_t _ns(const struct timespec *t) {
+	return (uint64_t) t->tv_sec * 1000000000ULL + t->tv_nsec;
+}
+
+uint64_t sample_time_now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return _ns(&t);
+}
+
+uint64_t sample_time_backdate(uint64_t read_ns, int index, int count, double odr_hz) {
+	uint64_t back;
+
+	if ( odr_hz <= 0.0 ) 
+		return read_ns;
+
+	back = (uint64_t) ((count - 1 - index + 0.5) * 1e9 / odr_hz);
+	return ( back < read_ns ) ? read_ns - back : 0;
+}
+
+void sample_time_end(sample_time *t, uint64_t edge_ns, double odr_hz) {
+	t->end_ns=sample_time_now_ns();
+
+	if ( 0 != edge_ns ) {
+		/* data-ready edge is the end of conversion */
+		t->sample_ns=edge_ns;
+	} else if ( odr_hz > 0.0 ) {
+		t->sample_ns=sample_time_backdate(t->start_ns,0,1,odr_hz);
+	} else {
+		t->sample_ns = t->start_ns + (t->end_ns - t->start_ns) / 2;
+	}
+}
+
+void sample_time_map_update(sample_time_map *m) {
+	struct timespec before, realtime, after;
+	uint64_t width;
+	int i;
+
+	m->uncertainty_ns=UINT64_MAX;
+
+	/* a preempted try has a wide bracket. Keep the narrowest */
+	for ( i=0 ; i<SAMPLE_TIME_MAP_TRIES ; i++ ) {
+		clock_gettime(CLOCK_MONOTONIC,&before);
+		clock_gettime(CLOCK_REALTIME,&realtime);
+		clock_gettime(CLOCK_MONOTONIC,&after);
+
+		width = _ns(&after) - _ns(&before);
+		if ( width / 2 < m->uncertainty_ns ) {
+			m->uncertainty_ns = width / 2;
+			m->monotonic_ns = _ns(&before) + width / 2;
+			m->offset_ns = (int64_t) _ns(&realtime) - (int64_t) m->monotonic_ns;
+		}
+	}
+}
+
+int sample_time_map_due(sample_time_map *m, double interval_seconds) {
+	uint64_t now = sample_time_now_ns();
+
+	if ( now < m->next_ns ) 
+		return 0;
+
+	sample_time_map_update(m);
+	m->next_ns = now + (uint64_t) (interval_seconds * 1e9);
+
+	return 1;
+}
+
+uint64_t sample_time_utc_usec(const sample_time_map *m, uint64_t monotonic_ns) {
+	return (uint64_t) ((int64_t) monotonic_ns + m->offset_ns) / 1000;
+}
@@ -0,0 +1,49 @@
+#ifndef APRSi2C_COMMON_SAMPLE_TIME_H
+#define APRSi2C_COMMON_SAMPLE_TIME_H
+/*
+Acquisition timestamps on CLOCK_MONOTONIC, which doesn't jump when the wall clock is set.
+
+Each sample records the monotonic time before and after its bus transfer and an estimate
+of when the sensor actually converted it. Samples are related to UTC by a mapping of
+monotonic to realtime that is measured and published periodically, so a consumer can
+line up samples from different programs and ignore wall clock steps between mappings.
+*/
+#include <stdint.h>
+
+typedef struct {
+	uint64_t start_ns;	/* monotonic before bus transfer */
+	uint64_t end_ns;	/* monotonic after bus transfer */
+	uint64_t sample_ns;	/* monotonic estimate of conversion. 0 if not acquired live */
+} sample_time;
+
+typedef struct {
+	uint64_t monotonic_ns;	/* monotonic time of measurement */
+	int64_t offset_ns;	/* realtime - monotonic */
+	uint64_t uncertainty_ns;	/* half the width of the narrowest bracket */
+	uint64_t next_ns;	/* monotonic time the mapping is due again */
+} sample_time_map;
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t sample_time_now_ns(void);
+
+/* 
+monotonic time sample index (0 oldest) of count read from a FIFO at read_ns was converted. The 
+newest was converted on average half a period before the read and each older one a period 
+before the next. Output registers are a FIFO with a count of 1 
+*/
+uint64_t sample_time_backdate(uint64_t read_ns, int index, int count, double odr_hz);
+
+/* 
+start_ns before and end_ns after a bus transfer. sample_ns is edge_ns of a data-ready edge if
+there was one, else back-dated from odr_hz, else the middle of the transfer
+*/
+#define sample_time_start(t) ((t)->start_ns=sample_time_now_ns())
+void sample_time_end(sample_time *t, uint64_t edge_ns, double odr_hz);
+
+/* measure realtime - monotonic */
+void sample_time_map_update(sample_time_map *m);
+/* measure if interval_seconds have passed since last time. Returns 1 if a new mapping should be published */
+int sample_time_map_due(sample_time_map *m, double interval_seconds);
+/* UTC microseconds since the epoch of monotonic time using mapping */
+uint64_t sample_time_utc_usec(const sample_time_map *m, uint64_t monotonic_ns);
+#endif
@@ -0,0 +1,160 @@
+/*
+Latest value of a sampler in POSIX shared memory, guarded by a seqlock. See shm_latest.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_latest.h"
+
+int shm_latest_create(shm_latest *s, const char *name, uint16_t type, uint32_t recordBytes) {
+	shm_latest_header *h;
+	size_t bytes = sizeof(shm_latest_header) + recordBytes;
+	int fd;
+
+	memset(s,0,sizeof(shm_latest));
+	snprintf(s->name,sizeof(s->name),"%s",name);
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if ( -1 == fd ) {
+		fprintf(stderr,"# Error creating shared memory %s. %s\n",name,strerror(errno));
+		return -1;
+	}
+
+	if ( -1 == ftruncate(fd, bytes) ) {
+		fprintf(stderr,"# Error sizing shared memory %s. %s\n",name,strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	h = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if ( MAP_FAILED == h ) {
+		fprintf(stderr,"# Error mapping shared memory %s. %s\n",name,strerror(errno));
+		return -1;
+	}
+
+	if ( SHM_LATEST_MAGIC != h->magic || SHM_LATEST_VERSION != h->version || type != h->type || recordBytes != h->recordBytes ) {
+		/* new segment or one left by a different build. Readers see seq 0 until the first write */
+		__atomic_store_n(&h->seq,0,__ATOMIC_RELEASE);
+		h->version=SHM_LATEST_VERSION;
+		h->type=type;
+		h->recordBytes=recordBytes;
+		h->writes=0;
+		memset(h->record,0,recordBytes);
+		__atomic_store_n(&h->magic,SHM_LATEST_MAGIC,__ATOMIC_RELEASE);
+	} else if ( h->seq & 1 ) {
+		/* previous writer died mid-copy. Last record is not trustworthy */
+		__atomic_store_n(&h->seq,h->seq+1,__ATOMIC_RELEASE);
+	}
+	h->pid=getpid();
+
+	s->header=h;
+	s->mapBytes=bytes;
+	s->writer=1;
+
+	return 0;
+}
+
+void shm_latest_write(shm_latest *s, const void *record) {
+	shm_latest_header *h = s->header;
+	uint32_t seq = h->seq;
+
+	/* odd while copying. The fence keeps the record stores after the count */
+	__atomic_store_n(&h->seq,seq+1,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(h->record,record,h->recordBytes);
+	h->writes++;
+
+	/* skip 0 on wrap so readers never think it is unwritten */
+	seq += 2;
+	if ( 0 == seq )
+		seq = 2;
+	__atomic_store_n(&h->seq,seq,__ATOMIC_RELEASE);
+}
+
+int shm_latest_open(shm_latest *s, const char *name) {
+	shm_latest_header *h;
+	struct stat st;
+	int fd;
+
+	memset(s,0,sizeof(shm_latest));
+	snprintf(s->name,sizeof(s->name),"%s",name);
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if ( -1 == fd ) {
+		fprintf(stderr,"# Error opening shared memory %s. %s\n",name,strerror(errno));
+		return -1;
+	}
+
+	if ( -1 == fstat(fd,&st) || st.st_size < (off_t) sizeof(shm_latest_header) ) {
+		fprintf(stderr,"# Shared memory %s is too short\n",name);
+		close(fd);
+		return -1;
+	}
+
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if ( MAP_FAILED == h ) {
+		fprintf(stderr,"# Error mapping shared memory %s. %s\n",name,strerror(errno));
+		return -1;
+	}
+
+	if ( SHM_LATEST_MAGIC != __atomic_load_n(&h->magic,__ATOMIC_ACQUIRE) || SHM_LATEST_VERSION != h->version ||
+	     (size_t) st.st_size < sizeof(shm_latest_header) + h->recordBytes ) {
+		fprintf(stderr,"# Shared memory %s is not a latest value segment of version %d\n",name,SHM_LATEST_VERSION);
+		munmap(h,st.st_size);
+		return -1;
+	}
+
+	s->header=h;
+	s->mapBytes=st.st_size;
+
+	return 0;
+}
+
+int shm_latest_read(const shm_latest *s, void *record, uint32_t *seq) {
+	const shm_latest_header *h = s->header;
+	uint32_t before, after;
+	int tries;
+
+	for ( tries=0 ; tries<SHM_LATEST_TRIES ; tries++ ) {
+		before = __atomic_load_n(&h->seq,__ATOMIC_ACQUIRE);
+		if ( 0 == before )
+			return 0;
+
+		if ( 0 == (before & 1) ) {
+			memcpy(record,h->record,h->recordBytes);
+			/* keep the record loads before the second look at the count */
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			after = __atomic_load_n(&h->seq,__ATOMIC_RELAXED);
+
+			if ( before == after ) {
+				if ( NULL != seq )
+					*seq=before;
+				return 1;
+			}
+		}
+
+		/* writer is mid-copy. It may be on our CPU */
+		if ( tries > 16 )
+			sched_yield();
+	}
+
+	return -1;
+}
+
+void shm_latest_close(shm_latest *s) {
+	if ( NULL != s->header ) {
+		munmap(s->header,s->mapBytes);
+	}
+	s->header=NULL;
+}
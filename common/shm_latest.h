@@ -0,0 +1,107 @@
+#ifndef APRSi2C_COMMON_SHM_LATEST_H
+#define APRSi2C_COMMON_SHM_LATEST_H
+/*
+Latest value of a sampler in a POSIX shared memory segment, so local programs can get the
+newest reading without MQTT or another trip on the I2C bus.
+
+A segment holds a header and one fixed layout record. The one writer brackets each copy
+with a sequence count (a seqlock): odd while the record is being written, advanced to the
+next even value when done. Readers copy the record and retry if the count was odd or
+changed. Neither side makes a system call or takes a lock after the segment is mapped, and
+a reader can never hold up the sampler.
+
+The segment is left in place when the writer exits, so readers still get the last value and
+can tell its age from monotonic_ns.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHM_LATEST_MAGIC   0x4c535041	/* "APSL" */
+#define SHM_LATEST_VERSION 1
+
+/* record types */
+#define SHM_LATEST_PZPOWER 1
+#define SHM_LATEST_IMU     2
+
+/* segment names */
+#define SHM_LATEST_NAME_PZPOWER "/aprsI2C.pzPower"
+#define SHM_LATEST_NAME_IMU     "/aprsI2C.imu"
+
+/* reader gives up after this many torn copies. Only possible if the writer is stopped mid-copy */
+#define SHM_LATEST_TRIES 1000
+
+/* pzPowerI2C registers of last read, decoded */
+typedef struct {
+	uint64_t timestamp_usec;	/* UTC */
+	uint64_t monotonic_ns;		/* CLOCK_MONOTONIC of read. 0 if replayed */
+	double voltage_in_now;
+	double voltage_in_average;
+	double temperature_pcb_now;	/* Celsius */
+	double temperature_pcb_average;
+	uint16_t magnetic_switch_state;
+	uint16_t magnetic_switch_latch;
+	uint16_t sequence_number;
+	uint16_t uptime_minutes;
+	uint16_t read_watchdog_seconds;
+	uint16_t write_watchdog_seconds;
+	uint16_t command_off_seconds;
+	uint16_t power_off_flags;
+} shm_pzpower_record;
+
+/* shm_imu_record.valid bits */
+#define SHM_IMU_ATTITUDE      0x01	/* acceleration through heading */
+#define SHM_IMU_HEADING_TILT  0x02	/* heading_compensated */
+#define SHM_IMU_TEMPERATURE   0x04	/* LSM9DS1 die temperature */
+#define SHM_IMU_PRESSURE      0x08	/* pressure_hpa and pressure_temperature */
+
+/* first LSM9DS1 and first BMP280 of last imuToMQTT cycle */
+typedef struct {
+	uint64_t timestamp_usec;	/* UTC */
+	uint64_t monotonic_ns;		/* CLOCK_MONOTONIC of LSM9DS1 sample. 0 if replayed */
+	uint32_t valid;			/* SHM_IMU_* */
+	uint32_t still;			/* stillness detector, when gyro bias estimation is on */
+	double acceleration[3];		/* g */
+	double gyro_rate[3];		/* deg/s */
+	double magnetometer[3];		/* raw LSB */
+	double angle[2];		/* complementary filter x, y, degrees */
+	double heading;			/* degrees */
+	double heading_compensated;	/* tilt compensated, degrees */
+	double temperature;		/* Celsius */
+	double pressure_hpa;
+	double pressure_temperature;	/* Celsius */
+} shm_imu_record;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;			/* SHM_LATEST_* */
+	uint32_t recordBytes;
+	uint32_t seq;			/* odd while being written, 0 until first write. 32 bits so ARMv6 can load it atomically */
+	int32_t pid;			/* of writer */
+	uint32_t reserved;
+	uint64_t writes;
+	uint8_t record[] __attribute__((aligned(8)));
+} shm_latest_header;
+
+typedef struct {
+	char name[64];
+	shm_latest_header *header;
+	size_t mapBytes;
+	int writer;
+} shm_latest;
+
+/* create or reuse segment name for a record of type and size. Returns 0 on success */
+int shm_latest_create(shm_latest *s, const char *name, uint16_t type, uint32_t recordBytes);
+/* replace the record */
+void shm_latest_write(shm_latest *s, const void *record);
+
+/* map existing segment read only. Returns 0 on success */
+int shm_latest_open(shm_latest *s, const char *name);
+/*
+consistent copy of the record into record (header->recordBytes long). Returns 1 and sets
+seq if there is one, 0 if nothing has been written, -1 if a consistent copy couldn't be made
+*/
+int shm_latest_read(const shm_latest *s, void *record, uint32_t *seq);
+
+void shm_latest_close(shm_latest *s);
+#endif
@@ -0,0 +1,932 @@
+/*
+24 series I2C EEPROM utility. The part is picked with --device from the profiles in
+eeprom_dev.c. eeprom_2464 and mac_24AA02E48T are this program built with a different
+DEFAULT_PART. See README.md
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "eeprom_dev.h"
+#include "eeprom_cache.h"
+#include "crc32.h"
+#include "lz.h"
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+#ifndef DEFAULT_PART
+#define DEFAULT_PART "24LC64"
+#endif
+#ifndef PROGRAM_BANNER
+#define PROGRAM_BANNER "eeprom_24xx 24 series EEPROM I2C utility"
+#endif
+
+/* bus reads and file I/O are this big at most, whatever the size of the part */
+#define STREAM_BYTES 4096
+
+/*
+--compress container, a 13 byte header then the payload:
+	0  magic "AZ"
+	2  codec		CODEC_STORED or CODEC_LZ (lz.h)
+	3  original length	uint24, little endian
+	6  payload length	uint24
+	9  crc32 of original	uint32
+*/
+#define CONTAINER_BYTES 13
+#define CONTAINER_MAX   (1 << 20)	/* largest input */
+#define CODEC_STORED    0
+#define CODEC_LZ        1
+
+static uint32_t get_le(const uint8_t *p, int n) {
+	uint32_t v=0;
+
+	while ( n-- > 0 )
+		v = (v << 8) | p[n];
+	return v;
+}
+
+static void put_le(uint8_t *p, uint32_t v, int n) {
+	for ( ; n > 0 ; n--, v >>= 8 )
+		*p++ = v & 0xff;
+}
+
+/*
+returns 1 if header is a whole container header that fits in room bytes: magic, a codec we
+know, and lengths that --compress could have written. Anything else is read as it is
+*/
+static int container_parse(const uint8_t *header, int room, int *codec, int *originalBytes, int *payloadBytes, uint32_t *crc) {
+	if ( room < CONTAINER_BYTES || 'A' != header[0] || 'Z' != header[1] )
+		return 0;
+
+	*codec = header[2];
+	*originalBytes = get_le(header+3,3);
+	*payloadBytes = get_le(header+6,3);
+	*crc = get_le(header+9,4);
+
+	if ( CODEC_STORED != *codec && CODEC_LZ != *codec )
+		return 0;
+	if ( *originalBytes > CONTAINER_MAX || *payloadBytes > room - CONTAINER_BYTES )
+		return 0;
+	/* stored is the input as is. lz is only used when it is no bigger than the input */
+	if ( CODEC_STORED == *codec && *payloadBytes != *originalBytes )
+		return 0;
+	if ( CODEC_LZ == *codec && ( *payloadBytes < 1 || *payloadBytes > *originalBytes ) )
+		return 0;
+
+	return 1;
+}
+
+/*
+all of fp compressed into a container, up to the first null in --string mode. Returns a stream
+of the container, which is *containerBytes long
+*/
+static FILE *compress_input(FILE *fp, int stringMode, int room, int *containerBytes) {
+	uint8_t *in, *out, *z;
+	int n, payload, codec;
+
+	in = malloc(CONTAINER_MAX+1);
+	out = malloc(CONTAINER_BYTES + LZ_BOUND(CONTAINER_MAX));
+	if ( NULL == in || NULL == out ) {
+		fprintf(stderr,"# Error allocating compression buffers\n# Exiting...\n");
+		exit(1);
+	}
+
+	n = fread(in,1,CONTAINER_MAX+1,fp);
+	fclose(fp);
+	if ( n > CONTAINER_MAX ) {
+		fprintf(stderr,"# --compress input is more than %d bytes\n# Exiting...\n",CONTAINER_MAX);
+		exit(1);
+	}
+	if ( stringMode && NULL != (z = memchr(in,'\0',n)) ) {
+		n = z-in;
+	}
+
+	/* stored if it doesn't get any smaller */
+	codec = CODEC_LZ;
+	payload = lz_compress(in, n, out+CONTAINER_BYTES, n);
+	if ( payload < 0 ) {
+		codec = CODEC_STORED;
+		payload = n;
+		memcpy(out+CONTAINER_BYTES, in, n);
+	}
+
+	out[0]='A';
+	out[1]='Z';
+	out[2]=codec;
+	put_le(out+3,n,3);
+	put_le(out+6,payload,3);
+	put_le(out+9,crc32_update(0,in,n),4);
+	free(in);
+
+	*containerBytes = CONTAINER_BYTES + payload;
+	fprintf(stderr,"# compressed %d bytes to %d (%s)\n",n,*containerBytes,CODEC_LZ == codec ? "lz" : "stored");
+	if ( *containerBytes > room ) {
+		fprintf(stderr,"# compressed input doesn't fit in %d bytes\n# Exiting...\n",room);
+		exit(1);
+	}
+
+	fp = fmemopen(out, *containerBytes, "r");
+	if ( NULL == fp ) {
+		fprintf(stderr,"# Error opening compressed input.\n# %s\n# Exiting...\n",strerror(errno));
+		exit(1);
+	}
+	return fp;
+}
+
+/* --dump-format */
+#define DUMP_BINARY 0
+#define DUMP_HEX    1
+#define DUMP_JSON   2
+
+/* lines of 16 bytes as xxd prints them, addressed from the EEPROM address */
+static void dump_hex(FILE *fp, int address, const uint8_t *buf, int n) {
+	int i, j;
+
+	for ( i=0 ; i<n ; i += 16 ) {
+		fprintf(fp,"%08x:",address+i);
+		for ( j=0 ; j<16 ; j++ ) {
+			if ( 0 == j%2 )
+				fputc(' ',fp);
+			if ( i+j < n ) {
+				fprintf(fp,"%02x",buf[i+j]);
+			} else {
+				fputs("  ",fp);
+			}
+		}
+		fputs("  ",fp);
+		for ( j=0 ; j<16 && i+j<n ; j++ ) {
+			fputc(buf[i+j] >= 0x20 && buf[i+j] < 0x7f ? buf[i+j] : '.',fp);
+		}
+		fputc('\n',fp);
+	}
+}
+
+/* bytes of a JSON array, first tells us whether a comma goes before the first */
+static void dump_json(FILE *fp, const uint8_t *buf, int n, int first) {
+	int i;
+
+	for ( i=0 ; i<n ; i++ ) {
+		fprintf(fp,( first && 0 == i ) ? "%d" : ",%d",buf[i]);
+	}
+}
+
+/* CRC32 of n bytes from address, read a chunk at a time. Returns 0, or -1 if not acknowledged */
+static int eeprom_crc(eeprom_dev *e, int address, int n, uint32_t *crc) {
+	uint8_t chunk[STREAM_BYTES];
+	int done, len;
+
+	*crc=0;
+	for ( done=0 ; done<n ; done += len ) {
+		len = n - done;
+		if ( len > (int) sizeof(chunk) )
+			len = sizeof(chunk);
+
+		if ( len != eeprom_read(e, address+done, chunk, len) )
+			return -1;
+		*crc = crc32_update(*crc,chunk,len);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	/* optarg */
+	int c;
+
+	/* program flow */
+	int dumpRead;
+	int dumpFormat;
+	int macRead;
+	int capacityPrint;
+	int startAddress;
+	int nBytes;
+	char *inFilename, *outFilename;
+	int stringMode;
+	int writeTimeout;	/* milliseconds to wait for write cycle */
+	int writeStats;
+	int diffWrite;
+	char *writeLogFilename;
+	int verify;
+	int maxTransfer;
+	char *cacheDir;
+	int compress;
+	int rawRead;
+
+	/* I2C stuff */
+	char i2cDevice[64];	/* I2C device name, or sim:filename */
+	int i2cAddress; 	/* chip address */
+
+	/* EEPROM stuff */
+	const eeprom_profile *profile;
+	eeprom_dev eeprom;
+	eeprom_cache cache;
+	uint8_t chunk[STREAM_BYTES];	/* receive buffer */
+	uint8_t page[EEPROM_MAX_PAGE_BYTES];
+	int opResult = 0;	/* for error checking of operations */
+	int i, n;
+
+
+	fprintf(stderr,"# %s\n",PROGRAM_BANNER);
+
+	/* defaults and command line arguments */
+	dumpRead=0;
+	dumpFormat=DUMP_BINARY;
+	macRead=0;
+	capacityPrint=0;
+	startAddress=0;
+	nBytes=-1;		/* rest of the EEPROM from startAddress */
+	inFilename=outFilename=NULL;
+	stringMode=0;
+	writeTimeout=EEPROM_ACK_DEADLINE_US/1000;
+	writeStats=0;
+	diffWrite=0;
+	writeLogFilename=NULL;
+	verify=1;
+	maxTransfer=0;		/* what the adapter reports */
+	cacheDir=NULL;		/* no cache */
+	compress=0;
+	rawRead=0;
+
+	profile=eeprom_profile_find(DEFAULT_PART);
+	strcpy(i2cDevice,"/dev/i2c-1"); /* Raspberry PI normal user accessible I2C bus */
+	i2cAddress=0x50; 		/* 0b1010(A2)(A1)(A0) */
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+		        {"read",           required_argument, 0, 'r' },
+		        {"write",          required_argument, 0, 'w' },
+		        {"dump",           no_argument,       0, 'd' },
+		        {"dump-format",    required_argument, 0, 'f' },
+		        {"read-mac",       no_argument,       0, 'm' },
+		        {"string",         no_argument,       0, 'b' },
+		        {"start-address",  required_argument, 0, 's' },
+		        {"n-bytes",        required_argument, 0, 'n' },
+		        {"i2c-device",     required_argument, 0, 'i' },
+		        {"i2c-address",    required_argument, 0, 'a' },
+		        {"device",         required_argument, 0, 'e' },
+		        {"list-devices",   no_argument,       0, 'l' },
+		        {"capacity",       no_argument,       0, 'c' },
+		        {"diff-write",     no_argument,       0, 'D' },
+		        {"write-timeout",  required_argument, 0, 't' },
+		        {"write-stats",    no_argument,       0, 'S' },
+		        {"write-log",      required_argument, 0, 'L' },
+		        {"no-verify",      no_argument,       0, 'V' },
+		        {"max-transfer",   required_argument, 0, 'x' },
+		        {"cache",          no_argument,       0, 'C' },
+		        {"compress",       no_argument,       0, 'z' },
+		        {"raw",            no_argument,       0, 'R' },
+		        {"cache-dir",      required_argument, 0, 'K' },
+		        {"help",           no_argument,       0, 'h' },
+		        {0,                0,                 0,  0 }
+		};
+
+		c = getopt_long(argc, argv, "", long_options, &option_index);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'h':
+				printf("switch           argument       description\n");
+				printf("========================================================================================================\n");
+				printf("--read           filename       read EEPROM and write to filename\n");
+				printf("--write          filename       write contents of filename to EEPROM\n");
+				printf("--dump                          dump EEPROM from start address for n-bytes (default all of it) to stdout\n");
+				printf("--dump-format    format         binary (default), hex like xxd, or json {\"start\":address,\"bytes\":[...]}\n");
+				printf("--read-mac                      read factory programmed MAC address from EEPROM (24AA02E48)\n");
+				printf("--string                        null terminate written content. Or read EEPROM until null encountered\n");
+				printf("--start-address  address        starting EEPROM address\n");
+				printf("--n-bytes        bytes          read/write n-bytes or up to n-bytes when in --string mode\n");
+				printf("--i2c-device     device         /dev/ entry for I2C-dev device, or sim:filename for a simulated EEPROM\n");
+				printf("--i2c-address    chip address   hex address of chip\n");
+				printf("--device         part           EEPROM part number (default %s). See --list-devices\n",DEFAULT_PART);
+				printf("--list-devices                  print known EEPROM parts and exit\n");
+				printf("--capacity                      print capacity of EEPROM to stdout and exit\n");
+				printf("--diff-write                    with --write, only write pages whose EEPROM contents differ from filename\n");
+				printf("--write-timeout  milliseconds   give up waiting for a page write cycle after milliseconds (default %d)\n",EEPROM_ACK_DEADLINE_US/1000);
+				printf("--write-stats                   print page write cycle times and throughput to stderr after writing\n");
+				printf("--write-log      filename       append address, bytes, write cycle microseconds and polls of each page to filename\n");
+				printf("--no-verify                     don't read back and check the CRC32 of what was written\n");
+				printf("--max-transfer   bytes          longest I2C read message, for adapters with a limit I2C_FUNCS doesn't show\n");
+				printf("--cache                         keep a copy of the EEPROM in %s and read from it while it is good\n",EEPROM_CACHE_DIR);
+				printf("--cache-dir      directory      --cache, with the copy in directory\n");
+				printf("--compress                      with --write, write filename as a compressed container. --read decompresses it\n");
+				printf("--raw                           with --read, don't decompress a compressed container\n");
+				printf("--help                          this message\n");
+				exit(0);
+			case 'c':
+				capacityPrint=1;
+				break;
+			case 'l':
+				eeprom_profile_list(stdout);
+				exit(0);
+			case 'e':
+				profile=eeprom_profile_find(optarg);
+				if ( NULL == profile ) {
+					fprintf(stderr,"# unknown EEPROM part %s. See --list-devices\n# Exiting...\n",optarg);
+					exit(1);
+				}
+				break;
+			case 'b':
+				stringMode=1;
+				break;
+			case 's':
+				startAddress=atoi(optarg);
+				break;
+			case 'n':
+				nBytes=atoi(optarg);
+				break;
+			case 'w':
+				inFilename=optarg;
+				break;
+			case 'r':
+				outFilename=optarg;
+				break;
+			case 'a':
+				sscanf(optarg,"%x",&i2cAddress);
+				break;
+			case 'i':
+				strncpy(i2cDevice,optarg,sizeof(i2cDevice)-1);
+				i2cDevice[sizeof(i2cDevice)-1]='\0';
+				break;
+			case 'd':
+				dumpRead=1;
+				break;
+			case 'f':
+				if ( 0 == strcmp(optarg,"binary") ) {
+					dumpFormat=DUMP_BINARY;
+				} else if ( 0 == strcmp(optarg,"hex") ) {
+					dumpFormat=DUMP_HEX;
+				} else if ( 0 == strcmp(optarg,"json") ) {
+					dumpFormat=DUMP_JSON;
+				} else {
+					fprintf(stderr,"# unknown dump format %s (binary, hex or json)\n# Exiting...\n",optarg);
+					exit(1);
+				}
+				break;
+			case 'm':
+				macRead=1;
+				break;
+			case 'D':
+				diffWrite=1;
+				break;
+			case 't':
+				writeTimeout=atoi(optarg);
+				if ( writeTimeout<1 || writeTimeout>1000 ) {
+					fprintf(stderr,"# write timeout out of range (1 to 1000 milliseconds)\n# Exiting...\n");
+					exit(1);
+				}
+				break;
+			case 'S':
+				writeStats=1;
+				break;
+			case 'L':
+				writeLogFilename=optarg;
+				break;
+			case 'V':
+				verify=0;
+				break;
+			case 'C':
+				cacheDir=EEPROM_CACHE_DIR;
+				break;
+			case 'K':
+				cacheDir=optarg;
+				break;
+			case 'z':
+				compress=1;
+				break;
+			case 'R':
+				rawRead=1;
+				break;
+			case 'x':
+				maxTransfer=atoi(optarg);
+				if ( maxTransfer<1 || maxTransfer>EEPROM_MAX_TRANSFER ) {
+					fprintf(stderr,"# max transfer out of range (1 to %d bytes)\n# Exiting...\n",EEPROM_MAX_TRANSFER);
+					exit(1);
+				}
+				break;
+			case '?':
+				exit(1);
+		}
+	}
+
+	/* ranges depend on the part, so they are checked once all arguments are in */
+	if ( capacityPrint ) {
+		printf("%d\n",profile->capacity);
+		exit(1);
+	}
+
+	if ( startAddress<0 || startAddress>=profile->capacity ) {
+		fprintf(stderr,"# start address out of range (0 to %d)\n# Exiting...\n",profile->capacity-1);
+		exit(1);
+	}
+	if ( -1 == nBytes ) {
+		nBytes=profile->capacity-startAddress;
+
+		/* generation header for the cache is in the last bytes */
+		if ( NULL != cacheDir && NULL != inFilename ) {
+			nBytes -= EEPROM_GEN_BYTES;
+		}
+	}
+	if ( nBytes<1 || nBytes>profile->capacity ) {
+		fprintf(stderr,"# number of bytes out of range (1 to %d)\n# Exiting...\n",profile->capacity);
+		exit(1);
+	}
+	if ( nBytes+startAddress>profile->capacity ) {
+		fprintf(stderr,"# nBytes+startAddress=%d which exceeds %d byte capacity of EEPROM.\n# Exiting...\n",nBytes+startAddress,profile->capacity);
+		exit(1);
+	}
+	if ( NULL != cacheDir && NULL != inFilename && nBytes+startAddress>profile->capacity-EEPROM_GEN_BYTES ) {
+		fprintf(stderr,"# with --cache the last %d bytes of the EEPROM hold the generation header and can't be written.\n# Exiting...\n",EEPROM_GEN_BYTES);
+		exit(1);
+	}
+	if ( macRead && profile->macAddress < 0 ) {
+		fprintf(stderr,"# %s has no MAC address\n# Exiting...\n",profile->name);
+		exit(1);
+	}
+
+	/* start-up verbosity */
+	fprintf(stderr,"# using I2C device %s\n",i2cDevice);
+	fprintf(stderr,"# using I2C device address of 0x%02X\n",i2cAddress);
+	fprintf(stderr,"# EEPROM %s: %d bytes, %d byte pages\n",profile->name,profile->capacity,profile->pageBytes);
+
+	if ( NULL != inFilename ) {
+		fprintf(stderr,"# input file: %s\n",inFilename);
+	}
+
+	fprintf(stderr,"# start address: %d\n",startAddress);
+	fprintf(stderr,"# bytes to read / write: %d\n",nBytes);
+
+
+	/* Open I2C bus */
+	if ( 0 != eeprom_open(&eeprom, i2cDevice, i2cAddress, profile, writeTimeout*1000) ) {
+		fprintf(stderr,"# Exiting...\n");
+		exit(1);
+	}
+
+	if ( maxTransfer > 0 ) {
+		eeprom.maxTransfer=maxTransfer;
+	}
+	fprintf(stderr,"# reading up to %d bytes per I2C message\n",eeprom.maxTransfer);
+
+	/* cache, checked against the generation header. Writing through the cache gives the part one */
+	opResult = eeprom_cache_open(&cache, &eeprom, cacheDir, i2cDevice, i2cAddress);
+	if ( 0 == opResult && NULL != inFilename && EEPROM_GEN_NONE == eeprom.genState ) {
+		fprintf(stderr,"# writing generation header at address %d\n",eeprom_gen_address(&eeprom));
+		if ( 0 != eeprom_gen_create(&eeprom) ) {
+			fprintf(stderr,"# No ACK! Exiting...\n");
+			exit(2);
+		}
+		opResult = eeprom_cache_open(&cache, &eeprom, cacheDir, i2cDevice, i2cAddress);
+	}
+	if ( opResult < 0 ) {
+		fprintf(stderr,"# No ACK! Exiting...\n");
+		exit(2);
+	}
+
+	/*
+	without the cache, a write that stops short of the generation header still keeps it, so
+	cached copies elsewhere see the write. A write that reaches it replaces it with data
+	*/
+	if ( NULL == cacheDir && NULL != inFilename && startAddress+nBytes <= eeprom_gen_address(&eeprom) && eeprom_gen_read(&eeprom) < 0 ) {
+		fprintf(stderr,"# No ACK! Exiting...\n");
+		exit(2);
+	}
+
+
+	/* write operation if needed */
+	if ( NULL != inFilename ) {
+		fprintf(stderr,"# input file: %s\n",inFilename);
+		if ( stringMode ) {
+			fprintf(stderr,"# write string mode (stopping at first null)\n");
+		} else {
+		 	fprintf(stderr,"# write binary mode\n");
+		}
+
+		/* open input file */
+		FILE *fp=fopen(inFilename,"r");
+		if ( NULL == fp ) {
+			fprintf(stderr,"# Error opening input file in read mode.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+
+		/* the container is binary. --string only picks how much input goes into it */
+		int containerBytes=0;
+		if ( compress ) {
+			fp = compress_input(fp, stringMode, nBytes, &containerBytes);
+			stringMode=0;
+		}
+
+		/*
+		diff write: compare each page with what the EEPROM holds, read ahead sequentially a chunk
+		at a time. Pages that already match are not written. A regular file tells us where the
+		input ends, so we don't read ahead past it
+		*/
+		int windowStart=0, windowBytes=0;
+		int diffEnd=startAddress+nBytes;
+		int pagesSkipped=0;
+		struct stat st;
+		if ( diffWrite && 0 == fstat(fileno(fp),&st) && S_ISREG(st.st_mode) && startAddress+st.st_size+stringMode < diffEnd ) {
+			diffEnd = startAddress+st.st_size+stringMode;
+		}
+		if ( compress ) {
+			diffEnd = startAddress+containerBytes;
+		}
+
+		if ( NULL != writeLogFilename ) {
+			eeprom.ack.log=fopen(writeLogFilename,"a");
+			if ( NULL == eeprom.ack.log ) {
+				fprintf(stderr,"# Error opening write log file in append mode.\n# %s\n# Exiting...\n",strerror(errno));
+				exit(1);
+			}
+		}
+
+		int done=0;
+		int bytesRead=0;
+		int truncated=0;
+		uint32_t crc=0;		/* of what should end up in the EEPROM */
+		int held=-1;		/* last byte, kept out of crc until we know --string mode won't replace it with the null */
+		uint8_t h;
+		/*
+		write can start anywhere, but we must write <= page length. So with 32 byte pages, if we want to
+		start at address 30, for example, then we can only write address 30 and address 31 in this page
+
+		Examples:
+		address	bytesWeCanWrite
+		0	32 (0, 1, 2, ..., 31)
+		30	2  (30, 31)
+		31	1  (31)
+		32	32 (0, 1, 2, ..., 31)
+
+		bytesWeCanWrite = pageBytes-(address%pageBytes)
+
+		*/
+		int address=startAddress;
+		/* EEPROM write is in page or less chunks. After writing, we must poll for ack to know that write is done */
+		do {
+			int bytesWeCanWrite = eeprom_page_room(&eeprom,address);
+			int want = bytesWeCanWrite;
+
+			if ( want > nBytes-bytesRead )
+				want = nBytes-bytesRead;
+
+			/* read up to bytesWeCanWrite bytes */
+			n = fread(page,1,want,fp);
+			if ( n < want ) {
+				done=1;
+			}
+			if ( stringMode ) {
+				uint8_t *z = memchr(page,'\0',n);
+				if ( NULL != z ) {
+					n = z-page;
+					done=1;
+				}
+			}
+			bytesRead += n;
+
+			if ( bytesRead >= nBytes ) {
+				fprintf(stderr,"# WARNING: truncating input\n");
+				truncated=1;
+				done=1;
+			}
+
+			if ( n > 0 ) {
+				if ( held >= 0 ) {
+					h = held;
+					crc = crc32_update(crc,&h,1);
+				}
+				crc = crc32_update(crc,page,n-1);
+				held = page[n-1];
+			}
+
+			/* read ahead when this page isn't in the window */
+			if ( diffWrite && n > 0 && ( address < windowStart || address+n > windowStart+windowBytes ) ) {
+				windowStart = address;
+				windowBytes = diffEnd-address;
+				if ( windowBytes > (int) sizeof(chunk) )
+					windowBytes = sizeof(chunk);
+				if ( windowBytes < n )
+					windowBytes = n;
+
+				if ( windowBytes != eeprom_cache_read(&cache, windowStart, chunk, windowBytes) ) {
+					fprintf(stderr,"# No ACK! Exiting...\n");
+					exit(2);
+				}
+			}
+
+			if ( diffWrite && 0 == memcmp(page, chunk+(address-windowStart), n) ) {
+				/* EEPROM already holds this page */
+				if ( n > 0 )
+					pagesSkipped++;
+				eeprom_cache_store(&cache, address, page, n);
+			} else {
+				/* write and wait out the write cycle so we can write the next page */
+				opResult = eeprom_write_page(&eeprom, address, page, n);
+				if ( -1 == opResult ) {
+					fprintf(stderr,"# No ACK! Exiting...\n");
+					exit(2);
+				}
+				if ( -2 == opResult ) {
+					fprintf(stderr,"# Timeout while polling for write acknowledgement! Exiting...\n");
+					exit(2);
+				}
+				if ( EEPROM_GEN_RESERVED == opResult ) {
+					fprintf(stderr,"# Write would overwrite the generation header at %d! Exiting...\n",eeprom_gen_address(&eeprom));
+					exit(1);
+				}
+				eeprom_cache_store(&cache, address, page, n);
+			}
+
+			address += bytesWeCanWrite;
+		} while ( ! done );
+
+		/*
+		if we need to null terminate, we now do that as a separate write
+
+		if we have room left before hitting nBytes limit, we put '\0' after data.
+		if we are out of room, then we replace the last data byte with a '\0'
+		*/
+		if ( held >= 0 && ! (stringMode && truncated) ) {
+			h = held;
+			crc = crc32_update(crc,&h,1);
+		}
+
+		if ( stringMode ) {
+			int nullAddress;
+
+
+			if ( truncated ) {
+				/* replace last byte */
+				nullAddress=startAddress+bytesRead-1;
+				fprintf(stderr,"# WARNING: replacing last byte with null at address %d due to --string mode.\n",nullAddress);
+			} else {
+				/* put after last byte */
+				nullAddress=startAddress+bytesRead;
+				bytesRead++;
+				fprintf(stderr,"# adding null after last byte. null at address %d due to --string mode.\n",nullAddress);
+			}
+
+			/* null byte */
+			page[0] = '\0';
+			crc = crc32_update(crc,page,1);
+
+			if ( diffWrite && 1 == eeprom_cache_read(&cache, nullAddress, chunk, 1) && '\0' == chunk[0] ) {
+				/* already null */
+				pagesSkipped++;
+			} else {
+				/* write and wait out the write cycle */
+				opResult = eeprom_write_page(&eeprom, nullAddress, page, 1);
+				if ( -1 == opResult ) {
+					fprintf(stderr,"# No ACK! Exiting...\n");
+					exit(2);
+				}
+				if ( -2 == opResult ) {
+					fprintf(stderr,"# Timeout while polling for write acknowledgement! Exiting...\n");
+					exit(2);
+				}
+				if ( EEPROM_GEN_RESERVED == opResult ) {
+					fprintf(stderr,"# Write would overwrite the generation header at %d! Exiting...\n",eeprom_gen_address(&eeprom));
+					exit(1);
+				}
+				eeprom_cache_store(&cache, nullAddress, page, 1);
+			}
+		}
+
+		/* close output file */
+		if ( 0 != fclose(fp) ) {
+			fprintf(stderr,"# Error closing input file.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+
+		fprintf(stderr,"# wrote %d bytes to EEPROM\n",bytesRead);
+
+		if ( diffWrite ) {
+			fprintf(stderr,"# diff write: %lu pages written, %d pages already matched\n",eeprom.ack.pages,pagesSkipped);
+		}
+		if ( writeStats ) {
+			eeprom_ack_report(&eeprom.ack,stderr);
+		}
+		if ( NULL != eeprom.ack.log ) {
+			fclose(eeprom.ack.log);
+		}
+
+		/* read it back */
+		if ( verify ) {
+			uint32_t eepromCrc;
+
+			if ( 0 != eeprom_crc(&eeprom, startAddress, bytesRead, &eepromCrc) ) {
+				fprintf(stderr,"# No ACK! Exiting...\n");
+				exit(2);
+			}
+			if ( eepromCrc != crc ) {
+				fprintf(stderr,"# Verify failed! EEPROM CRC32 0x%08x, expected 0x%08x. Exiting...\n",eepromCrc,crc);
+				exit(3);
+			}
+			fprintf(stderr,"# verified %d bytes, CRC32 0x%08x\n",bytesRead,crc);
+		}
+
+		/* new generation, and the cache is good again */
+		if ( 0 != eeprom_gen_end(&eeprom) ) {
+			fprintf(stderr,"# No ACK! Exiting...\n");
+			exit(2);
+		}
+		eeprom_cache_commit(&cache);
+	}
+
+
+	/* do any requested reading after sets */
+	if ( macRead ) {
+		/* read 6 bytes */
+		memset(chunk, 0, 6);
+		if ( 6 != eeprom_read(&eeprom, profile->macAddress, chunk, 6) ) {
+			fprintf(stderr,"# No ACK! Exiting...\n");
+			exit(2);
+		}
+
+		fprintf(stderr,"# MAC address\n");
+		printf("%02x:%02x:%02x:%02x:%02x:%02x\n",chunk[0],chunk[1],chunk[2],chunk[3],chunk[4],chunk[5]);
+	} else if ( dumpRead ) {
+		fprintf(stderr,"# Dump %d bytes from EEPROM address %d\n",nBytes,startAddress);
+
+		if ( DUMP_JSON == dumpFormat ) {
+			printf("{\"start\":%d,\"bytes\":[",startAddress);
+		}
+
+		/*
+		just the range, in sequential reads of a chunk. The chunk is a multiple of 16, so hex
+		lines carry on across chunks
+		*/
+		for ( i=0 ; i<nBytes ; i += n ) {
+			n = nBytes - i;
+			if ( n > (int) sizeof(chunk) )
+				n = sizeof(chunk);
+
+			if ( n != eeprom_cache_read(&cache, startAddress+i, chunk, n) ) {
+				fprintf(stderr,"# No ACK! Exiting...\n");
+				exit(2);
+			}
+
+			switch ( dumpFormat ) {
+				case DUMP_HEX:
+					dump_hex(stdout,startAddress+i,chunk,n);
+					break;
+				case DUMP_JSON:
+					dump_json(stdout,chunk,n,0 == i);
+					break;
+				default:
+					fwrite(chunk,1,n,stdout);
+			}
+		}
+
+		if ( DUMP_JSON == dumpFormat ) {
+			printf("]}\n");
+		}
+	} else if ( NULL != outFilename ) {
+		fprintf(stderr,"# output file: %s\n",outFilename);
+		if ( stringMode ) {
+			fprintf(stderr,"# read string mode (stopping before first null)\n");
+		} else {
+		 	fprintf(stderr,"# read binary mode\n");
+		}
+
+		/* open output file */
+		FILE *fp=fopen(outFilename,"w");
+		if ( NULL == fp ) {
+			fprintf(stderr,"# Error opening output file in write mode.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+
+		uint32_t crc=0;
+		int bytesRead=0, written=0, done=0;
+
+		/*
+		compressed container is read whole and decompressed, unless --raw. Anything that isn't
+		a container that checks out is read raw
+		*/
+		int codec, originalBytes, payloadBytes;
+		uint32_t originalCrc;
+		int container=0, damaged=0;
+		if ( ! rawRead && nBytes >= CONTAINER_BYTES ) {
+			if ( CONTAINER_BYTES != eeprom_cache_read(&cache, startAddress, chunk, CONTAINER_BYTES) ) {
+				fprintf(stderr,"# No ACK! Exiting...\n");
+				exit(2);
+			}
+			container = container_parse(chunk, nBytes, &codec, &originalBytes, &payloadBytes, &originalCrc);
+			if ( ! container && 'A' == chunk[0] && 'Z' == chunk[1] ) {
+				fprintf(stderr,"# WARNING: \"AZ\" at address %d isn't a valid container header. Reading raw.\n",startAddress);
+			}
+		}
+		if ( container ) {
+			uint8_t *payload = malloc(payloadBytes+1);
+			uint8_t *original = malloc(originalBytes+1);
+
+			if ( NULL == payload || NULL == original ) {
+				fprintf(stderr,"# Error allocating decompression buffers\n# Exiting...\n");
+				exit(1);
+			}
+			if ( payloadBytes != eeprom_cache_read(&cache, startAddress+CONTAINER_BYTES, payload, payloadBytes) ) {
+				fprintf(stderr,"# No ACK! Exiting...\n");
+				exit(2);
+			}
+			fprintf(stderr,"# compressed container: %d bytes (%s) to %d\n",CONTAINER_BYTES+payloadBytes,CODEC_LZ == codec ? "lz" : "stored",originalBytes);
+
+			if ( CODEC_STORED == codec ) {
+				memcpy(original,payload,payloadBytes);
+			} else if ( originalBytes != lz_decompress(payload, payloadBytes, original, originalBytes) ) {
+				fprintf(stderr,"# WARNING: container doesn't decompress. Reading raw.\n");
+				damaged=1;
+			}
+			if ( ! damaged && (crc = crc32_update(0,original,originalBytes)) != originalCrc ) {
+				fprintf(stderr,"# WARNING: container CRC32 0x%08x, expected 0x%08x. Reading raw.\n",crc,originalCrc);
+				damaged=1;
+			}
+
+			if ( ! damaged ) {
+				n = originalBytes;
+				if ( stringMode ) {
+					uint8_t *z = memchr(original,'\0',n);
+					if ( NULL != z ) {
+						n = z-original;
+						crc = crc32_update(0,original,n);
+					}
+				}
+				if ( n != (int) fwrite(original,1,n,fp) ) {
+					fprintf(stderr,"# Error writing EEPROM data to output file. %d bytes written.\n# Exiting...\n",written);
+					exit(1);
+				}
+				bytesRead = CONTAINER_BYTES+payloadBytes;
+				written = n;
+				done = 1;
+			} else {
+				crc = 0;
+			}
+
+			free(payload);
+			free(original);
+		}
+
+		/* read from start address a chunk at a time, stopping at the null in --string mode */
+		while ( bytesRead < nBytes && ! done ) {
+			n = nBytes - bytesRead;
+			if ( n > (int) sizeof(chunk) )
+				n = sizeof(chunk);
+
+			if ( n != eeprom_cache_read(&cache, startAddress+bytesRead, chunk, n) ) {
+				fprintf(stderr,"# No ACK! Exiting...\n");
+				exit(2);
+			}
+			bytesRead += n;
+
+			if ( stringMode ) {
+				uint8_t *z = memchr(chunk,'\0',n);
+				if ( NULL != z ) {
+					n = z-chunk;
+					done=1;
+				}
+			}
+
+			/* write to file */
+			crc = crc32_update(crc,chunk,n);
+			if ( n != (int) fwrite(chunk,1,n,fp) ) {
+				fprintf(stderr,"# Error writing EEPROM data to output file. %d bytes written.\n# Exiting...\n",written);
+				exit(1);
+			}
+			written += n;
+		}
+		fprintf(stderr,"# %d bytes read\n",bytesRead);
+		fprintf(stderr,"# %d bytes written, CRC32 0x%08x\n",written,crc);
+
+
+		/* close output file */
+		if ( 0 != fclose(fp) ) {
+			fprintf(stderr,"# Error closing output file.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+
+		/* raw bytes are out, but the container they hold is bad */
+		if ( damaged ) {
+			fprintf(stderr,"# Verify failed! Container is damaged. Exiting...\n");
+			exit(3);
+		}
+	}
+
+	if ( cache.readBytes > 0 && cache.enabled ) {
+		fprintf(stderr,"# cache: %lu bytes read, %lu from EEPROM\n",cache.readBytes,cache.busBytes);
+	}
+	eeprom_cache_close(&cache);
+
+	if ( -1 == eeprom_close(&eeprom) ) {
+		fprintf(stderr,"# Error closing I2C device.\n# %s\n# Exiting...\n",strerror(errno));
+		exit(1);
+	}
+
+	fprintf(stderr,"# Done...\n");
+
+	exit(0);
+}
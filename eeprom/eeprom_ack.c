@@ -0,0 +1,136 @@
+/*
+Page writes with adaptive acknowledge polling. See eeprom_ack.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "eeprom_ack.h"
+
+static void sleep_us(uint64_t us) {
+	struct timespec t;
+
+	t.tv_sec = us / 1000000;
+	t.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&t,NULL);
+}
+
+void eeprom_ack_init(eeprom_ack *a, int tWR_us, int deadline_us) {
+	memset(a,0,sizeof(eeprom_ack));
+
+	a->deadline_us=deadline_us;
+	a->pollMin_us=EEPROM_ACK_POLL_MIN_US;
+	a->pollMax_us=EEPROM_ACK_POLL_MAX_US;
+	a->expected_us=tWR_us;
+	a->hist.name="write_cycle";
+	a->hist.min_ns=UINT64_MAX;
+}
+
+void eeprom_ack_start(eeprom_ack *a, int address, int bytes) {
+	/* write cycle starts at the stop condition, which is when the write returned */
+	a->start_ns = latency_now_ns();
+	if ( 0 == a->pages )
+		a->first_ns = a->start_ns;
+
+	/* first poll after most of the expected write cycle */
+	a->next_ns = a->start_ns + (uint64_t) (a->expected_us * EEPROM_ACK_SLEEP * 1000.0);
+	a->interval = a->pollMin_us;
+	a->cyclePolls = 0;
+	a->address = address;
+	a->cycleBytes = bytes;
+}
+
+int eeprom_ack_check(eeprom_ack *a, eeprom_ack_poll poll, void *ctx) {
+	uint64_t now, elapsed_us;
+
+	if ( latency_now_ns() < a->next_ns )
+		return EEPROM_ACK_BUSY;
+
+	/* device acknowledges its address again when the write cycle is done */
+	a->cyclePolls++;
+	if ( 0 != poll(ctx) ) {
+		now = latency_now_ns();
+		if ( (now - a->start_ns) / 1000 >= (uint64_t) a->deadline_us ) {
+			a->polls += a->cyclePolls;
+			a->timeouts++;
+			return -2;
+		}
+
+		a->next_ns = now + (uint64_t) a->interval * 1000;
+		a->interval *= 2;
+		if ( a->interval > a->pollMax_us )
+			a->interval = a->pollMax_us;
+		return EEPROM_ACK_BUSY;
+	}
+
+	now = latency_now_ns();
+	elapsed_us = (now - a->start_ns) / 1000;
+
+	/*
+	answered on the first poll means we slept too long and elapsed is only our sleep. Try
+	polling sooner. Otherwise move towards the measured time
+	*/
+	if ( 1 == a->cyclePolls ) {
+		a->expected_us *= 0.95;
+	} else {
+		a->expected_us += (elapsed_us - a->expected_us) / 8.0;
+	}
+	if ( a->expected_us < a->pollMin_us )
+		a->expected_us = a->pollMin_us;
+	if ( a->expected_us > a->deadline_us )
+		a->expected_us = a->deadline_us;
+
+	latency_record(&a->hist, now - a->start_ns);
+	a->pages++;
+	a->bytes += a->cycleBytes;
+	a->polls += a->cyclePolls;
+	a->last_ns = now;
+
+	if ( NULL != a->log ) {
+		fprintf(a->log,"%d %d %llu %d\n",a->address,a->cycleBytes,(unsigned long long) elapsed_us,a->cyclePolls);
+	}
+
+	return (int) elapsed_us;
+}
+
+int eeprom_ack_wait(eeprom_ack *a, eeprom_ack_poll poll, void *ctx, int address, int bytes) {
+	uint64_t now;
+	int rc;
+
+	eeprom_ack_start(a,address,bytes);
+
+	for ( ; ; ) {
+		now = latency_now_ns();
+		if ( a->next_ns > now )
+			sleep_us((a->next_ns - now) / 1000);
+
+		rc = eeprom_ack_check(a,poll,ctx);
+		if ( EEPROM_ACK_BUSY != rc )
+			return rc;
+	}
+}
+
+void eeprom_ack_report(const eeprom_ack *a, FILE *fp) {
+	double seconds;
+
+	if ( 0 == a->pages ) {
+		fprintf(fp,"# no pages written\n");
+		return;
+	}
+
+	seconds = (a->last_ns - a->first_ns) / 1e9;
+
+	fprintf(fp,"# %lu pages, %lu bytes written in %0.3f seconds (%0.0f bytes/second)\n",
+		a->pages,a->bytes,seconds,seconds > 0.0 ? a->bytes / seconds : 0.0);
+	fprintf(fp,"# write cycle microseconds min %llu p50 %llu p90 %llu p99 %llu max %llu. Learned %0.0f\n",
+		(unsigned long long) a->hist.min_ns / 1000,
+		(unsigned long long) latency_quantile(&a->hist,0.5) / 1000,
+		(unsigned long long) latency_quantile(&a->hist,0.9) / 1000,
+		(unsigned long long) latency_quantile(&a->hist,0.99) / 1000,
+		(unsigned long long) a->hist.max_ns / 1000,
+		a->expected_us);
+	fprintf(fp,"# %0.2f acknowledge polls per page, %lu timeouts\n",(double) a->polls / a->pages,a->timeouts);
+}
@@ -0,0 +1,74 @@
+#ifndef APRSi2C_EEPROM_EEPROM_ACK_H
+#define APRSi2C_EEPROM_EEPROM_ACK_H
+/*
+Waiting out EEPROM page write cycles with adaptive acknowledge polling.
+
+After a page write the EEPROM ignores its address until the internal write cycle (tWR,
+5 ms maximum for most of the 24 series) is done. Rather than spinning on zero length writes,
+eeprom_ack_wait() sleeps through most of the write cycle time it has learned for the device,
+then polls with a backoff that doubles from pollMin_us to pollMax_us until the device
+acknowledges or deadline_us has passed. Every page's write cycle time is recorded.
+
+eeprom_ack_start() and eeprom_ack_check() are the same wait split up, so a caller with several
+devices can write to the others while one is in its write cycle.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include "latency.h"
+
+#define EEPROM_ACK_TWR_US      5000	/* datasheet maximum write cycle time. Starting estimate */
+#define EEPROM_ACK_DEADLINE_US 25000	/* default time to wait for acknowledge */
+#define EEPROM_ACK_POLL_MIN_US 50
+#define EEPROM_ACK_POLL_MAX_US 800
+#define EEPROM_ACK_SLEEP       0.9	/* fraction of expected write cycle to sleep before polling */
+#define EEPROM_ACK_BUSY        -3	/* eeprom_ack_check(): write cycle not done yet */
+
+typedef struct {
+	int deadline_us;
+	int pollMin_us;
+	int pollMax_us;
+	double expected_us;		/* learned write cycle time */
+	FILE *log;			/* if not NULL, one line per page: address bytes microseconds polls */
+
+	/* statistics */
+	unsigned long pages;
+	unsigned long bytes;
+	unsigned long polls;		/* acknowledge polls, including the one that was answered */
+	unsigned long timeouts;
+	uint64_t first_ns;		/* start of first write cycle and end of last */
+	uint64_t last_ns;
+	latency_hist hist;		/* write cycle time of each page */
+
+	/* write cycle in progress */
+	uint64_t start_ns;
+	uint64_t next_ns;		/* time of next poll */
+	int interval;
+	int cyclePolls;
+	int address;
+	int cycleBytes;
+} eeprom_ack;
+
+/* zero length write to the device. Returns 0 if it was acknowledged */
+typedef int (*eeprom_ack_poll)(void *ctx);
+
+/* tWR_us is the starting estimate of the write cycle time */
+void eeprom_ack_init(eeprom_ack *a, int tWR_us, int deadline_us);
+
+/*
+call right after writing bytes at address. Returns write cycle time in microseconds, or -2 if
+the device didn't acknowledge by the deadline. address and bytes are for statistics and log
+*/
+int eeprom_ack_wait(eeprom_ack *a, eeprom_ack_poll poll, void *ctx, int address, int bytes);
+
+/* call right after writing bytes at address */
+void eeprom_ack_start(eeprom_ack *a, int address, int bytes);
+
+/*
+poll if it is time to. Returns write cycle time in microseconds, EEPROM_ACK_BUSY if the write
+cycle isn't done (call again at next_ns), or -2 if the deadline has passed
+*/
+int eeprom_ack_check(eeprom_ack *a, eeprom_ack_poll poll, void *ctx);
+
+/* page count, write cycle quantiles, polls per page and throughput as # comments */
+void eeprom_ack_report(const eeprom_ack *a, FILE *fp);
+#endif
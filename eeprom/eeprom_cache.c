@@ -0,0 +1,178 @@
+/*
+Host side copy of EEPROM contents, checked against the generation header of the part. See
+eeprom_cache.h
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "eeprom_cache.h"
+
+static int have_block(const eeprom_cache *c, int block) {
+	return c->have[block/8] & (1 << (block%8));
+}
+
+static void set_block(eeprom_cache *c, int block) {
+	c->have[block/8] |= 1 << (block%8);
+}
+
+/* empty file for the part */
+static void cache_reset(eeprom_cache *c) {
+	memset(c->map,0,c->mapBytes);
+	c->file->magic = EEPROM_CACHE_MAGIC;
+	c->file->capacity = c->e->profile->capacity;
+	c->file->blockBytes = EEPROM_CACHE_BLOCK_BYTES;
+}
+
+int eeprom_cache_open(eeprom_cache *c, eeprom_dev *e, const char *dir, const char *i2cDevice, int i2cAddress) {
+	char filename[256];
+	const char *bus;
+	int blocks, rc;
+
+	memset(c,0,sizeof(eeprom_cache));
+	c->e=e;
+	c->fd=-1;
+
+	if ( NULL == dir )
+		return 0;
+
+	rc = eeprom_gen_read(e);
+	if ( rc < 0 )
+		return -1;
+	if ( 0 == rc ) {
+		fprintf(stderr,"# EEPROM has no generation header, not using cache\n");
+		return 0;
+	}
+	if ( e->generation & 1 ) {
+		fprintf(stderr,"# EEPROM generation %u is from a write that didn't finish, not using cache\n",e->generation);
+		return 0;
+	}
+
+	/* key: bus, chip address, part */
+	bus = strrchr(i2cDevice,'/');
+	bus = ( NULL == bus ) ? i2cDevice : bus+1;
+	if ( 0 == strncmp(bus,EEPROM_SIM_PREFIX,strlen(EEPROM_SIM_PREFIX)) )
+		bus += strlen(EEPROM_SIM_PREFIX);
+	snprintf(filename,sizeof(filename),"%s/eeprom-%s-%02x-%s.cache",dir,bus,i2cAddress,e->profile->name);
+
+	blocks = (e->profile->capacity + EEPROM_CACHE_BLOCK_BYTES - 1) / EEPROM_CACHE_BLOCK_BYTES;
+	c->mapBytes = sizeof(eeprom_cache_file) + (blocks+7)/8 + e->profile->capacity;
+
+	c->fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if ( c->fd < 0 ) {
+		fprintf(stderr,"# Error opening cache file %s, not using cache.\n# %s\n",filename,strerror(errno));
+		return 0;
+	}
+	if ( 0 != flock(c->fd, LOCK_EX) || 0 != ftruncate(c->fd, c->mapBytes) ) {
+		fprintf(stderr,"# Error sizing cache file %s, not using cache.\n# %s\n",filename,strerror(errno));
+		close(c->fd);
+		c->fd=-1;
+		return 0;
+	}
+
+	c->map = mmap(NULL, c->mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+	if ( MAP_FAILED == c->map ) {
+		fprintf(stderr,"# Error mapping cache file %s, not using cache.\n# %s\n",filename,strerror(errno));
+		close(c->fd);
+		c->fd=-1;
+		return 0;
+	}
+	c->file = (eeprom_cache_file *) c->map;
+	c->have = c->map + sizeof(eeprom_cache_file);
+	c->data = c->have + (blocks+7)/8;
+
+	if ( EEPROM_CACHE_MAGIC != c->file->magic || (uint32_t) e->profile->capacity != c->file->capacity ||
+	     EEPROM_CACHE_BLOCK_BYTES != c->file->blockBytes || 0 != memcmp(c->file->gen,e->gen,EEPROM_GEN_BYTES) ) {
+		cache_reset(c);
+		memcpy(c->file->gen,e->gen,EEPROM_GEN_BYTES);
+	}
+
+	fprintf(stderr,"# cache file %s, generation %u\n",filename,e->generation);
+	c->enabled=1;
+	return 1;
+}
+
+void eeprom_cache_close(eeprom_cache *c) {
+	if ( NULL != c->map ) {
+		munmap(c->map,c->mapBytes);
+		c->map=NULL;
+	}
+	if ( c->fd >= 0 ) {
+		close(c->fd);
+		c->fd=-1;
+	}
+	c->enabled=0;
+}
+
+int eeprom_cache_read(eeprom_cache *c, int address, uint8_t *buf, int n) {
+	int block, last, run, start, end;
+
+	if ( ! c->enabled ) {
+		c->readBytes += n;
+		c->busBytes += n;
+		return eeprom_read(c->e, address, buf, n);
+	}
+	if ( n <= 0 )
+		return 0;
+
+	/* fetch runs of missing blocks with one read each */
+	block = address / EEPROM_CACHE_BLOCK_BYTES;
+	last = (address + n - 1) / EEPROM_CACHE_BLOCK_BYTES;
+	while ( block <= last ) {
+		if ( have_block(c,block) ) {
+			block++;
+			continue;
+		}
+
+		for ( run=block ; run<=last && ! have_block(c,run) ; run++ )
+			;
+
+		start = block * EEPROM_CACHE_BLOCK_BYTES;
+		end = run * EEPROM_CACHE_BLOCK_BYTES;
+		if ( end > c->e->profile->capacity )
+			end = c->e->profile->capacity;
+
+		if ( end-start != eeprom_read(c->e, start, c->data+start, end-start) )
+			return -1;
+		c->busBytes += end-start;
+
+		for ( ; block<run ; block++ )
+			set_block(c,block);
+	}
+
+	memcpy(buf,c->data+address,n);
+	c->readBytes += n;
+
+	return n;
+}
+
+void eeprom_cache_store(eeprom_cache *c, int address, const uint8_t *buf, int n) {
+	int block, end;
+
+	if ( ! c->enabled || n <= 0 )
+		return;
+
+	/* file doesn't match any header until eeprom_cache_commit() */
+	memset(c->file->gen,0,EEPROM_GEN_BYTES);
+
+	memcpy(c->data+address,buf,n);
+
+	/* only blocks written whole become known. Others we had are still right */
+	end = address + n;
+	for ( block=(address + EEPROM_CACHE_BLOCK_BYTES - 1) / EEPROM_CACHE_BLOCK_BYTES ; (block+1)*EEPROM_CACHE_BLOCK_BYTES <= end ; block++ )
+		set_block(c,block);
+}
+
+void eeprom_cache_commit(eeprom_cache *c) {
+	if ( ! c->enabled )
+		return;
+
+	/* header pages were written around eeprom_cache_store() */
+	memcpy(c->data+eeprom_gen_address(c->e),c->e->gen,EEPROM_GEN_BYTES);
+	memcpy(c->file->gen,c->e->gen,EEPROM_GEN_BYTES);
+}
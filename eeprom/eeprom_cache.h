@@ -0,0 +1,60 @@
+#ifndef APRSi2C_EEPROM_EEPROM_CACHE_H
+#define APRSi2C_EEPROM_EEPROM_CACHE_H
+/*
+Host side copy of EEPROM contents, in a file per bus, chip address and part.
+
+The file holds the generation header (see eeprom_dev.h) the copy was taken under, a bit per
+block for the blocks it has, and the contents. eeprom_cache_open() reads just the header from
+the part. If it matches the file, reads of blocks the file has are served from it and only
+the missing blocks go on the bus. If it doesn't, the file is emptied. A part without a header,
+or with an odd generation from a write that didn't finish, isn't cached.
+
+Writes through the tool copy their pages into the file with eeprom_cache_store(), and
+eeprom_cache_commit() takes the new header once eeprom_gen_end() has written it.
+
+The file is locked for as long as it is open, so tools sharing it take turns.
+*/
+#include <stdint.h>
+#include "eeprom_dev.h"
+
+#define EEPROM_CACHE_DIR         "/var/cache/aprsI2C"
+#define EEPROM_CACHE_MAGIC       0x31434541	/* "AEC1" */
+#define EEPROM_CACHE_BLOCK_BYTES 64
+
+typedef struct {
+	uint32_t magic;
+	uint32_t capacity;
+	uint32_t blockBytes;
+	uint8_t gen[EEPROM_GEN_BYTES];	/* contents are from the part with this header. Zero if none */
+} eeprom_cache_file;
+
+typedef struct {
+	eeprom_dev *e;
+	int enabled;		/* reads are served from the file */
+	int fd;
+	uint8_t *map;
+	size_t mapBytes;
+	eeprom_cache_file *file;
+	uint8_t *have;		/* bit per block */
+	uint8_t *data;
+
+	/* statistics */
+	unsigned long readBytes;	/* asked for */
+	unsigned long busBytes;		/* read from the part */
+} eeprom_cache;
+
+/*
+open or create the cache file for e in directory dir and check it against the generation
+header of the part. If dir is NULL the cache is off and reads go to the part.
+Returns 1 if the cache is on, 0 if it is off, or -1 if the header can't be read
+*/
+int eeprom_cache_open(eeprom_cache *c, eeprom_dev *e, const char *dir, const char *i2cDevice, int i2cAddress);
+void eeprom_cache_close(eeprom_cache *c);
+
+/* like eeprom_read(), from the file where it can */
+int eeprom_cache_read(eeprom_cache *c, int address, uint8_t *buf, int n);
+/* n bytes at address were written to the part */
+void eeprom_cache_store(eeprom_cache *c, int address, const uint8_t *buf, int n);
+/* after eeprom_gen_end(), the file matches the part again */
+void eeprom_cache_commit(eeprom_cache *c);
+#endif
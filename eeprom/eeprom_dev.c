@@ -0,0 +1,452 @@
+/*
+24 series I2C EEPROM access driven by device profiles. See eeprom_dev.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <time.h>
+#include "eeprom_dev.h"
+#include "crc32.h"
+
+static const eeprom_profile profiles[] = {
+	/* name        key      capacity page addr block shift   tWR   mac */
+	{ "24C01",     "01",         128,   8,   1,    0,    0, 5000,   -1 },
+	{ "24C02",     "02",         256,   8,   1,    0,    0, 5000,   -1 },
+	{ "24AA02E48", "02E48",      128,   8,   1,    0,    0, 5000, 0xfa },	/* upper 128 bytes are write protected */
+	{ "24C04",     "04",         512,  16,   1,    1,    0, 5000,   -1 },
+	{ "24C08",     "08",        1024,  16,   1,    2,    0, 5000,   -1 },
+	{ "24C16",     "16",        2048,  16,   1,    3,    0, 5000,   -1 },
+	{ "24C32",     "32",        4096,  32,   2,    0,    0, 5000,   -1 },
+	{ "24C64",     "64",        8192,  32,   2,    0,    0, 5000,   -1 },
+	{ "24C128",    "128",      16384,  64,   2,    0,    0, 5000,   -1 },
+	{ "24C256",    "256",      32768,  64,   2,    0,    0, 5000,   -1 },
+	{ "24C512",    "512",      65536, 128,   2,    0,    0, 5000,   -1 },
+	{ "24LC1025",  "1025",    131072, 128,   2,    1,    2, 5000,   -1 },	/* block select is B0, above A1 A0 */
+	{ "24M01",     "M01",     131072, 256,   2,    1,    0, 5000,   -1 },
+	{ "24M02",     "M02",     262144, 256,   2,    2,    0, 10000,  -1 },
+	{ NULL,        NULL,           0,   0,   0,    0,    0,    0,    0 }
+};
+
+const eeprom_profile *eeprom_profile_find(const char *part) {
+	const char *s = part;
+	char key[32];
+	int i, len;
+
+	/* 24, then family letters: 24AA64, 24LC64, 24C64, 24FC64, 24CM02 */
+	if ( 0 == strncmp(s,"24",2) )
+		s += 2;
+	while ( '\0' != *s && NULL != strchr("AaLlCcFf",*s) )
+		s++;
+
+	for ( i=0 ; '\0' != s[i] && i < (int) sizeof(key)-1 ; i++ )
+		key[i] = toupper((unsigned char) s[i]);
+	key[i]='\0';
+
+	for ( i=0 ; NULL != profiles[i].name ; i++ ) {
+		len = strlen(profiles[i].key);
+
+		/* exact, or with T (tape and reel) on the end */
+		if ( 0 == strncmp(key,profiles[i].key,len) && ( '\0' == key[len] || 0 == strcmp(key+len,"T") ) )
+			return &profiles[i];
+	}
+
+	return NULL;
+}
+
+void eeprom_profile_list(FILE *fp) {
+	int i;
+
+	fprintf(fp,"part       capacity  page  address bytes  block bits  tWR ms\n");
+	for ( i=0 ; NULL != profiles[i].name ; i++ ) {
+		fprintf(fp,"%-10s %8d  %4d  %13d  %10d  %6d%s\n",
+			profiles[i].name,
+			profiles[i].capacity,
+			profiles[i].pageBytes,
+			profiles[i].addressBytes,
+			profiles[i].blockBits,
+			profiles[i].tWR_us / 1000,
+			profiles[i].macAddress >= 0 ? "  EUI-48" : "");
+	}
+}
+
+/* device address that holds memory address */
+static int device_address(const eeprom_dev *e, int address) {
+	const eeprom_profile *p = e->profile;
+	int block = (address >> (8*p->addressBytes)) & ((1 << p->blockBits) - 1);
+
+	return e->i2cAddress | (block << p->blockShift);
+}
+
+/* bytes addressable without changing the block select bits */
+static int block_bytes(const eeprom_profile *p) {
+	return 1 << (8*p->addressBytes);
+}
+
+int eeprom_open(eeprom_dev *e, const char *device, int i2cAddress, const eeprom_profile *p, int writeTimeout_us) {
+	struct stat st;
+	unsigned long funcs;
+	int fd;
+
+	memset(e,0,sizeof(eeprom_dev));
+	e->profile=p;
+	e->i2cAddress=i2cAddress;
+	e->selected=-1;
+	e->i2cHandle=-1;
+	e->maxTransfer=EEPROM_MAX_TRANSFER;
+	eeprom_ack_init(&e->ack,p->tWR_us,writeTimeout_us);
+
+	if ( 0 == strncmp(device,EEPROM_SIM_PREFIX,strlen(EEPROM_SIM_PREFIX)) ) {
+		device += strlen(EEPROM_SIM_PREFIX);
+
+		/* whole array, including anything above capacity like a factory MAC */
+		e->simBytes = p->capacity;
+		if ( p->macAddress >= 0 && p->macAddress + 6 > e->simBytes )
+			e->simBytes = 256;
+
+		fd = open(device, O_RDWR | O_CREAT, 0644);
+		if ( -1 == fd || -1 == fstat(fd,&st) ) {
+			fprintf(stderr,"# Error opening simulated EEPROM file %s.\n# %s\n",device,strerror(errno));
+			return -1;
+		}
+		if ( st.st_size < e->simBytes && -1 == ftruncate(fd,e->simBytes) ) {
+			fprintf(stderr,"# Error sizing simulated EEPROM file %s.\n# %s\n",device,strerror(errno));
+			close(fd);
+			return -1;
+		}
+
+		e->sim = mmap(NULL, e->simBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if ( MAP_FAILED == e->sim ) {
+			fprintf(stderr,"# Error mapping simulated EEPROM file %s.\n# %s\n",device,strerror(errno));
+			e->sim=NULL;
+			return -1;
+		}
+
+		/* new part of the file is erased, like a new EEPROM */
+		if ( st.st_size < e->simBytes )
+			memset(e->sim + st.st_size, 0xff, e->simBytes - st.st_size);
+
+		return 0;
+	}
+
+	e->i2cHandle = open(device, O_RDWR);
+	if ( -1 == e->i2cHandle ) {
+		fprintf(stderr,"# Error opening I2C device.\n# %s\n",strerror(errno));
+		return -1;
+	}
+
+	/* not using 10 bit addresses */
+	ioctl(e->i2cHandle, I2C_TENBIT, 0);
+
+	/* reads and writes are plain read() and write() messages, which SMBus-only adapters can't do */
+	if ( 0 == ioctl(e->i2cHandle, I2C_FUNCS, &funcs) && ! (funcs & I2C_FUNC_I2C) ) {
+		fprintf(stderr,"# adapter does not support plain I2C transfers\n");
+		close(e->i2cHandle);
+		e->i2cHandle=-1;
+		return -1;
+	}
+
+	return 0;
+}
+
+int eeprom_close(eeprom_dev *e) {
+	/* last write done */
+	eeprom_gen_end(e);
+
+	if ( NULL != e->sim ) {
+		munmap(e->sim,e->simBytes);
+		e->sim=NULL;
+		return 0;
+	}
+
+	return close(e->i2cHandle);
+}
+
+/* I2C_SLAVE only when the device address changes */
+static void select_device(eeprom_dev *e, int deviceAddress) {
+	if ( deviceAddress != e->selected ) {
+		ioctl(e->i2cHandle, I2C_SLAVE, deviceAddress);
+		e->selected=deviceAddress;
+	}
+}
+
+/* memory address in the simulated part of a transaction to deviceAddress, or -1 if it isn't ours or is busy */
+static int sim_address(eeprom_dev *e, int deviceAddress) {
+	const eeprom_profile *p = e->profile;
+	int blockMask = ((1 << p->blockBits) - 1) << p->blockShift;
+
+	if ( (deviceAddress & ~blockMask) != e->i2cAddress ) {
+		errno=ENXIO;
+		return -1;
+	}
+	if ( latency_now_ns() < e->simBusy_ns ) {
+		errno=EREMOTEIO;
+		return -1;
+	}
+
+	return ((deviceAddress & blockMask) >> p->blockShift) << (8*p->addressBytes);
+}
+
+int eeprom_bus_write(eeprom_dev *e, int deviceAddress, const uint8_t *buf, int n) {
+	const eeprom_profile *p = e->profile;
+	int block, address, pageStart, i;
+
+	if ( NULL == e->sim ) {
+		select_device(e,deviceAddress);
+		return write(e->i2cHandle, buf, n);
+	}
+
+	block = sim_address(e,deviceAddress);
+	if ( -1 == block )
+		return -1;
+	if ( n < p->addressBytes )
+		return n;
+
+	for ( i=0, address=0 ; i<p->addressBytes ; i++ )
+		address = (address << 8) | buf[i];
+	address = (block | address) % e->simBytes;
+	e->simAddress = address;
+
+	if ( n == p->addressBytes )
+		return n;
+
+	/* data wraps around within the page. Above capacity is write protected */
+	pageStart = address - (address % p->pageBytes);
+	for ( i=p->addressBytes ; i<n ; i++ ) {
+		int a = pageStart + ((address % p->pageBytes) + i - p->addressBytes) % p->pageBytes;
+
+		if ( a < p->capacity )
+			e->sim[a] = buf[i];
+	}
+	e->simBusy_ns = latency_now_ns() + (uint64_t) p->tWR_us * 1000;
+
+	return n;
+}
+
+int eeprom_bus_read(eeprom_dev *e, int deviceAddress, uint8_t *buf, int n) {
+	int i;
+
+	if ( NULL == e->sim ) {
+		select_device(e,deviceAddress);
+		return read(e->i2cHandle, buf, n);
+	}
+
+	if ( -1 == sim_address(e,deviceAddress) )
+		return -1;
+
+	for ( i=0 ; i<n ; i++ ) {
+		buf[i] = e->sim[e->simAddress];
+		e->simAddress = (e->simAddress + 1) % e->simBytes;
+	}
+
+	return n;
+}
+
+/* memory address bytes, most significant first */
+static int address_bytes(const eeprom_profile *p, int address, uint8_t *buf) {
+	int i;
+
+	for ( i=0 ; i<p->addressBytes ; i++ )
+		buf[i] = (address >> (8*(p->addressBytes-1-i))) & 0xff;
+
+	return p->addressBytes;
+}
+
+int eeprom_read(eeprom_dev *e, int address, uint8_t *buf, int n) {
+	const eeprom_profile *p = e->profile;
+	uint8_t txBuffer[4];
+	int done, chunk, deviceAddress, ab;
+
+	/*
+	sequential reads don't carry into the block select bits on every part. One read per block,
+	and no longer than the adapter takes
+	*/
+	for ( done=0 ; done<n ; done += chunk ) {
+		chunk = block_bytes(p) - ((address+done) % block_bytes(p));
+		if ( chunk > n - done )
+			chunk = n - done;
+		if ( chunk > e->maxTransfer )
+			chunk = e->maxTransfer;
+
+		deviceAddress = device_address(e,address+done);
+		ab = address_bytes(p,address+done,txBuffer);
+
+		if ( ab != eeprom_bus_write(e,deviceAddress,txBuffer,ab) )
+			return -1;
+		if ( chunk != eeprom_bus_read(e,deviceAddress,buf+done,chunk) )
+			return -1;
+	}
+
+	return n;
+}
+
+int eeprom_page_room(const eeprom_dev *e, int address) {
+	return e->profile->pageBytes - (address % e->profile->pageBytes);
+}
+
+static int poll_device(void *ctx) {
+	eeprom_dev *e = ctx;
+	uint8_t dummy=0;
+
+	return ( -1 == eeprom_bus_write(e,e->writeDevice,&dummy,0) ) ? -1 : 0;
+}
+
+/* page write on the bus, up to the write cycle. Returns 0 or -1 */
+static int bus_page(eeprom_dev *e, int address, const uint8_t *buf, int n) {
+	uint8_t txBuffer[4+EEPROM_MAX_PAGE_BYTES];
+	int ab;
+
+	e->writeDevice = device_address(e,address);
+
+	ab = address_bytes(e->profile,address,txBuffer);
+	memcpy(txBuffer+ab,buf,n);
+
+	if ( ab+n != eeprom_bus_write(e,e->writeDevice,txBuffer,ab+n) )
+		return -1;
+
+	return 0;
+}
+
+static int gen_write(eeprom_dev *e, uint32_t generation);
+
+/* caller's page write, up to the write cycle. Returns 0, or eeprom_write_page() error */
+static int send_page(eeprom_dev *e, int address, const uint8_t *buf, int n) {
+	int rc;
+
+	if ( EEPROM_GEN_IDLE == e->genState || EEPROM_GEN_WRITING == e->genState ) {
+		/* the header is ours while it is kept */
+		if ( address+n > eeprom_gen_address(e) )
+			return EEPROM_GEN_RESERVED;
+
+		/* first write. An odd generation tells readers a copy of the contents can't be trusted */
+		if ( EEPROM_GEN_IDLE == e->genState ) {
+			rc = gen_write(e, e->generation | 1);
+			if ( rc < 0 )
+				return rc;
+			e->genState = EEPROM_GEN_WRITING;
+		}
+	}
+
+	return bus_page(e,address,buf,n);
+}
+
+int eeprom_write_page(eeprom_dev *e, int address, const uint8_t *buf, int n) {
+	int rc;
+
+	if ( n <= 0 )
+		return 0;
+
+	rc = send_page(e,address,buf,n);
+	if ( rc < 0 )
+		return rc;
+
+	return eeprom_ack_wait(&e->ack,poll_device,e,address,n);
+}
+
+int eeprom_write_start(eeprom_dev *e, int address, const uint8_t *buf, int n) {
+	int rc = send_page(e,address,buf,n);
+
+	if ( 0 != rc )
+		return ( EEPROM_GEN_RESERVED == rc ) ? rc : -1;
+
+	eeprom_ack_start(&e->ack,address,n);
+	return 0;
+}
+
+int eeprom_write_check(eeprom_dev *e) {
+	return eeprom_ack_check(&e->ack,poll_device,e);
+}
+
+int eeprom_gen_address(const eeprom_dev *e) {
+	return e->profile->capacity - EEPROM_GEN_BYTES;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+int eeprom_gen_read(eeprom_dev *e) {
+	if ( EEPROM_GEN_BYTES != eeprom_read(e, eeprom_gen_address(e), e->gen, EEPROM_GEN_BYTES) )
+		return -1;
+
+	if ( EEPROM_GEN_MAGIC != get32(e->gen) || get32(e->gen+12) != crc32_update(0,e->gen,12) ) {
+		e->genState = EEPROM_GEN_NONE;
+		return 0;
+	}
+
+	e->generation = get32(e->gen+4);
+	e->genState = EEPROM_GEN_IDLE;
+	return 1;
+}
+
+/* header with generation and a new nonce, one page at a time */
+static int gen_write(eeprom_dev *e, uint32_t generation) {
+	uint8_t buf[EEPROM_GEN_BYTES];
+	struct timespec ts;
+	int address = eeprom_gen_address(e);
+	int done, n, rc;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+
+	put32(buf,EEPROM_GEN_MAGIC);
+	put32(buf+4,generation);
+	put32(buf+8,crc32_update((uint32_t) ts.tv_nsec ^ (uint32_t) getpid(),&ts,sizeof(ts)));
+	put32(buf+12,crc32_update(0,buf,12));
+
+	for ( done=0 ; done<EEPROM_GEN_BYTES ; done += n ) {
+		n = eeprom_page_room(e,address+done);
+		if ( n > EEPROM_GEN_BYTES - done )
+			n = EEPROM_GEN_BYTES - done;
+
+		if ( 0 != bus_page(e, address+done, buf+done, n) )
+			return -1;
+		rc = eeprom_ack_wait(&e->ack,poll_device,e,address+done,n);
+		if ( rc < 0 )
+			return rc;
+	}
+
+	memcpy(e->gen,buf,EEPROM_GEN_BYTES);
+	e->generation = generation;
+
+	return 0;
+}
+
+int eeprom_gen_create(eeprom_dev *e) {
+	int rc = gen_write(e,0);
+
+	e->genState = ( rc < 0 ) ? EEPROM_GEN_NONE : EEPROM_GEN_IDLE;
+
+	return rc;
+}
+
+int eeprom_gen_end(eeprom_dev *e) {
+	int rc;
+
+	if ( EEPROM_GEN_WRITING != e->genState )
+		return 0;
+
+	rc = gen_write(e, (e->generation | 1) + 1);
+	if ( rc < 0 )
+		return rc;
+
+	e->genState = EEPROM_GEN_IDLE;
+	return 0;
+}
@@ -0,0 +1,130 @@
+#ifndef APRSi2C_EEPROM_EEPROM_DEV_H
+#define APRSi2C_EEPROM_EEPROM_DEV_H
+/*
+24 series I2C EEPROM access driven by a table of device profiles.
+
+A profile gives the writable capacity, page size, number of memory address bytes, the memory
+address bits that go in the device address (block select) and the write cycle time. Reads are
+split at block boundaries, writes are at most one page and wait out the write cycle with
+eeprom_ack.
+
+A part that has been written with a generation header (see eeprom_gen_create()) keeps a
+generation count, a random nonce and their CRC32 in its last EEPROM_GEN_BYTES bytes. The
+header is only kept by callers that ask for it by reading it with eeprom_gen_read(); until
+then the last bytes are data like any other. While it is kept, the first page write through
+eeprom_write_page() makes the count odd, eeprom_gen_end() (or eeprom_close()) makes it even
+again with a new nonce, and writes over the header are refused. A host side copy of the contents that
+was taken under the same header is still good, which is how eeprom_cache checks its copy
+without reading it back.
+
+A device of "sim:filename" is a simulated bus with one EEPROM of the profile, backed by
+filename. It acknowledges, pages and wraps like the part and is busy for tWR after a page
+write, so the tools can be tried without hardware.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include "eeprom_ack.h"
+
+#define EEPROM_MAX_PAGE_BYTES 256
+#define EEPROM_MAX_TRANSFER   8192	/* i2c-dev limit on one read() */
+#define EEPROM_SIM_PREFIX     "sim:"
+
+/* generation header: magic, generation, nonce, crc32 of the first 12 bytes. Little endian */
+#define EEPROM_GEN_BYTES 16
+#define EEPROM_GEN_MAGIC 0x31474541	/* "AEG1" */
+
+typedef struct {
+	const char *name;	/* part number */
+	const char *key;	/* part number after "24" and the family letters (AA, LC, C, FC) */
+	int capacity;		/* writable bytes */
+	int pageBytes;
+	int addressBytes;	/* memory address bytes sent after the device address */
+	int blockBits;		/* memory address bits above the address bytes, sent in the device address */
+	int blockShift;		/* bit of the device address where the block bits start */
+	int tWR_us;		/* maximum write cycle time */
+	int macAddress;		/* memory address of factory programmed EUI-48, -1 if none */
+} eeprom_profile;
+
+typedef struct {
+	const eeprom_profile *profile;
+	int i2cHandle;		/* -1 if simulated */
+	int i2cAddress;		/* device address with the block bits 0 */
+	int selected;		/* device address of last I2C_SLAVE, -1 if none */
+	int maxTransfer;	/* longest read in one message. EEPROM_MAX_TRANSFER, can be lowered for adapters with a smaller limit */
+
+	/* simulated bus */
+	uint8_t *sim;
+	int simBytes;
+	int simAddress;		/* address pointer */
+	uint64_t simBusy_ns;	/* in write cycle until */
+
+	int writeDevice;	/* device address of the write in its write cycle */
+
+	/* generation header */
+	int genState;		/* EEPROM_GEN_* */
+	uint32_t generation;
+	uint8_t gen[EEPROM_GEN_BYTES];	/* as last read or written */
+
+	eeprom_ack ack;
+} eeprom_dev;
+
+/* eeprom_dev.genState. The header is kept in IDLE and WRITING */
+#define EEPROM_GEN_OFF     0	/* not read, writes leave it alone */
+#define EEPROM_GEN_NONE    1	/* part has no good header */
+#define EEPROM_GEN_IDLE    2
+#define EEPROM_GEN_WRITING 3	/* odd count written by us */
+
+/* eeprom_write_page() and eeprom_write_start() error for a write over a kept header */
+#define EEPROM_GEN_RESERVED -4
+
+/* profile by part number, like 24LC64, 24C02 or 24AA02E48T. NULL if unknown */
+const eeprom_profile *eeprom_profile_find(const char *part);
+/* table of profiles for --list-devices */
+void eeprom_profile_list(FILE *fp);
+
+/*
+open I2C device (or sim:filename) for the EEPROM of profile p at i2cAddress, waiting up to
+writeTimeout_us for each write cycle. Returns 0 on success, prints the error and returns -1
+*/
+int eeprom_open(eeprom_dev *e, const char *device, int i2cAddress, const eeprom_profile *p, int writeTimeout_us);
+int eeprom_close(eeprom_dev *e);
+
+/* one I2C transaction with device address. Like write() and read(), -1 if not acknowledged */
+int eeprom_bus_write(eeprom_dev *e, int deviceAddress, const uint8_t *buf, int n);
+int eeprom_bus_read(eeprom_dev *e, int deviceAddress, uint8_t *buf, int n);
+
+/*
+sequential read of n bytes from address, in messages of up to maxTransfer bytes. Returns n, or
+-1 if not acknowledged
+*/
+int eeprom_read(eeprom_dev *e, int address, uint8_t *buf, int n);
+
+/* bytes from address to the end of its page */
+int eeprom_page_room(const eeprom_dev *e, int address);
+
+/*
+write n bytes (no more than eeprom_page_room()) at address and wait out the write cycle.
+Returns write cycle microseconds, -1 if not acknowledged, -2 on write cycle timeout or
+EEPROM_GEN_RESERVED
+*/
+int eeprom_write_page(eeprom_dev *e, int address, const uint8_t *buf, int n);
+/*
+eeprom_write_page() in two halves, for writing to other devices during the write cycle.
+eeprom_write_start() returns 0, -1 if not acknowledged or EEPROM_GEN_RESERVED. eeprom_write_check() polls if it is
+time to, and returns write cycle microseconds, EEPROM_ACK_BUSY until e->ack.next_ns, or -2
+*/
+int eeprom_write_start(eeprom_dev *e, int address, const uint8_t *buf, int n);
+int eeprom_write_check(eeprom_dev *e);
+
+/* address of the generation header */
+int eeprom_gen_address(const eeprom_dev *e);
+/*
+read generation header into e->gen and keep it from now on if it is good. Returns 1 if it is
+good, 0 if the part has none, -1 if not acknowledged
+*/
+int eeprom_gen_read(eeprom_dev *e);
+/* write a new header with generation 0 and keep it. Returns 0, or eeprom_write_page() error */
+int eeprom_gen_create(eeprom_dev *e);
+/* after writes, make the generation even again with a new nonce. Returns 0, or eeprom_write_page() error */
+int eeprom_gen_end(eeprom_dev *e);
+#endif
@@ -0,0 +1,558 @@
+/*
+FUSE filesystem with a file for each I2C EEPROM and DS1307 RAM, read and written through a
+write-back page cache (page_cache.h). Needs libfuse3. See README.md
+*/
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/i2c-dev.h>
+#include "eeprom_dev.h"
+#include "page_cache.h"
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+#define MAX_FILES 16
+
+/* DS1307 battery backed RAM */
+#define DS1307_RAM_REGISTER 0x08
+#define DS1307_RAM_BYTES    56
+#define DS1307_REGISTERS    64
+
+/* file types */
+#define FILE_EEPROM 0
+#define FILE_DS1307 1
+
+typedef struct {
+	int i2cHandle;		/* -1 if simulated */
+	uint8_t *sim;		/* registers, for sim:filename */
+} ds1307_ram;
+
+typedef struct {
+	char name[32];
+	int type;
+	int size;
+	eeprom_dev eeprom;
+	ds1307_ram rtc;
+	page_cache pc;
+} fs_file;
+
+static fs_file files[MAX_FILES];
+static int nFiles;
+static int flushInterval=1000;	/* milliseconds */
+static int flushRunning;
+static pthread_t flushThread;
+
+/* page cache access to eeprom_dev */
+static int eeprom_pc_read(void *ctx, int address, uint8_t *buf, int n) {
+	return ( n == eeprom_read(ctx, address, buf, n) ) ? n : -EIO;
+}
+
+static int eeprom_pc_write(void *ctx, int address, const uint8_t *buf, int n) {
+	int rc = eeprom_write_page(ctx, address, buf, n);
+
+	if ( -2 == rc )
+		return -ETIMEDOUT;
+	return ( rc < 0 ) ? -EIO : n;
+}
+
+static int eeprom_pc_sync(void *ctx) {
+	return ( 0 == eeprom_gen_end(ctx) ) ? 0 : -EIO;
+}
+
+/* DS1307 RAM. Registers are written and read with the register address first */
+static int ds1307_open(ds1307_ram *r, const char *device, int i2cAddress) {
+	int fd;
+
+	r->i2cHandle=-1;
+	r->sim=NULL;
+
+	if ( 0 == strncmp(device,EEPROM_SIM_PREFIX,strlen(EEPROM_SIM_PREFIX)) ) {
+		device += strlen(EEPROM_SIM_PREFIX);
+		fd = open(device, O_RDWR | O_CREAT, 0644);
+		if ( fd < 0 || 0 != ftruncate(fd, DS1307_REGISTERS) ) {
+			fprintf(stderr,"# Error opening simulated DS1307 %s.\n# %s\n",device,strerror(errno));
+			return -1;
+		}
+		r->sim = mmap(NULL, DS1307_REGISTERS, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if ( MAP_FAILED == r->sim ) {
+			fprintf(stderr,"# Error mapping simulated DS1307 %s.\n# %s\n",device,strerror(errno));
+			r->sim=NULL;
+			return -1;
+		}
+		return 0;
+	}
+
+	r->i2cHandle = open(device, O_RDWR);
+	if ( -1 == r->i2cHandle ) {
+		fprintf(stderr,"# Error opening I2C device %s.\n# %s\n",device,strerror(errno));
+		return -1;
+	}
+	if ( ioctl(r->i2cHandle, I2C_SLAVE, i2cAddress) < 0 ) {
+		fprintf(stderr,"# Error selecting I2C address 0x%02X.\n# %s\n",i2cAddress,strerror(errno));
+		close(r->i2cHandle);
+		r->i2cHandle=-1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void ds1307_close(ds1307_ram *r) {
+	if ( NULL != r->sim )
+		munmap(r->sim, DS1307_REGISTERS);
+	if ( r->i2cHandle >= 0 )
+		close(r->i2cHandle);
+}
+
+static int ds1307_pc_read(void *ctx, int address, uint8_t *buf, int n) {
+	ds1307_ram *r = ctx;
+	uint8_t reg = DS1307_RAM_REGISTER + address;
+
+	if ( NULL != r->sim ) {
+		memcpy(buf, r->sim+reg, n);
+		return n;
+	}
+
+	if ( 1 != write(r->i2cHandle, &reg, 1) || n != read(r->i2cHandle, buf, n) )
+		return -EIO;
+	return n;
+}
+
+static int ds1307_pc_write(void *ctx, int address, const uint8_t *buf, int n) {
+	ds1307_ram *r = ctx;
+	uint8_t txBuffer[1+DS1307_RAM_BYTES];
+
+	if ( NULL != r->sim ) {
+		memcpy(r->sim+DS1307_RAM_REGISTER+address, buf, n);
+		return n;
+	}
+
+	txBuffer[0] = DS1307_RAM_REGISTER + address;
+	memcpy(txBuffer+1, buf, n);
+	if ( n+1 != write(r->i2cHandle, txBuffer, n+1) )
+		return -EIO;
+	return n;
+}
+
+static fs_file *find_file(const char *path) {
+	int i;
+
+	if ( '/' != path[0] )
+		return NULL;
+	for ( i=0 ; i<nFiles ; i++ ) {
+		if ( 0 == strcmp(path+1, files[i].name) )
+			return &files[i];
+	}
+
+	return NULL;
+}
+
+/* flush every interval. Once a file has had an interval without writes, sync it */
+static void *flush_thread(void *arg) {
+	unsigned long lastWrites[MAX_FILES], writes;
+	int i, rc, dirtyPages;
+
+	(void) arg;
+	memset(lastWrites,0,sizeof(lastWrites));
+
+	while ( flushRunning ) {
+		usleep(flushInterval*1000);
+
+		for ( i=0 ; i<nFiles ; i++ ) {
+			/* counters change under the cache lock while fuse threads write */
+			pthread_mutex_lock(&files[i].pc.lock);
+			writes = files[i].pc.writes;
+			pthread_mutex_unlock(&files[i].pc.lock);
+
+			if ( writes == lastWrites[i] ) {
+				rc = page_cache_sync(&files[i].pc);
+			} else {
+				rc = page_cache_flush(&files[i].pc);
+			}
+			lastWrites[i] = writes;
+
+			/* pages that failed stay dirty and are tried again next interval */
+			if ( rc < 0 ) {
+				pthread_mutex_lock(&files[i].pc.lock);
+				dirtyPages = files[i].pc.dirtyPages;
+				pthread_mutex_unlock(&files[i].pc.lock);
+				fprintf(stderr,"# Error flushing %s. %d dirty pages kept for the next flush\n# %s\n",files[i].name,dirtyPages,strerror(-rc));
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* threads don't survive fuse daemonizing, so the flush thread starts here */
+static void *fs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+	(void) conn;
+
+	/* every read and write comes to us, so the page cache is the only cache */
+	cfg->direct_io = 1;
+
+	flushRunning=1;
+	if ( 0 != pthread_create(&flushThread, NULL, flush_thread, NULL) ) {
+		fprintf(stderr,"# Error starting flush thread. Writes will only be flushed by fsync\n");
+		flushRunning=0;
+	}
+
+	return NULL;
+}
+
+static void fs_destroy(void *privateData) {
+	int i;
+
+	(void) privateData;
+
+	if ( flushRunning ) {
+		flushRunning=0;
+		pthread_join(flushThread, NULL);
+	}
+
+	for ( i=0 ; i<nFiles ; i++ ) {
+		if ( 0 != page_cache_sync(&files[i].pc) ) {
+			fprintf(stderr,"# Error flushing %s. %d dirty pages lost\n",files[i].name,files[i].pc.dirtyPages);
+		}
+		if ( FILE_EEPROM == files[i].type ) {
+			eeprom_close(&files[i].eeprom);
+		} else {
+			ds1307_close(&files[i].rtc);
+		}
+		page_cache_free(&files[i].pc);
+	}
+}
+
+static int fs_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
+	fs_file *f;
+
+	(void) fi;
+	memset(st,0,sizeof(struct stat));
+
+	if ( 0 == strcmp(path,"/") ) {
+		st->st_mode = S_IFDIR | 0755;
+		st->st_nlink = 2;
+		return 0;
+	}
+
+	f = find_file(path);
+	if ( NULL == f )
+		return -ENOENT;
+
+	st->st_mode = S_IFREG | 0644;
+	st->st_nlink = 1;
+	st->st_size = f->size;
+	return 0;
+}
+
+static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+	int i;
+
+	(void) offset;
+	(void) fi;
+	(void) flags;
+
+	if ( 0 != strcmp(path,"/") )
+		return -ENOENT;
+
+	filler(buf, ".", NULL, 0, 0);
+	filler(buf, "..", NULL, 0, 0);
+	for ( i=0 ; i<nFiles ; i++ )
+		filler(buf, files[i].name, NULL, 0, 0);
+
+	return 0;
+}
+
+static int fs_open(const char *path, struct fuse_file_info *fi) {
+	(void) fi;
+
+	return ( NULL == find_file(path) ) ? -ENOENT : 0;
+}
+
+static int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+	fs_file *f = find_file(path);
+
+	(void) fi;
+	if ( NULL == f )
+		return -ENOENT;
+	if ( offset >= f->size )
+		return 0;
+	if ( (off_t) size > f->size - offset )
+		size = f->size - offset;
+
+	return page_cache_read(&f->pc, offset, (uint8_t *) buf, size);
+}
+
+static int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+	fs_file *f = find_file(path);
+
+	(void) fi;
+	if ( NULL == f )
+		return -ENOENT;
+	if ( offset >= f->size )
+		return -ENOSPC;
+	if ( (off_t) size > f->size - offset )
+		size = f->size - offset;
+
+	return page_cache_write(&f->pc, offset, (const uint8_t *) buf, size);
+}
+
+/* devices don't change size. Shell redirection truncates, so that is allowed and does nothing */
+static int fs_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
+	fs_file *f = find_file(path);
+
+	(void) fi;
+	if ( NULL == f )
+		return -ENOENT;
+
+	return ( size <= f->size ) ? 0 : -EFBIG;
+}
+
+static int fs_fsync(const char *path, int dataSync, struct fuse_file_info *fi) {
+	fs_file *f = find_file(path);
+
+	(void) dataSync;
+	(void) fi;
+	if ( NULL == f )
+		return -ENOENT;
+
+	return page_cache_sync(&f->pc);
+}
+
+static const struct fuse_operations fs_ops = {
+	.init     = fs_init,
+	.destroy  = fs_destroy,
+	.getattr  = fs_getattr,
+	.readdir  = fs_readdir,
+	.open     = fs_open,
+	.read     = fs_read,
+	.write    = fs_write,
+	.truncate = fs_truncate,
+	.fsync    = fs_fsync,
+};
+
+/* name=device,address[,part] */
+static fs_file *parse_file(const char *arg, int type, char *device, int deviceBytes, int *i2cAddress, char *part, int partBytes) {
+	const char *equals = strchr(arg,'=');
+	char spec[128];
+	char *tok;
+	fs_file *f;
+
+	if ( nFiles >= MAX_FILES ) {
+		fprintf(stderr,"# more than %d files\n# Exiting...\n",MAX_FILES);
+		exit(1);
+	}
+	if ( NULL == equals || equals == arg || equals-arg >= (int) sizeof(f->name) || NULL != strchr(arg,'/') ) {
+		fprintf(stderr,"# %s should be name=device,address\n# Exiting...\n",arg);
+		exit(1);
+	}
+
+	f = &files[nFiles];
+	memset(f,0,sizeof(fs_file));
+	f->type = type;
+	memcpy(f->name, arg, equals-arg);
+	f->name[equals-arg]='\0';
+
+	strncpy(spec, equals+1, sizeof(spec)-1);
+	spec[sizeof(spec)-1]='\0';
+
+	tok = strtok(spec,",");
+	if ( NULL == tok ) {
+		fprintf(stderr,"# %s has no device\n# Exiting...\n",arg);
+		exit(1);
+	}
+	strncpy(device, tok, deviceBytes-1);
+	device[deviceBytes-1]='\0';
+
+	tok = strtok(NULL,",");
+	if ( NULL != tok ) {
+		sscanf(tok,"%x",i2cAddress);
+	}
+
+	tok = strtok(NULL,",");
+	if ( NULL != tok && NULL != part ) {
+		strncpy(part, tok, partBytes-1);
+		part[partBytes-1]='\0';
+	}
+
+	return f;
+}
+
+/* open the device for one --eeprom or --ds1307 and start its page cache */
+static void open_file(const char *arg, int type, int writeTimeout) {
+	char device[64];
+	char part[32];
+	int i2cAddress;
+	const eeprom_profile *profile;
+	fs_file *f;
+	int rc;
+
+	if ( FILE_EEPROM == type ) {
+		i2cAddress=0x50;
+		strcpy(part,"24LC64");
+		f = parse_file(arg, FILE_EEPROM, device, sizeof(device), &i2cAddress, part, sizeof(part));
+
+		profile = eeprom_profile_find(part);
+		if ( NULL == profile ) {
+			fprintf(stderr,"# unknown EEPROM part %s. See eeprom_24xx --list-devices\n# Exiting...\n",part);
+			exit(1);
+		}
+		if ( 0 != eeprom_open(&f->eeprom, device, i2cAddress, profile, writeTimeout*1000) ) {
+			fprintf(stderr,"# Exiting...\n");
+			exit(1);
+		}
+
+		/* a generation header stays out of the file and is kept up to date by the page cache */
+		rc = eeprom_gen_read(&f->eeprom);
+		if ( rc < 0 ) {
+			fprintf(stderr,"# No ACK from %s! Exiting...\n",f->name);
+			exit(2);
+		}
+		f->size = ( 1 == rc ) ? eeprom_gen_address(&f->eeprom) : profile->capacity;
+
+		if ( 0 != page_cache_init(&f->pc, f->size, profile->pageBytes, eeprom_pc_read, eeprom_pc_write, eeprom_pc_sync, &f->eeprom) ) {
+			fprintf(stderr,"# Error allocating page cache\n# Exiting...\n");
+			exit(1);
+		}
+		fprintf(stderr,"# %s: %s %d bytes at 0x%02X on %s\n",f->name,profile->name,f->size,i2cAddress,device);
+		nFiles++;
+	} else {
+		i2cAddress=0x68;
+		f = parse_file(arg, FILE_DS1307, device, sizeof(device), &i2cAddress, NULL, 0);
+
+		if ( 0 != ds1307_open(&f->rtc, device, i2cAddress) ) {
+			fprintf(stderr,"# Exiting...\n");
+			exit(1);
+		}
+
+		/* RAM has no write cycle, so it is one page */
+		f->size = DS1307_RAM_BYTES;
+		if ( 0 != page_cache_init(&f->pc, f->size, DS1307_RAM_BYTES, ds1307_pc_read, ds1307_pc_write, NULL, &f->rtc) ) {
+			fprintf(stderr,"# Error allocating page cache\n# Exiting...\n");
+			exit(1);
+		}
+		fprintf(stderr,"# %s: DS1307 RAM %d bytes at 0x%02X on %s\n",f->name,f->size,i2cAddress,device);
+		nFiles++;
+	}
+}
+
+void printUsage(void) {
+	fprintf(stderr,"Usage: eeprom_fs [switches] mountpoint\n\n");
+	fprintf(stderr,"switch           argument                    description\n");
+	fprintf(stderr,"========================================================================================================\n");
+	fprintf(stderr,"--eeprom         name=device[,address,part]  file name for an EEPROM (default address 50, part 24LC64)\n");
+	fprintf(stderr,"--ds1307         name=device[,address]       file name for the 56 bytes of DS1307 RAM (default address 68)\n");
+	fprintf(stderr,"                                             device is /dev/ entry for I2C-dev device, or sim:filename\n");
+	fprintf(stderr,"--flush-interval milliseconds                write dirty pages after milliseconds (default %d)\n",flushInterval);
+	fprintf(stderr,"--write-timeout  milliseconds                give up waiting for a page write cycle after milliseconds (default %d)\n",EEPROM_ACK_DEADLINE_US/1000);
+	fprintf(stderr,"--foreground                                 don't detach from the terminal\n");
+	fprintf(stderr,"--help                                       this message\n");
+}
+
+int main(int argc, char **argv) {
+	int c;
+	int foreground=0;
+	int writeTimeout=EEPROM_ACK_DEADLINE_US/1000;
+	const char *fileArg[MAX_FILES];
+	int fileType[MAX_FILES];
+	int nArgs=0;
+	char *fuseArgv[4];
+	int fuseArgc=0;
+	int i;
+
+	fprintf(stderr,"# eeprom_fs I2C EEPROM and DS1307 RAM filesystem\n");
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"eeprom",         required_argument, 0, 'e' },
+			{"ds1307",         required_argument, 0, 'r' },
+			{"flush-interval", required_argument, 0, 'F' },
+			{"write-timeout",  required_argument, 0, 't' },
+			{"foreground",     no_argument,       0, 'f' },
+			{"help",           no_argument,       0, 'h' },
+			{0,                0,                 0,  0 }
+		};
+
+		c = getopt_long(argc, argv, "", long_options, &option_index);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'e':
+			case 'r':
+				/* opened once all switches are in, so --write-timeout applies wherever it is */
+				if ( nArgs >= MAX_FILES ) {
+					fprintf(stderr,"# more than %d files\n# Exiting...\n",MAX_FILES);
+					exit(1);
+				}
+				fileArg[nArgs] = optarg;
+				fileType[nArgs] = ( 'e' == c ) ? FILE_EEPROM : FILE_DS1307;
+				nArgs++;
+				break;
+			case 'F':
+				flushInterval=atoi(optarg);
+				if ( flushInterval<1 || flushInterval>3600000 ) {
+					fprintf(stderr,"# flush interval out of range (1 to 3600000 milliseconds)\n# Exiting...\n");
+					exit(1);
+				}
+				break;
+			case 't':
+				writeTimeout=atoi(optarg);
+				if ( writeTimeout<1 || writeTimeout>1000 ) {
+					fprintf(stderr,"# write timeout out of range (1 to 1000 milliseconds)\n# Exiting...\n");
+					exit(1);
+				}
+				break;
+			case 'f':
+				foreground=1;
+				break;
+			case 'h':
+				printUsage();
+				exit(0);
+			case '?':
+				exit(1);
+		}
+	}
+
+	if ( optind != argc-1 || 0 == nArgs ) {
+		printUsage();
+		exit(1);
+	}
+
+	for ( i=0 ; i<nArgs ; i++ ) {
+		open_file(fileArg[i], fileType[i], writeTimeout);
+	}
+
+	/* names have to be unique */
+	for ( i=1 ; i<nFiles ; i++ ) {
+		for ( c=0 ; c<i ; c++ ) {
+			if ( 0 == strcmp(files[i].name, files[c].name) ) {
+				fprintf(stderr,"# %s given twice\n# Exiting...\n",files[i].name);
+				exit(1);
+			}
+		}
+	}
+
+	fuseArgv[fuseArgc++] = argv[0];
+	if ( foreground )
+		fuseArgv[fuseArgc++] = "-f";
+	fuseArgv[fuseArgc++] = argv[optind];
+	fuseArgv[fuseArgc] = NULL;
+
+	return fuse_main(fuseArgc, fuseArgv, &fs_ops, NULL);
+}
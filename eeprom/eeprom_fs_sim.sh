@@ -0,0 +1,65 @@
+#!/bin/bash
+# Exercise eeprom_fs without a board: mounts a simulated 24LC64 and DS1307 (sim:),
+# writes through the mount, waits for the flush thread, and reads back through the
+# mount, from the simulated parts, and after mounting again. Needs fuse3 and
+# eeprom_fs built with make eeprom_fs.
+#
+# ./eeprom_fs_sim.sh [flush_interval_ms]
+#
+# Exits 0 if everything read back matches.
+
+FLUSH=${1:-200}
+DIR=$(mktemp -d) || exit 1
+MNT=$DIR/mnt
+FAIL=0
+
+cleanup() {
+	mountpoint -q $MNT && fusermount3 -u $MNT
+	rm -rf $DIR
+}
+trap cleanup EXIT
+
+# mount and wait for the files to show up
+mount_fs() {
+	./eeprom_fs --eeprom id=sim:$DIR/24LC64.bin --ds1307 rtcram=sim:$DIR/ds1307.bin --flush-interval $FLUSH $MNT || exit 1
+	for i in $(seq 50); do
+		[ -e $MNT/id ] && return
+		sleep 0.1
+	done
+	echo "# eeprom_fs did not mount"
+	exit 1
+}
+
+# compare n bytes of file at offset with expected
+check() {
+	if cmp -s -n $4 <(tail -c +$(($3 + 1)) $2) $DIR/$1; then
+		echo "# ok   $5"
+	else
+		echo "# FAIL $5"
+		FAIL=1
+	fi
+}
+
+mkdir $MNT
+head -c 3000 /dev/urandom > $DIR/eeprom.expect
+head -c 56 /dev/urandom > $DIR/ram.expect
+
+mount_fs
+
+# unaligned write over several pages, and all of the DS1307 RAM
+dd if=$DIR/eeprom.expect of=$MNT/id bs=3000 seek=100 oflag=seek_bytes conv=notrunc status=none
+dd if=$DIR/ram.expect of=$MNT/rtcram bs=56 conv=notrunc status=none
+
+# still in the cache, then on the parts once the flush thread has run
+check eeprom.expect $MNT/id 100 3000 "EEPROM read back from cache"
+sleep $(awk "BEGIN { print 3 * $FLUSH / 1000 }")
+check eeprom.expect $DIR/24LC64.bin 100 3000 "EEPROM flushed to simulated part"
+check ram.expect $DIR/ds1307.bin 8 56 "DS1307 RAM flushed to simulated part"
+
+# nothing is left in a cache after mounting again
+fusermount3 -u $MNT
+mount_fs
+check eeprom.expect $MNT/id 100 3000 "EEPROM read back after mounting again"
+check ram.expect $MNT/rtcram 0 56 "DS1307 RAM read back after mounting again"
+
+exit $FAIL
@@ -0,0 +1,310 @@
+/*
+Key-value store on an I2C EEPROM, for board identity and site configuration. See kv_store.h
+for the format and README.md for use
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include "eeprom_dev.h"
+#include "kv_store.h"
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+/* exit values */
+#define EXIT_BUS       2
+#define EXIT_CRC       3
+#define EXIT_NOT_FOUND 4
+
+/* commands */
+#define CMD_NONE    0
+#define CMD_GET     1
+#define CMD_SET     2
+#define CMD_DELETE  3
+#define CMD_LIST    4
+#define CMD_INFO    5
+#define CMD_FORMAT  6
+#define CMD_COMPACT 7
+
+static void kv_exit(int rc) {
+	fprintf(stderr,"# %s Exiting...\n",kv_strerror(rc));
+
+	if ( KV_ERR_CRC == rc )
+		exit(EXIT_CRC);
+	if ( KV_ERR_BUS == rc || KV_ERR_TIMEOUT == rc )
+		exit(EXIT_BUS);
+	exit(1);
+}
+
+void printUsage(void) {
+	fprintf(stderr,"Usage:\n\n");
+	fprintf(stderr,"switch           argument       description\n");
+	fprintf(stderr,"========================================================================================================\n");
+	fprintf(stderr,"--get            key            print value of key to stdout. Exit %d if not set\n",EXIT_NOT_FOUND);
+	fprintf(stderr,"--set            key=value      set key to value\n");
+	fprintf(stderr,"--set-file       key=filename   set key to the contents of filename\n");
+	fprintf(stderr,"--delete         key            delete key\n");
+	fprintf(stderr,"--list                          print keys and value lengths\n");
+	fprintf(stderr,"--info                          print sectors, generation and space used as JSON\n");
+	fprintf(stderr,"--format                        start an empty store. Everything in it is lost\n");
+	fprintf(stderr,"--compact                       copy live records to the next sector now\n");
+	fprintf(stderr,"--start-address  address        start of the store in the EEPROM (default 0)\n");
+	fprintf(stderr,"--n-bytes        bytes          size of the store (default rest of the EEPROM, less the\n");
+	fprintf(stderr,"                                last 16 bytes for a generation header)\n");
+	fprintf(stderr,"--sectors        sectors        sectors the store is split into (default 4). Must match --format\n");
+	fprintf(stderr,"--i2c-device     device         /dev/ entry for I2C-dev device, or sim:filename for a simulated EEPROM\n");
+	fprintf(stderr,"--i2c-address    chip address   hex address of chip\n");
+	fprintf(stderr,"--device         part           EEPROM part number (default 24LC64). See eeprom_24xx --list-devices\n");
+	fprintf(stderr,"--write-timeout  milliseconds   give up waiting for a page write cycle after milliseconds (default %d)\n",EEPROM_ACK_DEADLINE_US/1000);
+	fprintf(stderr,"--help                          this message\n");
+}
+
+int main(int argc, char **argv) {
+	int c;
+	int command=CMD_NONE;
+	char *argument=NULL;
+	int fromFile=0;
+	int startAddress=0;
+	int nBytes=-1;
+	int sectors=4;
+	int writeTimeout=EEPROM_ACK_DEADLINE_US/1000;
+	char i2cDevice[64];
+	int i2cAddress=0x50;
+	const eeprom_profile *profile=eeprom_profile_find("24LC64");
+	eeprom_dev eeprom;
+	kv_store kv;
+	static uint8_t buf[KV_MAX_VALUE+1];
+	const kv_entry *entry;
+	int i, rc, len;
+
+	strcpy(i2cDevice,"/dev/i2c-1");
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"get",              required_argument, 0, 'g' },
+			{"set",              required_argument, 0, 's' },
+			{"set-file",         required_argument, 0, 'f' },
+			{"delete",           required_argument, 0, 'd' },
+			{"list",             no_argument,       0, 'l' },
+			{"info",             no_argument,       0, 'I' },
+			{"format",           no_argument,       0, 'F' },
+			{"compact",          no_argument,       0, 'C' },
+			{"start-address",    required_argument, 0, 'S' },
+			{"n-bytes",          required_argument, 0, 'n' },
+			{"sectors",          required_argument, 0, 'k' },
+			{"i2c-device",       required_argument, 0, 'i' },
+			{"i2c-address",      required_argument, 0, 'a' },
+			{"device",           required_argument, 0, 'e' },
+			{"write-timeout",    required_argument, 0, 't' },
+			{"help",             no_argument,       0, 'h' },
+			{0,                  0,                 0,  0 }
+		};
+
+		c = getopt_long(argc, argv, "", long_options, &option_index);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'g': command=CMD_GET;     argument=optarg; break;
+			case 's': command=CMD_SET;     argument=optarg; break;
+			case 'f': command=CMD_SET;     argument=optarg; fromFile=1; break;
+			case 'd': command=CMD_DELETE;  argument=optarg; break;
+			case 'l': command=CMD_LIST;    break;
+			case 'I': command=CMD_INFO;    break;
+			case 'F': command=CMD_FORMAT;  break;
+			case 'C': command=CMD_COMPACT; break;
+			case 'S':
+				startAddress=atoi(optarg);
+				break;
+			case 'n':
+				nBytes=atoi(optarg);
+				break;
+			case 'k':
+				sectors=atoi(optarg);
+				if ( sectors<2 || sectors>255 ) {
+					fprintf(stderr,"# sectors out of range (2 to 255)\n# Exiting...\n");
+					exit(1);
+				}
+				break;
+			case 'i':
+				strncpy(i2cDevice,optarg,sizeof(i2cDevice)-1);
+				i2cDevice[sizeof(i2cDevice)-1]='\0';
+				break;
+			case 'a':
+				sscanf(optarg,"%x",&i2cAddress);
+				break;
+			case 'e':
+				profile=eeprom_profile_find(optarg);
+				if ( NULL == profile ) {
+					fprintf(stderr,"# unknown EEPROM part %s. See eeprom_24xx --list-devices\n# Exiting...\n",optarg);
+					exit(1);
+				}
+				break;
+			case 't':
+				writeTimeout=atoi(optarg);
+				if ( writeTimeout<1 || writeTimeout>1000 ) {
+					fprintf(stderr,"# write timeout out of range (1 to 1000 milliseconds)\n# Exiting...\n");
+					exit(1);
+				}
+				break;
+			case 'h':
+				printUsage();
+				exit(0);
+			case '?':
+				exit(1);
+		}
+	}
+
+	if ( CMD_NONE == command ) {
+		printUsage();
+		exit(1);
+	}
+
+	/* key=value, or key=filename with --set-file */
+	if ( CMD_SET == command ) {
+		char *equals = strchr(argument,'=');
+
+		if ( NULL == equals ) {
+			fprintf(stderr,"# --set and --set-file take key=value\n# Exiting...\n");
+			exit(1);
+		}
+		*equals = '\0';
+
+		if ( ! fromFile ) {
+			len = strlen(equals+1);
+			if ( len > KV_MAX_VALUE ) {
+				fprintf(stderr,"# value is longer than %d bytes\n# Exiting...\n",KV_MAX_VALUE);
+				exit(1);
+			}
+			memcpy(buf,equals+1,len);
+		} else {
+			FILE *fp = fopen(equals+1,"r");
+			if ( NULL == fp ) {
+				fprintf(stderr,"# Error opening input file in read mode.\n# %s\n# Exiting...\n",strerror(errno));
+				exit(1);
+			}
+			len = fread(buf,1,sizeof(buf),fp);
+			fclose(fp);
+			if ( len > KV_MAX_VALUE ) {
+				fprintf(stderr,"# value is longer than %d bytes\n# Exiting...\n",KV_MAX_VALUE);
+				exit(1);
+			}
+		}
+	}
+
+	if ( startAddress<0 || startAddress>=profile->capacity ) {
+		fprintf(stderr,"# start address out of range (0 to %d)\n# Exiting...\n",profile->capacity-1);
+		exit(1);
+	}
+	/* by default the store stops short of where a generation header goes, so the two can share a part */
+	if ( -1 == nBytes ) {
+		nBytes=profile->capacity-EEPROM_GEN_BYTES-startAddress;
+	}
+	if ( nBytes<1 || nBytes+startAddress>profile->capacity ) {
+		fprintf(stderr,"# store of %d bytes at %d doesn't fit in %d byte EEPROM\n# Exiting...\n",nBytes,startAddress,profile->capacity);
+		exit(1);
+	}
+
+	if ( 0 != eeprom_open(&eeprom, i2cDevice, i2cAddress, profile, writeTimeout*1000) ) {
+		fprintf(stderr,"# Exiting...\n");
+		exit(1);
+	}
+
+	/* keep the generation header of a part that has one, so cached copies see our writes */
+	rc = eeprom_gen_read(&eeprom);
+	if ( rc < 0 ) {
+		kv_exit(KV_ERR_BUS);
+	}
+	if ( 1 == rc && startAddress+nBytes > eeprom_gen_address(&eeprom) ) {
+		fprintf(stderr,"# store reaches the generation header at %d. Use a smaller --n-bytes\n# Exiting...\n",eeprom_gen_address(&eeprom));
+		exit(1);
+	}
+
+	rc = kv_open(&kv, &eeprom, startAddress, nBytes, sectors);
+	if ( rc < 0 ) {
+		kv_exit(rc);
+	}
+	if ( kv.sectorBytes < kv.headerBytes + profile->pageBytes ) {
+		fprintf(stderr,"# %d byte sectors are too small for %d byte pages. Use fewer --sectors\n# Exiting...\n",kv.sectorBytes,profile->pageBytes);
+		exit(1);
+	}
+
+	if ( CMD_FORMAT == command ) {
+		rc = kv_format(&kv);
+		if ( rc < 0 ) {
+			kv_exit(rc);
+		}
+		fprintf(stderr,"# formatted %d sectors of %d bytes at %d\n",kv.sectors,kv.sectorBytes,kv.start);
+	} else if ( 0 == rc ) {
+		fprintf(stderr,"# no key-value store with %d sectors at %d. Use --format\n# Exiting...\n",sectors,startAddress);
+		exit(1);
+	}
+
+	switch ( command ) {
+		case CMD_GET:
+			entry = kv_find(&kv,argument);
+			if ( NULL == entry ) {
+				fprintf(stderr,"# %s is not set\n",argument);
+				exit(EXIT_NOT_FOUND);
+			}
+			rc = kv_get(&kv,entry,buf);
+			if ( rc < 0 ) {
+				kv_exit(rc);
+			}
+			fwrite(buf,1,rc,stdout);
+			printf("\n");
+			break;
+		case CMD_SET:
+			rc = kv_set(&kv,argument,buf,len);
+			if ( rc < 0 ) {
+				kv_exit(rc);
+			}
+			fprintf(stderr,"# %s %s\n",argument,1 == rc ? "already had that value" : "set");
+			break;
+		case CMD_DELETE:
+			rc = kv_delete(&kv,argument);
+			if ( rc < 0 ) {
+				kv_exit(rc);
+			}
+			if ( 1 == rc ) {
+				fprintf(stderr,"# %s is not set\n",argument);
+				exit(EXIT_NOT_FOUND);
+			}
+			fprintf(stderr,"# %s deleted\n",argument);
+			break;
+		case CMD_LIST:
+			for ( i=0 ; i<kv.nEntries ; i++ ) {
+				printf("%s\t%d\n",kv.entries[i].key,kv.entries[i].valueLen);
+			}
+			break;
+		case CMD_COMPACT:
+			rc = kv_compact(&kv);
+			if ( rc < 0 ) {
+				kv_exit(rc);
+			}
+			/* print where it went */
+			/* fall through */
+		case CMD_INFO:
+			printf("{\"start\":%d,\"sectors\":%d,\"sector_bytes\":%d,\"active\":%d,\"generation\":%u,\"keys\":%d,\"used\":%d,\"free\":%d}\n",
+				kv.start,kv.sectors,kv.sectorBytes,kv.active,kv.generation,kv.nEntries,kv_used(&kv),kv_free(&kv));
+			break;
+	}
+
+	if ( eeprom.ack.pages > 0 ) {
+		fprintf(stderr,"# %lu pages written\n",eeprom.ack.pages);
+	}
+
+	kv_close(&kv);
+	if ( -1 == eeprom_close(&eeprom) ) {
+		fprintf(stderr,"# Error closing I2C device.\n# %s\n# Exiting...\n",strerror(errno));
+		exit(1);
+	}
+
+	exit(0);
+}
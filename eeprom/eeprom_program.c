@@ -0,0 +1,477 @@
+/*
+Production programmer for 24 series EEPROMs on many boards at once. Reads a manifest of
+bus, address and image, writes each image and verifies its CRC32, and reads the MAC address
+from a 24AA02E48 where there is one. See README.md
+
+Devices on the same bus share one thread. A page is written to each device in turn, and the
+write cycle of one device is polled (eeprom_write_check()) while pages go to the others, so
+the bus is kept busy instead of waiting out every write cycle. Each bus has its own thread.
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "eeprom_dev.h"
+#include "crc32.h"
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+#define MAX_TARGETS 128
+
+/* target states */
+#define STATE_WRITE 0
+#define STATE_DONE  1
+#define STATE_ERROR 2
+
+typedef struct {
+	/* from the manifest */
+	int line;
+	char bus[64];
+	int i2cAddress;
+	char image[256];
+	const eeprom_profile *profile;
+	char macBus[64];
+	int macAddress;		/* -1 for none */
+
+	uint8_t *data;
+	int bytes;
+	uint32_t crc;
+
+	eeprom_dev e;
+	int opened;
+	int state;
+	int offset;		/* next byte to write */
+	int inFlight;		/* bytes of the page in its write cycle, 0 if none */
+	uint64_t start_ns;
+	uint64_t end_ns;
+
+	char mac[18];
+	int verified;
+	const char *error;
+} target;
+
+typedef struct {
+	target *t[MAX_TARGETS];
+	int n;
+	pthread_t thread;
+} bus_group;
+
+static target targets[MAX_TARGETS];
+static int nTargets;
+static bus_group groups[MAX_TARGETS];
+static int nGroups;
+static int writeTimeout=EEPROM_ACK_DEADLINE_US/1000;
+static int verify=1;
+
+static void sleep_until(uint64_t ns) {
+	uint64_t now = latency_now_ns();
+	struct timespec t;
+
+	if ( ns <= now )
+		return;
+	t.tv_sec = (ns - now) / 1000000000;
+	t.tv_nsec = (ns - now) % 1000000000;
+	nanosleep(&t,NULL);
+}
+
+static void fail(target *t, const char *error) {
+	t->error = error;
+	t->state = STATE_ERROR;
+	t->end_ns = latency_now_ns();
+}
+
+/* MAC from the 24AA02E48, before writing */
+static int read_mac(target *t) {
+	eeprom_dev m;
+	const eeprom_profile *p = eeprom_profile_find("24AA02E48");
+	uint8_t mac[6];
+	int rc;
+
+	if ( 0 != eeprom_open(&m, t->macBus, t->macAddress, p, writeTimeout*1000) )
+		return -1;
+	rc = eeprom_read(&m, p->macAddress, mac, 6);
+	eeprom_close(&m);
+	if ( 6 != rc )
+		return -1;
+
+	snprintf(t->mac,sizeof(t->mac),"%02x:%02x:%02x:%02x:%02x:%02x",mac[0],mac[1],mac[2],mac[3],mac[4],mac[5]);
+	return 0;
+}
+
+/* all pages written. Read back, end the generation and close */
+static void finish(target *t) {
+	uint8_t chunk[4096];
+	uint32_t crc=0;
+	int done, n;
+
+	if ( verify ) {
+		for ( done=0 ; done<t->bytes ; done += n ) {
+			n = t->bytes - done;
+			if ( n > (int) sizeof(chunk) )
+				n = sizeof(chunk);
+			if ( n != eeprom_read(&t->e, done, chunk, n) ) {
+				fail(t,"No ACK on verify");
+				return;
+			}
+			crc = crc32_update(crc,chunk,n);
+		}
+		if ( crc != t->crc ) {
+			fail(t,"Verify failed");
+			return;
+		}
+		t->verified=1;
+	}
+
+	if ( 0 != eeprom_gen_end(&t->e) ) {
+		fail(t,"No ACK on generation header");
+		return;
+	}
+
+	t->state = STATE_DONE;
+	t->end_ns = latency_now_ns();
+}
+
+/* write page after page to each device, during each other's write cycles */
+static void *program_bus(void *arg) {
+	bus_group *g = arg;
+	target *t;
+	uint64_t wake;
+	int i, n, rc, pending;
+
+	for ( i=0 ; i<g->n ; i++ ) {
+		t = g->t[i];
+		t->start_ns = latency_now_ns();
+
+		if ( t->macAddress >= 0 && 0 != read_mac(t) ) {
+			fail(t,"No ACK from MAC EEPROM");
+			continue;
+		}
+		if ( 0 != eeprom_open(&t->e, t->bus, t->i2cAddress, t->profile, writeTimeout*1000) ) {
+			fail(t,"Error opening I2C device");
+			continue;
+		}
+		t->opened=1;
+
+		/* an image that stops short of the generation header keeps it. One that reaches it replaces it */
+		if ( t->bytes <= eeprom_gen_address(&t->e) && eeprom_gen_read(&t->e) < 0 ) {
+			fail(t,"No ACK");
+			continue;
+		}
+	}
+
+	do {
+		pending=0;
+		wake=UINT64_MAX;
+
+		for ( i=0 ; i<g->n ; i++ ) {
+			t = g->t[i];
+
+			/* until this device is in a write cycle that isn't done */
+			while ( STATE_WRITE == t->state ) {
+				if ( t->inFlight > 0 ) {
+					rc = eeprom_write_check(&t->e);
+					if ( EEPROM_ACK_BUSY == rc ) {
+						if ( t->e.ack.next_ns < wake )
+							wake = t->e.ack.next_ns;
+						pending++;
+						break;
+					}
+					if ( rc < 0 ) {
+						fail(t,"Timeout while polling for write acknowledgement");
+						break;
+					}
+					t->offset += t->inFlight;
+					t->inFlight = 0;
+				}
+
+				if ( t->offset >= t->bytes ) {
+					finish(t);
+					break;
+				}
+
+				n = eeprom_page_room(&t->e, t->offset);
+				if ( n > t->bytes - t->offset )
+					n = t->bytes - t->offset;
+				if ( 0 != eeprom_write_start(&t->e, t->offset, t->data+t->offset, n) ) {
+					fail(t,"No ACK");
+					break;
+				}
+				t->inFlight = n;
+			}
+		}
+
+		if ( pending ) {
+			sleep_until(wake);
+		}
+	} while ( pending );
+
+	for ( i=0 ; i<g->n ; i++ ) {
+		if ( g->t[i]->opened ) {
+			eeprom_close(&g->t[i]->e);
+		}
+	}
+
+	return NULL;
+}
+
+/* bus address image [part [mac]]. mac is address, or device,address. Returns 0, or -1 with a message */
+static int parse_line(target *t, char *s, int line) {
+	char *field[5];
+	char *comma;
+	int n, bytes;
+	FILE *fp;
+
+	for ( n=0 ; n<5 && NULL != (field[n] = strtok(0 == n ? s : NULL," \t\r\n")) ; n++ )
+		;
+	if ( n < 3 ) {
+		fprintf(stderr,"# manifest line %d: needs bus, address and image\n",line);
+		return -1;
+	}
+
+	memset(t,0,sizeof(target));
+	t->line = line;
+	t->macAddress = -1;
+	strncpy(t->bus,field[0],sizeof(t->bus)-1);
+	sscanf(field[1],"%x",&t->i2cAddress);
+	strncpy(t->image,field[2],sizeof(t->image)-1);
+
+	t->profile = eeprom_profile_find(n > 3 ? field[3] : "24LC64");
+	if ( NULL == t->profile ) {
+		fprintf(stderr,"# manifest line %d: unknown EEPROM part %s. See eeprom_24xx --list-devices\n",line,field[3]);
+		return -1;
+	}
+
+	if ( n > 4 && 0 != strcmp(field[4],"-") ) {
+		comma = strrchr(field[4],',');
+		if ( NULL != comma ) {
+			*comma='\0';
+			strncpy(t->macBus,field[4],sizeof(t->macBus)-1);
+			sscanf(comma+1,"%x",&t->macAddress);
+		} else {
+			strcpy(t->macBus,t->bus);
+			sscanf(field[4],"%x",&t->macAddress);
+		}
+	}
+
+	/* whole image in memory. Parts are 256 KB at most */
+	t->data = malloc(t->profile->capacity+1);
+	fp = fopen(t->image,"r");
+	if ( NULL == t->data || NULL == fp ) {
+		fprintf(stderr,"# manifest line %d: error opening image %s.\n# %s\n",line,t->image,strerror(errno));
+		return -1;
+	}
+	bytes = fread(t->data,1,t->profile->capacity+1,fp);
+	fclose(fp);
+	if ( bytes > t->profile->capacity ) {
+		fprintf(stderr,"# manifest line %d: image %s is larger than %d byte %s\n",line,t->image,t->profile->capacity,t->profile->name);
+		return -1;
+	}
+	t->bytes = bytes;
+	t->crc = crc32_update(0,t->data,bytes);
+
+	return 0;
+}
+
+static void json_string(FILE *fp, const char *s) {
+	fputc('"',fp);
+	for ( ; '\0' != *s ; s++ ) {
+		if ( '"' == *s || '\\' == *s ) {
+			fputc('\\',fp);
+		}
+		fputc(*s,fp);
+	}
+	fputc('"',fp);
+}
+
+/* one line of JSON per device */
+static void report(FILE *fp, const target *t) {
+	fprintf(fp,"{\"line\":%d,\"bus\":",t->line);
+	json_string(fp,t->bus);
+	fprintf(fp,",\"address\":\"0x%02x\",\"part\":\"%s\",\"image\":",t->i2cAddress,t->profile->name);
+	json_string(fp,t->image);
+	fprintf(fp,",\"bytes\":%d,\"crc32\":\"0x%08x\",\"verified\":%s",t->bytes,t->crc,t->verified ? "true" : "false");
+	if ( t->macAddress >= 0 ) {
+		fprintf(fp,",\"mac\":\"%s\"",t->mac);
+	}
+	fprintf(fp,",\"pages\":%lu,\"seconds\":%0.3f",t->e.ack.pages,(t->end_ns - t->start_ns) / 1e9);
+	if ( t->e.ack.pages > 0 ) {
+		fprintf(fp,",\"write_cycle_us\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu}",
+			(unsigned long long) latency_quantile(&t->e.ack.hist,0.5) / 1000,
+			(unsigned long long) latency_quantile(&t->e.ack.hist,0.99) / 1000,
+			(unsigned long long) t->e.ack.hist.max_ns / 1000);
+	}
+	if ( STATE_DONE == t->state ) {
+		fprintf(fp,",\"status\":\"ok\"}\n");
+	} else {
+		fprintf(fp,",\"status\":\"error\",\"error\":\"%s\"}\n",t->error);
+	}
+}
+
+void printUsage(void) {
+	fprintf(stderr,"Usage:\n\n");
+	fprintf(stderr,"switch           argument       description\n");
+	fprintf(stderr,"========================================================================================================\n");
+	fprintf(stderr,"--manifest       filename       lines of: bus address image [part [mac address]]\n");
+	fprintf(stderr,"--report         filename       write JSON report to filename instead of stdout\n");
+	fprintf(stderr,"--one-thread                    program every bus from one thread\n");
+	fprintf(stderr,"--write-timeout  milliseconds   give up waiting for a page write cycle after milliseconds (default %d)\n",EEPROM_ACK_DEADLINE_US/1000);
+	fprintf(stderr,"--no-verify                     don't read back and check the CRC32 of what was written\n");
+	fprintf(stderr,"--help                          this message\n");
+}
+
+int main(int argc, char **argv) {
+	int c;
+	char *manifestFilename=NULL;
+	char *reportFilename=NULL;
+	int oneThread=0;
+	char line[512];
+	FILE *fp;
+	int i, j, lineNumber, failed;
+	uint64_t start_ns, end_ns;
+	unsigned long bytes, writeCycle_us;
+
+	fprintf(stderr,"# eeprom_program 24 series EEPROM production programmer\n");
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"manifest",      required_argument, 0, 'm' },
+			{"report",        required_argument, 0, 'r' },
+			{"one-thread",    no_argument,       0, 'o' },
+			{"write-timeout", required_argument, 0, 't' },
+			{"no-verify",     no_argument,       0, 'V' },
+			{"help",          no_argument,       0, 'h' },
+			{0,               0,                 0,  0 }
+		};
+
+		c = getopt_long(argc, argv, "", long_options, &option_index);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'm':
+				manifestFilename=optarg;
+				break;
+			case 'r':
+				reportFilename=optarg;
+				break;
+			case 'o':
+				oneThread=1;
+				break;
+			case 't':
+				writeTimeout=atoi(optarg);
+				if ( writeTimeout<1 || writeTimeout>1000 ) {
+					fprintf(stderr,"# write timeout out of range (1 to 1000 milliseconds)\n# Exiting...\n");
+					exit(1);
+				}
+				break;
+			case 'V':
+				verify=0;
+				break;
+			case 'h':
+				printUsage();
+				exit(0);
+			case '?':
+				exit(1);
+		}
+	}
+
+	if ( NULL == manifestFilename ) {
+		printUsage();
+		exit(1);
+	}
+
+	/* manifest. # starts a comment */
+	fp = fopen(manifestFilename,"r");
+	if ( NULL == fp ) {
+		fprintf(stderr,"# Error opening manifest file in read mode.\n# %s\n# Exiting...\n",strerror(errno));
+		exit(1);
+	}
+	for ( lineNumber=1 ; NULL != fgets(line,sizeof(line),fp) ; lineNumber++ ) {
+		char *hash = strchr(line,'#');
+
+		if ( NULL != hash )
+			*hash = '\0';
+		if ( strspn(line," \t\r\n") == strlen(line) )
+			continue;
+
+		if ( nTargets >= MAX_TARGETS ) {
+			fprintf(stderr,"# more than %d devices in manifest\n# Exiting...\n",MAX_TARGETS);
+			exit(1);
+		}
+		if ( 0 != parse_line(&targets[nTargets], line, lineNumber) ) {
+			fprintf(stderr,"# Exiting...\n");
+			exit(1);
+		}
+		for ( j=0 ; j<nTargets ; j++ ) {
+			if ( 0 == strcmp(targets[j].bus,targets[nTargets].bus) && targets[j].i2cAddress == targets[nTargets].i2cAddress ) {
+				fprintf(stderr,"# manifest line %d: 0x%02x on %s is also on line %d\n# Exiting...\n",lineNumber,targets[j].i2cAddress,targets[j].bus,targets[j].line);
+				exit(1);
+			}
+		}
+		nTargets++;
+	}
+	fclose(fp);
+
+	/* a thread per bus */
+	for ( i=0 ; i<nTargets ; i++ ) {
+		for ( j=0 ; j<nGroups ; j++ ) {
+			if ( oneThread || 0 == strcmp(groups[j].t[0]->bus,targets[i].bus) )
+				break;
+		}
+		if ( j == nGroups )
+			nGroups++;
+		groups[j].t[groups[j].n++] = &targets[i];
+	}
+	fprintf(stderr,"# %d devices on %d %s\n",nTargets,nGroups,oneThread ? "thread" : "buses");
+
+	start_ns = latency_now_ns();
+	for ( i=0 ; i<nGroups ; i++ ) {
+		if ( 0 != pthread_create(&groups[i].thread, NULL, program_bus, &groups[i]) ) {
+			fprintf(stderr,"# Error starting thread.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+	}
+	for ( i=0 ; i<nGroups ; i++ ) {
+		pthread_join(groups[i].thread, NULL);
+	}
+	end_ns = latency_now_ns();
+
+	/* report in manifest order */
+	fp = stdout;
+	if ( NULL != reportFilename ) {
+		fp = fopen(reportFilename,"w");
+		if ( NULL == fp ) {
+			fprintf(stderr,"# Error opening report file in write mode.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+	}
+
+	failed=0;
+	bytes=0;
+	writeCycle_us=0;
+	for ( i=0 ; i<nTargets ; i++ ) {
+		report(fp,&targets[i]);
+		if ( STATE_DONE != targets[i].state ) {
+			fprintf(stderr,"# line %d: 0x%02x on %s: %s\n",targets[i].line,targets[i].i2cAddress,targets[i].bus,targets[i].error);
+			failed++;
+		}
+		bytes += targets[i].e.ack.bytes;
+		writeCycle_us += targets[i].e.ack.hist.sum_ns / 1000;
+	}
+	if ( fp != stdout ) {
+		fclose(fp);
+	}
+
+	fprintf(stderr,"# %lu bytes written in %0.3f seconds, %0.3f seconds of write cycles. %d of %d devices failed\n",
+		bytes,(end_ns - start_ns) / 1e9,writeCycle_us / 1e6,failed,nTargets);
+
+	exit(failed ? 1 : 0);
+}
@@ -0,0 +1,426 @@
+/*
+Log-structured key-value store on an I2C EEPROM. See kv_store.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "kv_store.h"
+#include "crc32.h"
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	put16(p, v & 0xffff);
+	put16(p+2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return get16(p) | ((uint32_t) get16(p+2) << 16);
+}
+
+static int round_page(const kv_store *kv, int n) {
+	int page = kv->e->profile->pageBytes;
+
+	return ((n + page - 1) / page) * page;
+}
+
+static int sector_start(const kv_store *kv, int sector) {
+	return kv->start + sector * kv->sectorBytes;
+}
+
+/* nonce for a new sector generation. Only has to differ from the last few */
+static uint32_t new_nonce(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return crc32_update((uint32_t) ts.tv_nsec ^ (uint32_t) getpid(), &ts, sizeof(ts));
+}
+
+/* header CRC of a record: nonce, fixed fields and key */
+static uint32_t record_crc(uint32_t nonce, const uint8_t *record, int keyLen) {
+	uint8_t n[4];
+	uint32_t crc;
+
+	put32(n,nonce);
+	crc = crc32_update(0,n,4);
+	crc = crc32_update(crc,record,8);
+	return crc32_update(crc,record+KV_RECORD_BYTES,keyLen);
+}
+
+/* write n bytes at page aligned address, last page first. Returns 0 or a KV_ERR_ */
+static int write_pages(kv_store *kv, int address, const uint8_t *buf, int n) {
+	int page = kv->e->profile->pageBytes;
+	int offset, len, rc;
+
+	for ( offset=((n-1)/page)*page ; offset >= 0 ; offset -= page ) {
+		len = n - offset;
+		if ( len > page )
+			len = page;
+
+		/* eeprom_dev errors have their own numbers. Anything but a timeout is the bus refusing */
+		rc = eeprom_write_page(kv->e, address+offset, buf+offset, len);
+		if ( -2 == rc )
+			return KV_ERR_TIMEOUT;
+		if ( rc < 0 )
+			return KV_ERR_BUS;
+	}
+
+	return 0;
+}
+
+/* write a record at address. Returns bytes it takes up, or an error */
+static int write_record(kv_store *kv, int address, uint32_t nonce, int type, const char *key, const uint8_t *value, int valueLen) {
+	static uint8_t buf[KV_RECORD_BYTES + KV_MAX_KEY + KV_MAX_VALUE];
+	int keyLen = strlen(key);
+	int n = KV_RECORD_BYTES + keyLen + valueLen;
+	int rc;
+
+	buf[0] = type;
+	buf[1] = keyLen;
+	put16(buf+2,valueLen);
+	put32(buf+4,crc32_update(0,value,valueLen));
+	memcpy(buf+KV_RECORD_BYTES,key,keyLen);
+	memcpy(buf+KV_RECORD_BYTES+keyLen,value,valueLen);
+	put32(buf+8,record_crc(nonce,buf,keyLen));
+
+	rc = write_pages(kv,address,buf,n);
+	if ( rc < 0 )
+		return rc;
+
+	return round_page(kv,n);
+}
+
+static int write_header(kv_store *kv, int sector, uint16_t generation, uint32_t nonce) {
+	uint8_t buf[KV_HEADER_BYTES];
+
+	put32(buf,KV_MAGIC);
+	put16(buf+4,generation);
+	buf[6] = kv->sectors;
+	buf[7] = KV_VERSION;
+	put32(buf+8,nonce);
+	put32(buf+12,crc32_update(0,buf,12));
+
+	return write_pages(kv,sector_start(kv,sector),buf,KV_HEADER_BYTES);
+}
+
+static kv_entry *find(const kv_store *kv, const char *key) {
+	int i;
+
+	for ( i=0 ; i<kv->nEntries ; i++ ) {
+		if ( 0 == strcmp(kv->entries[i].key,key) )
+			return &kv->entries[i];
+	}
+
+	return NULL;
+}
+
+static void index_set(kv_store *kv, const char *key, int address, int valueLen, uint32_t valueCrc) {
+	kv_entry *entry = find(kv,key);
+
+	if ( NULL == entry ) {
+		if ( kv->nEntries == kv->maxEntries ) {
+			kv->maxEntries = kv->maxEntries ? kv->maxEntries * 2 : 32;
+			kv->entries = realloc(kv->entries, kv->maxEntries * sizeof(kv_entry));
+			if ( NULL == kv->entries ) {
+				fprintf(stderr,"# Error allocating key-value index. Exiting...\n");
+				exit(1);
+			}
+		}
+		entry = &kv->entries[kv->nEntries++];
+		strcpy(entry->key,key);
+	}
+
+	entry->address = address;
+	entry->valueLen = valueLen;
+	entry->valueCrc = valueCrc;
+}
+
+static void index_delete(kv_store *kv, const char *key) {
+	kv_entry *entry = find(kv,key);
+
+	if ( NULL != entry ) {
+		*entry = kv->entries[--kv->nEntries];
+	}
+}
+
+/* read the records of the active sector into the index. Returns 0 or an error */
+static int scan(kv_store *kv) {
+	uint8_t buf[KV_RECORD_BYTES + KV_MAX_KEY];
+	int end = sector_start(kv,kv->active) + kv->sectorBytes;
+	int address, n, keyLen, valueLen;
+	char key[KV_MAX_KEY+1];
+
+	kv->nEntries = 0;
+
+	for ( address = sector_start(kv,kv->active) + kv->headerBytes ; address + KV_RECORD_BYTES <= end ; ) {
+		n = end - address;
+		if ( n > (int) sizeof(buf) )
+			n = sizeof(buf);
+
+		if ( n != eeprom_read(kv->e,address,buf,n) )
+			return KV_ERR_BUS;
+
+		/* the log ends at the first record that isn't one of ours */
+		keyLen = buf[1];
+		valueLen = get16(buf+2);
+		if ( ( KV_SET != buf[0] && KV_DELETE != buf[0] ) || 0 == keyLen || keyLen > KV_MAX_KEY || KV_RECORD_BYTES + keyLen > n ||
+		     valueLen > KV_MAX_VALUE || address + KV_RECORD_BYTES + keyLen + valueLen > end ||
+		     get32(buf+8) != record_crc(kv->nonce,buf,keyLen) )
+			break;
+
+		memcpy(key,buf+KV_RECORD_BYTES,keyLen);
+		key[keyLen] = '\0';
+
+		if ( KV_SET == buf[0] ) {
+			index_set(kv,key,address,valueLen,get32(buf+4));
+		} else {
+			index_delete(kv,key);
+		}
+
+		address += round_page(kv, KV_RECORD_BYTES + keyLen + valueLen);
+	}
+
+	kv->append = address;
+
+	return 0;
+}
+
+static void layout(kv_store *kv, eeprom_dev *e, int start, int bytes, int sectors) {
+	int page = e->profile->pageBytes;
+
+	memset(kv,0,sizeof(kv_store));
+	kv->e = e;
+	kv->start = start;
+	kv->bytes = bytes;
+	kv->sectors = sectors;
+	kv->sectorBytes = ((bytes / sectors) / page) * page;
+	kv->headerBytes = round_page(kv,KV_HEADER_BYTES);
+	kv->active = -1;
+}
+
+int kv_open(kv_store *kv, eeprom_dev *e, int start, int bytes, int sectors) {
+	uint8_t buf[KV_HEADER_BYTES];
+	uint16_t generation;
+	int i;
+
+	layout(kv,e,start,bytes,sectors);
+
+	/* newest sector with a good header. Generations wrap, so compare the difference */
+	for ( i=0 ; i<kv->sectors ; i++ ) {
+		if ( KV_HEADER_BYTES != eeprom_read(e,sector_start(kv,i),buf,KV_HEADER_BYTES) )
+			return KV_ERR_BUS;
+
+		if ( KV_MAGIC != get32(buf) || kv->sectors != buf[6] || KV_VERSION != buf[7] || get32(buf+12) != crc32_update(0,buf,12) )
+			continue;
+
+		generation = get16(buf+4);
+		if ( -1 == kv->active || (int16_t) (generation - kv->generation) > 0 ) {
+			kv->active = i;
+			kv->generation = generation;
+			kv->nonce = get32(buf+8);
+		}
+	}
+
+	if ( -1 == kv->active )
+		return 0;
+
+	i = scan(kv);
+	if ( i < 0 )
+		return i;
+
+	return 1;
+}
+
+void kv_close(kv_store *kv) {
+	free(kv->entries);
+	kv->entries = NULL;
+	kv->nEntries = kv->maxEntries = 0;
+}
+
+int kv_format(kv_store *kv) {
+	uint8_t zero[KV_HEADER_BYTES];
+	int i, rc;
+
+	/* other headers first, so an older store can't win if we stop part way */
+	memset(zero,0,sizeof(zero));
+	for ( i=1 ; i<kv->sectors ; i++ ) {
+		rc = write_pages(kv,sector_start(kv,i),zero,KV_HEADER_BYTES);
+		if ( rc < 0 )
+			return rc;
+	}
+
+	kv->active = 0;
+	kv->generation = 1;
+	kv->nonce = new_nonce();
+	rc = write_header(kv,0,kv->generation,kv->nonce);
+	if ( rc < 0 )
+		return rc;
+
+	kv->nEntries = 0;
+	kv->append = sector_start(kv,0) + kv->headerBytes;
+
+	return 0;
+}
+
+const kv_entry *kv_find(const kv_store *kv, const char *key) {
+	return find(kv,key);
+}
+
+int kv_get(kv_store *kv, const kv_entry *entry, uint8_t *value) {
+	int offset = entry->address + KV_RECORD_BYTES + strlen(entry->key);
+
+	if ( entry->valueLen != eeprom_read(kv->e,offset,value,entry->valueLen) )
+		return KV_ERR_BUS;
+	if ( entry->valueCrc != crc32_update(0,value,entry->valueLen) )
+		return KV_ERR_CRC;
+
+	return entry->valueLen;
+}
+
+/*
+copy live records to the next sector. If key isn't NULL its record is left out, and if value
+isn't NULL too, key is written with value. That makes room for a set or delete that doesn't
+fit, and it only takes effect when the new header is written
+*/
+static int compact(kv_store *kv, const char *key, const uint8_t *value, int valueLen) {
+	static uint8_t buf[KV_MAX_VALUE];
+	int sector = (kv->active + 1) % kv->sectors;
+	uint16_t generation = kv->generation + 1;
+	uint32_t nonce = new_nonce();
+	int address = sector_start(kv,sector) + kv->headerBytes;
+	int end = sector_start(kv,sector) + kv->sectorBytes;
+	int i, n, rc;
+
+	for ( i=0 ; i<kv->nEntries ; i++ ) {
+		kv_entry *entry = &kv->entries[i];
+
+		if ( NULL != key && 0 == strcmp(entry->key,key) )
+			continue;
+
+		rc = kv_get(kv,entry,buf);
+		if ( KV_ERR_CRC == rc ) {
+			fprintf(stderr,"# WARNING: value of %s doesn't match its CRC. Dropped by compaction.\n",entry->key);
+			continue;
+		}
+		if ( rc < 0 )
+			return rc;
+
+		n = round_page(kv, KV_RECORD_BYTES + strlen(entry->key) + entry->valueLen);
+		if ( address + n > end )
+			return KV_ERR_FULL;
+
+		rc = write_record(kv,address,nonce,KV_SET,entry->key,buf,entry->valueLen);
+		if ( rc < 0 )
+			return rc;
+		address += rc;
+	}
+
+	if ( NULL != key && NULL != value ) {
+		n = round_page(kv, KV_RECORD_BYTES + strlen(key) + valueLen);
+		if ( address + n > end )
+			return KV_ERR_FULL;
+
+		rc = write_record(kv,address,nonce,KV_SET,key,value,valueLen);
+		if ( rc < 0 )
+			return rc;
+	}
+
+	/* switch over */
+	rc = write_header(kv,sector,generation,nonce);
+	if ( rc < 0 )
+		return rc;
+
+	kv->active = sector;
+	kv->generation = generation;
+	kv->nonce = nonce;
+
+	/* index again for the record addresses in the new sector */
+	return scan(kv);
+}
+
+int kv_compact(kv_store *kv) {
+	return compact(kv,NULL,NULL,0);
+}
+
+int kv_set(kv_store *kv, const char *key, const uint8_t *value, int valueLen) {
+	static uint8_t current[KV_MAX_VALUE];
+	const kv_entry *entry;
+	int n, rc;
+
+	if ( 0 == strlen(key) || strlen(key) > KV_MAX_KEY || valueLen > KV_MAX_VALUE )
+		return KV_ERR_SIZE;
+
+	n = round_page(kv, KV_RECORD_BYTES + strlen(key) + valueLen);
+	if ( n > kv->sectorBytes - kv->headerBytes )
+		return KV_ERR_SIZE;
+
+	/* already has that value. Costs a read of the value instead of a write */
+	entry = find(kv,key);
+	if ( NULL != entry && entry->valueLen == valueLen && entry->valueCrc == crc32_update(0,value,valueLen) &&
+	     valueLen == kv_get(kv,entry,current) && 0 == memcmp(current,value,valueLen) )
+		return 1;
+
+	/* no room at the end of the log. The new value goes in with the compacted records */
+	if ( kv->append + n > sector_start(kv,kv->active) + kv->sectorBytes )
+		return compact(kv,key,value,valueLen);
+
+	rc = write_record(kv,kv->append,kv->nonce,KV_SET,key,value,valueLen);
+	if ( rc < 0 )
+		return rc;
+
+	index_set(kv,key,kv->append,valueLen,crc32_update(0,value,valueLen));
+	kv->append += rc;
+
+	return 0;
+}
+
+int kv_delete(kv_store *kv, const char *key) {
+	int n, rc;
+
+	if ( NULL == find(kv,key) )
+		return 1;
+
+	/* no room for a delete record. Compacting without the key deletes it */
+	n = round_page(kv, KV_RECORD_BYTES + strlen(key));
+	if ( kv->append + n > sector_start(kv,kv->active) + kv->sectorBytes )
+		return compact(kv,key,NULL,0);
+
+	rc = write_record(kv,kv->append,kv->nonce,KV_DELETE,key,NULL,0);
+	if ( rc < 0 )
+		return rc;
+
+	index_delete(kv,key);
+	kv->append += rc;
+
+	return 0;
+}
+
+int kv_used(const kv_store *kv) {
+	return kv->append - sector_start(kv,kv->active) - kv->headerBytes;
+}
+
+int kv_free(const kv_store *kv) {
+	return sector_start(kv,kv->active) + kv->sectorBytes - kv->append;
+}
+
+const char *kv_strerror(int err) {
+	switch ( err ) {
+		case KV_ERR_BUS:     return "No ACK!";
+		case KV_ERR_TIMEOUT: return "Timeout while polling for write acknowledgement!";
+		case KV_ERR_CRC:     return "Value doesn't match its CRC!";
+		case KV_ERR_FULL:    return "Key-value store is full!";
+		case KV_ERR_SIZE:    return "Key or value too long!";
+	}
+	return "Unknown error!";
+}
@@ -0,0 +1,111 @@
+#ifndef APRSi2C_EEPROM_KV_STORE_H
+#define APRSi2C_EEPROM_KV_STORE_H
+/*
+Log-structured key-value store in a region of an I2C EEPROM.
+
+The region is split into sectors. One sector is active at a time and holds a log of records
+that start on page boundaries, so a small set writes one page and never rewrites a page that
+holds another record. A later record for a key replaces an earlier one, and a delete record
+removes it.
+
+When a set or delete doesn't fit in the active sector, the live records are copied to the
+next sector with the change applied, and its header, with a generation one higher, is
+written last. Sectors are used in turn, which spreads the writes over the whole region. A
+crash part way through leaves the old sector active.
+
+Each sector header has a random nonce that goes into the header CRC of every record written
+for it. Records left behind by an earlier use of the sector, or by a compaction that didn't
+finish, don't check out, so the log ends at the first record that doesn't. Record pages are
+written last to first, so a record with a good header is whole.
+
+kv_open() reads the sector headers and then only the header and key of each record, to build
+an index in RAM. kv_get() reads just the value and checks its CRC.
+
+sector header, 16 bytes, little endian:
+	0  magic "AKV1"
+	4  generation	uint16
+	6  sectors	uint8
+	7  version	uint8
+	8  nonce	uint32
+	12 crc32 of bytes 0 to 11
+
+record, 12 byte header then key and value:
+	0  type		uint8, KV_SET or KV_DELETE
+	1  key length	uint8
+	2  value length	uint16
+	4  crc32 of value
+	8  crc32 of nonce, bytes 0 to 7, and key
+*/
+#include <stdint.h>
+#include "eeprom_dev.h"
+
+#define KV_MAGIC        0x31564b41	/* "AKV1" */
+#define KV_VERSION      1
+#define KV_HEADER_BYTES 16
+#define KV_RECORD_BYTES 12
+#define KV_MAX_KEY      64
+#define KV_MAX_VALUE    4096
+
+/* record types */
+#define KV_SET    0x5a
+#define KV_DELETE 0xa5
+
+/* errors */
+#define KV_ERR_BUS     -1	/* not acknowledged */
+#define KV_ERR_TIMEOUT -2	/* write cycle didn't finish */
+#define KV_ERR_CRC     -3	/* value doesn't match its CRC */
+#define KV_ERR_FULL    -4	/* live records don't fit in a sector */
+#define KV_ERR_SIZE    -5	/* key or value too long */
+
+typedef struct {
+	char key[KV_MAX_KEY+1];
+	int address;		/* of record */
+	int valueLen;
+	uint32_t valueCrc;
+} kv_entry;
+
+typedef struct {
+	eeprom_dev *e;
+	int start;		/* region */
+	int bytes;
+	int sectors;
+	int sectorBytes;
+	int headerBytes;	/* header rounded up to whole pages */
+
+	int active;		/* sector, -1 if there is no store */
+	uint16_t generation;
+	uint32_t nonce;
+	int append;		/* address of next record */
+
+	kv_entry *entries;
+	int nEntries;
+	int maxEntries;
+} kv_store;
+
+/*
+find the active sector of the store in bytes at start of e, and index its records. Returns 1 if
+there is a store, 0 if there isn't (see kv_format()), or an error
+*/
+int kv_open(kv_store *kv, eeprom_dev *e, int start, int bytes, int sectors);
+void kv_close(kv_store *kv);
+
+/* empty store in the first sector. Headers of the other sectors are cleared. Returns 0 or an error */
+int kv_format(kv_store *kv);
+
+/* entry of key, NULL if not set */
+const kv_entry *kv_find(const kv_store *kv, const char *key);
+/* value of entry into value (entry->valueLen bytes). Returns length or an error */
+int kv_get(kv_store *kv, const kv_entry *entry, uint8_t *value);
+/* returns 0 if written, 1 if key already had that value, or an error */
+int kv_set(kv_store *kv, const char *key, const uint8_t *value, int valueLen);
+/* returns 0 if deleted, 1 if key wasn't set, or an error */
+int kv_delete(kv_store *kv, const char *key);
+/* copy live records to the next sector. Returns 0 or an error */
+int kv_compact(kv_store *kv);
+
+/* bytes of the active sector used by records and free for more */
+int kv_used(const kv_store *kv);
+int kv_free(const kv_store *kv);
+
+const char *kv_strerror(int err);
+#endif
@@ -0,0 +1,206 @@
+/*
+Write-back page cache over a small I2C memory. See page_cache.h
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "page_cache.h"
+
+int page_cache_init(page_cache *pc, int capacity, int pageBytes, page_cache_read_fn readFn, page_cache_write_fn writeFn, page_cache_sync_fn syncFn, void *ctx) {
+	memset(pc,0,sizeof(page_cache));
+	pc->readFn=readFn;
+	pc->writeFn=writeFn;
+	pc->syncFn=syncFn;
+	pc->ctx=ctx;
+	pc->capacity=capacity;
+	pc->pageBytes=pageBytes;
+	pc->pages=(capacity + pageBytes - 1) / pageBytes;
+
+	if ( pageBytes < 1 || pageBytes > PAGE_CACHE_MAX_PAGE )
+		return -1;
+
+	pc->data = malloc(capacity);
+	pc->valid = calloc(pc->pages,1);
+	pc->dirtyLo = calloc(pc->pages,sizeof(int));
+	pc->dirtyHi = calloc(pc->pages,sizeof(int));
+	if ( NULL == pc->data || NULL == pc->valid || NULL == pc->dirtyLo || NULL == pc->dirtyHi ) {
+		page_cache_free(pc);
+		return -1;
+	}
+
+	pthread_mutex_init(&pc->lock,NULL);
+	return 0;
+}
+
+void page_cache_free(page_cache *pc) {
+	free(pc->data);
+	free(pc->valid);
+	free(pc->dirtyLo);
+	free(pc->dirtyHi);
+	pc->data=NULL;
+	pc->valid=NULL;
+	pc->dirtyLo=pc->dirtyHi=NULL;
+}
+
+static int page_end(const page_cache *pc, int page) {
+	int end = (page+1) * pc->pageBytes;
+
+	return ( end > pc->capacity ) ? pc->capacity : end;
+}
+
+static int dirty(const page_cache *pc, int page) {
+	return pc->dirtyLo[page] != pc->dirtyHi[page];
+}
+
+/* read pages first to last-1 that we don't have, a run at a time, keeping dirty bytes */
+static int load_pages(page_cache *pc, int first, int last) {
+	uint8_t pageBuf[PAGE_CACHE_MAX_PAGE];
+	int page, run, start, end, rc;
+
+	page = first;
+	while ( page < last ) {
+		if ( pc->valid[page] ) {
+			page++;
+			continue;
+		}
+
+		start = page * pc->pageBytes;
+
+		if ( dirty(pc,page) ) {
+			/* on its own, and only the bytes around the dirty span go in */
+			end = page_end(pc,page);
+			rc = pc->readFn(pc->ctx, start, pageBuf, end-start);
+			if ( rc < 0 )
+				return rc;
+			pc->readBytes += end-start;
+
+			memcpy(pc->data+start, pageBuf, pc->dirtyLo[page]);
+			memcpy(pc->data+start+pc->dirtyHi[page], pageBuf+pc->dirtyHi[page], (end-start)-pc->dirtyHi[page]);
+			pc->valid[page]=1;
+			page++;
+			continue;
+		}
+
+		/* clean pages straight into place */
+		for ( run=page ; run<last && ! pc->valid[run] && ! dirty(pc,run) ; run++ )
+			;
+		end = page_end(pc,run-1);
+		rc = pc->readFn(pc->ctx, start, pc->data+start, end-start);
+		if ( rc < 0 )
+			return rc;
+		pc->readBytes += end-start;
+
+		for ( ; page<run ; page++ )
+			pc->valid[page]=1;
+	}
+
+	return 0;
+}
+
+int page_cache_read(page_cache *pc, int offset, uint8_t *buf, int n) {
+	int rc;
+
+	if ( offset >= pc->capacity || n <= 0 )
+		return 0;
+	if ( n > pc->capacity - offset )
+		n = pc->capacity - offset;
+
+	pthread_mutex_lock(&pc->lock);
+	rc = load_pages(pc, offset / pc->pageBytes, (offset + n - 1) / pc->pageBytes + 1);
+	if ( 0 == rc ) {
+		memcpy(buf, pc->data+offset, n);
+		rc = n;
+	}
+	pthread_mutex_unlock(&pc->lock);
+
+	return rc;
+}
+
+int page_cache_write(page_cache *pc, int offset, const uint8_t *buf, int n) {
+	int page, lo, hi, rc=0;
+
+	if ( offset >= pc->capacity || n <= 0 )
+		return 0;
+	if ( n > pc->capacity - offset )
+		n = pc->capacity - offset;
+
+	pthread_mutex_lock(&pc->lock);
+	pc->writes++;
+
+	for ( page = offset / pc->pageBytes ; page * pc->pageBytes < offset + n ; page++ ) {
+		lo = offset - page * pc->pageBytes;
+		if ( lo < 0 )
+			lo = 0;
+		hi = offset + n - page * pc->pageBytes;
+		if ( hi > page_end(pc,page) - page * pc->pageBytes )
+			hi = page_end(pc,page) - page * pc->pageBytes;
+
+		if ( ! dirty(pc,page) ) {
+			pc->dirtyLo[page] = lo;
+			pc->dirtyHi[page] = hi;
+			pc->dirtyPages++;
+		} else {
+			/* a gap between the spans has to come from the device */
+			if ( ! pc->valid[page] && ( hi < pc->dirtyLo[page] || lo > pc->dirtyHi[page] ) ) {
+				rc = load_pages(pc, page, page+1);
+				if ( rc < 0 )
+					break;
+			}
+			if ( lo < pc->dirtyLo[page] )
+				pc->dirtyLo[page] = lo;
+			if ( hi > pc->dirtyHi[page] )
+				pc->dirtyHi[page] = hi;
+		}
+
+		memcpy(pc->data + page * pc->pageBytes + lo, buf + (page * pc->pageBytes + lo - offset), hi-lo);
+	}
+	pthread_mutex_unlock(&pc->lock);
+
+	return ( rc < 0 ) ? rc : n;
+}
+
+int page_cache_flush(page_cache *pc) {
+	int page, start, rc, err=0, written=0;
+
+	pthread_mutex_lock(&pc->lock);
+	for ( page=0 ; page<pc->pages && pc->dirtyPages > 0 ; page++ ) {
+		if ( ! dirty(pc,page) )
+			continue;
+
+		start = page * pc->pageBytes + pc->dirtyLo[page];
+		rc = pc->writeFn(pc->ctx, start, pc->data+start, pc->dirtyHi[page] - pc->dirtyLo[page]);
+		if ( rc < 0 ) {
+			err = rc;
+			continue;
+		}
+
+		pc->dirtyLo[page] = pc->dirtyHi[page] = 0;
+		pc->dirtyPages--;
+		pc->pagesFlushed++;
+		written++;
+	}
+
+	if ( written > 0 )
+		pc->unsynced=1;
+	pthread_mutex_unlock(&pc->lock);
+
+	return err;
+}
+
+int page_cache_sync(page_cache *pc) {
+	int rc;
+
+	rc = page_cache_flush(pc);
+	if ( rc < 0 )
+		return rc;
+
+	pthread_mutex_lock(&pc->lock);
+	if ( pc->unsynced && 0 == pc->dirtyPages && NULL != pc->syncFn ) {
+		rc = pc->syncFn(pc->ctx);
+		if ( 0 == rc )
+			pc->unsynced=0;
+	}
+	pthread_mutex_unlock(&pc->lock);
+
+	return rc;
+}
@@ -0,0 +1,70 @@
+#ifndef APRSi2C_EEPROM_PAGE_CACHE_H
+#define APRSi2C_EEPROM_PAGE_CACHE_H
+/*
+Write-back page cache over a small I2C memory: an EEPROM through eeprom_dev, or the RAM of
+a DS1307.
+
+The whole device is held in RAM, which is at most 256 KB for the 24 series. Pages are read
+from the device the first time they are needed, and runs of missing pages are fetched with
+one read. Writes only go into RAM. Each page keeps the span of bytes that are dirty, so
+repeated writes to a page are coalesced into one device write. page_cache_flush() writes
+the dirty span of each page, in address order, with the device's write function. For an
+EEPROM that means eeprom_write_page(), which waits out the write cycle by ack polling.
+page_cache_sync() also calls syncFn once the writes are done. For an EEPROM with a generation
+header that is eeprom_gen_end(), which is left until the device has gone quiet because each
+call writes the header again.
+
+A page written partly, away from its dirty span, is read from the device first, so the
+bytes between the spans are right when the span is written.
+
+All calls take the cache's lock, so a flush thread can run alongside the readers and writers.
+*/
+#include <stdint.h>
+#include <pthread.h>
+
+#define PAGE_CACHE_MAX_PAGE 1024
+
+/* device access. Return bytes, or a negative errno. Writes never cross a page */
+typedef int (*page_cache_read_fn)(void *ctx, int address, uint8_t *buf, int n);
+typedef int (*page_cache_write_fn)(void *ctx, int address, const uint8_t *buf, int n);
+/* called by page_cache_sync() after flushes that wrote pages. May be NULL */
+typedef int (*page_cache_sync_fn)(void *ctx);
+
+typedef struct {
+	page_cache_read_fn readFn;
+	page_cache_write_fn writeFn;
+	page_cache_sync_fn syncFn;
+	void *ctx;
+
+	int capacity;
+	int pageBytes;
+	int pages;
+
+	uint8_t *data;
+	uint8_t *valid;		/* per page, read from the device */
+	int *dirtyLo;		/* per page, dirty span in page. lo == hi if clean */
+	int *dirtyHi;
+	int dirtyPages;
+	int unsynced;		/* pages written since syncFn */
+
+	pthread_mutex_t lock;
+
+	/* statistics */
+	unsigned long readBytes;	/* from the device */
+	unsigned long writes;		/* page_cache_write() calls */
+	unsigned long pagesFlushed;	/* device page writes */
+} page_cache;
+
+/* returns 0, or -1 if out of memory or pageBytes is more than PAGE_CACHE_MAX_PAGE */
+int page_cache_init(page_cache *pc, int capacity, int pageBytes, page_cache_read_fn readFn, page_cache_write_fn writeFn, page_cache_sync_fn syncFn, void *ctx);
+void page_cache_free(page_cache *pc);
+
+/* clipped to capacity. Return bytes, or a negative errno from the device */
+int page_cache_read(page_cache *pc, int offset, uint8_t *buf, int n);
+int page_cache_write(page_cache *pc, int offset, const uint8_t *buf, int n);
+
+/* write dirty spans. Returns 0, or a negative errno. Pages that failed stay dirty */
+int page_cache_flush(page_cache *pc);
+/* flush, then call syncFn if pages were written since it was last called. Returns 0, or a negative errno */
+int page_cache_sync(page_cache *pc);
+#endif
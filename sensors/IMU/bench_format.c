@@ -0,0 +1,73 @@
+/* 
+benchmark of IMU angle formatting. format_fixed() against snprintf("%1.3f") 
+over one million samples of six angles each.
+
+make bench_format && ./bench_format
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "format_number.h"
+
+#define N_SAMPLES 1000000
+#define N_ANGLES  6
+
+static double _seconds(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+	double *angles;
+	char a[FORMAT_FIXED_BUFFER], b[64];
+	struct timespec start, end;
+	double tSnprintf, tFixed;
+	unsigned long checksum=0, mismatch=0;
+	int i;
+
+	angles = malloc(sizeof(double) * N_SAMPLES * N_ANGLES);
+	if ( NULL == angles ) {
+		fprintf(stderr,"# out of memory\n");
+		return 1;
+	}
+
+	/* angles in the range the IMU produces */
+	srand(1);
+	for ( i=0 ; i<N_SAMPLES*N_ANGLES ; i++ ) {
+		angles[i] = ((double) rand() / RAND_MAX - 0.5) * 720.0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for ( i=0 ; i<N_SAMPLES*N_ANGLES ; i++ ) {
+		checksum += snprintf(b,sizeof(b),"%1.3f",angles[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	tSnprintf=_seconds(&start,&end);
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for ( i=0 ; i<N_SAMPLES*N_ANGLES ; i++ ) {
+		checksum += format_fixed(a,angles[i],3);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	tFixed=_seconds(&start,&end);
+
+	/* compare results. snprintf writes -0.000 for small negative values, format_fixed writes 0.000 */
+	for ( i=0 ; i<N_SAMPLES*N_ANGLES ; i++ ) {
+		format_fixed(a,angles[i],3);
+		snprintf(b,sizeof(b),"%1.3f",angles[i]);
+		if ( 0 != strcmp(a,b) && 0 != strcmp(b,"-0.000") ) {
+			mismatch++;
+		}
+	}
+
+	printf("samples             %d (%d angles each)\n",N_SAMPLES,N_ANGLES);
+	printf("snprintf %%1.3f      %0.3f seconds %0.1f ns/sample\n",tSnprintf,tSnprintf*1e9/N_SAMPLES);
+	printf("format_fixed 3      %0.3f seconds %0.1f ns/sample\n",tFixed,tFixed*1e9/N_SAMPLES);
+	printf("speedup             %0.1fx\n",tSnprintf/tFixed);
+	printf("mismatches          %lu\n",mismatch);
+	fprintf(stderr,"# checksum %lu\n",checksum);
+
+	free(angles);
+	return 0;
+}
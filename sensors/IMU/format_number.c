@@ -0,0 +1,110 @@
+/*
+Fixed decimal number formatting for JSON output.
+
+Equivalent to snprintf "%.Nf", but done with integer arithmetic and a two digit
+lookup table instead of the stdio format parser and exact binary to decimal
+conversion. Rounding is half away from zero on the scaled value, so a value that
+is within one ulp of a tie may differ from snprintf in the last digit.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "format_number.h"
+
+static const uint64_t pow10[FORMAT_FIXED_MAX_DECIMALS+1] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+static const char digitPairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* write digits of u right aligned ending at end. Returns pointer to first digit */
+static char *_write_digits(char *end, uint64_t u, int minDigits) {
+	char *p = end;
+
+	while ( u >= 100 ) {
+		unsigned pair = (unsigned) (u % 100) * 2;
+		u /= 100;
+		*--p = digitPairs[pair+1];
+		*--p = digitPairs[pair];
+	}
+	if ( u >= 10 ) {
+		*--p = digitPairs[u*2+1];
+		*--p = digitPairs[u*2];
+	} else {
+		*--p = '0' + u;
+	}
+
+	while ( end - p < minDigits ) {
+		*--p = '0';
+	}
+
+	return p;
+}
+
+/* 
+format value with decimals (0 to FORMAT_FIXED_MAX_DECIMALS) digits after the decimal point.
+s must hold FORMAT_FIXED_BUFFER bytes. Returns length of string.
+Values that are not finite are written as null so the result is always valid JSON.
+*/
+int format_fixed(char *s, double value, int decimals) {
+	char digits[FORMAT_FIXED_BUFFER];
+	char *end = digits + sizeof(digits);
+	char *p, *out = s;
+	double scaled;
+	uint64_t u;
+	int negative = 0;
+
+	if ( ! isfinite(value) ) {
+		return snprintf(s,FORMAT_FIXED_BUFFER,"null");
+	}
+
+	if ( decimals < 0 ) 
+		decimals = 0;
+	if ( decimals > FORMAT_FIXED_MAX_DECIMALS ) 
+		decimals = FORMAT_FIXED_MAX_DECIMALS;
+
+	if ( value < 0.0 ) {
+		negative = 1;
+		value = -value;
+	}
+
+	scaled = value * (double) pow10[decimals] + 0.5;
+
+	/* too big for integer path */
+	if ( scaled >= 9.0e18 ) {
+		return snprintf(s,FORMAT_FIXED_BUFFER,"%.*g",17,negative ? -value : value);
+	}
+
+	u = (uint64_t) scaled;
+
+	if ( negative && 0 != u ) {
+		*out++ = '-';
+	}
+
+	/* integer part, decimal point, fractional part */
+	if ( 0 == decimals ) {
+		p = _write_digits(end,u,1);
+	} else {
+		p = _write_digits(end,u % pow10[decimals],decimals);
+		*--p = '.';
+		p = _write_digits(p,u / pow10[decimals],1);
+	}
+
+	while ( p < end ) {
+		*out++ = *p++;
+	}
+	*out = '\0';
+
+	return out - s;
+}
@@ -0,0 +1,12 @@
+
+#ifndef APRSi2C_SENSORS_IMU_FORMAT_NUMBER_H
+#define APRSi2C_SENSORS_IMU_FORMAT_NUMBER_H
+
+/* most decimals supported by format_fixed() */
+#define FORMAT_FIXED_MAX_DECIMALS 9
+
+/* buffer size that holds any format_fixed() result */
+#define FORMAT_FIXED_BUFFER 32
+
+int format_fixed(char *s, double value, int decimals);
+#endif
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Exercise --data-ready without a board: gpio-sim provides the data-ready line and
+# i2c-stub answers as an LSM9DS1. Needs root, configfs, and i2c-tools.
+#
+# ./gpio_sim_data_ready.sh [rate_hz]
+#
+# Prints the imuToMQTT command to run in another terminal, then toggles the
+# simulated line at rate_hz (default 10) until interrupted.
+
+RATE=${1:-10}
+SIM=/sys/kernel/config/gpio-sim/imuToMQTT
+
+modprobe gpio-sim || exit 1
+modprobe i2c-dev
+modprobe i2c-stub chip_addr=0x1c,0x6a || exit 1
+
+# gpio-sim chip with one line
+if [ ! -d $SIM ]; then
+	mkdir $SIM $SIM/bank0 || exit 1
+	echo 1 > $SIM/bank0/num_lines
+	echo 1 > $SIM/live
+fi
+CHIP=$(cat $SIM/bank0/chip_name)
+PULL=/sys/devices/platform/$(cat $SIM/dev_name)/$CHIP/sim_gpio0/pull
+
+# WHO_AM_I of accelerometer / gyro and magnetometer on the i2c-stub bus
+BUS=$(i2cdetect -l | awk '/SMBus stub/ { sub("i2c-","",$1); print $1; exit }')
+i2cset -y $BUS 0x6a 0x0f 0x68
+i2cset -y $BUS 0x1c 0x0f 0x3d
+
+echo "# run: ./imuToMQTT --stdout --sensors LSM9DS1 --i2c-device /dev/i2c-$BUS --data-ready LSM9DS1=$CHIP:0"
+
+HALF=$(awk "BEGIN { print 0.5 / $RATE }")
+while true; do
+	echo pull-up > $PULL
+	sleep $HALF
+	echo pull-down > $PULL
+	sleep $HALF
+done
@@ -0,0 +1,120 @@
+/*
+Gyro bias estimation while the unit is at rest. See gyro_bias.h
+*/
+
+#include <string.h>
+#include <math.h>
+#include "gyro_bias.h"
+
+#define GYRO_BIAS_REFERENCE_C 25.0
+
+void gyro_bias_init(gyro_bias *g) {
+	int axis;
+
+	memset(g,0,sizeof(gyro_bias));
+
+	/* large initial covariance so the first still samples dominate */
+	for ( axis=0 ; axis<3 ; axis++ ) {
+		g->P[axis][0][0]=1000.0;
+		g->P[axis][1][1]=1000.0;
+	}
+}
+
+/* sum over axes of the variance of the window */
+static double _variance(const double (*v)[3], int n) {
+	double mean, sum, var=0.0;
+	int i, axis;
+
+	for ( axis=0 ; axis<3 ; axis++ ) {
+		mean=0.0;
+		for ( i=0 ; i<n ; i++ )
+			mean += v[i][axis];
+		mean /= n;
+
+		sum=0.0;
+		for ( i=0 ; i<n ; i++ )
+			sum += (v[i][axis]-mean)*(v[i][axis]-mean);
+		var += sum/n;
+	}
+
+	return var;
+}
+
+/* 
+one RLS step of y = theta . x with forgetting factor. While temperature doesn't change the
+slope isn't observed and forgetting would wind its covariance up without limit, so forgetting
+stops once the covariance is back to its initial size 
+*/
+static void _rls(double theta[2], double P[2][2], const double x[2], double y) {
+	double Px[2], denom, k[2], err;
+	double lambda = ( P[0][0] + P[1][1] < 2000.0 ) ? GYRO_BIAS_FORGET : 1.0;
+
+	Px[0] = P[0][0]*x[0] + P[0][1]*x[1];
+	Px[1] = P[1][0]*x[0] + P[1][1]*x[1];
+	denom = lambda + x[0]*Px[0] + x[1]*Px[1];
+	k[0] = Px[0]/denom;
+	k[1] = Px[1]/denom;
+
+	err = y - (theta[0]*x[0] + theta[1]*x[1]);
+	theta[0] += k[0]*err;
+	theta[1] += k[1]*err;
+
+	/* P = (P - k x' P) / lambda. x' P is Px' since P is symmetric */
+	P[0][0] = (P[0][0] - k[0]*Px[0]) / lambda;
+	P[0][1] = (P[0][1] - k[0]*Px[1]) / lambda;
+	P[1][0] = (P[1][0] - k[1]*Px[0]) / lambda;
+	P[1][1] = (P[1][1] - k[1]*Px[1]) / lambda;
+}
+
+int gyro_bias_update(gyro_bias *g, const double rate[3], const double acc[3], double temperatureC) {
+	double bias[3], x[2];
+	int axis;
+
+	memcpy(g->acc[g->next],acc,sizeof(g->acc[0]));
+	memcpy(g->gyro[g->next],rate,sizeof(g->gyro[0]));
+	g->next = (g->next+1) % GYRO_BIAS_WINDOW;
+	if ( g->n < GYRO_BIAS_WINDOW )
+		g->n++;
+
+	g->still=0;
+	if ( g->n < GYRO_BIAS_WINDOW )
+		return 0;
+
+	if ( _variance((const double (*)[3]) g->acc,g->n) > 3*GYRO_BIAS_ACC_STDDEV*GYRO_BIAS_ACC_STDDEV )
+		return 0;
+	if ( _variance((const double (*)[3]) g->gyro,g->n) > 3*GYRO_BIAS_GYRO_STDDEV*GYRO_BIAS_GYRO_STDDEV )
+		return 0;
+
+	/* slow steady rotation has low variance too */
+	gyro_bias_get(g,temperatureC,bias);
+	for ( axis=0 ; axis<3 ; axis++ ) {
+		if ( fabs(rate[axis]-bias[axis]) > GYRO_BIAS_MAX_RATE )
+			return 0;
+	}
+
+	g->still=1;
+
+	x[0]=1.0;
+	x[1]=temperatureC - GYRO_BIAS_REFERENCE_C;
+	for ( axis=0 ; axis<3 ; axis++ ) {
+		_rls(g->theta[axis],g->P[axis],x,rate[axis]);
+	}
+	g->updates++;
+
+	return 1;
+}
+
+int gyro_bias_get(const gyro_bias *g, double temperatureC, double bias[3]) {
+	int axis;
+
+	if ( g->updates < GYRO_BIAS_MIN_UPDATES ) {
+		bias[0]=bias[1]=bias[2]=0.0;
+		return 0;
+	}
+
+	for ( axis=0 ; axis<3 ; axis++ ) {
+		bias[axis] = g->theta[axis][0] + g->theta[axis][1]*(temperatureC - GYRO_BIAS_REFERENCE_C);
+	}
+
+	return 1;
+}
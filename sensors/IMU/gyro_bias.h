@@ -0,0 +1,42 @@
+#ifndef APRSi2C_SENSORS_IMU_GYRO_BIAS_H
+#define APRSi2C_SENSORS_IMU_GYRO_BIAS_H
+/*
+Gyro bias estimation while the unit is at rest.
+
+A stillness detector watches the variance of the accelerometer and gyro over the last
+GYRO_BIAS_WINDOW samples. While still, whatever the gyro reads is bias. Bias of each
+axis is modelled as linear in die temperature,
+
+	bias = b0 + b1 * (temperature - 25)
+
+and fitted by recursive least squares with a forgetting factor, so the model follows
+slow drift and is already correct for a temperature when the unit starts moving.
+*/
+
+#define GYRO_BIAS_WINDOW        16	/* samples in stillness window */
+#define GYRO_BIAS_ACC_STDDEV    0.01	/* g. Accelerometer noise allowed while still */
+#define GYRO_BIAS_GYRO_STDDEV   0.5	/* deg/s. Gyro noise allowed while still */
+#define GYRO_BIAS_MAX_RATE      10.0	/* deg/s. Larger than any bias, so it is rotation */
+#define GYRO_BIAS_FORGET        0.999	/* RLS forgetting factor */
+#define GYRO_BIAS_MIN_UPDATES   GYRO_BIAS_WINDOW	/* still samples before correcting */
+
+typedef struct {
+	/* stillness window */
+	double acc[GYRO_BIAS_WINDOW][3];
+	double gyro[GYRO_BIAS_WINDOW][3];
+	int n;
+	int next;
+	int still;
+
+	/* RLS model of each axis: theta = b0, b1. P is the 2x2 covariance */
+	double theta[3][2];
+	double P[3][2][2];
+	unsigned long updates;
+} gyro_bias;
+
+void gyro_bias_init(gyro_bias *g);
+/* add sample of rate (deg/s), acceleration (g) and temperature (C). Returns 1 if the unit is still */
+int gyro_bias_update(gyro_bias *g, const double rate[3], const double acc[3], double temperatureC);
+/* bias of each axis at temperature. Returns 0 and zeros until the model has enough data */
+int gyro_bias_get(const gyro_bias *g, double temperatureC, double bias[3]);
+#endif
@@ -16,8 +16,16 @@ send IMU data to MQTT
 #include <sys/time.h>
 #include <time.h>
 #include <mosquitto.h>
-#include "sensor_BMP280.h"
-#include "sensor_LSM9DS1.h"
+#include <pthread.h>
+#include <poll.h>
+#include "sensor_driver.h"
+#include "format_number.h"
+#include "capture_log.h"
+#include "gpio_event.h"
+#include "sample_time.h"
+#include "latency.h"
+#include "metrics_http.h"
+#include "shm_latest.h"
 
 int outputDebug=0;
 
@@ -30,8 +38,101 @@ static void _mosquitto_shutdown(void);
 
 static int disable_mqtt_output;
 
+/* sensors sampled each cycle. One per registered driver unless --sensor is used */
+#define SENSOR_MAX 16
+
+static sensor_instance sensors[SENSOR_MAX];
+static int nSensors;
+static int explicitSensors;	/* sensors[] came from --sensor */
+
+/* 
+each I2C bus is sampled by its own worker thread so that slow transfers on one bus
+don't delay the others. The main thread starts a cycle and waits for every bus 
+*/
+typedef struct {
+	char i2cDevice[64];
+	int i2cHandle;
+	pthread_t thread;
+	sensor_instance *sensors[SENSOR_MAX];
+	int nSensors;
+} sensor_bus;
+
+static sensor_bus buses[SENSOR_MAX];
+static int nBuses;
+
+/* LSM9DS1 settings from the command line, copied into each LSM9DS1 instance by _sensor_settings() */
+static LSM9DS1_settings LSM9DS1Settings = LSM9DS1_SETTINGS_DEFAULT;
+
+/* --mag-calibration name=filename gives one sensor its own calibration file */
+typedef struct {
+	char name[32];
+	char filename[256];
+} mag_calibration_file;
+
+static mag_calibration_file magCalFiles[SENSOR_MAX];
+static int nMagCalFiles;
+
+static pthread_mutex_t cycleMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cycleStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cycleDone = PTHREAD_COND_INITIALIZER;
+static unsigned long cycleNumber;
+static int cyclePending;
+static int cycleStop;
+static uint64_t cycleSampleTime;
+
+/* raw capture and replay */
+static char captureFilename[256];
+static char replayFilename[256];
+static capture_log captureLog;
+static capture_log replayLog;
+static int replayMaximumSpeed;
+static double replaySkipSeconds;
+
 /* JSON stuff */
 static char jsonEnclosingArray[256];
+
+/* event mode. Idle until an interrupt generator fires, then sample for eventHold seconds */
+static int eventMode;
+static int eventPollInterval = 1000;	/* milliseconds between source polls while idle */
+static double eventHold = 10.0;
+static char eventGpio[80];
+static gpio_line eventLine;
+static uint64_t eventUntil;		/* sample until this time */
+static int eventSources[SENSOR_MAX];	/* SENSOR_EVENT_* of each sensor this cycle */
+
+/* data-ready mode. Sensors with a line are read when it rises, the others when they have new data */
+static char dataReadySpec[SENSOR_MAX][96];	/* name=chip:line */
+static int nDataReadySpec;
+static gpio_line dataReadyLines[SENSOR_MAX];	/* by sensor. fd is -1 without a line */
+static int dataReadyFired[SENSOR_MAX];
+static uint64_t dataReadyTime[SENSOR_MAX];
+static uint64_t dataReadyEdge[SENSOR_MAX];	/* monotonic ns of edge. 0 if read without one */
+
+/* monotonic to UTC mapping is added to the JSON every clockMapInterval seconds */
+static sample_time_map clockMap;
+static double clockMapInterval = 10.0;
+
+/* per-stage latency. Nothing unless built with make LATENCY=1 */
+LATENCY_HIST(histRead,"i2c_read");
+LATENCY_HIST(histDecode,"decode");
+LATENCY_HIST(histSerialize,"serialize");
+LATENCY_HIST(histJsonString,"json_string");
+LATENCY_HIST(histPublish,"publish");
+LATENCY_HIST(histCycle,"cycle");
+#ifdef LATENCY_STATS
+static double latencyInterval = 60.0;
+#endif
+
+/* Prometheus endpoint */
+static char metricsListen[128];
+static metrics_http metrics;
+static unsigned long cycles;
+static unsigned long cycleOverruns;
+static unsigned long publishFailures;
+
+/* --shm latest value segment */
+static int shmEnabled;
+static shm_latest shmLatest;
 struct json_object *jobj_enclosing,*jobj,*jobj_sensors;
 
 void printUsage(void) {
@@ -41,7 +142,42 @@ void printUsage(void) {
 	fprintf(stderr,"--i2c-device             device         /dev/ entry for I2C-dev device\n");
 	fprintf(stderr,"--i2c-address            chip address   hex address of chip\n");
 	fprintf(stderr,"--json-enclosing-array   array name     wrap data array\n");
+	fprintf(stderr,"--sensors                list           comma separated sensors to sample (default all)\n");
+	fprintf(stderr,"--sensor                 spec           driver[@bus][:address][=name] sample this sensor. Repeat for more\n");
+	fprintf(stderr,"--BMP280-i2c-address     chip address   hex address of BMP280\n");
+	fprintf(stderr,"--LSM9DS1-i2c-address    chip address   hex address of LSM9DS1\n");
 	fprintf(stderr,"--stdout                                no mqtt output \n");
+	fprintf(stderr,"--decimals               digits         digits after decimal point of IMU angles (0-9, default 3)\n");
+	fprintf(stderr,"--json-string-numbers                   send IMU angles as JSON strings (old format)\n");
+	fprintf(stderr,"--gyro-odr               Hz             LSM9DS1 gyro output data rate (default from -s)\n");
+	fprintf(stderr,"--accel-odr              Hz             LSM9DS1 accelerometer output data rate (default from -s)\n");
+	fprintf(stderr,"--mag-odr                Hz             LSM9DS1 magnetometer output data rate (default from -s)\n");
+	fprintf(stderr,"--gyro-range             deg/s          LSM9DS1 gyro full scale 245, 500, or 2000 (default 2000)\n");
+	fprintf(stderr,"--accel-range            g              LSM9DS1 accelerometer full scale 2, 4, 8, or 16 (default 16)\n");
+	fprintf(stderr,"--mag-range              gauss          LSM9DS1 magnetometer full scale 4, 8, 12, or 16 (default 12)\n");
+	fprintf(stderr,"--accel-bandwidth        Hz             LSM9DS1 accelerometer anti-aliasing filter 50, 105, 211, or 408\n");
+	fprintf(stderr,"--gyro-bias                             estimate gyro bias while still and remove it\n");
+	fprintf(stderr,"--event-mode                            idle until motion, then sample at -s\n");
+	fprintf(stderr,"--event-accel-threshold  g              high-passed acceleration that is an event (default 0.5, 0 off)\n");
+	fprintf(stderr,"--event-gyro-threshold   deg/s          rotation rate that is an event (default 30, 0 off)\n");
+	fprintf(stderr,"--event-duration         samples        threshold must be exceeded for samples at ODR (default 0)\n");
+	fprintf(stderr,"--event-poll             mSeconds       poll interrupt sources while idle (default 1000)\n");
+	fprintf(stderr,"--event-gpio             chip:line      wait for INT1 edge on GPIO line instead of polling\n");
+	fprintf(stderr,"--event-hold             seconds        keep sampling after last event (default 10)\n");
+	fprintf(stderr,"--data-ready             name=chip:line sample sensor when its data-ready GPIO line rises. Repeat for more\n");
+	fprintf(stderr,"--clock-interval         seconds        publish monotonic to UTC mapping this often (default 10)\n");
+	fprintf(stderr,"--metrics-listen         address        serve Prometheus metrics on port, address:port, or unix:/path\n");
+	fprintf(stderr,"--shm                                   put latest cycle in shared memory %s for shmLatest\n",SHM_LATEST_NAME_IMU);
+#ifdef LATENCY_STATS
+	fprintf(stderr,"--latency-interval       seconds        publish stage latency histograms this often (default 60)\n");
+#endif
+	fprintf(stderr,"--mag-calibration        [name=]filename load and save magnetometer calibration. Repeat for more\n");
+	fprintf(stderr,"--mag-calibrate                         fit magnetometer calibration while running\n");
+	fprintf(stderr,"--mag-offset-registers                  load hard-iron offset into LSM9DS1 offset registers\n");
+	fprintf(stderr,"--capture                filename       append raw sensor registers to capture log\n");
+	fprintf(stderr,"--replay                 filename       read sensor registers from capture log instead of I2C\n");
+	fprintf(stderr,"--replay-speed           speed          realtime (default) or maximum\n");
+	fprintf(stderr,"--replay-skip            seconds        start replay seconds after start of capture log\n");
 	fprintf(stderr,"-T                       topic          mqtt topic\n");
 	fprintf(stderr,"-H                       host           mqtt topic\n");
 	fprintf(stderr,"-P                       port           mqtt port\n");
@@ -96,6 +232,795 @@ void wait_for_it(int interval ) {
 	/* okay we transition from before to after */
 }
 
+/* sleep so that replayed samples are output at the rate they were captured */
+static void _replay_pace(uint64_t timestamp_usec) {
+	static uint64_t firstRecord, firstWall;
+	uint64_t now = capture_now_usec();
+	int64_t ahead;
+
+	if ( 0 == firstRecord ) {
+		firstRecord=timestamp_usec;
+		firstWall=now;
+		return;
+	}
+
+	ahead = (int64_t) (timestamp_usec - firstRecord) - (int64_t) (now - firstWall);
+	if ( ahead > 0 ) {
+		usleep(ahead);
+	}
+}
+
+/* --mag-calibration [name=]filename. Without name= the file is for every LSM9DS1 */
+static void _mag_calibration_add(const char *arg) {
+	const char *filename = strchr(arg,'=');
+	mag_calibration_file *f;
+
+	if ( NULL == filename || NULL != memchr(arg,'/',filename-arg) ) {
+		strncpy(LSM9DS1Settings.magCalFilename,arg,sizeof(LSM9DS1Settings.magCalFilename)-1);
+		return;
+	}
+
+	if ( SENSOR_MAX == nMagCalFiles || filename-arg >= (int) sizeof(f->name) ) {
+		fprintf(stderr,"# bad --mag-calibration '%s'. Exiting...\n",arg);
+		exit(1);
+	}
+	f=&magCalFiles[nMagCalFiles++];
+	memcpy(f->name,arg,filename-arg);
+	strncpy(f->filename,filename+1,sizeof(f->filename)-1);
+}
+
+/* 
+give an instance its settings and start its state over. A second and later LSM9DS1 without
+a file of its own saves calibration to filename.name so instances don't share one file
+*/
+static int _sensor_settings(sensor_instance *s) {
+	LSM9DS1_settings settings;
+	int i;
+
+	if ( &sensor_driver_LSM9DS1 != s->driver ) 
+		return 0;
+
+	settings = LSM9DS1Settings;
+	for ( i=0 ; i<nMagCalFiles && 0 != strcmp(magCalFiles[i].name,s->name) ; i++ ) 
+		;
+	if ( i < nMagCalFiles ) {
+		memcpy(settings.magCalFilename,magCalFiles[i].filename,sizeof(settings.magCalFilename));
+	} else if ( s->instance > 0 && '\0' != settings.magCalFilename[0] ) {
+		if ( strlen(LSM9DS1Settings.magCalFilename) + strlen(s->name) + 2 > sizeof(settings.magCalFilename) ) {
+			fprintf(stderr,"# --mag-calibration filename too long for %s\n",s->name);
+			return -1;
+		}
+		snprintf(settings.magCalFilename,sizeof(settings.magCalFilename),"%s.%s",LSM9DS1Settings.magCalFilename,s->name);
+	}
+
+	return s->driver->init(s,&settings);
+}
+
+/* 
+instance that a capture record belongs to. When replaying with the default sensors, further 
+instances of a driver found in the log are added as they are found 
+*/
+static sensor_instance *_sensor_find_capture(uint16_t captureDevice) {
+	const sensor_driver *driver;
+	int i;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( sensors[i].enabled && CAPTURE_DEVICE_INSTANCE(captureDevice) == sensors[i].instance &&
+			( CAPTURE_DEVICE_TYPE(captureDevice) == sensors[i].driver->captureDevice || 
+			  CAPTURE_DEVICE_TYPE(captureDevice) == sensors[i].driver->captureSetupDevice ) ) {
+			return &sensors[i];
+		}
+	}
+
+	driver = sensor_driver_find_capture(captureDevice);
+	if ( explicitSensors || NULL == driver || SENSOR_MAX == nSensors || 0 == CAPTURE_DEVICE_INSTANCE(captureDevice) ) 
+		return NULL;
+
+	if ( 0 != sensor_instance_init(&sensors[nSensors],driver,CAPTURE_DEVICE_INSTANCE(captureDevice)) ||
+		0 != _sensor_settings(&sensors[nSensors]) ) {
+		exit(1);
+	}
+	fprintf(stderr,"# replay found %s in capture log\n",sensors[nSensors].name);
+
+	return &sensors[nSensors++];
+}
+
+/* 
+read replay log until we have a complete sample cycle. Raw records are captured with the
+sampleTime of their cycle, not a sensor's data-ready edge, so a change of timestamp is the
+start of the next cycle. Returns 0 at end of log 
+*/
+static int _replay_next_cycle(uint64_t *sampleTime) {
+	capture_record rec;
+	sensor_instance *sensor;
+	size_t previous;
+	int n=0;
+	LATENCY_VAR(t);
+
+	for ( ;; ) {
+		previous=replayLog.position;
+		if ( 0 == capture_log_next(&replayLog,&rec) ) 
+			break;
+
+		if ( n > 0 && rec.timestamp_usec != *sampleTime ) {
+			/* start of next cycle */
+			replayLog.position=previous;
+			break;
+		}
+
+		sensor=_sensor_find_capture(rec.device);
+		if ( NULL == sensor ) {
+			if ( 0 != outputDebug ) {
+				fprintf(stderr,"# replay skipping record with device 0x%04x\n",rec.device);
+			}
+			continue;
+		}
+
+		if ( CAPTURE_DEVICE_TYPE(rec.device) == sensor->driver->captureSetupDevice ) {
+			sensor->driver->load_setup(sensor,rec.data,rec.length);
+			continue;
+		}
+
+		/* drivers accept shorter blocks from older logs */
+		if ( 0 == rec.length || rec.length > sensor->driver->rawBytes ) 
+			continue;
+
+		memcpy(sensor->sample.raw,rec.data,rec.length);
+		sensor->sample.rawLength=rec.length;
+		sensor->sample.timestamp_usec=rec.timestamp_usec;
+		LATENCY_START(t);
+		sensor->driver->decode(sensor,sensor->sample.raw,&sensor->sample);
+		LATENCY_STOP(histDecode,t);
+		sensor->haveSample=1;
+
+		*sampleTime=rec.timestamp_usec;
+		n++;
+	}
+
+	if ( n > 0 && 0 == replayMaximumSpeed ) {
+		_replay_pace(*sampleTime);
+	}
+
+	return n > 0;
+}
+
+/* open replay log, load setup blocks (calibration) from start of log, and seek to start of replay */
+static void _replay_startup(void) {
+	capture_record rec;
+	sensor_instance *sensor;
+	uint64_t firstRecord=0;
+
+	if ( 0 != capture_log_open(&replayLog,replayFilename) ) {
+		exit(1);
+	}
+
+	while ( capture_log_next(&replayLog,&rec) ) {
+		sensor=_sensor_find_capture(rec.device);
+
+		if ( NULL == sensor || CAPTURE_DEVICE_TYPE(rec.device) != sensor->driver->captureSetupDevice ) {
+			/* setup blocks are written before the first raw block */
+			firstRecord=rec.timestamp_usec;
+			break;
+		}
+
+		sensor->driver->load_setup(sensor,rec.data,rec.length);
+	}
+
+	if ( replaySkipSeconds > 0.0 ) {
+		capture_log_seek(&replayLog,(uint64_t) (replaySkipSeconds*1000000.0));
+	} else {
+		capture_log_rewind(&replayLog);
+	}
+}
+
+/* enable comma separated list of sensors and disable the rest */
+static void _sensors_enable(char *list) {
+	char *name;
+	int i;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		sensors[i].enabled=0;
+	}
+
+	for ( name=strtok(list,",") ; NULL != name ; name=strtok(NULL,",") ) {
+		for ( i=0 ; i<nSensors ; i++ ) {
+			if ( 0 == strcasecmp(name,sensors[i].name) ) 
+				break;
+		}
+		if ( i == nSensors ) {
+			fprintf(stderr,"# unknown sensor '%s'. Exiting...\n",name);
+			exit(1);
+		}
+		sensors[i].enabled=1;
+	}
+}
+
+static sensor_instance *_sensor_by_name(const char *name) {
+	int i;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( 0 == strcasecmp(name,sensors[i].name) )
+			return &sensors[i];
+	}
+
+	return NULL;
+}
+
+/* 
+add sensor from driver[@bus][:address][=name]. bus is a number for /dev/i2c-<bus> or a 
+/dev/ entry. First --sensor replaces the default of one of every driver 
+*/
+static void _sensor_add(char *spec) {
+	const sensor_driver *driver;
+	sensor_instance *sensor;
+	char *name, *bus, *address;
+	int i, instance;
+
+	if ( ! explicitSensors ) {
+		for ( i=0 ; i<nSensors ; i++ ) {
+			sensor_instance_free(&sensors[i]);
+		}
+		nSensors=0;
+		explicitSensors=1;
+	}
+
+	if ( SENSOR_MAX == nSensors ) {
+		fprintf(stderr,"# too many sensors. Maximum is %d. Exiting...\n",SENSOR_MAX);
+		exit(1);
+	}
+
+	if ( NULL != (name=strchr(spec,'=')) ) 
+		*name++='\0';
+	if ( NULL != (address=strchr(spec,':')) ) 
+		*address++='\0';
+	if ( NULL != (bus=strchr(spec,'@')) ) 
+		*bus++='\0';
+
+	driver = sensor_driver_find(spec);
+	if ( NULL == driver ) {
+		fprintf(stderr,"# unknown sensor '%s'. Exiting...\n",spec);
+		exit(1);
+	}
+
+	/* instance number distinguishes sensors of the same type in capture logs */
+	for ( i=0, instance=0 ; i<nSensors ; i++ ) {
+		if ( driver == sensors[i].driver ) 
+			instance++;
+	}
+	if ( instance >= CAPTURE_INSTANCE_MAX ) {
+		fprintf(stderr,"# too many %s sensors. Exiting...\n",driver->name);
+		exit(1);
+	}
+
+	sensor=&sensors[nSensors];
+	if ( 0 != sensor_instance_init(sensor,driver,instance) ) {
+		exit(1);
+	}
+
+	if ( NULL != bus && '\0' != bus[0] ) {
+		if ( '/' == bus[0] ) {
+			snprintf(sensor->i2cDevice,sizeof(sensor->i2cDevice),"%s",bus);
+		} else {
+			snprintf(sensor->i2cDevice,sizeof(sensor->i2cDevice),"/dev/i2c-%d",atoi(bus));
+		}
+	}
+	if ( NULL != address && '\0' != address[0] ) {
+		sscanf(address,"%x",&sensor->i2cAddress);
+	}
+	if ( NULL != name && '\0' != name[0] ) {
+		snprintf(sensor->name,sizeof(sensor->name),"%s",name);
+	}
+
+	if ( NULL != _sensor_by_name(sensor->name) ) {
+		fprintf(stderr,"# sensor name '%s' is used more than once. Exiting...\n",sensor->name);
+		exit(1);
+	}
+
+	nSensors++;
+}
+
+/* open each bus used by an enabled sensor once and assign sensors to it */
+static void _buses_startup(void) {
+	sensor_bus *bus;
+	int i, j;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( ! sensors[i].enabled ) 
+			continue;
+
+		for ( j=0 ; j<nBuses ; j++ ) {
+			if ( 0 == strcmp(buses[j].i2cDevice,sensors[i].i2cDevice) ) 
+				break;
+		}
+
+		bus=&buses[j];
+		if ( j == nBuses ) {
+			strcpy(bus->i2cDevice,sensors[i].i2cDevice);
+
+			fprintf(stderr,"# using I2C device %s\n",bus->i2cDevice);
+			bus->i2cHandle = open(bus->i2cDevice, O_RDWR);
+			if ( -1 == bus->i2cHandle ) {
+				fprintf(stderr,"# Error opening I2C device %s.\n# %s\n# Exiting...\n",bus->i2cDevice,strerror(errno));
+				exit(1);
+			}
+
+			/* not using 10 bit addresses */
+			ioctl(bus->i2cHandle, I2C_TENBIT, 0);
+			nBuses++;
+		}
+
+		sensors[i].i2cHandle=bus->i2cHandle;
+		bus->sensors[bus->nSensors++]=&sensors[i];
+	}
+}
+
+/* read and decode sensors of bus that have new data */
+static void _bus_sample(sensor_bus *bus, uint64_t sampleTime) {
+	sensor_instance *sensor;
+	int i, n;
+	LATENCY_VAR(t);
+
+	for ( i=0 ; i<bus->nSensors ; i++ ) {
+		sensor=bus->sensors[i];
+		sensor->newSample=0;
+		n = sensor - sensors;
+
+		if ( nDataReadySpec ) {
+			if ( ! dataReadyFired[n] ) 
+				continue;
+			if ( dataReadyLines[n].fd < 0 && sensor->haveSample && NULL != sensor->driver->data_ready && 0 == sensor->driver->data_ready(sensor) ) 
+				continue;
+		} else if ( sensor->haveSample && NULL != sensor->driver->data_ready && 0 == sensor->driver->data_ready(sensor) ) {
+			continue;
+		}
+
+		LATENCY_START(t);
+		sample_time_start(&sensor->sample.time);
+		sensor->driver->read_raw(sensor,sensor->sample.raw);
+		sensor->reads++;
+		sample_time_end(&sensor->sample.time,nDataReadySpec ? dataReadyEdge[n] : 0,
+			NULL != sensor->driver->output_rate ? sensor->driver->output_rate(sensor) : 0.0);
+		LATENCY_STOP(histRead,t);
+		sensor->sample.rawLength=sensor->driver->rawBytes;
+		sensor->sample.timestamp_usec = nDataReadySpec ? dataReadyTime[n] : sampleTime;
+
+		LATENCY_START(t);
+		sensor->driver->decode(sensor,sensor->sample.raw,&sensor->sample);
+		LATENCY_STOP(histDecode,t);
+		sensor->haveSample=1;
+		sensor->newSample=1;
+	}
+}
+
+static void *_bus_worker(void *arg) {
+	sensor_bus *bus = arg;
+	unsigned long seen = 0;
+	uint64_t sampleTime;
+
+	for ( ;; ) {
+		pthread_mutex_lock(&cycleMutex);
+		while ( seen == cycleNumber && ! cycleStop ) {
+			pthread_cond_wait(&cycleStart,&cycleMutex);
+		}
+		if ( cycleStop ) {
+			pthread_mutex_unlock(&cycleMutex);
+			break;
+		}
+		seen=cycleNumber;
+		sampleTime=cycleSampleTime;
+		pthread_mutex_unlock(&cycleMutex);
+
+		_bus_sample(bus,sampleTime);
+
+		pthread_mutex_lock(&cycleMutex);
+		if ( 0 == --cyclePending ) {
+			pthread_cond_signal(&cycleDone);
+		}
+		pthread_mutex_unlock(&cycleMutex);
+	}
+
+	return NULL;
+}
+
+/* sample every bus. With a single bus the sampling is done by the calling thread */
+static void _buses_sample(uint64_t sampleTime) {
+	if ( 1 == nBuses ) {
+		_bus_sample(&buses[0],sampleTime);
+		return;
+	}
+
+	pthread_mutex_lock(&cycleMutex);
+	cycleSampleTime=sampleTime;
+	cyclePending=nBuses;
+	cycleNumber++;
+	pthread_cond_broadcast(&cycleStart);
+	while ( cyclePending > 0 ) {
+		pthread_cond_wait(&cycleDone,&cycleMutex);
+	}
+	pthread_mutex_unlock(&cycleMutex);
+}
+
+/* read and clear interrupt sources of every sensor that has them. Returns non-zero if any fired */
+static int _events_poll(void) {
+	sensor_instance *s;
+	int i, any = 0;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		s=&sensors[i];
+		eventSources[i]=0;
+		if ( ! s->enabled || NULL == s->driver->event_pending ) 
+			continue;
+
+		eventSources[i] = s->driver->event_pending(s);
+		any |= eventSources[i];
+	}
+
+	if ( any ) {
+		eventUntil = capture_now_usec() + (uint64_t) (eventHold * 1000000.0);
+	}
+
+	return any;
+}
+
+/* program interrupt generators and open GPIO line */
+static void _events_startup(void) {
+	sensor_instance *s;
+	int i, n = 0;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		s=&sensors[i];
+		if ( ! s->enabled || NULL == s->driver->event_configure ) 
+			continue;
+		if ( 0 == s->driver->event_configure(s) ) 
+			n++;
+	}
+
+	if ( 0 == n ) {
+		fputs("# --event-mode needs a sensor with interrupt generators. Exiting...\n",stderr);
+		exit(1);
+	}
+
+	eventLine.fd=-1;
+	if ( eventGpio[0] ) {
+		if ( 0 != gpio_line_parse(eventGpio,&eventLine) || 0 != gpio_line_open(&eventLine,GPIO_EVENT_RISING,"imuToMQTT") ) {
+			exit(1);
+		}
+		fprintf(stderr,"# waiting for events on %s line %u\n",eventLine.chip,eventLine.offset);
+	} else {
+		fprintf(stderr,"# polling for events every %d mSeconds\n",eventPollInterval);
+	}
+}
+
+/* 
+block until an event. Interrupts are latched, so the sources are polled after every GPIO timeout
+as well in case an edge came before the line was requested 
+*/
+static void _events_wait(void) {
+	int rc, waited;
+
+	for ( ;; ) {
+		if ( eventLine.fd >= 0 && metricsListen[0] ) {
+			/* wait in slices so scrapes are answered */
+			for ( waited=0, rc=0 ; 0 == rc && waited < eventPollInterval ; waited+=100 ) {
+				metrics_http_poll(&metrics,0);
+				rc = gpio_line_wait(&eventLine,eventPollInterval-waited < 100 ? eventPollInterval-waited : 100,NULL,NULL);
+			}
+			if ( rc < 0 ) 
+				exit(1);
+		} else if ( eventLine.fd >= 0 ) {
+			rc = gpio_line_wait(&eventLine,eventPollInterval,NULL,NULL);
+			if ( rc < 0 ) 
+				exit(1);
+		} else if ( metricsListen[0] ) {
+			metrics_http_sleep(&metrics,eventPollInterval);
+		} else {
+			usleep(eventPollInterval * 1000);
+		}
+
+		if ( _events_poll() ) 
+			return;
+	}
+}
+
+/* open data-ready line of each --data-ready sensor and route the sensor's data-ready to it */
+static void _data_ready_startup(void) {
+	sensor_instance *s;
+	char name[96], *p;
+	int i, n;
+
+	for ( i=0 ; i<SENSOR_MAX ; i++ ) {
+		dataReadyLines[i].fd=-1;
+	}
+
+	for ( i=0 ; i<nDataReadySpec ; i++ ) {
+		strcpy(name,dataReadySpec[i]);
+		p=strchr(name,'=');
+		if ( NULL == p ) {
+			fprintf(stderr,"# --data-ready %s must be name=chip:line. Exiting...\n",dataReadySpec[i]);
+			exit(1);
+		}
+		*p++='\0';
+
+		s=_sensor_by_name(name);
+		if ( NULL == s || ! s->enabled ) {
+			fprintf(stderr,"# --data-ready sensor %s is not being sampled. Exiting...\n",name);
+			exit(1);
+		}
+		n = s - sensors;
+
+		if ( NULL == s->driver->data_ready_configure || 0 != s->driver->data_ready_configure(s) ) {
+			fprintf(stderr,"# %s has no data-ready output. Exiting...\n",s->name);
+			exit(1);
+		}
+
+		if ( 0 != gpio_line_parse(p,&dataReadyLines[n]) || 0 != gpio_line_open(&dataReadyLines[n],GPIO_EVENT_RISING,"imuToMQTT") ) {
+			exit(1);
+		}
+		fprintf(stderr,"# %s data-ready on %s line %u\n",s->name,dataReadyLines[n].chip,dataReadyLines[n].offset);
+	}
+}
+
+/* 
+wait for data-ready edges. Sets dataReadyFired and dataReadyTime of each sensor and sampleTime to
+the earliest edge. Returns 0 if nothing fired. Data-ready stays high until the sensor is read, so a 
+line found high after a quiet second lost its edge and is read anyhow
+*/
+static int _data_ready_wait(uint64_t *sampleTime) {
+	struct pollfd pfd[SENSOR_MAX];
+	int map[SENSOR_MAX];
+	uint64_t ts, now;
+	int i, nfd = 0, fired = 0, rc;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		dataReadyFired[i]=0;
+		if ( dataReadyLines[i].fd < 0 ) 
+			continue;
+		pfd[nfd].fd=dataReadyLines[i].fd;
+		pfd[nfd].events=POLLIN;
+		pfd[nfd].revents=0;
+		map[nfd++]=i;
+	}
+
+	rc = poll(pfd,nfd,1000);
+	if ( rc < 0 && EINTR != errno ) {
+		fprintf(stderr,"# Error waiting for data-ready. %s\n",strerror(errno));
+		exit(1);
+	}
+
+	now = capture_now_usec();
+	*sampleTime = now;
+
+	for ( i=0 ; i<nfd ; i++ ) {
+		if ( rc > 0 && (pfd[i].revents & POLLIN) ) {
+			/* drain queued edges. Latest one goes with the data that is there now */
+			while ( 1 == gpio_line_wait(&dataReadyLines[map[i]],0,&ts,NULL) ) {
+				dataReadyTime[map[i]] = gpio_timestamp_usec(ts);
+				dataReadyEdge[map[i]] = ts;
+			}
+		} else if ( 0 == rc && 1 == gpio_line_value(&dataReadyLines[map[i]]) ) {
+			dataReadyTime[map[i]] = now;
+			dataReadyEdge[map[i]] = 0;
+		} else {
+			continue;
+		}
+
+		dataReadyFired[map[i]]=1;
+		if ( 0 == fired++ || dataReadyTime[map[i]] < *sampleTime ) 
+			*sampleTime = dataReadyTime[map[i]];
+	}
+
+	if ( 0 == fired ) 
+		return 0;
+
+	/* sensors without a line go along and are read if they have new data */
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( dataReadyLines[i].fd < 0 ) {
+			dataReadyFired[i]=1;
+			dataReadyTime[i]=*sampleTime;
+			dataReadyEdge[i]=0;
+		}
+	}
+
+	return fired;
+}
+
+/* monotonic times of sample and of its bus transfer */
+static struct json_object *_json_sample_time(const sample_time *t) {
+	struct json_object *jobj_time = json_object_new_object();
+
+	json_object_object_add(jobj_time,"sample",json_object_new_int64(t->sample_ns));
+	json_object_object_add(jobj_time,"read_start",json_object_new_int64(t->start_ns));
+	json_object_object_add(jobj_time,"read_end",json_object_new_int64(t->end_ns));
+
+	return jobj_time;
+}
+
+/* UTC of a monotonic time t is t + realtime_ns - monotonic_ns */
+static struct json_object *_json_clock_map(const sample_time_map *m) {
+	struct json_object *jobj_clock = json_object_new_object();
+
+	json_object_object_add(jobj_clock,"monotonic_ns",json_object_new_int64(m->monotonic_ns));
+	json_object_object_add(jobj_clock,"realtime_ns",json_object_new_int64((int64_t) m->monotonic_ns + m->offset_ns));
+	json_object_object_add(jobj_clock,"uncertainty_ns",json_object_new_int64(m->uncertainty_ns));
+
+	return jobj_clock;
+}
+
+/* render metrics for the next scrape */
+static void _metrics_render(uint64_t sampleTime) {
+	sensor_value values[SENSOR_VALUES_MAX];
+	sensor_instance *s;
+	char labels[128];
+	int i, j, n;
+
+	metrics_begin(&metrics);
+
+	metrics_family(&metrics,"imu_cycles_total","counter","Sample cycles published");
+	metrics_value(&metrics,"imu_cycles_total",NULL,cycles);
+	metrics_family(&metrics,"imu_cycle_overruns_total","counter","Cycles that took longer than the sampling interval");
+	metrics_value(&metrics,"imu_cycle_overruns_total",NULL,cycleOverruns);
+	metrics_family(&metrics,"imu_publish_failures_total","counter","MQTT publishes not accepted");
+	metrics_value(&metrics,"imu_publish_failures_total",NULL,publishFailures);
+	metrics_family(&metrics,"imu_last_sample_timestamp_seconds","gauge","Time of last sample cycle");
+	metrics_value(&metrics,"imu_last_sample_timestamp_seconds",NULL,sampleTime / 1e6);
+
+	metrics_family(&metrics,"imu_sensor_value","gauge","Latest decoded value of each sensor");
+	for ( i=0 ; i<nSensors ; i++ ) {
+		s=&sensors[i];
+		if ( ! s->enabled || ! s->haveSample || NULL == s->driver->values ) 
+			continue;
+
+		n = s->driver->values(s,&s->sample,values,SENSOR_VALUES_MAX);
+		for ( j=0 ; j<n ; j++ ) {
+			snprintf(labels,sizeof(labels),"sensor=\"%s\",field=\"%s\"",s->name,values[j].name);
+			metrics_value(&metrics,"imu_sensor_value",labels,values[j].value);
+		}
+	}
+
+	metrics_family(&metrics,"imu_sensor_reads_total","counter","Output register reads of each sensor");
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( ! sensors[i].enabled ) 
+			continue;
+		snprintf(labels,sizeof(labels),"sensor=\"%s\"",sensors[i].name);
+		metrics_value(&metrics,"imu_sensor_reads_total",labels,sensors[i].reads);
+	}
+	metrics_family(&metrics,"imu_bus_errors_total","counter","I2C transfers that failed");
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( ! sensors[i].enabled ) 
+			continue;
+		snprintf(labels,sizeof(labels),"sensor=\"%s\"",sensors[i].name);
+		metrics_value(&metrics,"imu_bus_errors_total",labels,sensors[i].busErrors);
+	}
+	metrics_family(&metrics,"imu_bus_naks_total","counter","I2C transfers not acknowledged");
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( ! sensors[i].enabled ) 
+			continue;
+		snprintf(labels,sizeof(labels),"sensor=\"%s\"",sensors[i].name);
+		metrics_value(&metrics,"imu_bus_naks_total",labels,sensors[i].busNaks);
+	}
+
+#ifdef LATENCY_STATS
+	{
+		static latency_hist * const hists[] = { &histRead, &histDecode, &histSerialize, &histJsonString, &histPublish, &histCycle };
+		static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+		metrics_family(&metrics,"imu_stage_latency_seconds","gauge","Stage latency quantiles since the last --latency-interval");
+		for ( i=0 ; i<(int) (sizeof(hists)/sizeof(hists[0])) ; i++ ) {
+			for ( j=0 ; j<(int) (sizeof(quantiles)/sizeof(quantiles[0])) ; j++ ) {
+				snprintf(labels,sizeof(labels),"stage=\"%s\",quantile=\"%g\"",hists[i]->name,quantiles[j]);
+				metrics_value(&metrics,"imu_stage_latency_seconds",labels,latency_quantile(hists[i],quantiles[j]) / 1e9);
+			}
+		}
+	}
+#endif
+
+	metrics_end(&metrics);
+}
+
+/* first LSM9DS1 and first BMP280 with a sample to the --shm segment */
+static void _shm_write(uint64_t sampleTime) {
+	shm_imu_record r;
+	const sensor_instance *s;
+	int i;
+
+	memset(&r,0,sizeof(r));
+	r.timestamp_usec=sampleTime;
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		s=&sensors[i];
+		if ( ! s->enabled || ! s->haveSample ) 
+			continue;
+
+		if ( &sensor_driver_LSM9DS1 == s->driver && ! (r.valid & SHM_IMU_ATTITUDE) ) {
+			const LSM9DS1_sample_struct *d = &s->sample.u.LSM9DS1;
+
+			r.valid |= SHM_IMU_ATTITUDE;
+			r.monotonic_ns=s->sample.time.sample_ns;
+			memcpy(r.acceleration,d->acc,sizeof(r.acceleration));
+			memcpy(r.gyro_rate,d->gyroRate,sizeof(r.gyro_rate));
+			r.magnetometer[0]=d->magRaw[0];
+			r.magnetometer[1]=d->magRaw[1];
+			r.magnetometer[2]=d->magRaw[2];
+			r.angle[0]=d->CFangle[0];
+			r.angle[1]=d->CFangle[1];
+			r.heading=d->heading;
+			r.still=d->still;
+			if ( d->magCalibrated ) {
+				r.valid |= SHM_IMU_HEADING_TILT;
+				r.heading_compensated=d->tiltHeading;
+			}
+			if ( d->haveTemperature ) {
+				r.valid |= SHM_IMU_TEMPERATURE;
+				r.temperature=d->temperatureC;
+			}
+		} else if ( &sensor_driver_bmp280 == s->driver && ! (r.valid & SHM_IMU_PRESSURE) ) {
+			r.valid |= SHM_IMU_PRESSURE;
+			r.pressure_hpa=s->sample.u.bmp280.pressureHPA;
+			r.pressure_temperature=s->sample.u.bmp280.temperatureC;
+		}
+	}
+
+	shm_latest_write(&shmLatest,&r);
+}
+
+#ifdef LATENCY_STATS
+/* publish histograms on <topic>/latency, or to stderr with --stdout, then start a new interval */
+static void _latency_export(void) {
+	static latency_hist * const hists[] = { &histRead, &histDecode, &histSerialize, &histJsonString, &histPublish, &histCycle };
+	static char buf[32768];
+	static uint64_t next;
+	char topic[sizeof(mqtt_topic)+16];
+	uint64_t now = latency_now_ns();
+	int i, len, rc;
+
+	if ( 0 == next ) 
+		next = now + (uint64_t) (latencyInterval * 1e9);
+	if ( now < next ) 
+		return;
+	next = now + (uint64_t) (latencyInterval * 1e9);
+
+	len = latency_json(buf,sizeof(buf),hists,sizeof(hists)/sizeof(hists[0]));
+	if ( len < 0 ) {
+		fputs("# latency metrics document too large\n",stderr);
+	} else if ( disable_mqtt_output ) {
+		fprintf(stderr,"# %s\n",buf);
+	} else {
+		snprintf(topic,sizeof(topic),"%s/latency",mqtt_topic);
+		rc = mosquitto_publish(mosq,NULL,topic,len,buf,0,0);
+		if ( MOSQ_ERR_SUCCESS != rc ) {
+			publishFailures++;
+			fprintf(stderr,"# mosquitto error %d publishing latency\n",rc);
+		}
+	}
+
+	for ( i=0 ; i<(int) (sizeof(hists)/sizeof(hists[0])) ; i++ ) {
+		latency_reset(hists[i]);
+	}
+}
+#endif
+
+static void _buses_shutdown(void) {
+	int i;
+
+	if ( nBuses > 1 ) {
+		pthread_mutex_lock(&cycleMutex);
+		cycleStop=1;
+		pthread_cond_broadcast(&cycleStart);
+		pthread_mutex_unlock(&cycleMutex);
+
+		for ( i=0 ; i<nBuses ; i++ ) {
+			pthread_join(buses[i].thread,NULL);
+		}
+	}
+
+	for ( i=0 ; i<nBuses ; i++ ) {
+		if ( -1 == close(buses[i].i2cHandle) ) {
+			fprintf(stderr,"# Error closing I2C device.\n# %s\n# Exiting...\n",strerror(errno));
+			exit(1);
+		}
+	}
+}
+
 static struct mosquitto * _mosquitto_startup(void) {
 	char clientid[24];
 	int rc = 0;
@@ -150,6 +1075,10 @@ int m_pub(const char *message ) {
 
 		/* check return status of mosquitto_publish */ 
 		/* this really just checks if mosquitto library accepted the message. Not that it was actually send on the network */
+		if ( MOSQ_ERR_SUCCESS != rc ) {
+			publishFailures++;
+		}
+
 		if ( MOSQ_ERR_SUCCESS == rc ) {
 			/* successful send */
 		} else if ( MOSQ_ERR_INVAL == rc ) {
@@ -182,16 +1111,22 @@ int main(int argc, char **argv) {
 
 	/* I2C stuff */
 	char i2cDevice[64];	/* I2C device name */
-	int LSM9DS1_i2cAddress; 
-	int BMP280_i2cAddress; 
-	int i2cHandle;
-	int opResult = 0;	/* for error checking of operations */
+	sensor_instance *sensor;
+	uint8_t setup[SENSOR_SETUP_MAX];
+	int setupLength;
+	int i;
 	int samplingInterval = 500;	// milliseconds;
 
 	/* sample loop */
 	struct timeval time;
 	struct tm *now;
 	char timestamp[32];
+	uint64_t sampleTime;
+	unsigned long nSamples=0;
+	struct timespec loopStart, loopEnd;
+	uint64_t cycleBegin = 0;
+	LATENCY_VAR(tCycle);
+	LATENCY_VAR(tStage);
 
 
 
@@ -199,11 +1134,15 @@ int main(int argc, char **argv) {
 	fprintf(stderr,"# IMU sensor to MQTT tility\n");
 
 	strcpy(i2cDevice,"/dev/i2c-1"); /* Raspberry PI normal user accessible I2C bus */
-	BMP280_i2cAddress=0x77;		/* default address of BMP280 device is 0x77. It can also be 0x76 */ 	
-	LSM9DS1_i2cAddress=0x12;	/* default address of LSM9DS1 device is TODO I DONT KNOW. */ 	
+
+	/* every registered sensor at its default address */
+	for ( nSensors=0 ; NULL != sensor_drivers[nSensors] && nSensors < SENSOR_MAX ; nSensors++ ) {
+		sensor_instance_init(&sensors[nSensors],sensor_drivers[nSensors],0);
+	}
 
 	strcpy(jsonEnclosingArray,"BerryIMU"); 
 
+
 	while (1) {
 		int this_option_optind = optind ? optind : 1;
 		int option_index = 0;
@@ -213,9 +1152,42 @@ int main(int argc, char **argv) {
 		        {"i2c-device",                       required_argument, 0, 'i' },
 		        {"LSM9DS1-i2c-address",              required_argument, 0, 'l' },
 		        {"BMP280-i2c-address",               required_argument, 0, 'b' },
+		        {"sensors",                          required_argument, 0, 'e' },
+		        {"sensor",                           required_argument, 0, 'n' },
 		        {"help",                             no_argument,       0, 'h' },
 		        {"stdout",                           no_argument,       0, 'N' },
 		        {"samplingInterval",                 required_argument, 0, 's' },
+		        {"decimals",                         required_argument, 0, 'D' },
+		        {"json-string-numbers",              no_argument,       0, 'S' },
+		        {"gyro-odr",                         required_argument, 0, 1000 },
+		        {"accel-odr",                        required_argument, 0, 1001 },
+		        {"mag-odr",                          required_argument, 0, 1002 },
+		        {"gyro-range",                       required_argument, 0, 1003 },
+		        {"accel-range",                      required_argument, 0, 1004 },
+		        {"mag-range",                        required_argument, 0, 1005 },
+		        {"accel-bandwidth",                  required_argument, 0, 1006 },
+		        {"gyro-bias",                        no_argument,       0, 1007 },
+		        {"event-mode",                       no_argument,       0, 1008 },
+		        {"event-accel-threshold",            required_argument, 0, 1009 },
+		        {"event-gyro-threshold",             required_argument, 0, 1010 },
+		        {"event-duration",                   required_argument, 0, 1011 },
+		        {"event-poll",                       required_argument, 0, 1012 },
+		        {"event-gpio",                       required_argument, 0, 1013 },
+		        {"event-hold",                       required_argument, 0, 1014 },
+		        {"data-ready",                       required_argument, 0, 1015 },
+		        {"clock-interval",                   required_argument, 0, 1016 },
+		        {"metrics-listen",                   required_argument, 0, 1018 },
+		        {"shm",                              no_argument,       0, 1019 },
+#ifdef LATENCY_STATS
+		        {"latency-interval",                 required_argument, 0, 1017 },
+#endif
+		        {"mag-calibration",                  required_argument, 0, 'm' },
+		        {"mag-calibrate",                    no_argument,       0, 'M' },
+		        {"mag-offset-registers",             no_argument,       0, 'O' },
+		        {"capture",                          required_argument, 0, 'c' },
+		        {"replay",                           required_argument, 0, 'r' },
+		        {"replay-speed",                     required_argument, 0, 'R' },
+		        {"replay-skip",                      required_argument, 0, 'k' },
 		        {0,                                  0,                 0,  0 }
 		};
 
@@ -242,6 +1214,118 @@ int main(int argc, char **argv) {
 			case 's':
 				samplingInterval = atoi(optarg);
 				break;
+			case 'D':
+				LSM9DS1Settings.jsonDecimals = atoi(optarg);
+				if ( LSM9DS1Settings.jsonDecimals < 0 || LSM9DS1Settings.jsonDecimals > FORMAT_FIXED_MAX_DECIMALS ) {
+					fprintf(stderr,"# --decimals must be 0 to %d\n",FORMAT_FIXED_MAX_DECIMALS);
+					exit(1);
+				}
+				break;
+			case 'S':
+				LSM9DS1Settings.jsonStringNumbers = 1;
+				break;
+			/* LSM9DS1 output data rate and full scale */
+			case 1000:
+				LSM9DS1Settings.config.gyroOdr = atof(optarg);
+				break;
+			case 1001:
+				LSM9DS1Settings.config.accelOdr = atof(optarg);
+				break;
+			case 1002:
+				LSM9DS1Settings.config.magOdr = atof(optarg);
+				break;
+			case 1003:
+				LSM9DS1Settings.config.gyroRange = atof(optarg);
+				break;
+			case 1004:
+				LSM9DS1Settings.config.accelRange = atof(optarg);
+				break;
+			case 1005:
+				LSM9DS1Settings.config.magRange = atof(optarg);
+				break;
+			case 1006:
+				LSM9DS1Settings.config.accelBandwidth = atof(optarg);
+				break;
+			case 1007:
+				LSM9DS1Settings.gyroBias = 1;
+				break;
+			/* event mode */
+			case 1008:
+				eventMode = 1;
+				break;
+			case 1009:
+				LSM9DS1Settings.event.accelThreshold = atof(optarg);
+				break;
+			case 1010:
+				LSM9DS1Settings.event.gyroThreshold = atof(optarg);
+				break;
+			case 1011:
+				LSM9DS1Settings.event.duration = atoi(optarg);
+				break;
+			case 1012:
+				eventPollInterval = atoi(optarg);
+				if ( eventPollInterval < 1 ) 
+					eventPollInterval = 1;
+				break;
+			case 1013:
+				strncpy(eventGpio,optarg,sizeof(eventGpio)-1);
+				eventMode = 1;
+				break;
+			case 1014:
+				eventHold = atof(optarg);
+				break;
+			/* data-ready mode */
+			case 1015:
+				if ( nDataReadySpec >= SENSOR_MAX ) {
+					fprintf(stderr,"# too many --data-ready lines. Maximum is %d\n",SENSOR_MAX);
+					exit(1);
+				}
+				strncpy(dataReadySpec[nDataReadySpec++],optarg,sizeof(dataReadySpec[0])-1);
+				break;
+			case 1016:
+				clockMapInterval = atof(optarg);
+				break;
+			case 1018:
+				strncpy(metricsListen,optarg,sizeof(metricsListen)-1);
+				break;
+			case 1019:
+				shmEnabled=1;
+				break;
+#ifdef LATENCY_STATS
+			case 1017:
+				latencyInterval = atof(optarg);
+				break;
+#endif
+			/* magnetometer calibration */
+			case 'm':
+				_mag_calibration_add(optarg);
+				break;
+			case 'M':
+				LSM9DS1Settings.magCalFit = 1;
+				break;
+			case 'O':
+				LSM9DS1Settings.magCalOffsetRegisters = 1;
+				break;
+			/* capture and replay */
+			case 'c':
+				strncpy(captureFilename,optarg,sizeof(captureFilename)-1);
+				break;
+			case 'r':
+				strncpy(replayFilename,optarg,sizeof(replayFilename)-1);
+				break;
+			case 'R':
+				if ( 0 == strcmp(optarg,"maximum") ) {
+					replayMaximumSpeed=1;
+				} else if ( 0 == strcmp(optarg,"realtime") ) {
+					replayMaximumSpeed=0;
+				} else {
+					fprintf(stderr,"# --replay-speed must be realtime or maximum\n");
+					exit(1);
+				}
+				break;
+			case 'k':
+				replaySkipSeconds = atof(optarg);
+				break;
 			/* getopt / standard program */
 			case '?':
 				/* getopt error of missing argument or unknown option */
@@ -252,10 +1336,18 @@ int main(int argc, char **argv) {
 				break;
 			/* I2C settings */
 			case 'l':
-				sscanf(optarg,"%x",&LSM9DS1_i2cAddress);
+				if ( NULL != (sensor=_sensor_by_name("LSM9DS1")) ) 
+					sscanf(optarg,"%x",&sensor->i2cAddress);
 				break;
 			case 'b':
-				sscanf(optarg,"%x",&BMP280_i2cAddress);
+				if ( NULL != (sensor=_sensor_by_name("bmp280")) ) 
+					sscanf(optarg,"%x",&sensor->i2cAddress);
+				break;
+			case 'e':
+				_sensors_enable(optarg);
+				break;
+			case 'n':
+				_sensor_add(optarg);
 				break;
 			case 'i':
 				strncpy(i2cDevice,optarg,sizeof(i2cDevice)-1);
@@ -294,71 +1386,160 @@ int main(int argc, char **argv) {
 	}
 
 
-	/* start-up verbosity */
-	fprintf(stderr,"# using I2C device %s\n",i2cDevice);
-	fprintf(stderr,"# using BMP280 I2C device address of 0x%02X\n",BMP280_i2cAddress);
-	fprintf(stderr,"# using LSM9DS1 I2C device address of 0x%02X\n",LSM9DS1_i2cAddress);
-
-
-	/* Open I2C bus */
-	i2cHandle = open(i2cDevice, O_RDWR);
+	LSM9DS1Settings.config.samplingInterval = samplingInterval;
+	for ( i=0 ; i<nSensors ; i++ ) {
+		if ( 0 != _sensor_settings(&sensors[i]) ) {
+			exit(1);
+		}
+	}
 
-	if ( -1 == i2cHandle ) {
-		fprintf(stderr,"# Error opening I2C device.\n# %s\n# Exiting...\n",strerror(errno));
+	if ( captureFilename[0] && replayFilename[0] ) {
+		fputs("# --capture and --replay can not be used together\n",stderr);
 		exit(1);
 	}
-	/* not using 10 bit addresses */
-	opResult = ioctl(i2cHandle, I2C_TENBIT, 0);
 
+	if ( replayFilename[0] ) {
+		fprintf(stderr,"# replaying from %s at %s speed\n",replayFilename,replayMaximumSpeed ? "maximum" : "realtime");
+		_replay_startup();
+	} else {
+		/* start-up verbosity. Sensors without a bus of their own are on --i2c-device */
+		for ( i=0 ; i<nSensors ; i++ ) {
+			if ( '\0' == sensors[i].i2cDevice[0] ) {
+				strcpy(sensors[i].i2cDevice,i2cDevice);
+			}
+			if ( sensors[i].enabled ) {
+				fprintf(stderr,"# using %s on %s at I2C device address of 0x%02X\n",sensors[i].name,sensors[i].i2cDevice,sensors[i].i2cAddress);
+			}
+		}
 
+		/* Open I2C buses */
+		_buses_startup();
 
-	fprintf(stderr,"# samplingInterval = %d mSeconds\n",samplingInterval);
 
-	/* I2C running, now initialize / configure hardware */
-	fprintf(stderr,"# initializing and configuring ... ");
+		fprintf(stderr,"# samplingInterval = %d mSeconds\n",samplingInterval);
 
-	fprintf(stderr,"# BMP280 ... ");
-	bmp280_init(i2cHandle,BMP280_i2cAddress);
-	fprintf(stderr,"# BMP280 initialized\n");
+		if ( captureFilename[0] ) {
+			fprintf(stderr,"# capturing raw registers to %s\n",captureFilename);
+			if ( 0 != capture_log_create(&captureLog,captureFilename) ) {
+				exit(1);
+			}
+		}
 
-	fprintf(stderr,"# LSM9DS1 ... ");
-	LSM9DS1_init(i2cHandle,LSM9DS1_i2cAddress);
-	fprintf(stderr,"# LSM9DS1 done\n");
+		/* I2C running, now initialize / configure hardware */
+		fprintf(stderr,"# initializing and configuring ... ");
 
+		for ( i=0 ; i<nSensors ; i++ ) {
+			sensor=&sensors[i];
+			if ( ! sensor->enabled ) 
+				continue;
 
-	/* allow hardware to finish initializing. May not be nescessary. */
-	fprintf(stderr,"# waiting to start\n");
-	sleep(1);
+			fprintf(stderr,"# %s ... ",sensor->name);
+			if ( 0 != sensor->driver->probe(sensor) ) {
+				fprintf(stderr,"# %s not detected. Exiting...\n",sensor->name);
+				exit(1);
+			}
 
+			setupLength = sensor->driver->configure(sensor,setup);
+			fprintf(stderr,"# %s initialized\n",sensor->name);
+
+			if ( captureFilename[0] && setupLength > 0 ) {
+				capture_log_append(&captureLog,CAPTURE_DEVICE_MAKE(sensor->driver->captureSetupDevice,sensor->instance),
+					capture_now_usec(),setup,setupLength);
+			}
+		}
+
+		if ( eventMode && nDataReadySpec ) {
+			fputs("# --event-mode and --data-ready both use the interrupt line. Use one. Exiting...\n",stderr);
+			exit(1);
+		}
+
+		if ( eventMode ) {
+			_events_startup();
+		}
+
+		if ( nDataReadySpec ) {
+			_data_ready_startup();
+		}
+
+		/* one worker thread per bus once there is more than one */
+		for ( i=0 ; nBuses > 1 && i<nBuses ; i++ ) {
+			if ( 0 != pthread_create(&buses[i].thread,NULL,_bus_worker,&buses[i]) ) {
+				fprintf(stderr,"# Error starting worker thread for %s. Exiting...\n",buses[i].i2cDevice);
+				exit(1);
+			}
+		}
+
+
+		/* allow hardware to finish initializing. May not be nescessary. */
+		fprintf(stderr,"# waiting to start\n");
+		sleep(1);
+	}
+
+
+	if ( metricsListen[0] ) {
+		if ( 0 != metrics_http_open(&metrics,metricsListen) ) 
+			exit(1);
+		fprintf(stderr,"# serving metrics on %s\n",metricsListen);
+	}
+
+	if ( shmEnabled && 0 != shm_latest_create(&shmLatest,SHM_LATEST_NAME_IMU,SHM_LATEST_IMU,sizeof(shm_imu_record)) ) {
+		exit(1);
+	}
 
 	/* ready to periodically sample */
 	fprintf(stderr,"# starting sample loop\n");
 	int	rc = 0;
+	clock_gettime(CLOCK_MONOTONIC,&loopStart);
 	while ( 0 == rc ) {
+		if ( replayFilename[0] ) {
+			/* raw registers from capture log */
+			if ( 0 == _replay_next_cycle(&sampleTime) ) {
+				break;
+			}
+			LATENCY_START(tCycle);
+		} else {
+			/* nothing to publish until something happens */
+			if ( eventMode && capture_now_usec() >= eventUntil ) {
+				_events_wait();
+			}
+
+			if ( nDataReadySpec ) {
+				/* timestamp of first data-ready edge */
+				if ( 0 == _data_ready_wait(&sampleTime) ) 
+					continue;
+			} else {
+				wait_for_it(samplingInterval);
+
+				/* timestamp of start of samples */
+				sampleTime = capture_now_usec();
+			}
+
+			/* sample sensors that have new data */
+			cycleBegin = sample_time_now_ns();
+			LATENCY_START(tCycle);
+			_buses_sample(sampleTime);
+
+			/* capture from this thread only, in sensor order, stamped with the cycle for replay */
+			for ( i=0 ; captureFilename[0] && i<nSensors ; i++ ) {
+				sensor=&sensors[i];
+				if ( sensor->enabled && sensor->newSample ) {
+					capture_log_append(&captureLog,CAPTURE_DEVICE_MAKE(sensor->driver->captureDevice,sensor->instance),
+						sampleTime,sensor->sample.raw,sensor->sample.rawLength);
+				}
+			}
+		}
+
 		/* setup JSON objects */
+		LATENCY_START(tStage);
 		jobj_enclosing = json_object_new_object();
 		jobj = json_object_new_object();
 		jobj_sensors = json_object_new_object();
-		jobj_sensors_bmp280 = json_object_new_object();
-		jobj_sensors_LSM9DS1 = json_object_new_object();
-		jobj_sensors_LSM9DS1_gyro = json_object_new_object();
-		jobj_sensors_LSM9DS1_accel = json_object_new_object();
-		jobj_sensors_LSM9DS1_magnet = json_object_new_object();
-
-		wait_for_it(samplingInterval);
-
-
-		/* timestamp of start of samples */
-		gettimeofday(&time, NULL); 
-		now = localtime(&time.tv_sec);
-
-
-		/* sample sensors */
-		bmp280_sample(i2cHandle,BMP280_i2cAddress);
-		LSM9DS1_sample(i2cHandle,LSM9DS1_i2cAddress);
 
 
 		/* pack data into JSON objects */
+		time.tv_sec = sampleTime / 1000000;
+		time.tv_usec = sampleTime % 1000000;
+		now = localtime(&time.tv_sec);
 	        if ( 0 == now ) {
         	        fprintf(stderr,"# error calling localtime() %s",strerror(errno));
 	                exit(1);
@@ -374,46 +1555,124 @@ int main(int argc, char **argv) {
 		);
 		json_object_object_add(jobj,"date",json_object_new_string(timestamp));
 
+		/* replayed samples have no monotonic time to map */
+		if ( ! replayFilename[0] && sample_time_map_due(&clockMap,clockMapInterval) ) 
+			json_object_object_add(jobj,"clock",_json_clock_map(&clockMap));
+
 
 		/* add individual sensors to sensor object */
-		json_object_object_add(jobj_sensors, "bmp280", jobj_sensors_bmp280);
-		json_object_object_add(jobj_sensors, "LSM9DS1", jobj_sensors_LSM9DS1);
+		for ( i=0 ; i<nSensors ; i++ ) {
+			sensor=&sensors[i];
+			if ( sensor->enabled && sensor->haveSample ) {
+				struct json_object *jobj_sensor = json_object_new_object();
+
+				sensor->driver->serialize(sensor,&sensor->sample,jobj_sensor);
+				if ( 0 != sensor->sample.time.sample_ns ) 
+					json_object_object_add(jobj_sensor,"monotonic_ns",_json_sample_time(&sensor->sample.time));
+				json_object_object_add(jobj_sensors, sensor->name, jobj_sensor);
+			}
+		}
 
 		/* add sensors to main JSON object */
 		json_object_object_add(jobj, "sensors", jobj_sensors);
 
+		/* which sensors triggered, then keep sampling while events continue */
+		if ( eventMode && ! replayFilename[0] ) {
+			struct json_object *jobj_event = NULL;
+
+			for ( i=0 ; i<nSensors ; i++ ) {
+				if ( 0 == eventSources[i] ) 
+					continue;
+				if ( NULL == jobj_event ) 
+					jobj_event = json_object_new_object();
+
+				struct json_object *jobj_source = json_object_new_object();
+				json_object_object_add(jobj_source,"accel",json_object_new_boolean(eventSources[i] & SENSOR_EVENT_ACCEL));
+				json_object_object_add(jobj_source,"gyro",json_object_new_boolean(eventSources[i] & SENSOR_EVENT_GYRO));
+				json_object_object_add(jobj_event,sensors[i].name,jobj_source);
+			}
+			if ( NULL != jobj_event ) 
+				json_object_object_add(jobj, "event", jobj_event);
+
+			_events_poll();
+		}
+
 		/* enclose array */
 		json_object_object_add(jobj_enclosing, jsonEnclosingArray, jobj);
 
 
 		/* convert array to string */
+		LATENCY_STOP(histSerialize,tStage);
+		LATENCY_START(tStage);
 		char	*s = (char *) json_object_to_json_string_ext(jobj_enclosing, JSON_C_TO_STRING_PRETTY);
+		LATENCY_STOP(histJsonString,tStage);
 		// printf("%s\n", s);
 
 		/* send to MQTT */
+		LATENCY_START(tStage);
 		rc =  m_pub(s);
+		LATENCY_STOP(histPublish,tStage);
 
 
-		/* release JSON object */
-		json_object_put(jobj_sensors_LSM9DS1);
-		json_object_put(jobj_sensors_LSM9DS1_gyro);
-		json_object_put(jobj_sensors_LSM9DS1_gyro_array);
-		json_object_put(jobj_sensors_LSM9DS1_accel);
-		json_object_put(jobj_sensors_LSM9DS1_accel_array);
-		json_object_put(jobj_sensors_LSM9DS1_magnet);
-		json_object_put(jobj_sensors_LSM9DS1_magnet_array);
-		json_object_put(jobj_sensors_bmp280);
-		json_object_put(jobj_sensors_bmp280_array);
-		json_object_put(jobj_sensors);
-		json_object_put(jobj);
+		/* release JSON objects. Enclosing object owns all of the others */
 		json_object_put(jobj_enclosing);
 
+		nSamples++;
+		LATENCY_STOP(histCycle,tCycle);
+
+		/* a timer cycle that runs past the next tick makes wait_for_it() skip it */
+		cycles++;
+		if ( ! replayFilename[0] && ! nDataReadySpec && sample_time_now_ns() - cycleBegin > (uint64_t) samplingInterval * 1000000 ) 
+			cycleOverruns++;
+
+		if ( metricsListen[0] ) {
+			_metrics_render(sampleTime);
+			metrics_http_poll(&metrics,0);
+		}
+		if ( shmEnabled ) {
+			_shm_write(sampleTime);
+		}
+#ifdef LATENCY_STATS
+		_latency_export();
+#endif
 	}
 
-	/* close I2C */
-	if ( -1 == close(i2cHandle) ) {
-		fprintf(stderr,"# Error closing I2C device.\n# %s\n# Exiting...\n",strerror(errno));
-		exit(1);
+	if ( replayFilename[0] ) {
+		double seconds;
+
+		clock_gettime(CLOCK_MONOTONIC,&loopEnd);
+		seconds = (loopEnd.tv_sec - loopStart.tv_sec) + (loopEnd.tv_nsec - loopStart.tv_nsec) / 1e9;
+		fprintf(stderr,"# replayed %lu samples in %0.3f seconds (%0.0f samples/second)\n",
+			nSamples,seconds,seconds > 0.0 ? nSamples/seconds : 0.0);
+
+		capture_log_close(&replayLog);
+	} else {
+		if ( captureFilename[0] ) {
+			capture_log_close(&captureLog);
+		}
+
+		if ( eventMode ) {
+			gpio_line_close(&eventLine);
+		}
+
+		for ( i=0 ; nDataReadySpec && i<nSensors ; i++ ) {
+			gpio_line_close(&dataReadyLines[i]);
+		}
+
+		/* stop workers and close I2C */
+		_buses_shutdown();
+	}
+
+	if ( metricsListen[0] ) {
+		metrics_http_close(&metrics);
+	}
+
+	if ( shmEnabled ) {
+		shm_latest_close(&shmLatest);
+	}
+
+	for ( i=0 ; i<nSensors ; i++ ) {
+		sensor_instance_free(&sensors[i]);
 	}
 	
 	/* shut down MQTT */
@@ -0,0 +1,454 @@
+/*
+Magnetometer hard-iron / soft-iron calibration by ellipsoid fit. See mag_calibration.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "mag_calibration.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* solve n x n system a x = b in place by Gaussian elimination with partial pivoting. Returns 0 on success */
+static int _solve(double *a, double *b, int n) {
+	int i, j, k, pivot;
+	double t, f;
+
+	for ( k=0 ; k<n ; k++ ) {
+		pivot=k;
+		for ( i=k+1 ; i<n ; i++ ) {
+			if ( fabs(a[i*n+k]) > fabs(a[pivot*n+k]) )
+				pivot=i;
+		}
+		if ( fabs(a[pivot*n+k]) < 1e-12 )
+			return -1;
+
+		if ( pivot != k ) {
+			for ( j=0 ; j<n ; j++ ) {
+				t=a[k*n+j]; a[k*n+j]=a[pivot*n+j]; a[pivot*n+j]=t;
+			}
+			t=b[k]; b[k]=b[pivot]; b[pivot]=t;
+		}
+
+		for ( i=k+1 ; i<n ; i++ ) {
+			f = a[i*n+k] / a[k*n+k];
+			for ( j=k ; j<n ; j++ ) {
+				a[i*n+j] -= f * a[k*n+j];
+			}
+			b[i] -= f * b[k];
+		}
+	}
+
+	for ( k=n-1 ; k>=0 ; k-- ) {
+		t=b[k];
+		for ( j=k+1 ; j<n ; j++ ) {
+			t -= a[k*n+j] * b[j];
+		}
+		b[k] = t / a[k*n+k];
+	}
+
+	return 0;
+}
+
+/* eigenvalues d and eigenvectors (columns of v) of symmetric 3x3 a by cyclic Jacobi rotation */
+static void _eigen3(const double a[3][3], double d[3], double v[3][3]) {
+	double m[3][3];
+	int i, j, p, q, sweep;
+	double theta, t, c, s, mpq;
+
+	memcpy(m,a,sizeof(m));
+	for ( i=0 ; i<3 ; i++ )
+		for ( j=0 ; j<3 ; j++ )
+			v[i][j] = (i == j);
+
+	for ( sweep=0 ; sweep<50 ; sweep++ ) {
+		if ( fabs(m[0][1]) + fabs(m[0][2]) + fabs(m[1][2]) < 1e-15 )
+			break;
+
+		for ( p=0 ; p<2 ; p++ ) {
+			for ( q=p+1 ; q<3 ; q++ ) {
+				mpq=m[p][q];
+				if ( 0.0 == mpq )
+					continue;
+
+				theta = (m[q][q] - m[p][p]) / (2.0 * mpq);
+				t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta*theta + 1.0));
+				c = 1.0 / sqrt(t*t + 1.0);
+				s = t * c;
+
+				/* m = Jt m J */
+				for ( i=0 ; i<3 ; i++ ) {
+					double mip = m[i][p], miq = m[i][q];
+					m[i][p] = c*mip - s*miq;
+					m[i][q] = s*mip + c*miq;
+				}
+				for ( i=0 ; i<3 ; i++ ) {
+					double mpi = m[p][i], mqi = m[q][i];
+					m[p][i] = c*mpi - s*mqi;
+					m[q][i] = s*mpi + c*mqi;
+				}
+				for ( i=0 ; i<3 ; i++ ) {
+					double vip = v[i][p], viq = v[i][q];
+					v[i][p] = c*vip - s*viq;
+					v[i][q] = s*vip + c*viq;
+				}
+			}
+		}
+	}
+
+	for ( i=0 ; i<3 ; i++ )
+		d[i]=m[i][i];
+}
+
+/*
+least squares fit of a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1.
+Samples are centered and scaled first so the normal equations stay well conditioned.
+*/
+int mag_calibration_fit(const double (*samples)[3], int n, mag_calibration *cal) {
+	double mean[3]={0.0,0.0,0.0}, scale=0.0;
+	double ata[81], atb[9], phi[9];
+	double A[3][3], center[3], k, d[3], v[3][3], det, norm;
+	double r, sum2, maxEigen, minEigen;
+	int i, j, l;
+
+	if ( n < MAG_CAL_MIN_SAMPLES )
+		return -1;
+
+	for ( i=0 ; i<n ; i++ )
+		for ( j=0 ; j<3 ; j++ )
+			mean[j] += samples[i][j] / n;
+	for ( i=0 ; i<n ; i++ )
+		for ( j=0 ; j<3 ; j++ )
+			if ( fabs(samples[i][j]-mean[j]) > scale )
+				scale = fabs(samples[i][j]-mean[j]);
+	if ( scale < 1.0 )
+		return -1;
+
+	memset(ata,0,sizeof(ata));
+	memset(atb,0,sizeof(atb));
+	for ( i=0 ; i<n ; i++ ) {
+		double x = (samples[i][0]-mean[0]) / scale;
+		double y = (samples[i][1]-mean[1]) / scale;
+		double z = (samples[i][2]-mean[2]) / scale;
+
+		phi[0]=x*x; phi[1]=y*y; phi[2]=z*z;
+		phi[3]=2*x*y; phi[4]=2*x*z; phi[5]=2*y*z;
+		phi[6]=2*x; phi[7]=2*y; phi[8]=2*z;
+
+		for ( j=0 ; j<9 ; j++ ) {
+			for ( l=0 ; l<9 ; l++ )
+				ata[j*9+l] += phi[j]*phi[l];
+			atb[j] += phi[j];
+		}
+	}
+	if ( 0 != _solve(ata,atb,9) )
+		return -1;
+
+	A[0][0]=atb[0]; A[1][1]=atb[1]; A[2][2]=atb[2];
+	A[0][1]=A[1][0]=atb[3];
+	A[0][2]=A[2][0]=atb[4];
+	A[1][2]=A[2][1]=atb[5];
+
+	/* center is -A^-1 v */
+	{
+		double a9[9], b3[3];
+		for ( i=0 ; i<3 ; i++ ) {
+			for ( j=0 ; j<3 ; j++ )
+				a9[i*3+j]=A[i][j];
+			b3[i] = -atb[6+i];
+		}
+		if ( 0 != _solve(a9,b3,3) )
+			return -1;
+		memcpy(center,b3,sizeof(center));
+	}
+
+	/* (u-c)' A (u-c) = 1 + c' A c */
+	k = 1.0;
+	for ( i=0 ; i<3 ; i++ )
+		for ( j=0 ; j<3 ; j++ )
+			k += center[i]*A[i][j]*center[j];
+	if ( k <= 0.0 )
+		return -1;
+
+	_eigen3(A,d,v);
+	maxEigen=minEigen=d[0]/k;
+	det=1.0;
+	for ( i=0 ; i<3 ; i++ ) {
+		d[i] /= k;
+		if ( d[i] <= 0.0 )
+			return -1;	/* not an ellipsoid */
+		if ( d[i] > maxEigen ) maxEigen=d[i];
+		if ( d[i] < minEigen ) minEigen=d[i];
+		det *= d[i];
+	}
+
+	/* radii differing by more than 3:1 is a bad fit, not soft-iron */
+	if ( maxEigen / minEigen > 9.0 )
+		return -1;
+
+	/* matrix = sqrt(A/k) scaled to keep the geometric mean radius. Scale of samples cancels out */
+	norm = pow(det,-1.0/6.0);
+	for ( i=0 ; i<3 ; i++ ) {
+		for ( j=0 ; j<3 ; j++ ) {
+			cal->matrix[i][j]=0.0;
+			for ( l=0 ; l<3 ; l++ )
+				cal->matrix[i][j] += v[i][l] * sqrt(d[l]) * v[j][l];
+			cal->matrix[i][j] *= norm;
+		}
+		cal->offset[i] = mean[i] + scale*center[i];
+	}
+	cal->radius = scale * norm;
+
+	/* RMS distance from sphere */
+	sum2=0.0;
+	for ( i=0 ; i<n ; i++ ) {
+		double out[3];
+
+		mag_calibration_apply(cal,samples[i],out);
+		r = sqrt(out[0]*out[0] + out[1]*out[1] + out[2]*out[2]);
+		sum2 += (r-cal->radius)*(r-cal->radius);
+	}
+	cal->residual = sqrt(sum2/n) / cal->radius;
+	if ( cal->residual > 0.1 )
+		return -1;
+
+	cal->valid=1;
+	return 0;
+}
+
+void mag_calibration_apply(const mag_calibration *cal, const double raw[3], double out[3]) {
+	double x = raw[0]-cal->offset[0];
+	double y = raw[1]-cal->offset[1];
+	double z = raw[2]-cal->offset[2];
+
+	out[0] = cal->matrix[0][0]*x + cal->matrix[0][1]*y + cal->matrix[0][2]*z;
+	out[1] = cal->matrix[1][0]*x + cal->matrix[1][1]*y + cal->matrix[1][2]*z;
+	out[2] = cal->matrix[2][0]*x + cal->matrix[2][1]*y + cal->matrix[2][2]*z;
+}
+
+int mag_calibration_load(const char *filename, mag_calibration *cal) {
+	FILE *fp;
+	char line[256];
+	int have=0;
+
+	fp=fopen(filename,"r");
+	if ( NULL == fp )
+		return -1;
+
+	memset(cal,0,sizeof(mag_calibration));
+	while ( NULL != fgets(line,sizeof(line),fp) ) {
+		if ( 3 == sscanf(line,"offset %lf %lf %lf",&cal->offset[0],&cal->offset[1],&cal->offset[2]) ) {
+			have |= 1;
+		} else if ( 9 == sscanf(line,"matrix %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+			&cal->matrix[0][0],&cal->matrix[0][1],&cal->matrix[0][2],
+			&cal->matrix[1][0],&cal->matrix[1][1],&cal->matrix[1][2],
+			&cal->matrix[2][0],&cal->matrix[2][1],&cal->matrix[2][2]) ) {
+			have |= 2;
+		} else if ( 1 == sscanf(line,"radius %lf",&cal->radius) ) {
+		} else if ( 1 == sscanf(line,"residual %lf",&cal->residual) ) {
+		}
+	}
+	fclose(fp);
+
+	if ( 3 != have ) {
+		fprintf(stderr,"# magnetometer calibration %s is incomplete\n",filename);
+		return -1;
+	}
+
+	cal->valid=1;
+	return 0;
+}
+
+/* written to a temporary file and renamed so a reader never sees half a file */
+int mag_calibration_save(const char *filename, const mag_calibration *cal) {
+	char tmp[300];
+	FILE *fp;
+
+	snprintf(tmp,sizeof(tmp),"%s.tmp",filename);
+	fp=fopen(tmp,"w");
+	if ( NULL == fp ) {
+		fprintf(stderr,"# error writing magnetometer calibration %s\n",tmp);
+		return -1;
+	}
+
+	fprintf(fp,"# magnetometer calibration. calibrated = matrix * (raw - offset)\n");
+	fprintf(fp,"offset %.3f %.3f %.3f\n",cal->offset[0],cal->offset[1],cal->offset[2]);
+	fprintf(fp,"matrix %.9f %.9f %.9f %.9f %.9f %.9f %.9f %.9f %.9f\n",
+		cal->matrix[0][0],cal->matrix[0][1],cal->matrix[0][2],
+		cal->matrix[1][0],cal->matrix[1][1],cal->matrix[1][2],
+		cal->matrix[2][0],cal->matrix[2][1],cal->matrix[2][2]);
+	fprintf(fp,"radius %.3f\n",cal->radius);
+	fprintf(fp,"residual %.6f\n",cal->residual);
+
+	if ( 0 != fclose(fp) || 0 != rename(tmp,filename) ) {
+		fprintf(stderr,"# error writing magnetometer calibration %s\n",filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *_mag_calibrator_thread(void *arg) {
+	mag_calibrator *c = arg;
+	mag_calibration cal;
+
+	pthread_mutex_lock(&c->mutex);
+	for ( ;; ) {
+		while ( 0 == c->busy )
+			pthread_cond_wait(&c->cond,&c->mutex);
+		if ( c->busy < 0 )
+			break;
+		pthread_mutex_unlock(&c->mutex);
+
+		memset(&cal,0,sizeof(cal));
+		if ( 0 == mag_calibration_fit((const double (*)[3]) c->work,c->nWork,&cal) ) {
+			if ( c->filename[0] )
+				mag_calibration_save(c->filename,&cal);
+
+			pthread_mutex_lock(&c->mutex);
+			c->current=cal;
+		} else {
+			pthread_mutex_lock(&c->mutex);
+		}
+
+		if ( c->busy > 0 )
+			c->busy=0;
+	}
+	pthread_mutex_unlock(&c->mutex);
+
+	return NULL;
+}
+
+mag_calibrator *mag_calibrator_new(const char *filename, int fit) {
+	mag_calibrator *c;
+
+	c = calloc(1,sizeof(mag_calibrator));
+	if ( NULL == c )
+		return NULL;
+
+	if ( NULL != filename )
+		snprintf(c->filename,sizeof(c->filename),"%s",filename);
+	c->fit=fit;
+	c->random=2463534242u;
+	pthread_mutex_init(&c->mutex,NULL);
+	pthread_cond_init(&c->cond,NULL);
+
+	if ( c->filename[0] && 0 == mag_calibration_load(c->filename,&c->current) ) {
+		fprintf(stderr,"# loaded magnetometer calibration from %s\n",c->filename);
+	}
+
+	return c;
+}
+
+void mag_calibrator_free(mag_calibrator *c) {
+	if ( NULL == c )
+		return;
+
+	if ( c->threadStarted ) {
+		pthread_mutex_lock(&c->mutex);
+		c->busy=-1;
+		pthread_cond_signal(&c->cond);
+		pthread_mutex_unlock(&c->mutex);
+		pthread_join(c->thread,NULL);
+	}
+
+	pthread_mutex_destroy(&c->mutex);
+	pthread_cond_destroy(&c->cond);
+	free(c);
+}
+
+void mag_calibrator_add(mag_calibrator *c, const double raw[3]) {
+	double dx, dy, dz;
+	unsigned long slot;
+
+	if ( ! c->fit )
+		return;
+
+	/* a unit sitting still would fill the reservoir with one point */
+	dx=raw[0]-c->last[0];
+	dy=raw[1]-c->last[1];
+	dz=raw[2]-c->last[2];
+	if ( c->seen > 0 && dx*dx + dy*dy + dz*dz < MAG_CAL_MIN_DISTANCE*MAG_CAL_MIN_DISTANCE )
+		return;
+	memcpy(c->last,raw,sizeof(c->last));
+
+	/* reservoir sampling. seen is capped so new samples keep replacing old ones after a move */
+	if ( c->nSamples < MAG_CAL_RESERVOIR ) {
+		memcpy(c->samples[c->nSamples++],raw,sizeof(c->samples[0]));
+	} else {
+		c->random ^= c->random << 13;
+		c->random ^= c->random >> 17;
+		c->random ^= c->random << 5;
+		slot = c->random % (c->seen+1);
+		if ( slot < MAG_CAL_RESERVOIR )
+			memcpy(c->samples[slot],raw,sizeof(c->samples[0]));
+	}
+	if ( c->seen < 4*MAG_CAL_RESERVOIR )
+		c->seen++;
+	c->sinceFit++;
+
+	if ( c->nSamples < MAG_CAL_MIN_SAMPLES || c->sinceFit < MAG_CAL_REFIT_SAMPLES )
+		return;
+
+	/* hand a copy to the background thread unless it is still busy with the last one */
+	pthread_mutex_lock(&c->mutex);
+	if ( 0 == c->busy ) {
+		memcpy(c->work,c->samples,c->nSamples*sizeof(c->samples[0]));
+		c->nWork=c->nSamples;
+		c->busy=1;
+		c->sinceFit=0;
+
+		if ( ! c->threadStarted ) {
+			if ( 0 == pthread_create(&c->thread,NULL,_mag_calibrator_thread,c) ) {
+				c->threadStarted=1;
+			} else {
+				fprintf(stderr,"# error starting magnetometer calibration thread\n");
+				c->fit=0;
+				c->busy=0;
+			}
+		}
+		pthread_cond_signal(&c->cond);
+	}
+	pthread_mutex_unlock(&c->mutex);
+}
+
+int mag_calibrator_get(mag_calibrator *c, mag_calibration *cal) {
+	pthread_mutex_lock(&c->mutex);
+	*cal=c->current;
+	pthread_mutex_unlock(&c->mutex);
+
+	return cal->valid;
+}
+
+/*
+pitch and roll from the accelerometer, then the magnetometer is rotated back to level.
+Axis signs follow the BerryIMU (LSM9DS1) mounting
+*/
+double mag_tilt_compensated_heading(const double mag[3], const int accRaw[3]) {
+	double norm, accXnorm, accYnorm, pitch, roll, magXcomp, magYcomp, heading;
+
+	norm = sqrt((double) accRaw[0]*accRaw[0] + (double) accRaw[1]*accRaw[1] + (double) accRaw[2]*accRaw[2]);
+	if ( 0.0 == norm )
+		return 0.0;
+
+	accXnorm = accRaw[0] / norm;
+	accYnorm = accRaw[1] / norm;
+
+	pitch = asin(accXnorm);
+	roll = ( fabs(cos(pitch)) > 1e-9 ) ? -asin(accYnorm/cos(pitch)) : 0.0;
+	if ( isnan(roll) )
+		roll = 0.0;
+
+	magXcomp = mag[0]*cos(pitch) - mag[2]*sin(pitch);
+	magYcomp = mag[0]*sin(roll)*sin(pitch) + mag[1]*cos(roll) + mag[2]*sin(roll)*cos(pitch);
+
+	heading = 180.0 * atan2(magYcomp,magXcomp) / M_PI;
+	if ( heading < 0.0 )
+		heading += 360.0;
+
+	return heading;
+}
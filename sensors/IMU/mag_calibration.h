@@ -0,0 +1,73 @@
+#ifndef APRSi2C_SENSORS_IMU_MAG_CALIBRATION_H
+#define APRSi2C_SENSORS_IMU_MAG_CALIBRATION_H
+/*
+Magnetometer hard-iron / soft-iron calibration.
+
+Samples are kept in a bounded reservoir. Every MAG_CAL_REFIT_SAMPLES new samples an
+ellipsoid is fitted to the reservoir by a background thread. The result is a hard-iron
+offset and a symmetric soft-iron matrix that maps the ellipsoid back onto a sphere:
+
+	calibrated = matrix * (raw - offset)
+
+Applying it is a subtract and a 3x3 multiply per sample.
+*/
+#include <stdint.h>
+#include <pthread.h>
+
+#define MAG_CAL_RESERVOIR      400	/* samples kept for fitting */
+#define MAG_CAL_MIN_SAMPLES    100	/* samples needed before first fit */
+#define MAG_CAL_REFIT_SAMPLES  200	/* new samples between fits */
+#define MAG_CAL_MIN_DISTANCE   40.0	/* LSB a sample must move from the last accepted one */
+
+typedef struct {
+	int valid;
+	double offset[3];	/* hard-iron, raw LSB */
+	double matrix[3][3];	/* soft-iron */
+	double radius;		/* average field magnitude, raw LSB */
+	double residual;	/* RMS fit error as a fraction of radius */
+} mag_calibration;
+
+typedef struct {
+	char filename[256];	/* saved here after every accepted fit. Empty for none */
+	int fit;		/* 0 to only use a loaded calibration */
+
+	/* reservoir, only touched by the sampling thread */
+	double samples[MAG_CAL_RESERVOIR][3];
+	int nSamples;
+	unsigned long seen;	/* accepted samples offered to the reservoir */
+	unsigned long sinceFit;
+	double last[3];
+	uint32_t random;
+
+	/* background fit */
+	pthread_t thread;
+	int threadStarted;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	double work[MAG_CAL_RESERVOIR][3];	/* copy of reservoir being fitted */
+	int nWork;
+	int busy;
+
+	mag_calibration current;	/* protected by mutex */
+} mag_calibrator;
+
+/* load filename if it exists. Fit in the background if fit is set. Returns NULL on error */
+mag_calibrator *mag_calibrator_new(const char *filename, int fit);
+void mag_calibrator_free(mag_calibrator *c);
+
+/* offer a raw (uncorrected) sample to the reservoir */
+void mag_calibrator_add(mag_calibrator *c, const double raw[3]);
+/* copy of the current calibration. Returns 1 if it is valid */
+int mag_calibrator_get(mag_calibrator *c, mag_calibration *cal);
+
+/* fit n samples. Returns 0 and fills cal if the fit looks like a real ellipsoid */
+int mag_calibration_fit(const double (*samples)[3], int n, mag_calibration *cal);
+void mag_calibration_apply(const mag_calibration *cal, const double raw[3], double out[3]);
+
+/* text file of offset, matrix, radius, and residual. Return 0 on success */
+int mag_calibration_load(const char *filename, mag_calibration *cal);
+int mag_calibration_save(const char *filename, const mag_calibration *cal);
+
+/* heading in degrees 0 to 360 from calibrated magnetometer, tilt compensated with accelerometer */
+double mag_tilt_compensated_heading(const double mag[3], const int accRaw[3]);
+#endif
@@ -14,20 +14,17 @@ Bosch BMP280 pressure and temperature I2C sensor.
 #include <errno.h>
 #include <sys/time.h>
 #include <time.h>
-#include "sensor_BMP280.h"
+#include "sensor_driver.h"
+#include "capture_log.h"
 
-struct json_object *jobj_sensors_bmp280,*jobj_sensors_bmp280_array;
-
-/* BMP280 calibration values that are read once on initialization */
+/* BMP280 calibration values that are read once on initialization. Private state of each instance */
 typedef struct { 
 	int dig_T1, dig_T2, dig_T3;
 	int dig_P1, dig_P2, dig_P3, dig_P4, dig_P5, dig_P6, dig_P7, dig_P8, dig_P9;
 } bmp280_struct_bmp280;
 
-bmp280_struct_bmp280 bmp280;
-
 
-int bmp280_make_int(uint8_t msb, uint8_t lsb, int sign_extend) {
+static int bmp280_make_int(uint8_t msb, uint8_t lsb, int sign_extend) {
 	int i;
 
 	i = msb * 256 + lsb;
@@ -39,13 +36,53 @@ int bmp280_make_int(uint8_t msb, uint8_t lsb, int sign_extend) {
 	return i;
 }
 
-void bmp280_init(int i2cHandle, int i2cAddress) {
+/* decode calibration block read from 0x88 */
+static void bmp280_decode_calibration(bmp280_struct_bmp280 *bmp280, const uint8_t *data) {
+	/* temperature */
+	bmp280->dig_T1 = bmp280_make_int(data[1],data[0],0); /* unsigned */
+	bmp280->dig_T2 = bmp280_make_int(data[3],data[2],1); /* signed */
+	bmp280->dig_T3 = bmp280_make_int(data[5],data[4],1); 
+	
+	/* pressure */
+	bmp280->dig_P1 = bmp280_make_int(data[7],data[6],0); 
+	bmp280->dig_P2 = bmp280_make_int(data[9],data[8],1); 
+	bmp280->dig_P3 = bmp280_make_int(data[11],data[10],1); 
+	bmp280->dig_P4 = bmp280_make_int(data[13],data[12],1); 
+	bmp280->dig_P5 = bmp280_make_int(data[15],data[14],1); 
+	bmp280->dig_P6 = bmp280_make_int(data[17],data[16],1); 
+	bmp280->dig_P7 = bmp280_make_int(data[19],data[18],1); 
+	bmp280->dig_P8 = bmp280_make_int(data[21],data[20],1); 
+	bmp280->dig_P9 = bmp280_make_int(data[23],data[22],1); 
+}
+
+/* check chip id register (0xD0). BMP280 is 0x58, 0x56 and 0x57 are samples, 0x60 is BME280 */
+static int bmp280_probe(sensor_instance *s) {
+	uint8_t reg[1];
+	uint8_t id[1];
+
+	ioctl(s->i2cHandle, I2C_SLAVE, s->i2cAddress);
+
+	reg[0] = 0xD0;
+	if ( 1 != write(s->i2cHandle, reg, 1) || 1 != read(s->i2cHandle, id, 1) ) {
+		return -1;
+	}
+
+	if ( 0x58 != id[0] && 0x56 != id[0] && 0x57 != id[0] && 0x60 != id[0] ) {
+		fprintf(stderr,"# %s unexpected chip id 0x%02x\n",s->name,id[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* read calibration and configure device. Raw calibration block is returned in data */
+static int bmp280_init(sensor_instance *s, uint8_t *data) {
+	int i2cHandle = s->i2cHandle;
 	int opResult;
 	uint8_t reg[1];
-	uint8_t data[24];
 
 	/* address of device we will be working with */
-	opResult = ioctl(i2cHandle, I2C_SLAVE, i2cAddress);
+	opResult = ioctl(i2cHandle, I2C_SLAVE, s->i2cAddress);
 
 	// Read 24 bytes of data from address(0x88)
 	reg[0] = 0x88;
@@ -56,26 +93,12 @@ void bmp280_init(int i2cHandle, int i2cAddress) {
 	}
 
 
-	if ( read(i2cHandle, data, 24) != 24 ) {
+	if ( read(i2cHandle, data, BMP280_CALIBRATION_BYTES) != BMP280_CALIBRATION_BYTES ) {
 		fprintf(stderr,"# I2C read error. Exiting...\n");
 		exit(1);
 	}
 
-	/* temperature */
-	bmp280.dig_T1 = bmp280_make_int(data[1],data[0],0); /* unsigned */
-	bmp280.dig_T2 = bmp280_make_int(data[3],data[2],1); /* signed */
-	bmp280.dig_T3 = bmp280_make_int(data[5],data[4],1); 
-	
-	/* pressure */
-	bmp280.dig_P1 = bmp280_make_int(data[7],data[6],0); 
-	bmp280.dig_P2 = bmp280_make_int(data[9],data[8],1); 
-	bmp280.dig_P3 = bmp280_make_int(data[11],data[10],1); 
-	bmp280.dig_P4 = bmp280_make_int(data[13],data[12],1); 
-	bmp280.dig_P5 = bmp280_make_int(data[15],data[14],1); 
-	bmp280.dig_P6 = bmp280_make_int(data[17],data[16],1); 
-	bmp280.dig_P7 = bmp280_make_int(data[19],data[18],1); 
-	bmp280.dig_P8 = bmp280_make_int(data[21],data[20],1); 
-	bmp280.dig_P9 = bmp280_make_int(data[23],data[22],1); 
+	bmp280_decode_calibration(s->priv,data);
 
 		
 	// Select control measurement register(0xF4)
@@ -99,19 +122,29 @@ void bmp280_init(int i2cHandle, int i2cAddress) {
 		exit(2);
 	}
 	
+	return BMP280_CALIBRATION_BYTES;
+}
 
+static void _bmp280_load_setup(sensor_instance *s, const uint8_t *setup, uint16_t length) {
+	if ( BMP280_CALIBRATION_BYTES == length ) {
+		bmp280_decode_calibration(s->priv,setup);
+	}
 }
 
 
-/* read bmp280 device that has been previously configured */
-void bmp280_sample(int i2cHandle, int i2cAddress) {
-	int opResult,i;
+/* normal mode with 1000 ms standby and 1x oversampling, which takes 6.4 ms to measure */
+static double bmp280_output_rate(const sensor_instance *s) {
+	return 1000.0 / (1000.0 + 6.4);
+}
+
+/* read raw measurement registers of bmp280 device that has been previously configured */
+static void bmp280_read_raw(sensor_instance *s, uint8_t *data) {
+	int i2cHandle = s->i2cHandle;
+	int opResult;
 	uint8_t reg[1];
-	uint8_t data[8];
-	char buffer[32];
 
 	/* address of device we will be working with */
-	opResult = ioctl(i2cHandle, I2C_SLAVE, i2cAddress);
+	opResult = ioctl(i2cHandle, I2C_SLAVE, s->i2cAddress);
 
 
 	// Read 8 bytes of data from register(0xF7)
@@ -122,48 +155,90 @@ void bmp280_sample(int i2cHandle, int i2cAddress) {
 		fprintf(stderr,"# I2C write error. No ACK! Exiting...\n");
 		exit(2);
 	}
-	if ( read(i2cHandle, data, 8) != 8 ) {
+	if ( read(i2cHandle, data, BMP280_RAW_BYTES) != BMP280_RAW_BYTES ) {
 		fprintf(stderr, "# I2C read error. Exiting...\n");
 		exit(1);
 	}
-	
+}
+
+/* decode raw measurement registers using calibration */
+static void bmp280_decode(sensor_instance *s, const uint8_t *data, sensor_sample *sample) {
+	const bmp280_struct_bmp280 *bmp280 = s->priv;
+
 	// Convert pressure and temperature data to 19-bits
 	long adc_p = (((long)data[0] * 65536) + ((long)data[1] * 256) + (long)(data[2] & 0xF0)) / 16;
 	long adc_t = (((long)data[3] * 65536) + ((long)data[4] * 256) + (long)(data[5] & 0xF0)) / 16;
 		
 	// Temperature offset calculations
-	double var1 = (((double)adc_t) / 16384.0 - ((double)bmp280.dig_T1) / 1024.0) * ((double)bmp280.dig_T2);
-	double var2 = ((((double)adc_t) / 131072.0 - ((double)bmp280.dig_T1) / 8192.0) *(((double)adc_t)/131072.0 - ((double)bmp280.dig_T1)/8192.0)) * ((double)bmp280.dig_T3);
+	double var1 = (((double)adc_t) / 16384.0 - ((double)bmp280->dig_T1) / 1024.0) * ((double)bmp280->dig_T2);
+	double var2 = ((((double)adc_t) / 131072.0 - ((double)bmp280->dig_T1) / 8192.0) *(((double)adc_t)/131072.0 - ((double)bmp280->dig_T1)/8192.0)) * ((double)bmp280->dig_T3);
 	double t_fine = (long)(var1 + var2);
 	double temperatureC = (var1 + var2) / 5120.0;
 		
 	// Pressure offset calculations
 	var1 = ((double)t_fine / 2.0) - 64000.0;
-	var2 = var1 * var1 * ((double)bmp280.dig_P6) / 32768.0;
-	var2 = var2 + var1 * ((double)bmp280.dig_P5) * 2.0;
-	var2 = (var2 / 4.0) + (((double)bmp280.dig_P4) * 65536.0);
-	var1 = (((double) bmp280.dig_P3) * var1 * var1 / 524288.0 + ((double) bmp280.dig_P2) * var1) / 524288.0;
-	var1 = (1.0 + var1 / 32768.0) * ((double)bmp280.dig_P1);
+	var2 = var1 * var1 * ((double)bmp280->dig_P6) / 32768.0;
+	var2 = var2 + var1 * ((double)bmp280->dig_P5) * 2.0;
+	var2 = (var2 / 4.0) + (((double)bmp280->dig_P4) * 65536.0);
+	var1 = (((double) bmp280->dig_P3) * var1 * var1 / 524288.0 + ((double) bmp280->dig_P2) * var1) / 524288.0;
+	var1 = (1.0 + var1 / 32768.0) * ((double)bmp280->dig_P1);
 	double p = 1048576.0 - (double)adc_p;
 	p = (p - (var2 / 4096.0)) * 6250.0 / var1;
-	var1 = ((double) bmp280.dig_P9) * p * p / 2147483648.0;
-	var2 = p * ((double) bmp280.dig_P8) / 32768.0;
-	double pressureHPA = (p + (var1 + var2 + ((double)bmp280.dig_P7)) / 16.0) / 100;
+	var1 = ((double) bmp280->dig_P9) * p * p / 2147483648.0;
+	var2 = p * ((double) bmp280->dig_P8) / 32768.0;
+	double pressureHPA = (p + (var1 + var2 + ((double)bmp280->dig_P7)) / 16.0) / 100;
 	
-	json_object_object_add(jobj_sensors_bmp280, "pressure_HPA", json_object_new_double(pressureHPA));
-	json_object_object_add(jobj_sensors_bmp280, "temperature_C", json_object_new_double(temperatureC));
+	sample->u.bmp280.pressureHPA=pressureHPA;
+	sample->u.bmp280.temperatureC=temperatureC;
+}
+
+/* decoded values for metrics */
+static int bmp280_values(const sensor_instance *s, const sensor_sample *sample, sensor_value *v, int max) {
+	if ( max < 2 ) 
+		return 0;
+
+	v[0].name="pressure_hpa";
+	v[0].value=sample->u.bmp280.pressureHPA;
+	v[1].name="temperature_c";
+	v[1].value=sample->u.bmp280.temperatureC;
+
+	return 2;
+}
+
+/* put sample into JSON object */
+static void bmp280_serialize(const sensor_instance *s, const sensor_sample *sample, struct json_object *jobj_sensors_bmp280) {
+	struct json_object *jobj_sensors_bmp280_array;
+	int i;
 
-#if 0
-	snprintf(buffer,sizeof(buffer),"%02x %02x %02x %02x %02x %02x %02x %02x",
-		data[0], data[1],  data[2], data[3], data[4], data[5], data[6], data[7]);
+	json_object_object_add(jobj_sensors_bmp280, "pressure_HPA", json_object_new_double(sample->u.bmp280.pressureHPA));
+	json_object_object_add(jobj_sensors_bmp280, "temperature_C", json_object_new_double(sample->u.bmp280.temperatureC));
 
-	json_object_object_add(jobj_sensors_bmp280, "sample_0X", json_object_new_string(buffer));
-#endif
 	jobj_sensors_bmp280_array = json_object_new_array();
-	for ( i= 0; 8 > i; i++ ) {
-		json_object_array_add( jobj_sensors_bmp280_array, json_object_new_int(data[i]));
+	for ( i= 0; sample->rawLength > i; i++ ) {
+		json_object_array_add( jobj_sensors_bmp280_array, json_object_new_int(sample->raw[i]));
 	}
 	
 	json_object_object_add(jobj_sensors_bmp280, "sample_0X",jobj_sensors_bmp280_array);
 }
 
+const sensor_driver sensor_driver_bmp280 = {
+	.name = "bmp280",
+	.defaultAddress = 0x77,
+	.rawBytes = BMP280_RAW_BYTES,
+	.captureDevice = CAPTURE_DEVICE_BMP280,
+	.captureSetupDevice = CAPTURE_DEVICE_BMP280_CALIBRATION,
+	.privBytes = sizeof(bmp280_struct_bmp280),
+
+	.probe = bmp280_probe,
+	.configure = bmp280_init,
+	.load_setup = _bmp280_load_setup,
+	.data_ready = NULL,	/* BMP280 only reports conversion in progress, not new data */
+	.output_rate = bmp280_output_rate,
+	.read_raw = bmp280_read_raw,
+	.decode = bmp280_decode,
+	.serialize = bmp280_serialize,
+	.values = bmp280_values,
+	.data_ready_configure = NULL,
+	.event_configure = NULL,
+	.event_pending = NULL,
+};
@@ -1,7 +1,15 @@
+
 #ifndef APRSi2C_SENSORS_IMU_SENSOR_BMP280_H
 #define APRSi2C_SENSORS_IMU_SENSOR_BMP280_H
-extern void bmp280_init(int, int);
-extern void bmp280_sample(int, int);
-extern struct json_object *jobj_sensors_bmp280,*jobj_sensors_bmp280_array;
-#endif
+#include <stdint.h>
 
+/* raw register block sizes. Calibration from 0x88, measurement from 0xF7 */
+#define BMP280_CALIBRATION_BYTES 24
+#define BMP280_RAW_BYTES         8
+
+/* decoded measurement */
+typedef struct {
+	double pressureHPA;
+	double temperatureC;
+} bmp280_sample_struct;
+#endif
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -26,7 +27,11 @@
 #include "i2c-dev.h" /* TODO: this should be using linux/i2c.h and/or linux/i2c-dev.h ... BerryIMU file seems to be weird hybrid */
 #include "LSM9DS0.h"
 #include "LSM9DS1.h"
-#include "sensor_LSM9DS1.h"
+#include "sensor_driver.h"
+#include "format_number.h"
+#include "capture_log.h"
+#include "mag_calibration.h"
+#include "gyro_bias.h"
 
 
 #if 0
@@ -35,15 +40,42 @@
 
 	json_object_object_add(jobj_sensors_bmp280, "sample_0X", json_object_new_string(buffer));
 #endif
-static int file;
-static int LSM9DS0 = 0;
-static int LSM9DS1 = 0;
+/* private state of each instance. Which chip was detected and where its parts are */
+typedef struct {
+	int LSM9DS0;
+	int LSM9DS1;
+	int accAddress;
+	int gyrAddress;
+	int magAddress;
+
+	int16_t magChipOffset[3];	/* in OFFSET_*_REG_M. Subtracted by the chip from magnetometer output */
+	mag_calibrator *magCal;
+	gyro_bias gyroBias;
+	int gyroBiasInitialized;
+
+	/* ODR and full-scale register fields in use, and the resulting gains */
+	uint8_t gyroOdrBits, gyroFsBits, accOdrBits, accFsBits, magOdrBits, magFsBits;
+	int haveScales;
+	double gyroGain;	/* deg/s/LSB */
+	double accGain;		/* g/LSB */
+	double magGain;		/* gauss/LSB */
+
+	/* settings from init() */
+	LSM9DS1_settings settings;
+
+	/* filter state, started over by init() */
+	double gyroAngle[3];	/* integrated gyro rates, x, y, z */
+	double CFangle[2];	/* complementary filter x, y */
+	uint64_t lastSample_usec;	/* timestamp of the sample the state is from. 0 if none */
+
+	/* last value written to each register of the gyro (0), accelerometer (1), and magnetometer (2) */
+	uint8_t shadow[3][128];
+	uint8_t shadowValid[3][128];
+} LSM9DS1_context;
 
 #define DT 0.02         // [s/loop] loop period. 20ms
 #define AA 0.97         // complementary filter constant
 
-#define A_GAIN 0.0573    // [deg/LSB]
-#define G_GAIN 0.070     // [deg/s/LSB]
 #define RAD_TO_DEG 57.29578
 #define M_PI 3.14159265358979323846
 
@@ -51,146 +83,155 @@ static int LSM9DS1 = 0;
 int outputDebug=0;
 #endif
 
-/* JSON stuff */
-struct json_object *jobj_sensors_LSM9DS1,*jobj_sensors_LSM9DS1_gyro,*jobj_sensors_LSM9DS1_accel,*jobj_sensors_LSM9DS1_magnet;
-struct json_object *jobj_sensors_LSM9DS1_gyro_array,*jobj_sensors_LSM9DS1_accel_array,*jobj_sensors_LSM9DS1_magnet_array;
+/* ODR chosen automatically is at least this many times the sampling rate so every read is new data */
+#define LSM9DS1_ODR_OVERSAMPLE 2
 
-void  readBlock(uint8_t command, uint8_t size, uint8_t *data)
+/* register field value of each setting and its gain */
+typedef struct {
+	double value;
+	uint8_t bits;
+	double gain;
+} LSM9DS1_setting;
+
+#define LSM9DS1_SETTINGS(table) (sizeof(table)/sizeof(table[0]))
+
+/* CTRL_REG1_G ODR_G and FS_G. Gain is deg/s/LSB */
+static const LSM9DS1_setting gyroOdrTable[] = { {14.9,1}, {59.5,2}, {119,3}, {238,4}, {476,5}, {952,6} };
+static const LSM9DS1_setting gyroFsTable[] = { {245,0,0.00875}, {500,1,0.0175}, {2000,3,0.070} };
+/* CTRL_REG6_XL ODR_XL, FS_XL, and BW_XL. Gain is g/LSB */
+static const LSM9DS1_setting accOdrTable[] = { {10,1}, {50,2}, {119,3}, {238,4}, {476,5}, {952,6} };
+static const LSM9DS1_setting accFsTable[] = { {2,0,0.000061}, {4,2,0.000122}, {8,3,0.000244}, {16,1,0.000732} };
+static const LSM9DS1_setting accBwTable[] = { {50,3}, {105,2}, {211,1}, {408,0} };
+/* CTRL_REG1_M DO and CTRL_REG2_M FS. Gain is gauss/LSB */
+static const LSM9DS1_setting magOdrTable[] = { {0.625,0}, {1.25,1}, {2.5,2}, {5,3}, {10,4}, {20,5}, {40,6}, {80,7} };
+static const LSM9DS1_setting magFsTable[] = { {4,0,0.00014}, {8,1,0.00029}, {12,2,0.00043}, {16,3,0.00058} };
+
+/* defaults when no range is requested. These were the fixed settings of older versions */
+#define LSM9DS1_DEFAULT_GYRO_RANGE  2000.0
+#define LSM9DS1_DEFAULT_ACCEL_RANGE 16.0
+#define LSM9DS1_DEFAULT_MAG_RANGE   12.0
+
+
+static void readBlock(int file, uint8_t command, uint8_t size, uint8_t *data)
 {
     int result = i2c_smbus_read_i2c_block_data(file, command, size, data);
     if (result != size){
-		printf("Failed to read block from I2C.");
+		fprintf(stderr,"# Failed to read block from I2C. Exiting...\n");
 		exit(1);
 	}
 }
 
-void selectDevice(int file, int addr)
+static void selectDevice(int file, int addr)
 {
 	if (ioctl(file, I2C_SLAVE, addr) < 0) {
-		 printf("Failed to select I2C device.");
+		 fprintf(stderr,"# Failed to select I2C device 0x%02x.\n",addr);
 	}
 }
 
 
-void readACC(int  *a)
+/* raw blocks are 6 bytes, X Y Z little endian */
+static void readACC(sensor_instance *s, uint8_t *block)
 {
-	uint8_t block[6];
-	if (LSM9DS0){
-		selectDevice(file,LSM9DS0_ACC_ADDRESS);
-		readBlock(0x80 |  LSM9DS0_OUT_X_L_A, sizeof(block), block);
+	LSM9DS1_context *c = s->priv;
+
+	selectDevice(s->i2cHandle,c->accAddress);
+	if (c->LSM9DS0){
+		readBlock(s->i2cHandle, 0x80 |  LSM9DS0_OUT_X_L_A, 6, block);
 	}
-	else if (LSM9DS1){
-		selectDevice(file,LSM9DS1_ACC_ADDRESS);
-		readBlock(0x80 |  LSM9DS1_OUT_X_L_XL, sizeof(block), block);       
+	else if (c->LSM9DS1){
+		readBlock(s->i2cHandle, 0x80 |  LSM9DS1_OUT_X_L_XL, 6, block);       
 	}
-	
-	// Combine readings for each axis.
-	*a = (int16_t)(block[0] | block[1] << 8);
-	*(a+1) = (int16_t)(block[2] | block[3] << 8);
-	*(a+2) = (int16_t)(block[4] | block[5] << 8);
-
 }
 
 
-void readMAG(int  *m)
+static void readMAG(sensor_instance *s, uint8_t *block)
 {
-	uint8_t block[6];
-    if (LSM9DS0){
-		selectDevice(file,LSM9DS0_MAG_ADDRESS);
-		readBlock(0x80 |  LSM9DS0_OUT_X_L_M, sizeof(block), block);
+	LSM9DS1_context *c = s->priv;
+
+	selectDevice(s->i2cHandle,c->magAddress);
+	if (c->LSM9DS0){
+		readBlock(s->i2cHandle, 0x80 |  LSM9DS0_OUT_X_L_M, 6, block);
 	}
-	else if (LSM9DS1){
-		selectDevice(file,LSM9DS1_MAG_ADDRESS);
-		readBlock(0x80 |  LSM9DS1_OUT_X_L_M, sizeof(block), block);    
+	else if (c->LSM9DS1){
+		readBlock(s->i2cHandle, 0x80 |  LSM9DS1_OUT_X_L_M, 6, block);    
 	}
-	
-	// Combine readings for each axis.
-	*m = (int16_t)(block[0] | block[1] << 8);
-	*(m+1) = (int16_t)(block[2] | block[3] << 8);
-	*(m+2) = (int16_t)(block[4] | block[5] << 8);
-
 }
 
-void readGYR(int *g)
+/* LSM9DS1 gyroscope is read from OUT_TEMP_L so temperature and status come with the same transfer */
+static void readGYR(sensor_instance *s, uint8_t *block, uint8_t *temp)
 {
-	uint8_t block[6];
-    if (LSM9DS0){
-		selectDevice(file,LSM9DS0_GYR_ADDRESS);
-		readBlock(0x80 |  LSM9DS0_OUT_X_L_G, sizeof(block), block);
+	LSM9DS1_context *c = s->priv;
+	uint8_t burst[9];
+
+	selectDevice(s->i2cHandle,c->gyrAddress);
+	if (c->LSM9DS0){
+		readBlock(s->i2cHandle, 0x80 |  LSM9DS0_OUT_X_L_G, 6, block);
+		memset(temp,0,3);
 	}
-	else if (LSM9DS1){
-		selectDevice(file,LSM9DS1_GYR_ADDRESS);
-		readBlock(0x80 |  LSM9DS1_OUT_X_L_G, sizeof(block), block);    
+	else if (c->LSM9DS1){
+		/* OUT_TEMP_L, OUT_TEMP_H, STATUS_REG, OUT_X_L_G ... OUT_Z_H_G */
+		readBlock(s->i2cHandle, 0x80 |  LSM9DS1_OUT_TEMP_L, sizeof(burst), burst);    
+		memcpy(temp,burst,3);
+		memcpy(block,burst+3,6);
 	}
- 
+}
 
-	// Combine readings for each axis.
-	*g = (int16_t)(block[0] | block[1] << 8);
-	*(g+1) = (int16_t)(block[2] | block[3] << 8);
-	*(g+2) = (int16_t)(block[4] | block[5] << 8);
+/* combine readings for each axis */
+static void _block_to_xyz(const uint8_t *block, int *v) {
+	*v = (int16_t)(block[0] | block[1] << 8);
+	*(v+1) = (int16_t)(block[2] | block[3] << 8);
+	*(v+2) = (int16_t)(block[4] | block[5] << 8);
 }
 
 
-void writeAccReg(uint8_t reg, uint8_t value)
-{
-	if (LSM9DS0)
-		selectDevice(file,LSM9DS0_ACC_ADDRESS);
-	else if (LSM9DS1)
-		selectDevice(file,LSM9DS1_ACC_ADDRESS);
-	
-	int result = i2c_smbus_write_byte_data(file, reg, value);
-	if (result == -1){
-		printf ("Failed to write byte to I2C Acc.");
-        exit(1);
-    }
+/* shadow registers of the part at addr. Parts sharing an address share registers */
+static int _shadow_part(const LSM9DS1_context *c, int addr) {
+	if ( addr == c->gyrAddress ) 
+		return 0;
+	if ( addr == c->accAddress ) 
+		return 1;
+	return 2;
 }
 
-void writeMagReg(uint8_t reg, uint8_t value)
+/* write one register of the part at addr, unless it already holds value */
+static void writeReg(sensor_instance *s, int addr, uint8_t reg, uint8_t value)
 {
-    if (LSM9DS0)
-		selectDevice(file,LSM9DS0_MAG_ADDRESS);
-	else if (LSM9DS1)
-		selectDevice(file,LSM9DS1_MAG_ADDRESS);
-  
-	int result = i2c_smbus_write_byte_data(file, reg, value);
-	if (result == -1){
-		printf("Failed to write byte to I2C Mag.");
-		exit(1);
-	}
-}
+	LSM9DS1_context *c = s->priv;
+	int part = _shadow_part(c,addr);
 
+	reg &= 0x7f;
+	if ( c->shadowValid[part][reg] && c->shadow[part][reg] == value ) 
+		return;
 
-void writeGyrReg(uint8_t reg, uint8_t value)
-{
-    if (LSM9DS0)
-		selectDevice(file,LSM9DS0_GYR_ADDRESS);
-	else if (LSM9DS1)
-		selectDevice(file,LSM9DS1_GYR_ADDRESS);
-  
-	int result = i2c_smbus_write_byte_data(file, reg, value);
+	selectDevice(s->i2cHandle,addr);
+
+	int result = i2c_smbus_write_byte_data(s->i2cHandle, reg, value);
 	if (result == -1){
-		printf("Failed to write byte to I2C Gyr.");
+		fprintf(stderr,"# Failed to write byte to %s register 0x%02x at 0x%02x. Exiting...\n",s->name,reg,addr);
 		exit(1);
 	}
-}
 
+	c->shadow[part][reg]=value;
+	c->shadowValid[part][reg]=1;
+}
 
+#define writeAccReg(s,reg,value) writeReg(s,((LSM9DS1_context *) (s)->priv)->accAddress,reg,value)
+#define writeMagReg(s,reg,value) writeReg(s,((LSM9DS1_context *) (s)->priv)->magAddress,reg,value)
+#define writeGyrReg(s,reg,value) writeReg(s,((LSM9DS1_context *) (s)->priv)->gyrAddress,reg,value)
 
-void detectIMU(void)
-{
 
-	__u16 block[I2C_SMBUS_BLOCK_MAX];
-
-	int res, bus,  size;
 
+/* 
+returns 0 if a LSM9DS0 or LSM9DS1 is found on the bus of the instance. i2cAddress is the address 
+of the accelerometer / gyroscope; 0x6B (SDO_AG high) means the magnetometer is at 0x1E (SDO_M high) 
+*/
+static int detectIMU(sensor_instance *s)
+{
+	LSM9DS1_context *c = s->priv;
+	int file = s->i2cHandle;
 
-	char filename[20];
-	sprintf(filename, "/dev/i2c-%d", 1);
-	file = open(filename, O_RDWR);
-	if (file<0) {
-		printf("Unable to open I2C bus!");
-			exit(1);
-	}
+	c->LSM9DS0 = c->LSM9DS1 = 0;
+	memset(c->shadowValid,0,sizeof(c->shadowValid));
 
 	//Detect if BerryIMUv1 (Which uses a LSM9DS0) is connected
 	selectDevice(file,LSM9DS0_ACC_ADDRESS);
@@ -200,75 +241,335 @@ void detectIMU(void)
 	int LSM9DS0_WHO_G_response = i2c_smbus_read_byte_data(file, LSM9DS0_WHO_AM_I_G);
 
 	if (LSM9DS0_WHO_G_response == 0xd4 && LSM9DS0_WHO_XM_response == 0x49){
-		printf ("\n\n\n#####   BerryIMUv1/LSM9DS0  DETECTED    #####\n\n");
-		LSM9DS0 = 1;
+		fprintf(stderr,"# %s BerryIMUv1/LSM9DS0 detected on %s\n",s->name,s->i2cDevice);
+		c->LSM9DS0 = 1;
+		c->accAddress = LSM9DS0_ACC_ADDRESS;
+		c->gyrAddress = LSM9DS0_GYR_ADDRESS;
+		c->magAddress = LSM9DS0_MAG_ADDRESS;
+		return 0;
 	}
 
 
 
-
 	//Detect if BerryIMUv2 (Which uses a LSM9DS1) is connected
-	selectDevice(file,LSM9DS1_MAG_ADDRESS);
+	c->accAddress = c->gyrAddress = s->i2cAddress;
+	c->magAddress = ( LSM9DS1_GYR_ADDRESS == s->i2cAddress ) ? LSM9DS1_MAG_ADDRESS : LSM9DS1_MAG_ADDRESS + 2;
+
+	selectDevice(file,c->magAddress);
 	int LSM9DS1_WHO_M_response = i2c_smbus_read_byte_data(file, LSM9DS1_WHO_AM_I_M);
 
-	selectDevice(file,LSM9DS1_GYR_ADDRESS);	
+	selectDevice(file,c->gyrAddress);	
 	int LSM9DS1_WHO_XG_response = i2c_smbus_read_byte_data(file, LSM9DS1_WHO_AM_I_XG);
 
     if (LSM9DS1_WHO_XG_response == 0x68 && LSM9DS1_WHO_M_response == 0x3d){
-		printf ("\n\n\n#####   BerryIMUv2/LSM9DS1  DETECTED    #####\n\n");
-		LSM9DS1 = 1;
+		fprintf(stderr,"# %s BerryIMUv2/LSM9DS1 detected on %s at 0x%02x / 0x%02x\n",s->name,s->i2cDevice,c->gyrAddress,c->magAddress);
+		c->LSM9DS1 = 1;
+		return 0;
 	}
   
 
+	fprintf(stderr,"# %s no IMU detected\n",s->name);
+	return -1;
+}
 
-	if (!LSM9DS0 && !LSM9DS1){
-		printf ("NO IMU DETECTED\n");
-		exit(1);
+
+
+
+/* first setting of table at or above wanted, or the largest */
+static const LSM9DS1_setting *_setting(const LSM9DS1_setting *table, int n, double wanted) {
+	int i;
+
+	for ( i=0 ; i<n-1 ; i++ ) {
+		if ( table[i].value >= wanted ) 
+			break;
 	}
+
+	return &table[i];
 }
 
+static const LSM9DS1_setting *_setting_bits(const LSM9DS1_setting *table, int n, uint8_t bits) {
+	int i;
 
+	for ( i=0 ; i<n-1 ; i++ ) {
+		if ( table[i].bits == bits ) 
+			break;
+	}
+
+	return &table[i];
+}
+
+/* gains from register fields */
+static void _scales_gain(LSM9DS1_context *c) {
+	c->gyroGain = _setting_bits(gyroFsTable,LSM9DS1_SETTINGS(gyroFsTable),c->gyroFsBits)->gain;
+	c->accGain = _setting_bits(accFsTable,LSM9DS1_SETTINGS(accFsTable),c->accFsBits)->gain;
+	c->magGain = _setting_bits(magFsTable,LSM9DS1_SETTINGS(magFsTable),c->magFsBits)->gain;
+	c->haveScales = 1;
+}
 
+/* pick ODR and full-scale register fields from the requested configuration */
+static void _scales_select(LSM9DS1_context *c) {
+	const LSM9DS1_config_struct *config = &c->settings.config;
+	double rate = 1000.0 / (config->samplingInterval > 0 ? config->samplingInterval : 500);
+	double odr = LSM9DS1_ODR_OVERSAMPLE * rate;
+
+	c->gyroOdrBits = _setting(gyroOdrTable,LSM9DS1_SETTINGS(gyroOdrTable),config->gyroOdr > 0.0 ? config->gyroOdr : odr)->bits;
+	c->accOdrBits = _setting(accOdrTable,LSM9DS1_SETTINGS(accOdrTable),config->accelOdr > 0.0 ? config->accelOdr : odr)->bits;
+	c->magOdrBits = _setting(magOdrTable,LSM9DS1_SETTINGS(magOdrTable),config->magOdr > 0.0 ? config->magOdr : odr)->bits;
+
+	c->gyroFsBits = _setting(gyroFsTable,LSM9DS1_SETTINGS(gyroFsTable),config->gyroRange > 0.0 ? config->gyroRange : LSM9DS1_DEFAULT_GYRO_RANGE)->bits;
+	c->accFsBits = _setting(accFsTable,LSM9DS1_SETTINGS(accFsTable),config->accelRange > 0.0 ? config->accelRange : LSM9DS1_DEFAULT_ACCEL_RANGE)->bits;
+	c->magFsBits = _setting(magFsTable,LSM9DS1_SETTINGS(magFsTable),config->magRange > 0.0 ? config->magRange : LSM9DS1_DEFAULT_MAG_RANGE)->bits;
+
+	_scales_gain(c);
+}
 
-void enableIMU(void)
+static void enableIMU(sensor_instance *s)
 {
+	LSM9DS1_context *c = s->priv;
+	uint8_t bw;
 
-	if (LSM9DS0){//For BerryIMUv1
+	if (c->LSM9DS0){//For BerryIMUv1
 		// Enable accelerometer.
-		writeAccReg(LSM9DS0_CTRL_REG1_XM, 0b01100111); //  z,y,x axis enabled, continuous update,  100Hz data rate
-		writeAccReg(LSM9DS0_CTRL_REG2_XM, 0b00100000); // +/- 16G full scale
+		writeAccReg(s,LSM9DS0_CTRL_REG1_XM, 0b01100111); //  z,y,x axis enabled, continuous update,  100Hz data rate
+		writeAccReg(s,LSM9DS0_CTRL_REG2_XM, 0b00100000); // +/- 16G full scale
 
 		//Enable the magnetometer
-		writeMagReg(LSM9DS0_CTRL_REG5_XM, 0b11110000); // Temp enable, M data rate = 50Hz
-		writeMagReg(LSM9DS0_CTRL_REG6_XM, 0b01100000); // +/-12gauss
-		writeMagReg(LSM9DS0_CTRL_REG7_XM, 0b00000000); // Continuous-conversion mode
+		writeMagReg(s,LSM9DS0_CTRL_REG5_XM, 0b11110000); // Temp enable, M data rate = 50Hz
+		writeMagReg(s,LSM9DS0_CTRL_REG6_XM, 0b01100000); // +/-12gauss
+		writeMagReg(s,LSM9DS0_CTRL_REG7_XM, 0b00000000); // Continuous-conversion mode
 
 		// Enable Gyro
-		writeGyrReg(LSM9DS0_CTRL_REG1_G, 0b00001111); // Normal power mode, all axes enabled
-		writeGyrReg(LSM9DS0_CTRL_REG4_G, 0b00110000); // Continuos update, 2000 dps full scale
+		writeGyrReg(s,LSM9DS0_CTRL_REG1_G, 0b00001111); // Normal power mode, all axes enabled
+		writeGyrReg(s,LSM9DS0_CTRL_REG4_G, 0b00110000); // Continuos update, 2000 dps full scale
+
+		/* same gains as LSM9DS1 at 2000 dps, 16 g, 12 gauss */
+		c->gyroFsBits=3;
+		c->accFsBits=1;
+		c->magFsBits=2;
+		_scales_gain(c);
 	}
 
-	if (LSM9DS1){//For BerryIMUv2      
-		// Enable the gyroscope
-		writeGyrReg(LSM9DS1_CTRL_REG4,0b00111000);      // z, y, x axis enabled for gyro
-		writeGyrReg(LSM9DS1_CTRL_REG1_G,0b10111000);    // Gyro ODR = 476Hz, 2000 dps
-		writeGyrReg(LSM9DS1_ORIENT_CFG_G,0b10111000);   // Swap orientation 
+	if (c->LSM9DS1){//For BerryIMUv2      
+		_scales_select(c);
 
-		// Enable the accelerometer
-		writeAccReg(LSM9DS1_CTRL_REG5_XL,0b00111000);   // z, y, x axis enabled for accelerometer
-		writeAccReg(LSM9DS1_CTRL_REG6_XL,0b00101000);   // +/- 16g
+		// Enable the gyroscope
+		writeGyrReg(s,LSM9DS1_CTRL_REG4,0b00111000);      // z, y, x axis enabled for gyro
+		writeGyrReg(s,LSM9DS1_CTRL_REG1_G,(c->gyroOdrBits << 5) | (c->gyroFsBits << 3));    // Gyro ODR and full scale
+		writeGyrReg(s,LSM9DS1_ORIENT_CFG_G,0b10111000);   // Swap orientation 
+
+		// Enable the accelerometer. Bandwidth follows ODR unless one is requested (BW_SCAL_ODR)
+		bw = 0;
+		if ( c->settings.config.accelBandwidth > 0.0 ) {
+			bw = 0x04 | _setting(accBwTable,LSM9DS1_SETTINGS(accBwTable),c->settings.config.accelBandwidth)->bits;
+		}
+		writeAccReg(s,LSM9DS1_CTRL_REG5_XL,0b00111000);   // z, y, x axis enabled for accelerometer
+		writeAccReg(s,LSM9DS1_CTRL_REG6_XL,(c->accOdrBits << 5) | (c->accFsBits << 3) | bw);   // ODR, full scale, bandwidth
 
 		//Enable the magnetometer
-		writeMagReg(LSM9DS1_CTRL_REG1_M, 0b10011100);   // Temp compensation enabled,Low power mode mode,80Hz ODR
-		writeMagReg(LSM9DS1_CTRL_REG2_M, 0b01000000);   // +/-12gauss
-		writeMagReg(LSM9DS1_CTRL_REG3_M, 0b00000000);   // continuos update
-		writeMagReg(LSM9DS1_CTRL_REG4_M, 0b00000000);   // lower power mode for Z axis
+		writeMagReg(s,LSM9DS1_CTRL_REG1_M, 0x80 | (c->magOdrBits << 2));   // Temp compensation enabled,Low power mode mode, ODR
+		writeMagReg(s,LSM9DS1_CTRL_REG2_M, c->magFsBits << 5);   // full scale
+		writeMagReg(s,LSM9DS1_CTRL_REG3_M, 0b00000000);   // continuos update
+		writeMagReg(s,LSM9DS1_CTRL_REG4_M, 0b00000000);   // lower power mode for Z axis
+
+		fprintf(stderr,"# %s gyro %g Hz %g deg/s, accelerometer %g Hz %g g, magnetometer %g Hz %g gauss\n",s->name,
+			_setting_bits(gyroOdrTable,LSM9DS1_SETTINGS(gyroOdrTable),c->gyroOdrBits)->value,
+			_setting_bits(gyroFsTable,LSM9DS1_SETTINGS(gyroFsTable),c->gyroFsBits)->value,
+			_setting_bits(accOdrTable,LSM9DS1_SETTINGS(accOdrTable),c->accOdrBits)->value,
+			_setting_bits(accFsTable,LSM9DS1_SETTINGS(accFsTable),c->accFsBits)->value,
+			_setting_bits(magOdrTable,LSM9DS1_SETTINGS(magOdrTable),c->magOdrBits)->value,
+			_setting_bits(magFsTable,LSM9DS1_SETTINGS(magFsTable),c->magFsBits)->value);
+	}
+
+}
+
+/* accelerometer and gyro data-ready on INT1_A/G. The pin is high until the output registers are read */
+static int LSM9DS1_data_ready_configure(sensor_instance *s) {
+	LSM9DS1_context *c = s->priv;
+
+	if ( ! c->LSM9DS1 ) 
+		return -1;
+
+	writeAccReg(s,LSM9DS1_INT1_CTRL,0b00000011);             // INT1_DRDY_G | INT1_DRDY_XL
+
+	return 0;
+}
+
+/* reading the sources clears the latched interrupts. IA_XL and IA_G are bit 6 */
+static int LSM9DS1_event_pending(sensor_instance *s) {
+	LSM9DS1_context *c = s->priv;
+	int src, events = 0;
+
+	selectDevice(s->i2cHandle,c->accAddress);
+
+	if ( c->settings.event.accelThreshold > 0.0 ) {
+		src = i2c_smbus_read_byte_data(s->i2cHandle, LSM9DS1_INT_GEN_SRC_XL);
+		if ( src < 0 ) 
+			sensor_bus_error(s,errno);
+		else if ( src & 0x40 ) 
+			events |= SENSOR_EVENT_ACCEL;
+	}
+
+	if ( c->settings.event.gyroThreshold > 0.0 ) {
+		src = i2c_smbus_read_byte_data(s->i2cHandle, LSM9DS1_INT_GEN_SRC_G);
+		if ( src < 0 ) 
+			sensor_bus_error(s,errno);
+		else if ( src & 0x40 ) 
+			events |= SENSOR_EVENT_GYRO;
+	}
+
+	return events;
+}
+
+/* 
+program accelerometer and gyro interrupt generators. Both are latched and routed to INT1_A/G,
+so either the pin or INT_GEN_SRC_XL / INT_GEN_SRC_G can be watched 
+*/
+static int LSM9DS1_event_configure(sensor_instance *s) {
+	LSM9DS1_context *c = s->priv;
+	long ths;
+	uint8_t dur, int1 = 0;
+	int i;
+
+	if ( ! c->LSM9DS1 ) 
+		return -1;
+
+	dur = ( c->settings.event.duration > 0 ) ? 0x80 | (c->settings.event.duration & 0x7f) : 0;
+
+	if ( c->settings.event.accelThreshold > 0.0 ) {
+		/* threshold is compared with the 8 most significant bits of the output */
+		ths = lrint(c->settings.event.accelThreshold / (c->accGain * 256.0));
+		if ( ths < 1 ) ths = 1;
+		if ( ths > 255 ) ths = 255;
+
+		writeAccReg(s,LSM9DS1_CTRL_REG7_XL,0b00000001);         // high-pass filtered data to interrupt generator
+		writeAccReg(s,LSM9DS1_INT_GEN_THS_X_XL,ths);
+		writeAccReg(s,LSM9DS1_INT_GEN_THS_Y_XL,ths);
+		writeAccReg(s,LSM9DS1_INT_GEN_THS_Z_XL,ths);
+		writeAccReg(s,LSM9DS1_INT_GEN_DUR_XL,dur);
+		writeAccReg(s,LSM9DS1_INT_GEN_CFG_XL,0b00101010);       // OR of X, Y, Z high events
+		writeGyrReg(s,LSM9DS1_CTRL_REG4,0b00111010);            // gyro axes enabled, latch accelerometer interrupt
+		int1 |= 0x40;
+
+		fprintf(stderr,"# %s accelerometer event above %0.3f g\n",s->name,ths * c->accGain * 256.0);
+	}
+
+	if ( c->settings.event.gyroThreshold > 0.0 ) {
+		/* 15 bit threshold in output LSB */
+		ths = lrint(c->settings.event.gyroThreshold / c->gyroGain);
+		if ( ths < 1 ) ths = 1;
+		if ( ths > 0x7fff ) ths = 0x7fff;
+
+		for ( i=0 ; i<3 ; i++ ) {
+			writeGyrReg(s,LSM9DS1_INT_GEN_THS_XH_G + 2*i,(ths >> 8) & 0x7f);
+			writeGyrReg(s,LSM9DS1_INT_GEN_THS_XL_G + 2*i,ths & 0xff);
+		}
+		writeGyrReg(s,LSM9DS1_INT_GEN_DUR_G,dur);
+		writeGyrReg(s,LSM9DS1_INT_GEN_CFG_G,0b01101010);        // latched, OR of X, Y, Z high events
+		int1 |= 0x80;
+
+		fprintf(stderr,"# %s gyro event above %0.1f deg/s\n",s->name,ths * c->gyroGain);
+	}
+
+	writeAccReg(s,LSM9DS1_INT1_CTRL,int1);
+
+	/* clear anything latched while configuring */
+	LSM9DS1_event_pending(s);
+
+	return 0;
+}
+
+
+/* calibrator of instance, created on first use so it also exists when replaying */
+static mag_calibrator *_mag_calibrator(sensor_instance *s) {
+	LSM9DS1_context *c = s->priv;
+
+	if ( NULL != c->magCal || ( '\0' == c->settings.magCalFilename[0] && ! c->settings.magCalFit ) ) 
+		return c->magCal;
+
+	c->magCal = mag_calibrator_new(c->settings.magCalFilename,c->settings.magCalFit);
+	return c->magCal;
+}
+
+/* hard-iron offset from calibration file into magnetometer offset registers */
+static void _mag_offset_registers(sensor_instance *s) {
+	LSM9DS1_context *c = s->priv;
+	mag_calibration cal;
+	int i;
+
+	if ( ! c->LSM9DS1 || NULL == _mag_calibrator(s) || 0 == mag_calibrator_get(c->magCal,&cal) ) 
+		return;
+
+	for ( i=0 ; i<3 ; i++ ) {
+		c->magChipOffset[i] = (int16_t) lrint(cal.offset[i]);
+		writeMagReg(s,LSM9DS1_OFFSET_X_REG_L_M + 2*i, c->magChipOffset[i] & 0xff);
+		writeMagReg(s,LSM9DS1_OFFSET_X_REG_H_M + 2*i, (c->magChipOffset[i] >> 8) & 0xff);
 	}
 
+	fprintf(stderr,"# %s magnetometer offset registers set to %d %d %d\n",s->name,
+		c->magChipOffset[0],c->magChipOffset[1],c->magChipOffset[2]);
+}
+
+/* setup block is the magnetometer offset registers and the ODR and full-scale fields */
+static void _setup_encode(const LSM9DS1_context *c, uint8_t *setup) {
+	int i;
+
+	for ( i=0 ; i<3 ; i++ ) {
+		setup[LSM9DS1_SETUP_MAG_OFFSET + 2*i] = c->magChipOffset[i] & 0xff;
+		setup[LSM9DS1_SETUP_MAG_OFFSET + 2*i + 1] = (c->magChipOffset[i] >> 8) & 0xff;
+	}
+
+	setup[LSM9DS1_SETUP_SCALES + 0] = c->gyroOdrBits;
+	setup[LSM9DS1_SETUP_SCALES + 1] = c->gyroFsBits;
+	setup[LSM9DS1_SETUP_SCALES + 2] = c->accOdrBits;
+	setup[LSM9DS1_SETUP_SCALES + 3] = c->accFsBits;
+	setup[LSM9DS1_SETUP_SCALES + 4] = c->magOdrBits;
+	setup[LSM9DS1_SETUP_SCALES + 5] = c->magFsBits;
+}
+
+/* logs from before scales were configurable have only the offsets */
+static void LSM9DS1_load_setup(sensor_instance *s, const uint8_t *setup, uint16_t length) {
+	LSM9DS1_context *c = s->priv;
+	int i;
+
+	if ( length >= LSM9DS1_SETUP_SCALES ) {
+		for ( i=0 ; i<3 ; i++ ) {
+			c->magChipOffset[i] = (int16_t) (setup[LSM9DS1_SETUP_MAG_OFFSET + 2*i] | setup[LSM9DS1_SETUP_MAG_OFFSET + 2*i + 1] << 8);
+		}
+	}
+
+	if ( length >= LSM9DS1_SETUP_BYTES ) {
+		c->gyroOdrBits = setup[LSM9DS1_SETUP_SCALES + 0];
+		c->gyroFsBits = setup[LSM9DS1_SETUP_SCALES + 1];
+		c->accOdrBits = setup[LSM9DS1_SETUP_SCALES + 2];
+		c->accFsBits = setup[LSM9DS1_SETUP_SCALES + 3];
+		c->magOdrBits = setup[LSM9DS1_SETUP_SCALES + 4];
+		c->magFsBits = setup[LSM9DS1_SETUP_SCALES + 5];
+		_scales_gain(c);
+	}
 }
 
-static void _build_raw_array(struct json_object *j_array_obj, int *raw, int count ) {
-	int *raw_end = raw + count;
+static void LSM9DS1_release(sensor_instance *s) {
+	LSM9DS1_context *c = s->priv;
+
+	mag_calibrator_free(c->magCal);
+	c->magCal=NULL;
+}
+
+/* JSON number formatted with the instance's decimals, or JSON string of the same if in compatibility mode */
+static struct json_object *_json_number(const LSM9DS1_context *c, double value) {
+	char buffer[FORMAT_FIXED_BUFFER];
+
+	format_fixed(buffer,value,c->settings.jsonDecimals);
+
+	if ( c->settings.jsonStringNumbers ) {
+		return json_object_new_string(buffer);
+	}
+
+	return json_object_new_double_s(value,buffer);
+}
+
+static void _build_raw_array(struct json_object *j_array_obj, const int *raw, int count ) {
+	const int *raw_end = raw + count;
 	for ( ; raw < raw_end ; raw++ ) {
 		json_object_array_add(j_array_obj, json_object_new_int(*raw));
 	}
@@ -277,55 +578,159 @@ static void _build_raw_array(struct json_object *j_array_obj, int *raw, int coun
 
 
 
-void LSM9DS1_init(int i2cHandle, int i2cAddress) {
+static int LSM9DS1_init(sensor_instance *s, const void *settings) {
+	static const LSM9DS1_settings defaults = LSM9DS1_SETTINGS_DEFAULT;
+	LSM9DS1_context *c = s->priv;
 
-	detectIMU();
-	enableIMU();
+	c->settings = ( NULL == settings ) ? defaults : *(const LSM9DS1_settings *) settings;
+
+	memset(c->gyroAngle,0,sizeof(c->gyroAngle));
+	memset(c->CFangle,0,sizeof(c->CFangle));
+	c->lastSample_usec = 0;
+	c->gyroBiasInitialized = 0;
+	mag_calibrator_free(c->magCal);
+	c->magCal = NULL;
+
+	return 0;
 }
 
-void LSM9DS1_sample(int i2cHandle, int i2cAddress) {
-	char buffer[64];
-        float accXnorm,accYnorm,pitch,roll,magXcomp,magYcomp;
+static int LSM9DS1_probe(sensor_instance *s) {
+	return detectIMU(s);
+}
+
+static int LSM9DS1_configure(sensor_instance *s, uint8_t *setup) {
+	LSM9DS1_context *c = s->priv;
 
+	enableIMU(s);
+
+	if ( c->settings.magCalOffsetRegisters ) {
+		_mag_offset_registers(s);
+	}
+
+	_setup_encode(c,setup);
+	return LSM9DS1_SETUP_BYTES;
+}
 
+/* new accelerometer or gyroscope data in STATUS_REG_1. LSM9DS0 is always read */
+/* accelerometer and gyro share the gyro's ODR while the gyro is on */
+static double LSM9DS1_output_rate(const sensor_instance *s) {
+	const LSM9DS1_context *c = s->priv;
+
+	if ( ! c->LSM9DS1 || ! c->haveScales ) 
+		return 0.0;
+
+	if ( 0 != c->gyroOdrBits ) 
+		return _setting_bits(gyroOdrTable,LSM9DS1_SETTINGS(gyroOdrTable),c->gyroOdrBits)->value;
+
+	return _setting_bits(accOdrTable,LSM9DS1_SETTINGS(accOdrTable),c->accOdrBits)->value;
+}
+
+static int LSM9DS1_data_ready(sensor_instance *s) {
+	LSM9DS1_context *c = s->priv;
+	int status;
+
+	if ( ! c->LSM9DS1 ) 
+		return 1;
+
+	selectDevice(s->i2cHandle,c->accAddress);
+	status = i2c_smbus_read_byte_data(s->i2cHandle, LSM9DS1_STATUS_REG_1);
+
+	if ( status < 0 ) 
+		sensor_bus_error(s,errno);
+
+	/* XLDA is bit 0, GDA is bit 1. Read anyhow if status can't be read */
+	return ( status < 0 || 0 != (status & 0x03) );
+}
+
+/* read accelerometer, gyroscope, and magnetometer output registers into data (LSM9DS1_RAW_BYTES) */
+static void LSM9DS1_read_raw(sensor_instance *s, uint8_t *data) {
+	readACC(s,data+LSM9DS1_RAW_ACC);
+	readGYR(s,data+LSM9DS1_RAW_GYR,data+LSM9DS1_RAW_TEMP);
+	readMAG(s,data+LSM9DS1_RAW_MAG);
+}
+
+/* raw output registers to angles and heading */
+static void LSM9DS1_decode(sensor_instance *s, const uint8_t *data, sensor_sample *sample) {
+        float accXnorm,accYnorm,pitch,roll,magXcomp,magYcomp;
+	LSM9DS1_sample_struct *m = &sample->u.LSM9DS1;
+	LSM9DS1_context *c = s->priv;
 
 	float rate_gyr_y = 0.0;   // [deg/s]
 	float rate_gyr_x = 0.0;   // [deg/s]
 	float rate_gyr_z = 0.0;   // [deg/s]
 
-	int  accRaw[3];
-	int  magRaw[3];
-	int  gyrRaw[3];
+	int *accRaw = m->accRaw;
+	int *magRaw = m->magRaw;
+	int *gyrRaw = m->gyrRaw;
 
 
 
-	float gyroXangle = 0.0;
-	float gyroYangle = 0.0;
-	float gyroZangle = 0.0;
 	float AccYangle = 0.0;
 	float AccXangle = 0.0;
-	float CFangleX = 0.0;
-	float CFangleY = 0.0;
+	double dt = DT;
 
-	char *raw_fmt="%04x %04x %04x";
+	//combine MAG ACC and GYR data
+	_block_to_xyz(data+LSM9DS1_RAW_ACC,accRaw);
+	_block_to_xyz(data+LSM9DS1_RAW_GYR,gyrRaw);
+	_block_to_xyz(data+LSM9DS1_RAW_MAG,magRaw);
 
-	//read MAG ACC and GYR data
-	readACC(accRaw);
-	readGYR(gyrRaw);
-	readMAG(magRaw);
 
+	/* replay of a log without a setup block uses the command line configuration */
+	if ( ! c->haveScales ) {
+		_scales_select(c);
+	}
 
 	//Convert Gyro raw to degrees per second
-	rate_gyr_x = (float) gyrRaw[0] * G_GAIN;
-	rate_gyr_y = (float) gyrRaw[1]  * G_GAIN;
-	rate_gyr_z = (float) gyrRaw[2]  * G_GAIN;
+	rate_gyr_x = (float) gyrRaw[0] * c->gyroGain;
+	rate_gyr_y = (float) gyrRaw[1]  * c->gyroGain;
+	rate_gyr_z = (float) gyrRaw[2]  * c->gyroGain;
+
+	m->gyroRate[0]=rate_gyr_x;
+	m->gyroRate[1]=rate_gyr_y;
+	m->gyroRate[2]=rate_gyr_z;
+	m->acc[0]=accRaw[0] * c->accGain;
+	m->acc[1]=accRaw[1] * c->accGain;
+	m->acc[2]=accRaw[2] * c->accGain;
+
+	/* OUT_TEMP is 16 LSB per degree with 0 at 25C. LSM9DS0 blocks have no temperature */
+	m->haveTemperature = ( sample->rawLength >= LSM9DS1_RAW_BYTES && ( c->LSM9DS1 || ! c->LSM9DS0 ) );
+	m->temperatureC = 25.0;
+	if ( m->haveTemperature ) {
+		m->temperatureC = 25.0 + (int16_t) (data[LSM9DS1_RAW_TEMP] | data[LSM9DS1_RAW_TEMP+1] << 8) / 16.0;
+	}
+
+	/* learn bias while still and remove it from the rates everything else is computed from */
+	m->still = m->gyroBiasValid = 0;
+	if ( c->settings.gyroBias ) {
+		if ( ! c->gyroBiasInitialized ) {
+			gyro_bias_init(&c->gyroBias);
+			c->gyroBiasInitialized=1;
+		}
+
+		m->still = gyro_bias_update(&c->gyroBias,m->gyroRate,m->acc,m->temperatureC);
+		m->gyroBiasValid = gyro_bias_get(&c->gyroBias,m->temperatureC,m->gyroBias);
+		if ( m->gyroBiasValid ) {
+			m->gyroRate[0] -= m->gyroBias[0];
+			m->gyroRate[1] -= m->gyroBias[1];
+			m->gyroRate[2] -= m->gyroBias[2];
+			rate_gyr_x = m->gyroRate[0];
+			rate_gyr_y = m->gyroRate[1];
+			rate_gyr_z = m->gyroRate[2];
+		}
+	}
 
 
 
+	/* the filter runs over the time since this instance's last sample. DT if there isn't one or it was long ago */
+	if ( 0 != c->lastSample_usec && sample->timestamp_usec > c->lastSample_usec && sample->timestamp_usec - c->lastSample_usec < 1000000 ) {
+		dt = (sample->timestamp_usec - c->lastSample_usec) / 1e6;
+	}
+	c->lastSample_usec = sample->timestamp_usec;
+
 	//Calculate the angles from the gyro
-	gyroXangle+=rate_gyr_x*DT;
-	gyroYangle+=rate_gyr_y*DT;
-	gyroZangle+=rate_gyr_z*DT;
+	c->gyroAngle[0]+=rate_gyr_x*dt;
+	c->gyroAngle[1]+=rate_gyr_y*dt;
+	c->gyroAngle[2]+=rate_gyr_z*dt;
 
 
 
@@ -355,26 +760,19 @@ void LSM9DS1_sample(int i2cHandle, int i2cAddress) {
 
 
 	//Complementary filter used to combine the accelerometer and gyro values.
-	CFangleX=AA*(CFangleX+rate_gyr_x*DT) +(1 - AA) * AccXangle;
-	CFangleY=AA*(CFangleY+rate_gyr_y*DT) +(1 - AA) * AccYangle;
+	c->CFangle[0]=AA*(c->CFangle[0]+rate_gyr_x*dt) +(1 - AA) * AccXangle;
+	c->CFangle[1]=AA*(c->CFangle[1]+rate_gyr_y*dt) +(1 - AA) * AccYangle;
 
 
 	//printf ("   GyroX  %7.3f \t AccXangle \e[m %7.3f \t \033[22;31mCFangleX %7.3f\033[0m\t GyroY  %7.3f \t AccYangle %7.3f \t \033[22;36mCFangleY %7.3f\t\033[0m\n",gyroXangle,AccXangle,CFangleX,gyroYangle,AccYangle,CFangleY);
 
-	/* put data in JSON objects */
-	/* put gyroscope data in jobj_sensors_LSM9DS1_gyro */
-	snprintf(buffer,sizeof(buffer),"%1.3f",gyroXangle);
-	json_object_object_add(jobj_sensors_LSM9DS1_gyro, "gyro_x", json_object_new_string(buffer));
-	snprintf(buffer,sizeof(buffer),"%1.3f",gyroYangle);
-	json_object_object_add(jobj_sensors_LSM9DS1_gyro, "gyro_y", json_object_new_string(buffer));
-	snprintf(buffer,sizeof(buffer),"%1.3f",gyroZangle);
-	json_object_object_add(jobj_sensors_LSM9DS1_gyro, "gyro_z", json_object_new_string(buffer));
-
-	/* put accelerometer data in jobj_sensors_LSM9DS1_accel */
-	snprintf(buffer,sizeof(buffer),"%1.3f",AccXangle);
-	json_object_object_add(jobj_sensors_LSM9DS1_accel, "accel_x", json_object_new_string(buffer));
-	snprintf(buffer,sizeof(buffer),"%1.3f",AccYangle);
-	json_object_object_add(jobj_sensors_LSM9DS1_accel, "accel_y", json_object_new_string(buffer));
+	m->gyroAngle[0]=c->gyroAngle[0];
+	m->gyroAngle[1]=c->gyroAngle[1];
+	m->gyroAngle[2]=c->gyroAngle[2];
+	m->accAngle[0]=AccXangle;
+	m->accAngle[1]=AccYangle;
+	m->CFangle[0]=c->CFangle[0];
+	m->CFangle[1]=c->CFangle[1];
 
 	//Compute heading
 	float heading = 180 * atan2(magRaw[1],magRaw[0])/M_PI;
@@ -383,22 +781,110 @@ void LSM9DS1_sample(int i2cHandle, int i2cAddress) {
 	if(heading < 0)
 		heading += 360;
 
+	m->heading=heading;
+
+	/* calibration is in terms of the uncorrected magnetometer, so add back what the chip subtracted */
+	m->magCalibrated=0;
+	if ( NULL != _mag_calibrator(s) ) {
+		mag_calibration cal;
+		double mag[3];
+		int i;
+
+		for ( i=0 ; i<3 ; i++ ) {
+			mag[i] = magRaw[i] + c->magChipOffset[i];
+		}
+		mag_calibrator_add(c->magCal,mag);
+
+		if ( mag_calibrator_get(c->magCal,&cal) ) {
+			mag_calibration_apply(&cal,mag,m->magCal);
+			m->tiltHeading = mag_tilt_compensated_heading(m->magCal,accRaw);
+			m->magCalibrated=1;
+		}
+	}
+}
+
+/* decoded values for metrics */
+static int LSM9DS1_values(const sensor_instance *s, const sensor_sample *sample, sensor_value *v, int max) {
+	const LSM9DS1_sample_struct *d = &sample->u.LSM9DS1;
+	const LSM9DS1_context *c = s->priv;
+	int n = 0;
+
+/* add value if there is room */
+#define LSM9DS1_VALUE(label,x) do { if ( n < max ) { v[n].name=label; v[n].value=(x); n++; } } while ( 0 )
+
+	LSM9DS1_VALUE("acceleration_x_g",d->acc[0]);
+	LSM9DS1_VALUE("acceleration_y_g",d->acc[1]);
+	LSM9DS1_VALUE("acceleration_z_g",d->acc[2]);
+	LSM9DS1_VALUE("gyro_rate_x_dps",d->gyroRate[0]);
+	LSM9DS1_VALUE("gyro_rate_y_dps",d->gyroRate[1]);
+	LSM9DS1_VALUE("gyro_rate_z_dps",d->gyroRate[2]);
+	LSM9DS1_VALUE("magnetometer_x_raw",d->magRaw[0]);
+	LSM9DS1_VALUE("magnetometer_y_raw",d->magRaw[1]);
+	LSM9DS1_VALUE("magnetometer_z_raw",d->magRaw[2]);
+	LSM9DS1_VALUE("angle_x_deg",d->CFangle[0]);
+	LSM9DS1_VALUE("angle_y_deg",d->CFangle[1]);
+	LSM9DS1_VALUE("heading_deg",d->heading);
+	if ( d->magCalibrated ) 
+		LSM9DS1_VALUE("heading_compensated_deg",d->tiltHeading);
+	if ( d->haveTemperature ) 
+		LSM9DS1_VALUE("temperature_c",d->temperatureC);
+	if ( c->settings.gyroBias ) 
+		LSM9DS1_VALUE("still",d->still);
+
+#undef LSM9DS1_VALUE
+	return n;
+}
+
+/* put sample into JSON objects */
+static void LSM9DS1_serialize(const sensor_instance *s, const sensor_sample *sample, struct json_object *jobj_sensors_LSM9DS1) {
+	const LSM9DS1_sample_struct *m = &sample->u.LSM9DS1;
+	const LSM9DS1_context *c = s->priv;
+	struct json_object *jobj_sensors_LSM9DS1_gyro,*jobj_sensors_LSM9DS1_accel,*jobj_sensors_LSM9DS1_magnet;
+	struct json_object *jobj_sensors_LSM9DS1_gyro_array,*jobj_sensors_LSM9DS1_accel_array,*jobj_sensors_LSM9DS1_magnet_array;
+
+	jobj_sensors_LSM9DS1_gyro = json_object_new_object();
+	jobj_sensors_LSM9DS1_accel = json_object_new_object();
+	jobj_sensors_LSM9DS1_magnet = json_object_new_object();
+
+	/* put gyroscope data in jobj_sensors_LSM9DS1_gyro */
+	json_object_object_add(jobj_sensors_LSM9DS1_gyro, "gyro_x", _json_number(c,m->gyroAngle[0]));
+	json_object_object_add(jobj_sensors_LSM9DS1_gyro, "gyro_y", _json_number(c,m->gyroAngle[1]));
+	json_object_object_add(jobj_sensors_LSM9DS1_gyro, "gyro_z", _json_number(c,m->gyroAngle[2]));
+
+	if ( c->settings.gyroBias ) {
+		struct json_object *jobj_bias = json_object_new_array();
+
+		json_object_array_add(jobj_bias, _json_number(c,m->gyroBias[0]));
+		json_object_array_add(jobj_bias, _json_number(c,m->gyroBias[1]));
+		json_object_array_add(jobj_bias, _json_number(c,m->gyroBias[2]));
+		json_object_object_add(jobj_sensors_LSM9DS1_gyro, "bias", jobj_bias);
+		json_object_object_add(jobj_sensors_LSM9DS1_gyro, "still", json_object_new_boolean(m->still));
+		if ( m->haveTemperature ) {
+			json_object_object_add(jobj_sensors_LSM9DS1_gyro, "temperature_C", _json_number(c,m->temperatureC));
+		}
+	}
+
+	/* put accelerometer data in jobj_sensors_LSM9DS1_accel */
+	json_object_object_add(jobj_sensors_LSM9DS1_accel, "accel_x", _json_number(c,m->accAngle[0]));
+	json_object_object_add(jobj_sensors_LSM9DS1_accel, "accel_y", _json_number(c,m->accAngle[1]));
 
 	/* put magnetometer data in jobj_sensors_LSM9DS1_magnet */
-	snprintf(buffer,sizeof(buffer),"%1.3f",heading);
-	json_object_object_add(jobj_sensors_LSM9DS1_magnet, "magnet_heading", json_object_new_string(buffer));
+	json_object_object_add(jobj_sensors_LSM9DS1_magnet, "magnet_heading", _json_number(c,m->heading));
+	if ( m->magCalibrated ) {
+		json_object_object_add(jobj_sensors_LSM9DS1_magnet, "magnet_heading_compensated", _json_number(c,m->tiltHeading));
+	}
 
 	/* put raw data from the three sensos */
 	jobj_sensors_LSM9DS1_accel_array = json_object_new_array();
-	_build_raw_array(jobj_sensors_LSM9DS1_accel_array,accRaw,3);
+	_build_raw_array(jobj_sensors_LSM9DS1_accel_array,m->accRaw,3);
 	json_object_object_add( jobj_sensors_LSM9DS1_accel, "sample_0X", jobj_sensors_LSM9DS1_accel_array);
 
 	jobj_sensors_LSM9DS1_gyro_array = json_object_new_array();
-	_build_raw_array(jobj_sensors_LSM9DS1_gyro_array,gyrRaw,3);
+	_build_raw_array(jobj_sensors_LSM9DS1_gyro_array,m->gyrRaw,3);
 	json_object_object_add( jobj_sensors_LSM9DS1_gyro, "sample_0X", jobj_sensors_LSM9DS1_gyro_array);
 
 	jobj_sensors_LSM9DS1_magnet_array =  json_object_new_array();
-	_build_raw_array(jobj_sensors_LSM9DS1_magnet_array,magRaw,3);
+	_build_raw_array(jobj_sensors_LSM9DS1_magnet_array,m->magRaw,3);
 	json_object_object_add( jobj_sensors_LSM9DS1_magnet, "sample_0X", jobj_sensors_LSM9DS1_magnet_array);
 
 	/* put gyro, accel, and magnet into main LSM9DS1 */
@@ -406,3 +892,27 @@ void LSM9DS1_sample(int i2cHandle, int i2cAddress) {
 	json_object_object_add(jobj_sensors_LSM9DS1, "accelerometer", jobj_sensors_LSM9DS1_accel);
 	json_object_object_add(jobj_sensors_LSM9DS1, "magnetometer", jobj_sensors_LSM9DS1_magnet);
 }
+
+const sensor_driver sensor_driver_LSM9DS1 = {
+	.name = "LSM9DS1",
+	.defaultAddress = LSM9DS1_GYR_ADDRESS,
+	.rawBytes = LSM9DS1_RAW_BYTES,
+	.captureDevice = CAPTURE_DEVICE_LSM9DS1,
+	.captureSetupDevice = CAPTURE_DEVICE_LSM9DS1_SETUP,
+	.privBytes = sizeof(LSM9DS1_context),
+
+	.init = LSM9DS1_init,
+	.probe = LSM9DS1_probe,
+	.configure = LSM9DS1_configure,
+	.load_setup = LSM9DS1_load_setup,
+	.data_ready = LSM9DS1_data_ready,
+	.output_rate = LSM9DS1_output_rate,
+	.read_raw = LSM9DS1_read_raw,
+	.decode = LSM9DS1_decode,
+	.serialize = LSM9DS1_serialize,
+	.values = LSM9DS1_values,
+	.data_ready_configure = LSM9DS1_data_ready_configure,
+	.event_configure = LSM9DS1_event_configure,
+	.event_pending = LSM9DS1_event_pending,
+	.release = LSM9DS1_release,
+};
@@ -1,7 +1,77 @@
+
 #ifndef APRSi2C_SENSORS_IMU_SENSOR_LSM9DS1_H
 #define APRSi2C_SENSORS_IMU_SENSOR_LSM9DS1_H
-void LSM9DS1_init(int, int);
-void LSM9DS1_sample(int, int);
-extern struct json_object *jobj_sensors_LSM9DS1,*jobj_sensors_LSM9DS1_gyro,*jobj_sensors_LSM9DS1_accel,*jobj_sensors_LSM9DS1_magnet;
-extern struct json_object *jobj_sensors_LSM9DS1_gyro_array,*jobj_sensors_LSM9DS1_accel_array,*jobj_sensors_LSM9DS1_magnet_array;
+#include <stdint.h>
+
+/* 
+raw register block: accelerometer, gyroscope, magnetometer output registers, then OUT_TEMP 
+and STATUS_REG which are read in the same burst as the gyroscope. Older logs stop after MAG 
+*/
+#define LSM9DS1_RAW_ACC          0
+#define LSM9DS1_RAW_GYR          6
+#define LSM9DS1_RAW_MAG          12
+#define LSM9DS1_RAW_TEMP         18
+#define LSM9DS1_RAW_STATUS       20
+#define LSM9DS1_RAW_BYTES        21
+#define LSM9DS1_RAW_BYTES_NOTEMP 18
+
+/* decoded sample */
+typedef struct {
+	int accRaw[3];
+	int gyrRaw[3];
+	int magRaw[3];
+	double gyroRate[3];	/* deg/s */
+	double acc[3];		/* g */
+	double gyroAngle[3];	/* x, y, z */
+	double accAngle[2];	/* x, y */
+	double CFangle[2];	/* complementary filter x, y */
+	double heading;
+	int magCalibrated;	/* magCal and tiltHeading are valid */
+	double magCal[3];	/* hard / soft iron corrected magnetometer, raw LSB */
+	double tiltHeading;	/* tilt compensated heading from magCal */
+	int haveTemperature;
+	double temperatureC;	/* die temperature */
+	int still;		/* stillness detector */
+	int gyroBiasValid;	/* gyroRate has had gyroBias removed */
+	double gyroBias[3];	/* deg/s */
+} LSM9DS1_sample_struct;
+
+/* setup block: magnetometer offset registers, then ODR and full-scale register fields */
+#define LSM9DS1_SETUP_MAG_OFFSET 0
+#define LSM9DS1_SETUP_SCALES     6
+#define LSM9DS1_SETUP_BYTES      12
+
+/* requested configuration. 0 picks ODR from samplingInterval and keeps the default range */
+typedef struct {
+	int samplingInterval;	/* milliseconds */
+	double gyroOdr;		/* Hz */
+	double accelOdr;
+	double magOdr;
+	double gyroRange;	/* deg/s */
+	double accelRange;	/* g */
+	double magRange;	/* gauss */
+	double accelBandwidth;	/* Hz, anti-aliasing filter. 0 for automatic from ODR */
+} LSM9DS1_config_struct;
+
+/* interrupt generator thresholds for event mode. 0 disables a generator */
+typedef struct {
+	double accelThreshold;	/* g, after high-pass filter so gravity doesn't count */
+	double gyroThreshold;	/* deg/s */
+	int duration;		/* samples the threshold must be exceeded for */
+} LSM9DS1_event_struct;
+
+/* settings of one instance, given to the driver's init(). Start from LSM9DS1_SETTINGS_DEFAULT */
+typedef struct {
+	int jsonDecimals;		/* digits after the decimal point */
+	int jsonStringNumbers;		/* numbers as JSON strings, for compatibility */
+	char magCalFilename[256];	/* magnetometer calibration file, "" for none */
+	int magCalFit;			/* fit calibration online */
+	int magCalOffsetRegisters;	/* load offsets into the OFFSET_*_REG_M registers */
+	LSM9DS1_config_struct config;
+	int gyroBias;			/* estimate gyro bias while still and remove it from the gyro rates */
+	LSM9DS1_event_struct event;
+} LSM9DS1_settings;
+
+#define LSM9DS1_SETTINGS_DEFAULT { .jsonDecimals = 3, .config = { .samplingInterval = 500 }, \
+	.event = { .accelThreshold = 0.5, .gyroThreshold = 30.0 } }
 #endif
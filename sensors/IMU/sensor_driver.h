@@ -0,0 +1,127 @@
+
+#ifndef APRSi2C_SENSORS_IMU_SENSOR_DRIVER_H
+#define APRSi2C_SENSORS_IMU_SENSOR_DRIVER_H
+/*
+Uniform interface to sensor drivers. The sample loop only calls through this
+table, so a new sensor is added by writing a driver and listing it in
+sensor_registry.c
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include "sensor_BMP280.h"
+#include "sensor_LSM9DS1.h"
+#include "sample_time.h"
+
+/* event_pending() sources */
+#define SENSOR_EVENT_ACCEL 0x01
+#define SENSOR_EVENT_GYRO  0x02
+
+/* largest raw register block or setup block of any driver */
+#define SENSOR_RAW_MAX   32
+#define SENSOR_SETUP_MAX 32
+
+struct json_object;
+
+/* one decoded value for metrics. name is lower case with unit, ie temperature_c */
+typedef struct {
+	const char *name;
+	double value;
+} sensor_value;
+
+#define SENSOR_VALUES_MAX 32
+
+/* decoded sample. Raw registers are kept for the sample_0X JSON arrays */
+typedef struct {
+	uint64_t timestamp_usec;	/* data-ready edge, or the cycle's sampleTime without data-ready or when replayed */
+	sample_time time;	/* monotonic acquisition time. Zero when replayed */
+	uint16_t rawLength;
+	uint8_t raw[SENSOR_RAW_MAX];
+	union {
+		bmp280_sample_struct bmp280;
+		LSM9DS1_sample_struct LSM9DS1;
+	} u;
+} sensor_sample;
+
+struct sensor_instance;
+
+typedef struct {
+	const char *name;		/* command line and JSON name */
+	int defaultAddress;		/* default I2C address */
+	uint16_t rawBytes;		/* bytes returned by read_raw */
+	uint16_t captureDevice;		/* capture log device of raw block */
+	uint16_t captureSetupDevice;	/* capture log device of setup block, 0 if none */
+	size_t privBytes;		/* size of driver private state allocated for each instance */
+
+	/* 
+	copy settings (the driver's own settings struct, NULL for defaults) into the instance and
+	start its state over. sensor_instance_init() calls it with NULL. NULL if driver has no settings 
+	*/
+	int (*init)(struct sensor_instance *s, const void *settings);
+	/* 0 if device is present */
+	int (*probe)(struct sensor_instance *s);
+	/* configure device. Returns length of setup block (ie calibration) copied to setup */
+	int (*configure)(struct sensor_instance *s, uint8_t *setup);
+	/* load setup block from configure() or from a capture log */
+	void (*load_setup)(struct sensor_instance *s, const uint8_t *setup, uint16_t length);
+	/* 1 if new data is available. NULL if device can not tell us */
+	int (*data_ready)(struct sensor_instance *s);
+	/* Hz new data is converted at, to back-date samples. 0 if unknown */
+	double (*output_rate)(const struct sensor_instance *s);
+	/* read raw output registers */
+	void (*read_raw)(struct sensor_instance *s, uint8_t *raw);
+	/* raw registers to engineering units */
+	void (*decode)(struct sensor_instance *s, const uint8_t *raw, sensor_sample *sample);
+	/* add sample to JSON object of this sensor */
+	void (*serialize)(const struct sensor_instance *s, const sensor_sample *sample, struct json_object *jobj_sensor);
+	/* decoded values of sample for metrics. Returns number put in values */
+	int (*values)(const struct sensor_instance *s, const sensor_sample *sample, sensor_value *values, int max);
+	/* route data-ready to the interrupt pin. Returns 0 if done. NULL if device has no data-ready pin */
+	int (*data_ready_configure)(struct sensor_instance *s);
+	/* program hardware interrupt generators for event mode. Returns 0 if done. NULL if device has none */
+	int (*event_configure)(struct sensor_instance *s);
+	/* read and clear interrupt sources. Returns SENSOR_EVENT_* bits that fired */
+	int (*event_pending)(struct sensor_instance *s);
+	/* release anything held in priv besides the memory itself. NULL if nothing */
+	void (*release)(struct sensor_instance *s);
+} sensor_driver;
+
+/* 
+one sensor on one bus. Drivers keep all of their state in here or in priv, so any
+number of instances of a driver can be sampled, each from its bus worker thread 
+*/
+typedef struct sensor_instance {
+	const sensor_driver *driver;
+	char name[32];		/* JSON name. Driver name for first instance */
+	int instance;		/* 0 for first instance of driver, 1 for second, ... */
+	char i2cDevice[64];	/* /dev/ entry of bus */
+	int i2cHandle;		/* shared with other instances on the same bus */
+	int i2cAddress;
+	int enabled;
+	void *priv;		/* driver->privBytes of driver private state */
+
+	int haveSample;
+	int newSample;		/* read on this cycle */
+	sensor_sample sample;
+
+	/* counters for metrics. Only the instance's bus thread writes them */
+	unsigned long reads;
+	unsigned long busErrors;	/* transfers that failed without ending the program */
+	unsigned long busNaks;		/* of those, not acknowledged */
+} sensor_instance;
+
+/* drivers */
+extern const sensor_driver sensor_driver_bmp280;
+extern const sensor_driver sensor_driver_LSM9DS1;
+
+/* NULL terminated list of all drivers */
+extern const sensor_driver *sensor_drivers[];
+
+const sensor_driver *sensor_driver_find(const char *name);
+const sensor_driver *sensor_driver_find_capture(uint16_t captureDevice);
+
+/* initialize instance of driver, allocating its private state. Returns 0 on success */
+int sensor_instance_init(sensor_instance *s, const sensor_driver *driver, int instance);
+void sensor_instance_free(sensor_instance *s);
+/* count a failed transfer. err is errno of the failure */
+void sensor_bus_error(sensor_instance *s, int err);
+#endif
@@ -0,0 +1,86 @@
+/*
+Static registry of sensor drivers. Drivers are sampled and output in this order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sensor_driver.h"
+#include "capture_log.h"
+
+const sensor_driver *sensor_drivers[] = {
+	&sensor_driver_bmp280,
+	&sensor_driver_LSM9DS1,
+	NULL
+};
+
+const sensor_driver *sensor_driver_find(const char *name) {
+	int i;
+
+	for ( i=0 ; NULL != sensor_drivers[i] ; i++ ) {
+		if ( 0 == strcasecmp(name,sensor_drivers[i]->name) )
+			return sensor_drivers[i];
+	}
+
+	return NULL;
+}
+
+/* find driver by raw block or setup block capture device */
+const sensor_driver *sensor_driver_find_capture(uint16_t captureDevice) {
+	int i;
+
+	for ( i=0 ; NULL != sensor_drivers[i] ; i++ ) {
+		if ( CAPTURE_DEVICE_TYPE(captureDevice) == sensor_drivers[i]->captureDevice || 
+			( 0 != sensor_drivers[i]->captureSetupDevice && CAPTURE_DEVICE_TYPE(captureDevice) == sensor_drivers[i]->captureSetupDevice ) )
+			return sensor_drivers[i];
+	}
+
+	return NULL;
+}
+
+int sensor_instance_init(sensor_instance *s, const sensor_driver *driver, int instance) {
+	memset(s,0,sizeof(sensor_instance));
+
+	s->driver=driver;
+	s->instance=instance;
+	s->i2cHandle=-1;
+	s->i2cAddress=driver->defaultAddress;
+	s->enabled=1;
+
+	if ( 0 == instance ) {
+		snprintf(s->name,sizeof(s->name),"%s",driver->name);
+	} else {
+		snprintf(s->name,sizeof(s->name),"%s_%d",driver->name,instance+1);
+	}
+
+	if ( driver->privBytes > 0 ) {
+		s->priv = calloc(1,driver->privBytes);
+		if ( NULL == s->priv ) {
+			fprintf(stderr,"# out of memory allocating %s\n",s->name);
+			return -1;
+		}
+	}
+
+	if ( NULL != driver->init ) {
+		return driver->init(s,NULL);
+	}
+
+	return 0;
+}
+
+void sensor_instance_free(sensor_instance *s) {
+	if ( NULL != s->priv && NULL != s->driver->release ) {
+		s->driver->release(s);
+	}
+	free(s->priv);
+	s->priv=NULL;
+}
+
+void sensor_bus_error(sensor_instance *s, int err) {
+	s->busErrors++;
+
+	/* i2c bus drivers report a missing acknowledge as one of these */
+	if ( ENXIO == err || EREMOTEIO == err ) 
+		s->busNaks++;
+}
@@ -0,0 +1,273 @@
+/*
+Print the latest pzPowerI2C or imuToMQTT values from shared memory. Doesn't touch the I2C bus
+or need MQTT. See README.md
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include "shm_latest.h"
+
+/* exit values */
+#define EXIT_NO_RECORD 2
+#define EXIT_STALE     3
+
+/* one printable field of a record */
+typedef struct {
+	const char *name;
+	size_t offset;
+	char type;		/* 'd' double, 'h' uint16_t, 'u' uint32_t, 'q' uint64_t */
+	uint32_t valid;		/* shm_imu_record.valid bit needed, 0 for always */
+} shm_field;
+
+#define PZ(field,type)           { #field, offsetof(shm_pzpower_record,field), type, 0 }
+#define IMU(name,field,type,bit) { name, offsetof(shm_imu_record,field), type, bit }
+
+static const shm_field pzpowerFields[] = {
+	PZ(timestamp_usec,'q'),
+	PZ(monotonic_ns,'q'),
+	PZ(voltage_in_now,'d'),
+	PZ(voltage_in_average,'d'),
+	PZ(temperature_pcb_now,'d'),
+	PZ(temperature_pcb_average,'d'),
+	PZ(magnetic_switch_state,'h'),
+	PZ(magnetic_switch_latch,'h'),
+	PZ(sequence_number,'h'),
+	PZ(uptime_minutes,'h'),
+	PZ(read_watchdog_seconds,'h'),
+	PZ(write_watchdog_seconds,'h'),
+	PZ(command_off_seconds,'h'),
+	PZ(power_off_flags,'h'),
+	{ NULL, 0, 0, 0 }
+};
+
+static const shm_field imuFields[] = {
+	IMU("timestamp_usec",timestamp_usec,'q',0),
+	IMU("monotonic_ns",monotonic_ns,'q',0),
+	IMU("acceleration_x",acceleration[0],'d',SHM_IMU_ATTITUDE),
+	IMU("acceleration_y",acceleration[1],'d',SHM_IMU_ATTITUDE),
+	IMU("acceleration_z",acceleration[2],'d',SHM_IMU_ATTITUDE),
+	IMU("gyro_rate_x",gyro_rate[0],'d',SHM_IMU_ATTITUDE),
+	IMU("gyro_rate_y",gyro_rate[1],'d',SHM_IMU_ATTITUDE),
+	IMU("gyro_rate_z",gyro_rate[2],'d',SHM_IMU_ATTITUDE),
+	IMU("magnetometer_x",magnetometer[0],'d',SHM_IMU_ATTITUDE),
+	IMU("magnetometer_y",magnetometer[1],'d',SHM_IMU_ATTITUDE),
+	IMU("magnetometer_z",magnetometer[2],'d',SHM_IMU_ATTITUDE),
+	IMU("angle_x",angle[0],'d',SHM_IMU_ATTITUDE),
+	IMU("angle_y",angle[1],'d',SHM_IMU_ATTITUDE),
+	IMU("heading",heading,'d',SHM_IMU_ATTITUDE),
+	IMU("heading_compensated",heading_compensated,'d',SHM_IMU_HEADING_TILT),
+	IMU("temperature",temperature,'d',SHM_IMU_TEMPERATURE),
+	IMU("still",still,'u',SHM_IMU_ATTITUDE),
+	IMU("pressure_hpa",pressure_hpa,'d',SHM_IMU_PRESSURE),
+	IMU("pressure_temperature",pressure_temperature,'d',SHM_IMU_PRESSURE),
+	{ NULL, 0, 0, 0 }
+};
+
+static void printField(const shm_field *f, const uint8_t *record) {
+	const uint8_t *p = record + f->offset;
+
+	switch ( f->type ) {
+		case 'd': printf("%.10g",*(const double *) p); break;
+		case 'h': printf("%u",*(const uint16_t *) p); break;
+		case 'u': printf("%u",*(const uint32_t *) p); break;
+		case 'q': printf("%llu",(unsigned long long) *(const uint64_t *) p); break;
+	}
+}
+
+/* valid bits of record. Every field of a pzPower record is always there */
+static uint32_t recordValid(uint16_t type, const uint8_t *record) {
+	if ( SHM_LATEST_IMU == type )
+		return ((const shm_imu_record *) record)->valid;
+	return 0xffffffff;
+}
+
+/* seconds since record was sampled. Monotonic time if the writer had it, else UTC */
+static double recordAge(const uint8_t *record) {
+	uint64_t timestamp_usec, monotonic_ns;
+	struct timespec ts;
+	struct timeval tv;
+
+	/* both record types start with timestamp_usec and monotonic_ns */
+	memcpy(&timestamp_usec,record,sizeof(uint64_t));
+	memcpy(&monotonic_ns,record+sizeof(uint64_t),sizeof(uint64_t));
+
+	if ( 0 != monotonic_ns ) {
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return ((int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec - (int64_t) monotonic_ns) / 1e9;
+	}
+
+	gettimeofday(&tv,NULL);
+	return ((int64_t) tv.tv_sec * 1000000LL + tv.tv_usec - (int64_t) timestamp_usec) / 1e6;
+}
+
+static void printRecord(const shm_field *fields, uint16_t type, const uint8_t *record, uint32_t seq, const char *field) {
+	uint32_t valid = recordValid(type,record);
+	int i;
+
+	if ( NULL != field ) {
+		for ( i=0 ; NULL != fields[i].name ; i++ ) {
+			if ( 0 == strcmp(fields[i].name,field) ) {
+				if ( fields[i].valid & ~valid ) {
+					printf("null\n");
+				} else {
+					printField(&fields[i],record);
+					printf("\n");
+				}
+				break;
+			}
+		}
+	} else {
+		printf("{\"seq\":%u,\"age_seconds\":%.6f",seq,recordAge(record));
+		for ( i=0 ; NULL != fields[i].name ; i++ ) {
+			if ( fields[i].valid & ~valid )
+				continue;
+			printf(",\"%s\":",fields[i].name);
+			printField(&fields[i],record);
+		}
+		printf("}\n");
+	}
+	fflush(stdout);
+}
+
+void printUsage(void) {
+	fprintf(stderr,"Usage:\n\n");
+	fprintf(stderr,"switch           argument       description\n");
+	fprintf(stderr,"========================================================================================================\n");
+	fprintf(stderr,"--pzpower                       read segment of pzPowerI2C --shm (default)\n");
+	fprintf(stderr,"--imu                           read segment of imuToMQTT --shm\n");
+	fprintf(stderr,"--name           segment        shared memory segment name instead of the default\n");
+	fprintf(stderr,"--field          name           print only the value of field name\n");
+	fprintf(stderr,"--max-age        seconds        exit %d if the latest value is older than seconds\n",EXIT_STALE);
+	fprintf(stderr,"--watch          milliseconds   check this often and print each new value\n");
+	fprintf(stderr,"--list-fields                   print field names and exit\n");
+	fprintf(stderr,"--help                          this message\n");
+}
+
+int main(int argc, char **argv) {
+	int c;
+	char name[64];
+	char *field=NULL;
+	double maxAge=0.0;
+	int watch=0;
+	int listFields=0;
+	uint16_t type=SHM_LATEST_PZPOWER;
+	const shm_field *fields;
+	shm_latest shm;
+	uint8_t record[256];
+	uint32_t seq, lastSeq=0;
+	int i, rc;
+
+	name[0]='\0';
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"pzpower",          no_argument,       0, 'p' },
+			{"imu",              no_argument,       0, 'u' },
+			{"name",             required_argument, 0, 'n' },
+			{"field",            required_argument, 0, 'f' },
+			{"max-age",          required_argument, 0, 'a' },
+			{"watch",            required_argument, 0, 'w' },
+			{"list-fields",      no_argument,       0, 'l' },
+			{"help",             no_argument,       0, 'h' },
+			{0,                  0,                 0,  0 }
+		};
+
+		c = getopt_long(argc, argv, "", long_options, &option_index);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'p':
+				type=SHM_LATEST_PZPOWER;
+				break;
+			case 'u':
+				type=SHM_LATEST_IMU;
+				break;
+			case 'n':
+				strncpy(name,optarg,sizeof(name)-1);
+				name[sizeof(name)-1]='\0';
+				break;
+			case 'f':
+				field=optarg;
+				break;
+			case 'a':
+				maxAge=atof(optarg);
+				break;
+			case 'w':
+				watch=atoi(optarg);
+				break;
+			case 'l':
+				listFields=1;
+				break;
+			case 'h':
+				printUsage();
+				exit(0);
+			case '?':
+				exit(1);
+		}
+	}
+
+	fields = ( SHM_LATEST_IMU == type ) ? imuFields : pzpowerFields;
+	if ( '\0' == name[0] )
+		strcpy(name, ( SHM_LATEST_IMU == type ) ? SHM_LATEST_NAME_IMU : SHM_LATEST_NAME_PZPOWER);
+
+	if ( listFields ) {
+		for ( i=0 ; NULL != fields[i].name ; i++ )
+			printf("%s\n",fields[i].name);
+		exit(0);
+	}
+
+	if ( NULL != field ) {
+		for ( i=0 ; NULL != fields[i].name && 0 != strcmp(fields[i].name,field) ; i++ )
+			;
+		if ( NULL == fields[i].name ) {
+			fprintf(stderr,"# unknown field '%s'. See --list-fields\n",field);
+			exit(1);
+		}
+	}
+
+	if ( 0 != shm_latest_open(&shm,name) ) {
+		exit(1);
+	}
+	if ( type != shm.header->type || shm.header->recordBytes > sizeof(record) ) {
+		fprintf(stderr,"# %s holds record type %u, not %u\n",name,shm.header->type,type);
+		exit(1);
+	}
+
+	do {
+		rc = shm_latest_read(&shm,record,&seq);
+		if ( rc < 0 ) {
+			fprintf(stderr,"# %s is being written but no copy was consistent\n",name);
+			exit(1);
+		}
+		if ( 0 == rc && ! watch ) {
+			fprintf(stderr,"# %s has no value yet\n",name);
+			exit(EXIT_NO_RECORD);
+		}
+
+		if ( 1 == rc && seq != lastSeq ) {
+			if ( maxAge > 0.0 && recordAge(record) > maxAge ) {
+				fprintf(stderr,"# latest value of %s is %0.1f seconds old\n",name,recordAge(record));
+				if ( ! watch )
+					exit(EXIT_STALE);
+			}
+			printRecord(fields,type,record,seq,field);
+			lastSeq=seq;
+		}
+
+		if ( watch )
+			usleep(watch*1000);
+	} while ( watch );
+
+	shm_latest_close(&shm);
+
+	exit(0);
+}